@@ -1,10 +1,23 @@
 //example of some shaders compiled
 flat basic.vs flat.fs
 texture basic.vs texture.fs
+texture_instanced instanced.vs texture.fs
 skybox basic.vs skybox.fs
 depth quad.vs depth.fs
 multi basic.vs multi.fs
 
+\blocks
+
+//shared by all the shaders, uploaded by the renderer once per camera and once per frame (see Renderer::uploadCameraBlock)
+layout(std140) uniform u_camera_block {
+	mat4 u_viewprojection;
+	vec3 u_camera_position;
+};
+
+layout(std140) uniform u_frame_block {
+	float u_time;
+};
+
 \basic.vs
 
 #version 330 core
@@ -17,7 +30,21 @@ in vec4 a_color;
 uniform vec3 u_camera_pos;
 
 uniform mat4 u_model;
-uniform mat4 u_viewprojection;
+
+#include "blocks"
+
+//quantized meshes (see Mesh::setDequantizationUniforms)
+uniform vec3 u_quant_offset = vec3(0.0);
+uniform vec3 u_quant_scale = vec3(1.0);
+uniform bool u_quant_normals = false;
+
+vec3 octDecode( vec2 e )
+{
+	vec3 n = vec3( e, 1.0 - abs(e.x) - abs(e.y) );
+	if( n.z < 0.0 )
+		n.xy = (1.0 - abs(n.yx)) * vec2( n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0 );
+	return normalize(n);
+}
 
 //this will store the color for the pixel shader
 out vec3 v_position;
@@ -26,15 +53,16 @@ out vec3 v_normal;
 out vec2 v_uv;
 out vec4 v_color;
 
-uniform float u_time;
-
 void main()
 {	
+	vec3 position = u_quant_offset + a_vertex * u_quant_scale;
+	vec3 normal = u_quant_normals ? octDecode( a_normal.xy ) : a_normal;
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (u_model * vec4( normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
+	v_position = position;
 	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the color in the varying var to use it from the pixel shader
@@ -88,8 +116,10 @@ in vec4 v_color;
 
 uniform vec4 u_color;
 uniform sampler2D u_texture;
-uniform float u_time;
 uniform float u_alpha_cutoff;
+uniform float u_lod_fade; //0 if not fading between levels of detail, positive keeps that fraction of the pixels, negative the rest
+
+#include "blocks"
 
 out vec4 FragColor;
 
@@ -102,6 +132,14 @@ void main()
 	if(color.a < u_alpha_cutoff)
 		discard;
 
+	//dithered cross-fade, the two levels of detail draw complementary pixels
+	if(u_lod_fade != 0.0)
+	{
+		float noise = fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+		if(u_lod_fade > 0.0 ? noise >= u_lod_fade : noise < -u_lod_fade)
+			discard;
+	}
+
 	FragColor = color;
 }
 
@@ -114,7 +152,9 @@ in vec3 v_position;
 in vec3 v_world_position;
 
 uniform samplerCube u_texture;
-uniform vec3 u_camera_position;
+
+#include "blocks"
+
 out vec4 FragColor;
 
 void main()
@@ -136,9 +176,10 @@ in vec2 v_uv;
 
 uniform vec4 u_color;
 uniform sampler2D u_texture;
-uniform float u_time;
 uniform float u_alpha_cutoff;
 
+#include "blocks"
+
 layout(location = 0) out vec4 FragColor;
 layout(location = 1) out vec4 NormalColor;
 
@@ -186,28 +227,49 @@ void main()
 in vec3 a_vertex;
 in vec3 a_normal;
 in vec2 a_coord;
+in vec4 a_color;
 
 in mat4 u_model;
 
 uniform vec3 u_camera_pos;
 
-uniform mat4 u_viewprojection;
+#include "blocks"
+
+//quantized meshes (see Mesh::setDequantizationUniforms)
+uniform vec3 u_quant_offset = vec3(0.0);
+uniform vec3 u_quant_scale = vec3(1.0);
+uniform bool u_quant_normals = false;
+
+vec3 octDecode( vec2 e )
+{
+	vec3 n = vec3( e, 1.0 - abs(e.x) - abs(e.y) );
+	if( n.z < 0.0 )
+		n.xy = (1.0 - abs(n.yx)) * vec2( n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0 );
+	return normalize(n);
+}
 
 //this will store the color for the pixel shader
 out vec3 v_position;
 out vec3 v_world_position;
 out vec3 v_normal;
 out vec2 v_uv;
+out vec4 v_color;
 
 void main()
 {	
+	vec3 position = u_quant_offset + a_vertex * u_quant_scale;
+	vec3 normal = u_quant_normals ? octDecode( a_normal.xy ) : a_normal;
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (u_model * vec4( normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
-	v_world_position = (u_model * vec4( a_vertex, 1.0) ).xyz;
+	v_position = position;
+	v_world_position = (u_model * vec4( position, 1.0) ).xyz;
 	
+	//store the color in the varying var to use it from the pixel shader
+	v_color = a_color;
+
 	//store the texture coordinates
 	v_uv = a_coord;
 
@@ -1,6 +1,7 @@
 //example of some shaders compiled
 flat basic.vs flat.fs
 texture basic.vs texture.fs
+texture_instanced instanced.vs texture.fs
 
 \basic.vs
 
@@ -15,6 +16,19 @@ uniform vec3 u_camera_pos;
 uniform mat4 u_model;
 uniform mat4 u_viewprojection;
 
+//quantized meshes (see Mesh::setDequantizationUniforms)
+uniform vec3 u_quant_offset;
+uniform vec3 u_quant_scale;
+uniform bool u_quant_normals;
+
+vec3 octDecode( vec2 e )
+{
+	vec3 n = vec3( e, 1.0 - abs(e.x) - abs(e.y) );
+	if( n.z < 0.0 )
+		n.xy = (1.0 - abs(n.yx)) * vec2( n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0 );
+	return normalize(n);
+}
+
 //this will store the color for the pixel shader
 varying vec3 v_position;
 varying vec3 v_world_position;
@@ -24,11 +38,14 @@ varying vec4 v_color;
 
 void main()
 {	
+	vec3 position = u_quant_offset + a_vertex * u_quant_scale;
+	vec3 normal = u_quant_normals ? octDecode( a_normal.xy ) : a_normal;
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (u_model * vec4( normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
+	v_position = position;
 	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the color in the varying var to use it from the pixel shader
@@ -64,6 +81,7 @@ uniform vec4 u_color;
 uniform sampler2D u_texture;
 uniform float u_time;
 uniform float u_alpha_cutoff;
+uniform float u_lod_fade; //0 if not fading between levels of detail, positive keeps that fraction of the pixels, negative the rest
 
 void main()
 {
@@ -74,6 +92,14 @@ void main()
 	if(color.a < u_alpha_cutoff)
 		discard;
 
+	//dithered cross-fade, the two levels of detail draw complementary pixels
+	if(u_lod_fade != 0.0)
+	{
+		float noise = fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+		if(u_lod_fade > 0.0 ? noise >= u_lod_fade : noise < -u_lod_fade)
+			discard;
+	}
+
 	gl_FragColor = color;
 }
 
@@ -159,6 +185,7 @@ void main()
 attribute vec3 a_vertex;
 attribute vec3 a_normal;
 attribute vec2 a_coord;
+attribute vec4 a_color;
 
 attribute mat4 u_model;
 
@@ -166,21 +193,41 @@ uniform vec3 u_camera_pos;
 
 uniform mat4 u_viewprojection;
 
+//quantized meshes (see Mesh::setDequantizationUniforms)
+uniform vec3 u_quant_offset;
+uniform vec3 u_quant_scale;
+uniform bool u_quant_normals;
+
+vec3 octDecode( vec2 e )
+{
+	vec3 n = vec3( e, 1.0 - abs(e.x) - abs(e.y) );
+	if( n.z < 0.0 )
+		n.xy = (1.0 - abs(n.yx)) * vec2( n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0 );
+	return normalize(n);
+}
+
 //this will store the color for the pixel shader
 varying vec3 v_position;
 varying vec3 v_world_position;
 varying vec3 v_normal;
 varying vec2 v_uv;
+varying vec4 v_color;
 
 void main()
 {	
+	vec3 position = u_quant_offset + a_vertex * u_quant_scale;
+	vec3 normal = u_quant_normals ? octDecode( a_normal.xy ) : a_normal;
+
 	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
-	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+	v_normal = (u_model * vec4( normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
-	v_world_position = (u_model * vec4( a_vertex, 1.0) ).xyz;
+	v_position = position;
+	v_world_position = (u_model * vec4( position, 1.0) ).xyz;
 	
+	//store the color in the varying var to use it from the pixel shader
+	v_color = a_color;
+
 	//store the texture coordinates
 	v_uv = a_coord;
 
@@ -72,11 +72,11 @@ void Application::render(void)
 		GFX::drawGrid();
 
 		//render debug points 
-		glDisable(GL_DEPTH_TEST);
+		GFX::setGPUState(GFX_STATE_NONE, GFX_STATE_DEPTH_TEST_MASK);
 		GFX::drawPoints(debug_points, Vector4f(1, 1, 0, 1),4);
 	}
 
-	glDisable(GL_DEPTH_TEST);
+	GFX::setGPUState(GFX_STATE_NONE, GFX_STATE_DEPTH_TEST_MASK);
 	//render anything in the gui after this
 }
 
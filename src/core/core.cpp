@@ -260,8 +260,8 @@ void CORE::mainLoop(CORE::Window* window, BaseApplication* app)
 		//update app logic
 		app->update(elapsed_time);
 
-		//execute a task in the main task manager (blocking)
-		TaskManager::foreground.fetchTask();
+		//execute tasks in the main task manager till the time budget is over (blocking)
+		TaskManager::foreground.fetchTasks(TaskManager::foreground.time_budget_ms);
 
 		//check errors in opengl only when working in debug
 #ifdef _DEBUG
@@ -275,6 +275,8 @@ void CORE::mainLoop(CORE::Window* window, BaseApplication* app)
 void CORE::destroy()
 {
 	// Cleanup
+	TaskManager::background.stopThreads();
+
 #ifndef SKIP_IMGUI
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
@@ -316,6 +318,7 @@ void CORE::renderUI(CORE::Window* window, BaseApplication* app)
 	glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 	glGetError();
+	GFX::resetGPUState(); //imgui restores the state it changed, but not always in the same texture slot
 #endif
 }
 
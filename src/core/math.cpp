@@ -9,9 +9,16 @@
 #include <cstring>
 #include <algorithm>
 #include <iostream>
+#include <chrono>
 
 #define M_PI_2 1.57079632679489661923
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define MATH_SSE
+	#include <emmintrin.h>
+	#define SHUFFLE4(v, a, b, c, d) _mm_shuffle_ps(v, v, _MM_SHUFFLE(d, c, b, a))
+#endif
+
 //**************************************
 
 
@@ -402,25 +409,109 @@ Vector3f Matrix44::project(const Vector3f& v)
 }
 
 
-//Multiply a matrix by another and returns the result
-Matrix44 Matrix44::operator*(const Matrix44& matrix) const
+//result can be a or b
+static inline void multiplyMatrixScalar(const Matrix44& a, const Matrix44& b, Matrix44& result)
 {
-	Matrix44 ret;
-
+	float ret[16];
 	unsigned int i,j,k;
 	for (i=0;i<4;i++) 	
 	{
 		for (j=0;j<4;j++) 
 		{
-			ret.M[i][j]=0.0;
+			ret[i * 4 + j]=0.0;
 			for (k=0;k<4;k++) 
-				ret.M[i][j] += M[i][k] * matrix.M[k][j];
+				ret[i * 4 + j] += a.M[i][k] * b.M[k][j];
 		}
 	}
+	memcpy(result.m, ret, sizeof(ret));
+}
 
+#ifdef MATH_SSE
+//every row of the result is the rows of b weighted by the values of the row of a
+static inline void multiplyMatrixSSE(const Matrix44& a, const Matrix44& b, Matrix44& result)
+{
+	__m128 b0 = _mm_loadu_ps(b.m);
+	__m128 b1 = _mm_loadu_ps(b.m + 4);
+	__m128 b2 = _mm_loadu_ps(b.m + 8);
+	__m128 b3 = _mm_loadu_ps(b.m + 12);
+	__m128 rows[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128 row = _mm_loadu_ps(a.m + i * 4);
+		rows[i] = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(SHUFFLE4(row, 0, 0, 0, 0), b0), _mm_mul_ps(SHUFFLE4(row, 1, 1, 1, 1), b1)),
+			_mm_add_ps(_mm_mul_ps(SHUFFLE4(row, 2, 2, 2, 2), b2), _mm_mul_ps(SHUFFLE4(row, 3, 3, 3, 3), b3)));
+	}
+	for (int i = 0; i < 4; ++i)
+		_mm_storeu_ps(result.m + i * 4, rows[i]);
+}
+
+static inline void storeVector3(Vector3f& v, __m128 value)
+{
+	_mm_storel_pi((__m64*)&v.x, value);
+	_mm_store_ss(&v.z, _mm_movehl_ps(value, value));
+}
+#endif
+
+//Multiply a matrix by another and returns the result
+Matrix44 Matrix44::operator*(const Matrix44& matrix) const
+{
+	Matrix44 ret;
+#ifdef MATH_SSE
+	multiplyMatrixSSE(*this, matrix, ret);
+#else
+	multiplyMatrixScalar(*this, matrix, ret);
+#endif
 	return ret;
 }
 
+void multiplyMatrices(const Matrix44* a, const Matrix44* b, Matrix44* result, int num)
+{
+	for (int i = 0; i < num; ++i)
+#ifdef MATH_SSE
+		multiplyMatrixSSE(a[i], b[i], result[i]);
+#else
+		multiplyMatrixScalar(a[i], b[i], result[i]);
+#endif
+}
+
+void transformPoints(const Matrix44& matrix, const Vector3f* points, Vector3f* result, int num)
+{
+#ifdef MATH_SSE
+	__m128 c0 = _mm_loadu_ps(matrix.m);
+	__m128 c1 = _mm_loadu_ps(matrix.m + 4);
+	__m128 c2 = _mm_loadu_ps(matrix.m + 8);
+	__m128 c3 = _mm_loadu_ps(matrix.m + 12);
+	for (int i = 0; i < num; ++i)
+	{
+		const Vector3f& p = points[i];
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y))), _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p.z)), c3));
+		storeVector3(result[i], v);
+	}
+#else
+	for (int i = 0; i < num; ++i)
+		result[i] = matrix * points[i];
+#endif
+}
+
+void transformVectors(const Matrix44& matrix, const Vector3f* vectors, Vector3f* result, int num)
+{
+#ifdef MATH_SSE
+	__m128 c0 = _mm_loadu_ps(matrix.m);
+	__m128 c1 = _mm_loadu_ps(matrix.m + 4);
+	__m128 c2 = _mm_loadu_ps(matrix.m + 8);
+	for (int i = 0; i < num; ++i)
+	{
+		const Vector3f& p = vectors[i];
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y))), _mm_mul_ps(c2, _mm_set1_ps(p.z)));
+		storeVector3(result[i], v);
+	}
+#else
+	for (int i = 0; i < num; ++i)
+		result[i] = matrix.rotateVector(vectors[i]);
+#endif
+}
+
 //Multiplies a vector by a matrix and returns the new vector
 Vector3f operator * (const Matrix44& matrix, const Vector3f& v) 
 {   
@@ -513,9 +604,10 @@ void Matrix44::setFrontAndOrthonormalize(Vector3f front)
 	
 }
 
-bool Matrix44::inverse()
+static bool inverseMatrixScalar(Matrix44& matrix)
 {
 	// http://www.geometrictools.com/LibFoundation/Mathematics/Wm4Matrix4.inl
+	float* m = matrix.m;
 	double A0 = m[0] * m[5] - m[1] * m[4];
 	double A1 = m[0] * m[6] - m[2] * m[4];
 	double A2 = m[0] * m[7] - m[3] * m[4];
@@ -535,7 +627,7 @@ bool Matrix44::inverse()
 	auto threshold = (double)1e-11;
 	if (std::abs(det) <= threshold)
 	{
-		setIdentity();
+		matrix.setIdentity();
 		return false;
 	}
 
@@ -577,6 +669,60 @@ bool Matrix44::inverse()
 	return true;
 }
 
+#ifdef MATH_SSE
+//same cofactors than the scalar version, computed four at a time
+static bool inverseMatrixSSE(Matrix44& matrix)
+{
+	float* m = matrix.m;
+	__m128 r0 = _mm_loadu_ps(m);
+	__m128 r1 = _mm_loadu_ps(m + 4);
+	__m128 r2 = _mm_loadu_ps(m + 8);
+	__m128 r3 = _mm_loadu_ps(m + 12);
+
+	//2x2 determinants of the first two rows (A) and the last two (B)
+	float A[8], B[8];
+	_mm_storeu_ps(A, _mm_sub_ps(_mm_mul_ps(SHUFFLE4(r0, 0, 0, 0, 1), SHUFFLE4(r1, 1, 2, 3, 2)), _mm_mul_ps(SHUFFLE4(r0, 1, 2, 3, 2), SHUFFLE4(r1, 0, 0, 0, 1))));
+	_mm_storeu_ps(A + 4, _mm_sub_ps(_mm_mul_ps(SHUFFLE4(r0, 1, 2, 1, 2), SHUFFLE4(r1, 3, 3, 3, 3)), _mm_mul_ps(SHUFFLE4(r0, 3, 3, 3, 3), SHUFFLE4(r1, 1, 2, 1, 2))));
+	_mm_storeu_ps(B, _mm_sub_ps(_mm_mul_ps(SHUFFLE4(r2, 0, 0, 0, 1), SHUFFLE4(r3, 1, 2, 3, 2)), _mm_mul_ps(SHUFFLE4(r2, 1, 2, 3, 2), SHUFFLE4(r3, 0, 0, 0, 1))));
+	_mm_storeu_ps(B + 4, _mm_sub_ps(_mm_mul_ps(SHUFFLE4(r2, 1, 2, 1, 2), SHUFFLE4(r3, 3, 3, 3, 3)), _mm_mul_ps(SHUFFLE4(r2, 3, 3, 3, 3), SHUFFLE4(r3, 1, 2, 1, 2))));
+
+	double det = (double)A[0] * B[5] - (double)A[1] * B[4] + (double)A[2] * B[3] + (double)A[3] * B[2] - (double)A[4] * B[1] + (double)A[5] * B[0];
+	if (std::abs(det) <= 1e-11) //same threshold than the scalar version
+	{
+		matrix.setIdentity();
+		return false;
+	}
+
+	__m128 sign = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+	__m128 neg_sign = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+	__m128 b1 = _mm_setr_ps(B[5], B[5], B[4], B[3]), b2 = _mm_setr_ps(B[4], B[2], B[2], B[1]), b3 = _mm_setr_ps(B[3], B[1], B[0], B[0]);
+	__m128 a1 = _mm_setr_ps(A[5], A[5], A[4], A[3]), a2 = _mm_setr_ps(A[4], A[2], A[2], A[1]), a3 = _mm_setr_ps(A[3], A[1], A[0], A[0]);
+	#define COFACTORS4(r, v1, v2, v3) _mm_add_ps(_mm_sub_ps(_mm_mul_ps(SHUFFLE4(r, 1, 0, 0, 0), v1), _mm_mul_ps(SHUFFLE4(r, 2, 2, 1, 1), v2)), _mm_mul_ps(SHUFFLE4(r, 3, 3, 3, 2), v3))
+	__m128 c0 = _mm_mul_ps(COFACTORS4(r1, b1, b2, b3), sign);
+	__m128 c1 = _mm_mul_ps(COFACTORS4(r0, b1, b2, b3), neg_sign);
+	__m128 c2 = _mm_mul_ps(COFACTORS4(r3, a1, a2, a3), sign);
+	__m128 c3 = _mm_mul_ps(COFACTORS4(r2, a1, a2, a3), neg_sign);
+	#undef COFACTORS4
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+	__m128 rdet = _mm_set1_ps((float)(1.0 / det));
+	_mm_storeu_ps(m, _mm_mul_ps(c0, rdet));
+	_mm_storeu_ps(m + 4, _mm_mul_ps(c1, rdet));
+	_mm_storeu_ps(m + 8, _mm_mul_ps(c2, rdet));
+	_mm_storeu_ps(m + 12, _mm_mul_ps(c3, rdet));
+	return true;
+}
+#endif
+
+bool Matrix44::inverse()
+{
+#ifdef MATH_SSE
+	return inverseMatrixSSE(*this);
+#else
+	return inverseMatrixScalar(*this);
+#endif
+}
+
 Quaternion::Quaternion()
 {
 	x = y = z = 0.0f; w = 1.0f;
@@ -1459,7 +1605,8 @@ float signedDistanceToPlane( const Vector4f& plane, const Vector3f& point )
 
 const Vector3f corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
 
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box)
+//transforms the 8 corners, used as reference by the benchmark
+static BoundingBox transformBoundingBoxCorners(const Matrix44& m, const BoundingBox& box)
 {
 	Vector3f box_min(10000000.0f,1000000.0f, 1000000.0f);
 	Vector3f box_max(-10000000.0f, -1000000.0f, -1000000.0f);
@@ -1478,6 +1625,55 @@ BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box)
 	return BoundingBox(box_max - halfsize, halfsize );
 }
 
+#ifdef MATH_SSE
+static inline void transformBoundingBoxSSE(__m128 c0, __m128 c1, __m128 c2, __m128 c3, const BoundingBox& box, BoundingBox& result)
+{
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const Vector3f& c = box.center;
+	const Vector3f& h = box.halfsize;
+	__m128 center = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(c.x)), _mm_mul_ps(c1, _mm_set1_ps(c.y))), _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(c.z)), c3));
+	__m128 halfsize = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(c0, abs_mask), _mm_set1_ps(h.x)), _mm_mul_ps(_mm_and_ps(c1, abs_mask), _mm_set1_ps(h.y))), _mm_mul_ps(_mm_and_ps(c2, abs_mask), _mm_set1_ps(h.z)));
+	storeVector3(result.center, center);
+	storeVector3(result.halfsize, halfsize);
+}
+#endif
+
+//Arvo's method: the center is transformed and the halfsize is the sum of the absolute values of the axis scaled by the halfsize
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box)
+{
+	BoundingBox result;
+#ifdef MATH_SSE
+	transformBoundingBoxSSE(_mm_loadu_ps(m.m), _mm_loadu_ps(m.m + 4), _mm_loadu_ps(m.m + 8), _mm_loadu_ps(m.m + 12), box, result);
+#else
+	result.center = m * box.center;
+	const Vector3f& h = box.halfsize;
+	for (int i = 0; i < 3; ++i)
+		result.halfsize.v[i] = fabs(m.m[i]) * h.x + fabs(m.m[4 + i]) * h.y + fabs(m.m[8 + i]) * h.z;
+#endif
+	return result;
+}
+
+void transformBoundingBoxes(const Matrix44& m, const BoundingBox* boxes, BoundingBox* result, int num)
+{
+#ifdef MATH_SSE
+	__m128 c0 = _mm_loadu_ps(m.m);
+	__m128 c1 = _mm_loadu_ps(m.m + 4);
+	__m128 c2 = _mm_loadu_ps(m.m + 8);
+	__m128 c3 = _mm_loadu_ps(m.m + 12);
+	for (int i = 0; i < num; ++i)
+		transformBoundingBoxSSE(c0, c1, c2, c3, boxes[i], result[i]);
+#else
+	for (int i = 0; i < num; ++i)
+		result[i] = transformBoundingBox(m, boxes[i]);
+#endif
+}
+
+void transformBoundingBoxes(const Matrix44* models, const BoundingBox* boxes, BoundingBox* result, int num)
+{
+	for (int i = 0; i < num; ++i)
+		result[i] = transformBoundingBox(models[i], boxes[i]);
+}
+
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b)
 {
 	BoundingBox result;
@@ -1613,3 +1809,95 @@ std::ostream& operator<<(std::ostream& os, const Vector4f& v)
 	os << v.x << ',' << v.y << ',' << v.z << ',' << v.w;
 	return os;
 }
+
+static float maxMatrixError(const std::vector<Matrix44>& a, const std::vector<Matrix44>& b)
+{
+	float error = 0.0f;
+	for (size_t i = 0; i < a.size(); ++i)
+		for (int j = 0; j < 16; ++j)
+			error = std::max(error, (float)fabs(a[i].m[j] - b[i].m[j]));
+	return error;
+}
+
+void benchmarkMathKernels(int num)
+{
+	if (num < 1)
+		num = 1;
+	typedef std::chrono::high_resolution_clock clock;
+	typedef std::chrono::duration<double, std::nano> nanoseconds;
+
+	//random affine transforms like the ones of the scene
+	std::vector<Matrix44> a(num), b(num), result(num), reference(num);
+	std::vector<BoundingBox> boxes(num), boxes_result(num), boxes_reference(num);
+	std::vector<Vector3f> points(num), points_result(num), points_reference(num);
+	for (int i = 0; i < num; ++i)
+	{
+		a[i].setRotation(random(6.28f), Vector3f(random(2.0f, -1), random(2.0f, -1), random(2.0f, -1)).normalize());
+		a[i].scale(random(2.0f) + 0.1f, random(2.0f) + 0.1f, random(2.0f) + 0.1f);
+		a[i].translateGlobal(random(200.0f, -100), random(200.0f, -100), random(200.0f, -100));
+		b[i].setRotation(random(6.28f), Vector3f(random(2.0f, -1), random(2.0f, -1), random(2.0f, -1)).normalize());
+		b[i].translateGlobal(random(20.0f, -10), random(20.0f, -10), random(20.0f, -10));
+		boxes[i] = BoundingBox(Vector3f(random(20.0f, -10), random(20.0f, -10), random(20.0f, -10)), Vector3f(random(5.0f), random(5.0f), random(5.0f)));
+		points[i].set(random(200.0f, -100), random(200.0f, -100), random(200.0f, -100));
+	}
+
+	auto start = clock::now();
+	for (int i = 0; i < num; ++i)
+		multiplyMatrixScalar(a[i], b[i], reference[i]);
+	nanoseconds multiply_scalar = clock::now() - start;
+	start = clock::now();
+	multiplyMatrices(&a[0], &b[0], &result[0], num);
+	nanoseconds multiply_batch = clock::now() - start;
+	float multiply_error = maxMatrixError(result, reference);
+
+	reference = a;
+	start = clock::now();
+	for (int i = 0; i < num; ++i)
+		inverseMatrixScalar(reference[i]);
+	nanoseconds inverse_scalar = clock::now() - start;
+	result = a;
+	start = clock::now();
+	for (int i = 0; i < num; ++i)
+		result[i].inverse();
+	nanoseconds inverse_new = clock::now() - start;
+	float inverse_error = maxMatrixError(result, reference);
+
+	start = clock::now();
+	for (int i = 0; i < num; ++i)
+		boxes_reference[i] = transformBoundingBoxCorners(a[i], boxes[i]);
+	nanoseconds box_corners = clock::now() - start;
+	start = clock::now();
+	transformBoundingBoxes(&a[0], &boxes[0], &boxes_result[0], num);
+	nanoseconds box_batch = clock::now() - start;
+	start = clock::now();
+	transformBoundingBoxes(a[0], &boxes[0], &boxes_result[0], num);
+	nanoseconds box_batch_same = clock::now() - start;
+	float box_error = 0.0f;
+	for (int i = 0; i < num; ++i)
+	{
+		BoundingBox box = transformBoundingBox(a[i], boxes[i]);
+		box_error = std::max(box_error, std::max((box.center - boxes_reference[i].center).length(), (box.halfsize - boxes_reference[i].halfsize).length()));
+	}
+
+	start = clock::now();
+	for (int i = 0; i < num; ++i)
+		points_reference[i] = a[0] * points[i];
+	nanoseconds points_scalar = clock::now() - start;
+	start = clock::now();
+	transformPoints(a[0], &points[0], &points_result[0], num);
+	nanoseconds points_batch = clock::now() - start;
+	float points_error = 0.0f;
+	for (int i = 0; i < num; ++i)
+		points_error = std::max(points_error, (points_result[i] - points_reference[i]).length());
+
+#ifdef MATH_SSE
+	const char* path = "SSE2";
+#else
+	const char* path = "scalar";
+#endif
+	std::cout << " + Math kernels benchmark: " << num << " operations, " << path << " path" << std::endl;
+	std::cout << "	matrix multiply: " << multiply_scalar.count() / num << "ns -> " << multiply_batch.count() / num << "ns (max error " << multiply_error << ")" << std::endl;
+	std::cout << "	matrix inverse:  " << inverse_scalar.count() / num << "ns -> " << inverse_new.count() / num << "ns (max error " << inverse_error << ")" << std::endl;
+	std::cout << "	box transform:   " << box_corners.count() / num << "ns -> " << box_batch.count() / num << "ns, same matrix " << box_batch_same.count() / num << "ns (max error " << box_error << ")" << std::endl;
+	std::cout << "	point transform: " << points_scalar.count() / num << "ns -> " << points_batch.count() / num << "ns (max error " << points_error << ")" << std::endl;
+}
@@ -295,6 +295,11 @@ class Matrix44
 Vector3f operator * (const Matrix44& matrix, const Vector3f& v);
 Vector4f operator * (const Matrix44& matrix, const Vector4f& v);
 
+//batch versions, result can be the same array as the input
+void multiplyMatrices(const Matrix44* a, const Matrix44* b, Matrix44* result, int num); //result[i] = a[i] * b[i]
+void transformPoints(const Matrix44& matrix, const Vector3f* points, Vector3f* result, int num);
+void transformVectors(const Matrix44& matrix, const Vector3f* vectors, Vector3f* result, int num); //rotation and scale only
+
 //** QUAT ********************************************************
 
 class Quaternion
@@ -392,7 +397,9 @@ public:
 
 //applies a transform to a AABB from object to world
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b);
-BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box);
+BoundingBox transformBoundingBox(const Matrix44& m, const BoundingBox& box);
+void transformBoundingBoxes(const Matrix44& m, const BoundingBox* boxes, BoundingBox* result, int num); //same matrix for all
+void transformBoundingBoxes(const Matrix44* models, const BoundingBox* boxes, BoundingBox* result, int num); //one matrix per box
 
 
 //** RAY ********************************************************
@@ -421,6 +428,9 @@ inline float random(float range = 1.0f, int offset = 0) { return ((rand() % 1000
 std::ostream& operator << (std::ostream& os, const Vector3f& v);
 std::ostream& operator << (std::ostream& os, const Vector4f& v);
 
+//prints the time of the SIMD matrix and bounding box operations compared to the scalar ones
+void benchmarkMathKernels(int num = 100000);
+
 //generic types
 
 typedef Vector2f vec2;
@@ -3,77 +3,353 @@
 #include <thread>         // std::thread
 #include <chrono>		  //ms
 #include <cassert>
+#include <algorithm>	  //min, max
 
 TaskManager TaskManager::foreground;
 TaskManager TaskManager::background;
 
+//info about the worker running in this thread
+thread_local TaskManager* current_manager = NULL;
+thread_local int current_worker = -1;
+
+void TaskCounter::decrement()
+{
+	//locked so the counter is not destroyed by a waiting thread before we are done with it
+	std::vector<std::pair<Task*, TaskManager*>> ready;
+	{
+		const std::lock_guard<std::mutex> lock(dependents_mutex);
+		if (--value != 0)
+			return;
+		ready.swap(dependents);
+	}
+	for (auto& it : ready)
+		it.second->addTask(it.first);
+}
+
+//*********************
+
+WorkStealingQueue::WorkStealingQueue()
+{
+	top = 0;
+	bottom = 0;
+	for (int i = 0; i < CAPACITY; ++i)
+		buffer[i].store(NULL, std::memory_order_relaxed);
+}
+
+bool WorkStealingQueue::push(Task* task)
+{
+	long b = bottom.load(std::memory_order_relaxed);
+	long t = top.load(std::memory_order_acquire);
+	if (b - t >= CAPACITY)
+		return false;
+	buffer[b & (CAPACITY - 1)].store(task, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+Task* WorkStealingQueue::pop()
+{
+	long b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long t = top.load(std::memory_order_relaxed);
+	if (t > b) //empty
+	{
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	Task* task = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (t == b) //last one, race against thieves
+	{
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			task = NULL;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return task;
+}
+
+Task* WorkStealingQueue::steal()
+{
+	long t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return NULL;
+	Task* task = buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return NULL; //another thread got it
+	return task;
+}
+
+//*********************
+
 TaskManager::TaskManager()
 {
 	must_loop = false;
-	_thread = NULL;
+	num_pending = 0;
+	time_budget_ms = 4;
 }
 
-void TaskManager::loop()
+void TaskManager::loop(int worker_index)
 {
-	using namespace std::chrono_literals;
-	std::cout << "Starting Task Manager ..." << std::endl;
+	std::cout << "Starting Task Manager worker " << worker_index << " ..." << std::endl;
+	current_manager = this;
+	current_worker = worker_index;
 
 	while (must_loop)
 	{
-		if (pending_tasks.empty())
+		Task* task = findTask();
+		if (task)
 		{
-			std::this_thread::sleep_for(10ms);
+			executeTask(task);
 			continue;
 		}
 
-		fetchTask();
+		//some task is being pushed, try again
+		if (num_pending > 0)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		//nothing to do, sleep till somebody adds a task
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake_condition.wait(lock, [this] { return num_pending > 0 || !must_loop; });
 	}
 
-	std::cout << "Ending Task Manager" << std::endl;
+	current_manager = NULL;
+	current_worker = -1;
+	std::cout << "Ending Task Manager worker " << worker_index << std::endl;
 }
 
-void TaskManager::fetchTask()
+Task* TaskManager::findTask()
 {
 	Task* task = NULL;
-	try
+	int num_queues = (int)queues.size();
+
+	//frame work waiting to be finished
 	{
-		//lock
 		const std::lock_guard<std::mutex> lock(tasks_mutex);
-		if (pending_tasks.empty())
-			return;
-		task = pending_tasks.front();
-		pending_tasks.pop_front();
-		//unlock after finishing scope
+		if (!parallel_tasks.empty())
+		{
+			task = parallel_tasks.front();
+			parallel_tasks.pop_front();
+		}
 	}
-	catch (std::logic_error&) {
-		std::cout << "[exception caught]\n";
+
+	//from my own queue
+	if (!task && current_manager == this && current_worker != -1)
+		task = queues[current_worker]->pop();
+
+	//from the shared queue
+	if (!task)
+	{
+		const std::lock_guard<std::mutex> lock(tasks_mutex);
+		if (!pending_tasks.empty())
+		{
+			task = pending_tasks.front();
+			pending_tasks.pop_front();
+		}
+	}
+
+	//steal from other workers
+	if (!task && num_queues)
+	{
+		int first = current_manager == this ? current_worker + 1 : 0;
+		for (int i = 0; i < num_queues && !task; ++i)
+		{
+			int index = (first + i) % num_queues;
+			if (current_manager == this && index == current_worker)
+				continue;
+			task = queues[index]->steal();
+		}
 	}
 
 	if (task)
+		num_pending--;
+	return task;
+}
+
+Task* TaskManager::findParallelTask(TaskCounter* counter)
+{
+	const std::lock_guard<std::mutex> lock(tasks_mutex);
+	for (auto it = parallel_tasks.begin(); it != parallel_tasks.end(); ++it)
 	{
-		task->onExecute();
-		delete task;
-		task = NULL;
+		if ((*it)->counter != counter)
+			continue;
+		Task* task = *it;
+		parallel_tasks.erase(it);
+		num_pending--;
+		return task;
 	}
+	return NULL;
 }
 
-void thread_loop_func(TaskManager* manager)
+void TaskManager::executeTask(Task* task)
 {
-	manager->loop();
-	//join?
+	TaskCounter* counter = task->counter;
+	task->onExecute();
+	delete task;
+	if (counter)
+		counter->decrement();
 }
 
-void TaskManager::startThread()
+void TaskManager::pushTask(Task* task)
 {
-	assert(!_thread && "TaskManager already in a thread");
+	//workers push to their own queue, any other thread to the shared queue
+	if (current_manager != this || current_worker == -1 || !queues[current_worker]->push(task))
+	{
+		const std::lock_guard<std::mutex> lock(tasks_mutex);
+		pending_tasks.push_back(task);
+	}
+	num_pending++;
+
+	//wake up one worker
+	if (threads.size())
+	{
+		{ const std::lock_guard<std::mutex> lock(sleep_mutex); }
+		wake_condition.notify_one();
+	}
+}
+
+void TaskManager::addTask(Task* task, TaskCounter* counter, TaskCounter* dependency)
+{
+	assert(task);
+	if (counter)
+	{
+		task->counter = counter;
+		counter->increment();
+	}
+
+	if (dependency)
+	{
+		const std::lock_guard<std::mutex> lock(dependency->dependents_mutex);
+		if (!dependency->isDone())
+		{
+			dependency->dependents.push_back(std::pair<Task*, TaskManager*>(task, this));
+			return;
+		}
+	}
+
+	pushTask(task);
+}
+
+bool TaskManager::fetchTask()
+{
+	Task* task = findTask();
+	if (!task)
+		return false;
+	executeTask(task);
+	return true;
+}
+
+int TaskManager::fetchTasks(float max_ms)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	int num = 0;
+	while (fetchTask())
+	{
+		num++;
+		std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		if (elapsed.count() >= max_ms)
+			break;
+	}
+	return num;
+}
+
+void TaskManager::wait(TaskCounter* counter)
+{
+	//help instead of blocking, only with the work of this counter: any other task could be a long load
+	while (!counter->isDone())
+	{
+		Task* task = findParallelTask(counter);
+		if (task)
+			executeTask(task);
+		else
+			std::this_thread::yield();
+	}
+
+	//ensure the thread that finished the last task has released the counter
+	const std::lock_guard<std::mutex> lock(counter->dependents_mutex);
+}
+
+void TaskManager::parallelFor(int start, int end, std::function<void(int start, int end)> func, int min_range)
+{
+	int total = end - start;
+	if (total <= 0)
+		return;
+	if (min_range < 1)
+		min_range = 1;
+
+	//few chunks per worker so fast workers can steal the remaining ones
+	int num_chunks = (getNumWorkers() + 1) * 4;
+	int chunk_size = std::max(min_range, (total + num_chunks - 1) / num_chunks);
+	if (!threads.size() || chunk_size >= total)
+	{
+		func(start, end);
+		return;
+	}
+
+	//in the parallel queue, the workers take them before the loading tasks already queued
+	TaskCounter counter;
+	for (int i = start; i < end; i += chunk_size)
+	{
+		int chunk_end = std::min(i + chunk_size, end);
+		Task* task = new Task([&func, i, chunk_end]() { func(i, chunk_end); });
+		task->counter = &counter;
+		counter.increment();
+		{
+			const std::lock_guard<std::mutex> lock(tasks_mutex);
+			parallel_tasks.push_back(task);
+		}
+		num_pending++;
+	}
+	if (threads.size())
+	{
+		{ const std::lock_guard<std::mutex> lock(sleep_mutex); }
+		wake_condition.notify_all();
+	}
+	wait(&counter);
+}
+
+void thread_loop_func(TaskManager* manager, int worker_index)
+{
+	manager->loop(worker_index);
+}
+
+void TaskManager::startThread(int num_threads)
+{
+	assert(!threads.size() && "TaskManager already in a thread");
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
 	must_loop = true;
-	_thread = new std::thread(thread_loop_func, this);
+	for (int i = 0; i < num_threads; ++i)
+		queues.push_back(new WorkStealingQueue());
+	for (int i = 0; i < num_threads; ++i)
+		threads.push_back(new std::thread(thread_loop_func, this, i));
 }
 
-void TaskManager::addTask(Task* task)
+void TaskManager::stopThreads()
 {
-	//block pending_tasks
-	const std::lock_guard<std::mutex> lock(tasks_mutex);
-	pending_tasks.push_back(task);
-	//release pending_tasks automatically
-}
\ No newline at end of file
+	{
+		const std::lock_guard<std::mutex> lock(sleep_mutex);
+		must_loop = false;
+	}
+	wake_condition.notify_all();
+	for (auto t : threads)
+	{
+		t->join();
+		delete t;
+	}
+	threads.clear();
+	//pending tasks in the worker queues are moved to the shared queue
+	for (auto q : queues)
+	{
+		while (Task* task = q->steal())
+			pending_tasks.push_back(task);
+		delete q;
+	}
+	queues.clear();
+}
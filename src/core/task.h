@@ -1,34 +1,97 @@
 #pragma once
 
 #include <vector>
-#include <list>
+#include <deque>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <thread>         // std::thread
 #include <functional>
 
+class TaskManager;
+class Task;
+
+//used to know when a group of tasks has finished, or to make tasks wait for others (dependencies)
+class TaskCounter {
+public:
+	std::atomic<int> value;
+	std::mutex dependents_mutex; // protects dependents
+	std::vector<std::pair<Task*, TaskManager*>> dependents; //tasks waiting for this counter to reach zero
+
+	TaskCounter() { value = 0; }
+	bool isDone() { return value.load() == 0; }
+	void increment() { value++; }
+	void decrement(); //when reaching zero the dependent tasks are sent to their managers
+};
+
 //any task executed in BG should inherit from this one
 class Task {
 public:
 	std::function<void()> callback;
-	Task() { callback = NULL; };
-	Task(std::function<void()> func) { callback = func; };
+	TaskCounter* counter; //decremented when the task is finished (optional)
+	Task() { callback = NULL; counter = NULL; };
+	Task(std::function<void()> func) { callback = func; counter = NULL; };
 	virtual ~Task() {};
 	virtual void onExecute() { if (callback) callback(); }
 };
 
+//Chase-Lev lock-free deque: the owner thread pushes and pops from the bottom, other threads steal from the top
+class WorkStealingQueue {
+public:
+	static const int CAPACITY = 4096; //must be power of two
+
+	std::atomic<long> top;
+	std::atomic<long> bottom;
+	std::atomic<Task*> buffer[CAPACITY];
+
+	WorkStealingQueue();
+	bool push(Task* task); //owner only, returns false if full
+	Task* pop(); //owner only
+	Task* steal(); //any thread
+};
+
+//Every manager has a shared queue (any thread can add tasks to it) and, if threads are started,
+//one work stealing queue per worker. Workers sleep when there is nothing to do and wake up when tasks are added.
 class TaskManager {
 public:
-	std::list<Task*> pending_tasks;
-	std::mutex tasks_mutex;  // protects pending_tasks
-	bool must_loop;
-	std::thread* _thread;
+	std::deque<Task*> pending_tasks; //shared queue, used when adding tasks from outside the workers
+	std::deque<Task*> parallel_tasks; //chunks of parallelFor, before any other task so they are not delayed by long loads
+	std::mutex tasks_mutex;  // protects pending_tasks and parallel_tasks
+	std::atomic<bool> must_loop;
+	std::vector<std::thread*> threads;
+	std::vector<WorkStealingQueue*> queues; //one per worker
+	std::atomic<int> num_pending; //tasks added but not started yet
+
+	std::mutex sleep_mutex;
+	std::condition_variable wake_condition;
+
+	float time_budget_ms; //max time per frame spent in fetchTasks
 
 	static TaskManager foreground;
 	static TaskManager background;
 
 	TaskManager();
-	void addTask(Task* task);
-	void fetchTask();
-	void loop();
-	void startThread();
-};
\ No newline at end of file
+
+	//if counter is passed it will be incremented now and decremented once the task is finished
+	//if dependency is passed the task wont start till the dependency counter reaches zero
+	void addTask(Task* task, TaskCounter* counter = NULL, TaskCounter* dependency = NULL);
+	void addTask(std::function<void()> func, TaskCounter* counter = NULL, TaskCounter* dependency = NULL) { addTask(new Task(func), counter, dependency); }
+
+	bool fetchTask(); //executes one task if any, returns false if there was nothing to do
+	int fetchTasks(float max_ms); //executes tasks till the queue is empty or the time is over, returns the number of tasks executed
+	void wait(TaskCounter* counter); //executes the chunks of parallelFor of this counter while waiting for it to reach zero
+
+	//splits the range [start,end) in chunks of at least min_range and executes them in parallel, returns when all are done
+	void parallelFor(int start, int end, std::function<void(int start, int end)> func, int min_range = 1);
+
+	void loop(int worker_index);
+	void startThread(int num_threads = 0); //0 means one less than the number of cores
+	void stopThreads();
+	int getNumWorkers() { return (int)threads.size(); }
+
+private:
+	Task* findTask(); //from the parallelFor chunks, own queue, shared queue or stealing from other workers
+	Task* findParallelTask(TaskCounter* counter); //a chunk of parallelFor of this counter
+	void executeTask(Task* task);
+	void pushTask(Task* task);
+};
@@ -1,6 +1,9 @@
 
 #include "litengine.h"
 #include "editor.h"
+#include "pipeline/animator.h"
+#include "gfx/texture_streamer.h"
+#include "gfx/texture_encoder.h"
 
 long mouse_press_time = 0;
 
@@ -122,6 +125,8 @@ void SceneEditor::render(Camera* camera)
 		{
 			static bool was_used = false;
 			bool used = UI::manipulateMatrix(SCN::BaseEntity::s_selected->root.model, camera);
+			if (used)
+				SCN::BaseEntity::s_selected->root.markDirty();
 			if (!was_used && used)
 				saveUndo();
 			was_used = used;
@@ -207,6 +212,21 @@ void SceneEditor::render(Camera* camera)
 
 	if (ImGui::BeginTabItem("Stats"))
 	{
+		//results are printed in the console
+		if (ImGui::Button("Benchmark ray tests"))
+			for (auto it : GFX::Mesh::sMeshesLoaded)
+				GFX::benchmarkMeshCollision(it.second);
+		if (ImGui::Button("Benchmark animations"))
+			for (auto it : Animation::sAnimationsLoaded)
+			{
+				benchmarkAnimation(it.second);
+				benchmarkAnimator(it.second);
+			}
+		if (ImGui::Button("Benchmark math"))
+			benchmarkMathKernels();
+		if (ImGui::Button("Benchmark culling"))
+			SCN::benchmarkCulling();
+		ImGui::EndTabItem();
 	}
 
 
@@ -294,6 +314,13 @@ void SceneEditor::renderTexturesPanel()
 	if (ImGui::Begin("Textures", nullptr, flags))// Create a window
 	{
 		ImGui::Checkbox("Big", &show_big);
+		ImGui::SameLine();
+		ImGui::Checkbox("Compress on load", &GFX::Texture::use_compression);
+		ImGui::SameLine();
+		ImGui::Checkbox("BC7", &GFX::Texture::use_bc7);
+		int upload_kb = (int)(UploadTextureTask::max_bytes_per_step / 1024);
+		if (ImGui::SliderInt("Upload KB per step", &upload_kb, 64, 8192))
+			UploadTextureTask::max_bytes_per_step = upload_kb * 1024;
 		for (auto it : GFX::Texture::sTextures)
 		{
 			GFX::Texture* tex = it.second;
@@ -306,7 +333,10 @@ void SceneEditor::renderTexturesPanel()
 			ImGui::Image((ImTextureID)tex->texture_id, ImVec2(s,s));
 			if (ImGui::IsItemClicked(0))
 				selected_texture = selected_texture == tex->index ? -1 : tex->index;
-			ImGui::Text("%dx%d %s", (int)tex->width, (int)tex->height, tex->filename.c_str());
+			const char* block_format = GFX::getBlockFormatName(tex->internal_format);
+			ImGui::Text("%dx%d %s %s", (int)tex->width, (int)tex->height, block_format ? block_format : "", tex->filename.c_str());
+			if (tex->streaming)
+				ImGui::Text("Streamed: mip %d (required %d, initial %d)", tex->streaming->resident_mip, tex->streaming->required_mip, tex->streaming->initial_mip);
 		}
 	}
 	ImGui::End();
@@ -325,7 +355,8 @@ void SceneEditor::inspectEntity(SCN::BaseEntity* entity)
 	ImGui::Checkbox("Visible", &entity->visible);
 	UI::Layers("Layers", &entity->layers);
 
-	UI::inspectObject(entity->root.model);//Model edit
+	if (UI::inspectObject(entity->root.model)) //Model edit
+		entity->root.markDirty();
 #endif
 }
 
@@ -341,6 +372,11 @@ void SceneEditor::inspectEntity(SCN::PrefabEntity* entity)
 		entity->loadPrefab(entity->filename.c_str());
 	}
 
+	if (entity->prefab && entity->prefab->loading_state == SCN::LOADING_IN_PROGRESS)
+		ImGui::ProgressBar(entity->prefab->loading_progress, ImVec2(-1, 0), "Loading...");
+	else if (entity->prefab && entity->prefab->loading_state == SCN::LOADING_FAILED)
+		ImGui::TextColored(ImVec4(1, 0, 0, 1), "Error loading prefab");
+
 #endif
 }
 
@@ -490,12 +526,21 @@ void SceneEditor::inspectObject(SCN::Node* node)
 #ifndef SKIP_IMGUI
 	ImGui::Text("Node Name: %s", node->name.size() > 0 ? node->name.c_str() : "unnamed");
 	if (node->mesh)
+	{
 		ImGui::Text("Mesh: %s", node->mesh->name.c_str());
+		//post-transform cache efficiency before and after the optimization stage
+		const GFX::sMeshOptimizationStats& stats = node->mesh->optimization_stats;
+		if (stats.vertices_before)
+			ImGui::Text("ACMR: %.3f -> %.3f ATVR: %.3f -> %.3f\nVertices: %u -> %u", stats.acmr_before, stats.acmr_after, stats.atvr_before, stats.atvr_after, stats.vertices_before, stats.vertices_after);
+		for (size_t i = 0; i < node->mesh->lods.size(); ++i)
+			ImGui::Text("LOD %d: %d triangles, error %.4f%s", (int)i + 1, node->mesh->lods[i].length / 3, node->mesh->lods[i].error, node->lod == (int)i + 1 ? " (current)" : "");
+	}
 
 	ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.75f, 0.75f, 0.75f, 1.0f));
 
 	//Model edit
-	UI::inspectObject(node->model);
+	if (UI::inspectObject(node->model))
+		node->markDirty();
 
 	//Material
 	if (node->material && ImGui::TreeNode(node->material, "Material"))
@@ -10,6 +10,301 @@ namespace GFX {
 
 	long gpu_frame_microseconds = 0;
 	long gpu_frame_microseconds_history[GPU_FRAME_HISTORY_SIZE];
+	sGPUStateStats gpu_state_stats = { 0, 0, 0, 0 };
+
+	// GPU STATE ***************************************
+
+	#ifndef GL_TEXTURE_2D_ARRAY
+		#define GL_TEXTURE_2D_ARRAY 0x8C1A
+	#endif
+	#ifndef GL_SHADER_STORAGE_BUFFER
+		#define GL_SHADER_STORAGE_BUFFER 0x90D2
+	#endif
+
+	#define GPU_MAX_TEXTURE_SLOTS 16
+	#define GPU_MAX_BUFFER_INDICES 16
+	#define GPU_UNKNOWN_BINDING 0xFFFFFFFF
+
+	//what is bound now, GPU_UNKNOWN_BINDING if it is not known
+	struct sGPUBindings {
+		GLuint program;
+		GLuint vao;
+		int active_slot; //-1 if not known
+		GLuint textures[GPU_MAX_TEXTURE_SLOTS][4]; //2D, cubemap, 3D and 2D array of every slot
+		GLuint buffers[3]; //array, uniform and storage
+		GLuint indexed_buffers[2][GPU_MAX_BUFFER_INDICES]; //uniform and storage, only the whole buffers
+	};
+
+	static uint64_t gpu_current_state = GFX_STATE_NONE;
+	static bool gpu_state_known = false;
+	static sGPUBindings gpu_bindings;
+	static bool gpu_bindings_known = false;
+
+	static int getTextureTargetIndex(GLenum target)
+	{
+		switch (target)
+		{
+			case GL_TEXTURE_2D: return 0;
+			case GL_TEXTURE_CUBE_MAP: return 1;
+			case GL_TEXTURE_3D: return 2;
+			case GL_TEXTURE_2D_ARRAY: return 3;
+		}
+		return -1;
+	}
+
+	static int getBufferTargetIndex(GLenum target)
+	{
+		switch (target)
+		{
+			case GL_ARRAY_BUFFER: return 0;
+			case GL_UNIFORM_BUFFER: return 1;
+			case GL_SHADER_STORAGE_BUFFER: return 2;
+		}
+		return -1;
+	}
+
+	static GLenum getBlendFactor(uint64_t value, GLenum default_factor)
+	{
+		static const GLenum factors[] = { 0, GL_ZERO, GL_ONE, GL_SRC_COLOR, GL_ONE_MINUS_SRC_COLOR, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+			GL_DST_ALPHA, GL_ONE_MINUS_DST_ALPHA, GL_DST_COLOR, GL_ONE_MINUS_DST_COLOR, GL_SRC_ALPHA_SATURATE, GL_CONSTANT_COLOR, GL_ONE_MINUS_CONSTANT_COLOR };
+		int index = (int)(value & 0xF);
+		return index && index < 14 ? factors[index] : default_factor;
+	}
+
+	static GLenum getBlendEquation(uint64_t value)
+	{
+		static const GLenum equations[] = { GL_FUNC_ADD, GL_FUNC_SUBTRACT, GL_FUNC_REVERSE_SUBTRACT, GL_MIN, GL_MAX };
+		int index = (int)(value & 0x7);
+		return index < 5 ? equations[index] : GL_FUNC_ADD;
+	}
+
+	static void initBindings()
+	{
+		memset(&gpu_bindings, 0xFF, sizeof(gpu_bindings)); //all GPU_UNKNOWN_BINDING
+		gpu_bindings.active_slot = -1;
+		gpu_bindings_known = true;
+	}
+
+	void resetGPUState()
+	{
+		gpu_state_known = false;
+		gpu_bindings_known = false;
+	}
+
+	uint64_t getGPUState()
+	{
+		return gpu_current_state;
+	}
+
+	void setGPUState(uint64_t state, uint64_t mask)
+	{
+		state = (gpu_current_state & ~mask) | (state & mask);
+		//everything is applied the first time
+		bool first = !gpu_state_known;
+		uint64_t changed = first ? GFX_STATE_MASK : (state ^ gpu_current_state);
+		uint64_t previous = gpu_current_state;
+		gpu_current_state = state;
+		gpu_state_known = true;
+
+		//the parts that did not change would be set again without the cache: enable/disable and the values
+		if (changed & GFX_STATE_DEPTH_TEST_MASK)
+		{
+			uint64_t depth = (state & GFX_STATE_DEPTH_TEST_MASK) >> GFX_STATE_DEPTH_TEST_SHIFT;
+			static const GLenum funcs[] = { GL_LESS, GL_LESS, GL_LEQUAL, GL_EQUAL, GL_GEQUAL, GL_GREATER, GL_NOTEQUAL, GL_NEVER, GL_ALWAYS };
+			if (!depth)
+				glDisable(GL_DEPTH_TEST);
+			else
+			{
+				if (first || !(previous & GFX_STATE_DEPTH_TEST_MASK))
+				{
+					glEnable(GL_DEPTH_TEST);
+					gpu_state_stats.state_calls++;
+				}
+				glDepthFunc(funcs[depth < 9 ? depth : 0]);
+			}
+			gpu_state_stats.state_calls++;
+		}
+		else
+			gpu_state_stats.redundant_states += 2;
+
+		if (changed & (GFX_STATE_WRITE_RGB | GFX_STATE_WRITE_A))
+		{
+			glColorMask((state & GFX_STATE_WRITE_R) != 0, (state & GFX_STATE_WRITE_G) != 0, (state & GFX_STATE_WRITE_B) != 0, (state & GFX_STATE_WRITE_A) != 0);
+			gpu_state_stats.state_calls++;
+		}
+		else
+			gpu_state_stats.redundant_states++;
+
+		if (changed & GFX_STATE_WRITE_Z)
+		{
+			glDepthMask((state & GFX_STATE_WRITE_Z) != 0);
+			gpu_state_stats.state_calls++;
+		}
+		else
+			gpu_state_stats.redundant_states++;
+
+		if (changed & (GFX_STATE_BLEND_MASK | GFX_STATE_BLEND_EQUATION_MASK))
+		{
+			uint64_t blend = (state & GFX_STATE_BLEND_MASK) >> GFX_STATE_BLEND_SHIFT;
+			uint64_t equation = (state & GFX_STATE_BLEND_EQUATION_MASK) >> GFX_STATE_BLEND_EQUATION_SHIFT;
+			if (!blend)
+			{
+				glDisable(GL_BLEND);
+				gpu_state_stats.state_calls++;
+			}
+			else
+			{
+				if (first || !(previous & GFX_STATE_BLEND_MASK))
+				{
+					glEnable(GL_BLEND);
+					gpu_state_stats.state_calls++;
+				}
+				if (changed & GFX_STATE_BLEND_MASK)
+				{
+					glBlendFuncSeparate(getBlendFactor(blend, GL_ONE), getBlendFactor(blend >> 4, GL_ZERO), getBlendFactor(blend >> 8, GL_ONE), getBlendFactor(blend >> 12, GL_ZERO));
+					gpu_state_stats.state_calls++;
+				}
+				if (changed & GFX_STATE_BLEND_EQUATION_MASK)
+				{
+					glBlendEquationSeparate(getBlendEquation(equation), getBlendEquation(equation >> 3));
+					gpu_state_stats.state_calls++;
+				}
+			}
+		}
+		else
+			gpu_state_stats.redundant_states += 2;
+
+		if (changed & GFX_STATE_CULL_MASK)
+		{
+			uint64_t cull = state & GFX_STATE_CULL_MASK;
+			if (!cull)
+				glDisable(GL_CULL_FACE);
+			else
+			{
+				if (first || !(previous & GFX_STATE_CULL_MASK))
+				{
+					glEnable(GL_CULL_FACE);
+					gpu_state_stats.state_calls++;
+				}
+				glCullFace(cull == GFX_STATE_CULL_MASK ? GL_FRONT_AND_BACK : (cull == GFX_STATE_CULL_FRONT ? GL_FRONT : GL_BACK));
+			}
+			gpu_state_stats.state_calls++;
+		}
+		else
+			gpu_state_stats.redundant_states++;
+
+		if (changed & GFX_STATE_FRONT_CW)
+		{
+			glFrontFace(state & GFX_STATE_FRONT_CW ? GL_CW : GL_CCW);
+			gpu_state_stats.state_calls++;
+		}
+		else
+			gpu_state_stats.redundant_states++;
+
+		if (changed & GFX_STATE_WIREFRAME)
+		{
+			glPolygonMode(GL_FRONT_AND_BACK, state & GFX_STATE_WIREFRAME ? GL_LINE : GL_FILL);
+			gpu_state_stats.state_calls++;
+		}
+		else
+			gpu_state_stats.redundant_states++;
+	}
+
+	void useProgram(GLuint program)
+	{
+		if (!gpu_bindings_known)
+			initBindings();
+		if (gpu_bindings.program == program)
+		{
+			gpu_state_stats.redundant_bindings++;
+			return;
+		}
+		glUseProgram(program);
+		gpu_bindings.program = program;
+		gpu_state_stats.bindings++;
+	}
+
+	void bindVertexArray(GLuint vao)
+	{
+		if (!gpu_bindings_known)
+			initBindings();
+		if (gpu_bindings.vao == vao)
+		{
+			gpu_state_stats.redundant_bindings++;
+			return;
+		}
+		glBindVertexArray(vao);
+		gpu_bindings.vao = vao;
+		gpu_state_stats.bindings++;
+	}
+
+	void bindTexture(int slot, GLenum target, GLuint texture)
+	{
+		if (!gpu_bindings_known)
+			initBindings();
+		int index = slot < GPU_MAX_TEXTURE_SLOTS ? getTextureTargetIndex(target) : -1;
+		if (index != -1 && gpu_bindings.textures[slot][index] == texture)
+		{
+			gpu_state_stats.redundant_bindings++;
+			return;
+		}
+		if (gpu_bindings.active_slot != slot)
+		{
+			glActiveTexture(GL_TEXTURE0 + slot);
+			gpu_bindings.active_slot = slot;
+			gpu_state_stats.bindings++;
+		}
+		glBindTexture(target, texture);
+		if (index != -1)
+			gpu_bindings.textures[slot][index] = texture;
+		gpu_state_stats.bindings++;
+	}
+
+	void bindTexture(GLenum target, GLuint texture)
+	{
+		if (!gpu_bindings_known)
+			initBindings();
+		bindTexture(gpu_bindings.active_slot == -1 ? 0 : gpu_bindings.active_slot, target, texture);
+	}
+
+	void bindBuffer(GLenum target, GLuint buffer)
+	{
+		if (!gpu_bindings_known)
+			initBindings();
+		int index = getBufferTargetIndex(target);
+		if (index != -1 && gpu_bindings.buffers[index] == buffer)
+		{
+			gpu_state_stats.redundant_bindings++;
+			return;
+		}
+		glBindBuffer(target, buffer);
+		if (index != -1)
+			gpu_bindings.buffers[index] = buffer;
+		gpu_state_stats.bindings++;
+	}
+
+	void bindBufferRange(GLenum target, int index, GLuint buffer, int start, int length)
+	{
+		if (!gpu_bindings_known)
+			initBindings();
+		int target_index = getBufferTargetIndex(target);
+		GLuint* indexed = target_index > 0 && index < GPU_MAX_BUFFER_INDICES ? &gpu_bindings.indexed_buffers[target_index - 1][index] : NULL;
+		if (length == -1 && indexed && *indexed == buffer)
+		{
+			gpu_state_stats.redundant_bindings++;
+			return;
+		}
+		//both also bind the buffer to the target
+		if (length == -1)
+			glBindBufferBase(target, index, buffer);
+		else
+			glBindBufferRange(target, index, buffer, start, length);
+		if (indexed)
+			*indexed = length == -1 ? buffer : GPU_UNKNOWN_BINDING;
+		if (target_index != -1)
+			gpu_bindings.buffers[target_index] = buffer;
+		gpu_state_stats.bindings++;
+	}
 
 	void startGPULabel(const char* text)
 	{
@@ -37,9 +332,10 @@ namespace GFX {
 			nCurAvailMemoryInKB = 0;
 		}
 
-		std::string str = "FPS: " + std::to_string(CORE::BaseApplication::instance->fps) + " Time: " + std::to_string(gpu_frame_microseconds) + "us DCS: " + std::to_string(Mesh::num_meshes_rendered) + " Tris: " + std::to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + std::to_string(int((nTotalMemoryInKB - nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
+		std::string str = "FPS: " + std::to_string(CORE::BaseApplication::instance->fps) + " Time: " + std::to_string(gpu_frame_microseconds) + "us DCS: " + std::to_string(Mesh::num_meshes_rendered) + " Saved: " + std::to_string(Mesh::num_draws_saved) + " Tris: " + std::to_string(long(Mesh::num_triangles_rendered * 0.001)) + "Ks  VRAM: " + std::to_string(int((nTotalMemoryInKB - nCurAvailMemoryInKB) * 0.001)) + "MBs / " + std::to_string(int(nTotalMemoryInKB * 0.001)) + "MBs";
 		Mesh::num_meshes_rendered = 0;
 		Mesh::num_triangles_rendered = 0;
+		Mesh::num_draws_saved = 0;
 		return str;
 	}
 
@@ -76,9 +372,7 @@ namespace GFX {
 		}
 
 		glLineWidth(1);
-		glEnable(GL_BLEND);
-		glDepthMask(false);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		setGPUState(GFX_STATE_BLEND_ALPHA, GFX_STATE_BLEND_MASK | GFX_STATE_WRITE_Z); //blending without writing the depth
 		Shader* grid_shader = Shader::getDefaultShader("grid");
 		grid_shader->enable();
 		Matrix44 m;
@@ -88,8 +382,7 @@ namespace GFX {
 		grid_shader->setUniform("u_camera_position", Camera::current->eye);
 		grid_shader->setUniform("u_viewprojection", Camera::current->viewprojection_matrix);
 		grid->render(GL_LINES); //background grid
-		glDisable(GL_BLEND);
-		glDepthMask(true);
+		setGPUState(GFX_STATE_WRITE_Z, GFX_STATE_BLEND_MASK | GFX_STATE_WRITE_Z);
 		grid_shader->disable();
 	}
 
@@ -123,8 +416,7 @@ namespace GFX {
 		Vector2f size = CORE::getWindowSize();
 		projection_matrix.ortho(0, size.x / scale, size.y / scale, 0, -1, 1);
 
-		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_CULL_FACE);
+		setGPUState(GFX_STATE_NONE, GFX_STATE_DEPTH_TEST_MASK | GFX_STATE_CULL_MASK);
 
 		Shader* shader = Shader::getDefaultShader("flat2D");
 		shader->enable();
@@ -142,7 +434,7 @@ namespace GFX {
 
 	void drawTexture2D(Texture* tex, vec4 pos)
 	{
-		glDisable(GL_DEPTH_TEST);
+		setGPUState(GFX_STATE_NONE, GFX_STATE_DEPTH_TEST_MASK);
 		glPushAttrib(GL_VIEWPORT_BIT);
 		glViewport(pos.x, pos.y, pos.z, pos.w);
 
@@ -179,6 +471,7 @@ namespace GFX {
 	void displaceMesh(Mesh* mesh, ::Image* heightmap, float altitude)
 	{
 		assert(heightmap && heightmap->data && "image without data");
+		mesh->loadCPUData();
 		assert(mesh->uvs.size() && "cannot displace without uvs");
 
 		bool is_interleaved = mesh->interleaved.size() != 0;
@@ -236,13 +529,3 @@ namespace GFX {
 		return available != 0;
 	}
 };
-
-/*
-uint64 gpu_current_state = GFX_STATE_DEFAULT;
-
-void setGPUState(uint64 state)
-{
-	//TODO
-}
-*/
-
@@ -2,6 +2,7 @@
 
 #include "../core/core.h"
 #include "../gfx/texture.h" //FloatImage
+#include <stdint.h>
 
 class Image;
 
@@ -30,6 +31,101 @@ namespace GFX {
 
 	void displaceMesh(Mesh* mesh, ::Image* heightmap, float altitude);
 
+	//render state in a 64 bits word (layout from BGFX), set with setGPUState and applied comparing with the current one,
+	//so only the GL calls of the parts that changed are done. Like in GL, without depth test the depth is not written
+
+	//color and depth writes, disabled if not specified
+	#define GFX_STATE_WRITE_R				UINT64_C(0x0000000000000001)
+	#define GFX_STATE_WRITE_G				UINT64_C(0x0000000000000002)
+	#define GFX_STATE_WRITE_B				UINT64_C(0x0000000000000004)
+	#define GFX_STATE_WRITE_A				UINT64_C(0x0000000000000008)
+	#define GFX_STATE_WRITE_Z				UINT64_C(0x0000004000000000)
+	#define GFX_STATE_WRITE_RGB				(GFX_STATE_WRITE_R | GFX_STATE_WRITE_G | GFX_STATE_WRITE_B)
+	#define GFX_STATE_WRITE_MASK			(GFX_STATE_WRITE_RGB | GFX_STATE_WRITE_A | GFX_STATE_WRITE_Z)
+
+	//depth test, disabled if not specified
+	#define GFX_STATE_DEPTH_TEST_LESS		UINT64_C(0x0000000000000010)
+	#define GFX_STATE_DEPTH_TEST_LEQUAL		UINT64_C(0x0000000000000020)
+	#define GFX_STATE_DEPTH_TEST_EQUAL		UINT64_C(0x0000000000000030)
+	#define GFX_STATE_DEPTH_TEST_GEQUAL		UINT64_C(0x0000000000000040)
+	#define GFX_STATE_DEPTH_TEST_GREATER	UINT64_C(0x0000000000000050)
+	#define GFX_STATE_DEPTH_TEST_NOTEQUAL	UINT64_C(0x0000000000000060)
+	#define GFX_STATE_DEPTH_TEST_NEVER		UINT64_C(0x0000000000000070)
+	#define GFX_STATE_DEPTH_TEST_ALWAYS		UINT64_C(0x0000000000000080)
+	#define GFX_STATE_DEPTH_TEST_SHIFT		4
+	#define GFX_STATE_DEPTH_TEST_MASK		UINT64_C(0x00000000000000f0)
+
+	//blend factors, use GFX_STATE_BLEND_FUNC(src, dst), blending is disabled if not specified
+	#define GFX_STATE_BLEND_ZERO			UINT64_C(0x0000000000001000)
+	#define GFX_STATE_BLEND_ONE				UINT64_C(0x0000000000002000)
+	#define GFX_STATE_BLEND_SRC_COLOR		UINT64_C(0x0000000000003000)
+	#define GFX_STATE_BLEND_INV_SRC_COLOR	UINT64_C(0x0000000000004000)
+	#define GFX_STATE_BLEND_SRC_ALPHA		UINT64_C(0x0000000000005000)
+	#define GFX_STATE_BLEND_INV_SRC_ALPHA	UINT64_C(0x0000000000006000)
+	#define GFX_STATE_BLEND_DST_ALPHA		UINT64_C(0x0000000000007000)
+	#define GFX_STATE_BLEND_INV_DST_ALPHA	UINT64_C(0x0000000000008000)
+	#define GFX_STATE_BLEND_DST_COLOR		UINT64_C(0x0000000000009000)
+	#define GFX_STATE_BLEND_INV_DST_COLOR	UINT64_C(0x000000000000a000)
+	#define GFX_STATE_BLEND_SRC_ALPHA_SAT	UINT64_C(0x000000000000b000)
+	#define GFX_STATE_BLEND_FACTOR			UINT64_C(0x000000000000c000)
+	#define GFX_STATE_BLEND_INV_FACTOR		UINT64_C(0x000000000000d000)
+	#define GFX_STATE_BLEND_SHIFT			12
+	#define GFX_STATE_BLEND_MASK			UINT64_C(0x000000000ffff000)
+
+	//blend equations, use GFX_STATE_BLEND_EQUATION(equation), add if not specified
+	#define GFX_STATE_BLEND_EQUATION_ADD	UINT64_C(0x0000000000000000)
+	#define GFX_STATE_BLEND_EQUATION_SUB	UINT64_C(0x0000000010000000)
+	#define GFX_STATE_BLEND_EQUATION_REVSUB	UINT64_C(0x0000000020000000)
+	#define GFX_STATE_BLEND_EQUATION_MIN	UINT64_C(0x0000000030000000)
+	#define GFX_STATE_BLEND_EQUATION_MAX	UINT64_C(0x0000000040000000)
+	#define GFX_STATE_BLEND_EQUATION_SHIFT	28
+	#define GFX_STATE_BLEND_EQUATION_MASK	UINT64_C(0x00000003f0000000)
+
+	#define GFX_STATE_BLEND_FUNC_SEPARATE(src_rgb, dst_rgb, src_a, dst_a) ((uint64_t)(src_rgb) | ((uint64_t)(dst_rgb) << 4) | ((uint64_t)(src_a) << 8) | ((uint64_t)(dst_a) << 12))
+	#define GFX_STATE_BLEND_FUNC(src, dst)	GFX_STATE_BLEND_FUNC_SEPARATE(src, dst, src, dst)
+	#define GFX_STATE_BLEND_EQUATION_SEPARATE(rgb, a) ((uint64_t)(rgb) | ((uint64_t)(a) << 3))
+	#define GFX_STATE_BLEND_EQUATION(equation) GFX_STATE_BLEND_EQUATION_SEPARATE(equation, equation)
+	#define GFX_STATE_BLEND_ALPHA			GFX_STATE_BLEND_FUNC(GFX_STATE_BLEND_SRC_ALPHA, GFX_STATE_BLEND_INV_SRC_ALPHA)
+	#define GFX_STATE_BLEND_ADD				GFX_STATE_BLEND_FUNC(GFX_STATE_BLEND_ONE, GFX_STATE_BLEND_ONE)
+
+	//face culling, disabled if not specified. The front faces are counter-clockwise unless FRONT_CW
+	#define GFX_STATE_CULL_BACK				UINT64_C(0x0000001000000000)
+	#define GFX_STATE_CULL_FRONT			UINT64_C(0x0000002000000000)
+	#define GFX_STATE_CULL_SHIFT			36
+	#define GFX_STATE_CULL_MASK				UINT64_C(0x0000003000000000)
+	#define GFX_STATE_FRONT_CW				UINT64_C(0x0000008000000000)
+
+	#define GFX_STATE_WIREFRAME				UINT64_C(0x0000010000000000) //polygons rendered as lines
+
+	#define GFX_STATE_NONE					UINT64_C(0x0000000000000000)
+	#define GFX_STATE_MASK					UINT64_C(0xffffffffffffffff)
+	//opaque geometry: writes everything, depth test less and back faces culled
+	#define GFX_STATE_DEFAULT (GFX_STATE_WRITE_MASK | GFX_STATE_DEPTH_TEST_LESS | GFX_STATE_CULL_BACK)
+
+	//only the bits in mask are changed, the rest keep the current state: setGPUState(GFX_STATE_NONE, GFX_STATE_BLEND_MASK) disables blending
+	void setGPUState(uint64_t state, uint64_t mask = GFX_STATE_MASK);
+	uint64_t getGPUState();
+	//the state and bindings are not known anymore (after changing them with GL directly), the next calls apply them again
+	void resetGPUState();
+
+	//the bindings are remembered and skipped if they are already bound, the GL names must not be bound directly
+	//with GL after deleting them, call resetGPUState as the driver can give the same name to a new object
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vao);
+	void bindTexture(int slot, GLenum target, GLuint texture);
+	void bindTexture(GLenum target, GLuint texture); //in the active slot, to create or upload it
+	void bindBuffer(GLenum target, GLuint buffer); //GL_ELEMENT_ARRAY_BUFFER is part of the VAO, it is not remembered
+	void bindBufferRange(GLenum target, int index, GLuint buffer, int start = 0, int length = -1); //whole buffer if length is -1
+
+	//GL calls done and avoided, the renderer resets them every frame
+	struct sGPUStateStats {
+		int state_calls;		//GL calls to change the render state
+		int redundant_states;	//GL calls avoided because that part of the state did not change
+		int bindings;
+		int redundant_bindings;
+	};
+	extern sGPUStateStats gpu_state_stats;
+
 	class GPUQuery
 	{
 	public:
@@ -47,117 +143,3 @@ namespace GFX {
 };
 
 
-//GPU state representation from BGFX
-
-/*
-//Color RGB/alpha/depth write. When it's not specified write will be disabled.
-
-#define GFX_STATE_WRITE_R                        UINT64_C(0x0000000000000001) //!< Enable R write.
-#define GFX_STATE_WRITE_G                        UINT64_C(0x0000000000000002) //!< Enable G write.
-#define GFX_STATE_WRITE_B                        UINT64_C(0x0000000000000004) //!< Enable B write.
-#define GFX_STATE_WRITE_A                        UINT64_C(0x0000000000000008) //!< Enable alpha write.
-#define GFX_STATE_WRITE_Z                        UINT64_C(0x0000004000000000) //!< Enable depth write.
- /// Enable RGB write.
-#define GFX_STATE_WRITE_RGB (0 \
-	| GFX_STATE_WRITE_R \
-	| GFX_STATE_WRITE_G \
-	| GFX_STATE_WRITE_B \
-	)
-
-/// Write all channels mask.
-#define GFX_STATE_WRITE_MASK (0 \
-	| GFX_STATE_WRITE_RGB \
-	| GFX_STATE_WRITE_A \
-	| GFX_STATE_WRITE_Z \
-	)
-
-
-//Depth test state. When `GFX_STATE_DEPTH_` is not specified depth test will be disabled.
-#define GFX_STATE_DEPTH_TEST_LESS                UINT64_C(0x0000000000000010) //!< Enable depth test, less.
-#define GFX_STATE_DEPTH_TEST_LEQUAL              UINT64_C(0x0000000000000020) //!< Enable depth test, less or equal.
-#define GFX_STATE_DEPTH_TEST_EQUAL               UINT64_C(0x0000000000000030) //!< Enable depth test, equal.
-#define GFX_STATE_DEPTH_TEST_GEQUAL              UINT64_C(0x0000000000000040) //!< Enable depth test, greater or equal.
-#define GFX_STATE_DEPTH_TEST_GREATER             UINT64_C(0x0000000000000050) //!< Enable depth test, greater.
-#define GFX_STATE_DEPTH_TEST_NOTEQUAL            UINT64_C(0x0000000000000060) //!< Enable depth test, not equal.
-#define GFX_STATE_DEPTH_TEST_NEVER               UINT64_C(0x0000000000000070) //!< Enable depth test, never.
-#define GFX_STATE_DEPTH_TEST_ALWAYS              UINT64_C(0x0000000000000080) //!< Enable depth test, always.
-#define GFX_STATE_DEPTH_TEST_SHIFT               4                            //!< Depth test state bit shift
-#define GFX_STATE_DEPTH_TEST_MASK                UINT64_C(0x00000000000000f0) //!< Depth test state bit mask
-
-//Use GFX_STATE_BLEND_FUNC(_src, _dst) or GFX_STATE_BLEND_FUNC_SEPARATE(_srcRGB, _dstRGB, _srcA, _dstA)
-//helper macros.
-
-#define GFX_STATE_BLEND_ZERO                     UINT64_C(0x0000000000001000) //!< 0, 0, 0, 0
-#define GFX_STATE_BLEND_ONE                      UINT64_C(0x0000000000002000) //!< 1, 1, 1, 1
-#define GFX_STATE_BLEND_SRC_COLOR                UINT64_C(0x0000000000003000) //!< Rs, Gs, Bs, As
-#define GFX_STATE_BLEND_INV_SRC_COLOR            UINT64_C(0x0000000000004000) //!< 1-Rs, 1-Gs, 1-Bs, 1-As
-#define GFX_STATE_BLEND_SRC_ALPHA                UINT64_C(0x0000000000005000) //!< As, As, As, As
-#define GFX_STATE_BLEND_INV_SRC_ALPHA            UINT64_C(0x0000000000006000) //!< 1-As, 1-As, 1-As, 1-As
-#define GFX_STATE_BLEND_DST_ALPHA                UINT64_C(0x0000000000007000) //!< Ad, Ad, Ad, Ad
-#define GFX_STATE_BLEND_INV_DST_ALPHA            UINT64_C(0x0000000000008000) //!< 1-Ad, 1-Ad, 1-Ad ,1-Ad
-#define GFX_STATE_BLEND_DST_COLOR                UINT64_C(0x0000000000009000) //!< Rd, Gd, Bd, Ad
-#define GFX_STATE_BLEND_INV_DST_COLOR            UINT64_C(0x000000000000a000) //!< 1-Rd, 1-Gd, 1-Bd, 1-Ad
-#define GFX_STATE_BLEND_SRC_ALPHA_SAT            UINT64_C(0x000000000000b000) //!< f, f, f, 1; f = min(As, 1-Ad)
-#define GFX_STATE_BLEND_FACTOR                   UINT64_C(0x000000000000c000) //!< Blend factor
-#define GFX_STATE_BLEND_INV_FACTOR               UINT64_C(0x000000000000d000) //!< 1-Blend factor
-#define GFX_STATE_BLEND_SHIFT                    12                           //!< Blend state bit shift
-#define GFX_STATE_BLEND_MASK                     UINT64_C(0x000000000ffff000) //!< Blend state bit mask
-
-//Use GFX_STATE_BLEND_EQUATION(_equation) or GFX_STATE_BLEND_EQUATION_SEPARATE(_equationRGB, _equationA)
-//helper macros.
-#define GFX_STATE_BLEND_EQUATION_ADD             UINT64_C(0x0000000000000000) //!< Blend add: src + dst.
-#define GFX_STATE_BLEND_EQUATION_SUB             UINT64_C(0x0000000010000000) //!< Blend subtract: src - dst.
-#define GFX_STATE_BLEND_EQUATION_REVSUB          UINT64_C(0x0000000020000000) //!< Blend reverse subtract: dst - src.
-#define GFX_STATE_BLEND_EQUATION_MIN             UINT64_C(0x0000000030000000) //!< Blend min: min(src, dst).
-#define GFX_STATE_BLEND_EQUATION_MAX             UINT64_C(0x0000000040000000) //!< Blend max: max(src, dst).
-#define GFX_STATE_BLEND_EQUATION_SHIFT           28                           //!< Blend equation bit shift
-#define GFX_STATE_BLEND_EQUATION_MASK            UINT64_C(0x00000003f0000000) //!< Blend equation bit mask
-
-//Cull state. When `GFX_STATE_CULL_*` is not specified culling will be disabled.
-#define GFX_STATE_CULL_CW                        UINT64_C(0x0000001000000000) //!< Cull clockwise triangles.
-#define GFX_STATE_CULL_CCW                       UINT64_C(0x0000002000000000) //!< Cull counter-clockwise triangles.
-#define GFX_STATE_CULL_SHIFT                     36                           //!< Culling mode bit shift
-#define GFX_STATE_CULL_MASK                      UINT64_C(0x0000003000000000) //!< Culling mode bit mask
-
-//Alpha reference value.
-
-#define GFX_STATE_ALPHA_REF_SHIFT                40                           //!< Alpha reference bit shift
-#define GFX_STATE_ALPHA_REF_MASK                 UINT64_C(0x0000ff0000000000) //!< Alpha reference bit mask
-#define GFX_STATE_ALPHA_REF(v) ( ( (uint64_t)(v)<<GFX_STATE_ALPHA_REF_SHIFT )&GFX_STATE_ALPHA_REF_MASK)
-
-#define GFX_STATE_PT_TRISTRIP                    UINT64_C(0x0001000000000000) //!< Tristrip.
-#define GFX_STATE_PT_LINES                       UINT64_C(0x0002000000000000) //!< Lines.
-#define GFX_STATE_PT_LINESTRIP                   UINT64_C(0x0003000000000000) //!< Line strip.
-#define GFX_STATE_PT_POINTS                      UINT64_C(0x0004000000000000) //!< Points.
-#define GFX_STATE_PT_SHIFT                       48                           //!< Primitive type bit shift
-#define GFX_STATE_PT_MASK                        UINT64_C(0x0007000000000000) //!< Primitive type bit mask
-
-//Point size value.
-#define GFX_STATE_POINT_SIZE_SHIFT               52                           //!< Point size bit shift
-#define GFX_STATE_POINT_SIZE_MASK                UINT64_C(0x00f0000000000000) //!< Point size bit mask
-#define GFX_STATE_POINT_SIZE(v) ( ( (uint64_t)(v)<<GFX_STATE_POINT_SIZE_SHIFT )&GFX_STATE_POINT_SIZE_MASK)
-
-//Enable MSAA write when writing into MSAA frame buffer.
-//This flag is ignored when not writing into MSAA frame buffer.
-#define GFX_STATE_MSAA                           UINT64_C(0x0100000000000000) //!< Enable MSAA rasterization.
-#define GFX_STATE_LINEAA                         UINT64_C(0x0200000000000000) //!< Enable line AA rasterization.
-#define GFX_STATE_CONSERVATIVE_RASTER            UINT64_C(0x0400000000000000) //!< Enable conservative rasterization.
-#define GFX_STATE_NONE                           UINT64_C(0x0000000000000000) //!< No state.
-#define GFX_STATE_FRONT_CCW                      UINT64_C(0x0000008000000000) //!< Front counter-clockwise (default is clockwise).
-#define GFX_STATE_BLEND_INDEPENDENT              UINT64_C(0x0000000400000000) //!< Enable blend independent.
-#define GFX_STATE_BLEND_ALPHA_TO_COVERAGE        UINT64_C(0x0000000800000000) //!< Enable alpha to coverage.
-       /// Default state is write to RGB, alpha, and depth with depth test less enabled, with clockwise
-       /// culling and MSAA (when writing into MSAA frame buffer, otherwise this flag is ignored).
-#define GFX_STATE_DEFAULT (0 \
-	| GFX_STATE_WRITE_RGB \
-	| GFX_STATE_WRITE_A \
-	| GFX_STATE_WRITE_Z \
-	| GFX_STATE_DEPTH_TEST_LESS \
-	| GFX_STATE_CULL_CW \
-	| GFX_STATE_MSAA \
-	)
-
-#define GFX_STATE_MASK                           UINT64_C(0xffffffffffffffff) //!< State bit mask
-
-void setGPUState(uint64 state);
-*/
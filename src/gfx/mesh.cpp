@@ -9,12 +9,14 @@
 #include <cassert>
 #include <iostream>
 #include <limits>
+#include <cfloat>
 #include <sys/stat.h>
 
 #include "../pipeline/camera.h" //??
 #include "texture.h"
+#include "mesh_optimizer.h"
+#include "../core/task.h"
 //#include "animation.h"
-#include "../extra/coldet/coldet.h"
 
 //#include "engine/application.h"
 
@@ -24,11 +26,13 @@ bool Mesh::use_binary = false;			//checks if there is .wbin, it there is one tri
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
 bool Mesh::use_vao = false;	//places the geometry in an interleaved array
+uint32 Mesh::optimize_flags = MESH_OPTIMIZE_DEFAULT; //weld and reorder imported meshes, quantization needs shaders that support it
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 long Mesh::num_meshes_rendered = 0;
+long Mesh::num_draws_saved = 0;
 long Mesh::num_triangles_rendered = 0;
-uint32 Mesh::s_last_index = 0;
+std::atomic<uint32> Mesh::s_last_index(0);
 
 #define FORMAT_ASE 1
 #define FORMAT_OBJ 2
@@ -41,6 +45,7 @@ Mesh::Mesh()
 	radius = 0;
 	vao_id = vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
 	collision_model = NULL;
+	mapped_file = NULL;
 
 	clear();
 }
@@ -53,6 +58,10 @@ Mesh::~Mesh()
 
 void Mesh::clear()
 {
+	//the names can be given to new buffers, the bindings remembered are not valid
+	if (vao_id || vertices_vbo_id || interleaved_vbo_id || indices_vbo_id)
+		resetGPUState();
+
 	//Free VBOs
 	#ifdef USE_OPENGL_EXT
 		if (vertices_vbo_id)
@@ -97,6 +106,11 @@ void Mesh::clear()
     #endif
 
 
+	index_size = 4;
+	quantization = 0;
+	uv_density = -1.0f;
+	memset(&optimization_stats, 0, sizeof(optimization_stats));
+
 	//GPU Buffers ids set to 0
 	vao_id = vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
 
@@ -107,30 +121,51 @@ void Mesh::clear()
 	colors.clear();
 	interleaved.clear();
 	m_indices.clear();
+	lods.clear();
+	lod_ranges.clear();
+	lod_indices.clear();
 	bones.clear();
 	weights.clear();
 	m_uvs1.clear();
 
 	if (collision_model)
-		delete (CollisionModel3D*)collision_model;
+		delete collision_model;
+	collision_model = NULL;
+
+	releaseMappedFile();
 }
 
 #define glGenBuffersARB glGenBuffers
-#define glBindBufferARB glBindBuffer
+#define glBindBufferARB bindBuffer
 #define glBufferDataARB glBufferData
 #define GL_ARRAY_BUFFER_ARB GL_ARRAY_BUFFER
 #define GL_STATIC_DRAW_ARB GL_STATIC_DRAW
+#define glBufferSubDataARB glBufferSubData
+
+//creates the buffer if needed and uploads the data
+static void uploadBuffer(unsigned int& buffer_id, unsigned int target, size_t size, const void* data)
+{
+	if (buffer_id == 0)
+		glGenBuffersARB(1, &buffer_id);
+	glBindBufferARB(target, buffer_id);
+	glBufferDataARB(target, size, data, GL_STATIC_DRAW_ARB);
+}
+
+//returns the vector data or the stream from the file mapping
+#define STREAM_DATA(vector, stream) (vector.size() ? (const void*)&vector[0] : (mapped_file ? mapped_streams[stream] : NULL))
 
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() || interleaved.size());
+	unsigned int num_vertices = getNumVertices();
+	unsigned int num_indices = getNumIndices();
+	assert(num_vertices);
 
 	/*
 	if (use_vao)
 	{
 		if (vao_id == 0)
 			glGenVertexArrays(1, &vao_id);
-		glBindVertexArray(vao_id);
+		bindVertexArray(vao_id);
 	}
 	*/
 
@@ -140,83 +175,125 @@ void Mesh::uploadToVRAM()
 		exit(0);
 	}
 
-	if (interleaved.size())
+	const void* data = NULL;
+	if (isInterleaved())
 	{
 		// Vertex,Normal,UV
-		if (interleaved_vbo_id == 0)
-			glGenBuffersARB(1, &interleaved_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+		uploadBuffer(interleaved_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(tInterleaved), STREAM_DATA(interleaved, VERTICES_STREAM));
 	}
 	else
 	{
+		//quantized streams in the file mapping are already quantized, the vectors are quantized here
+		std::vector<int16> quantized;
+
 		// Vertices
-		if (vertices_vbo_id == 0)
-			glGenBuffersARB(1, &vertices_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(Vector3f), &vertices[0], GL_STATIC_DRAW_ARB);
+		if (quantization & MESH_OPTIMIZE_QUANTIZE_POSITIONS)
+		{
+			if (vertices.size())
+			{
+				quantized.resize(num_vertices * 4);
+				quantizePositions(&vertices[0], num_vertices, box, &quantized[0]);
+			}
+			uploadBuffer(vertices_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(int16) * 4, vertices.size() ? (const void*)&quantized[0] : (const void*)mapped_streams[VERTICES_STREAM]);
+		}
+		else
+			uploadBuffer(vertices_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector3f), STREAM_DATA(vertices, VERTICES_STREAM));
 
 		// UVs
-		if (uvs.size())
+		if ((data = STREAM_DATA(uvs, UVS_STREAM)))
 		{
-			if (uvs_vbo_id == 0)
-				glGenBuffersARB(1, &uvs_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(Vector2f), &uvs[0], GL_STATIC_DRAW_ARB);
+			if (quantization & MESH_OPTIMIZE_QUANTIZE_UVS)
+			{
+				if (uvs.size())
+				{
+					quantized.resize(num_vertices * 2);
+					quantizeUVs(&uvs[0], num_vertices, (uint16*)&quantized[0]);
+					data = &quantized[0];
+				}
+				uploadBuffer(uvs_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(uint16) * 2, data);
+			}
+			else
+				uploadBuffer(uvs_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector2f), data);
 		}
 
 		// Normals
-		if (normals.size())
+		if ((data = STREAM_DATA(normals, NORMALS_STREAM)))
 		{
-			if (normals_vbo_id == 0)
-				glGenBuffersARB(1, &normals_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(Vector3f), &normals[0], GL_STATIC_DRAW_ARB);
+			if (quantization & MESH_OPTIMIZE_QUANTIZE_NORMALS)
+			{
+				if (normals.size())
+				{
+					quantized.resize(num_vertices * 2);
+					quantizeNormals(&normals[0], num_vertices, &quantized[0]);
+					data = &quantized[0];
+				}
+				uploadBuffer(normals_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(int16) * 2, data);
+			}
+			else
+				uploadBuffer(normals_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector3f), data);
 		}
 	}
 
 	// UVs
-	if (m_uvs1.size())
+	if ((data = STREAM_DATA(m_uvs1, UVS1_STREAM)))
 	{
-		if (uvs1_vbo_id == 0)
-			glGenBuffersARB(1, &uvs1_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs1_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_uvs1.size() * sizeof(Vector2f), &m_uvs1[0], GL_STATIC_DRAW_ARB);
+		if (quantization & MESH_OPTIMIZE_QUANTIZE_UVS)
+		{
+			std::vector<uint16> quantized;
+			if (m_uvs1.size())
+			{
+				quantized.resize(num_vertices * 2);
+				quantizeUVs(&m_uvs1[0], num_vertices, &quantized[0]);
+				data = &quantized[0];
+			}
+			uploadBuffer(uvs1_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(uint16) * 2, data);
+		}
+		else
+			uploadBuffer(uvs1_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector2f), data);
 	}
 
 	// Colors
-	if (colors.size())
-	{
-		if (colors_vbo_id == 0)
-			glGenBuffersARB(1, &colors_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4f), &colors[0], GL_STATIC_DRAW_ARB);
-	}
+	if ((data = STREAM_DATA(colors, COLORS_STREAM)))
+		uploadBuffer(colors_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4f), data);
 
-	if (bones.size())
-	{
-		if (bones_vbo_id == 0)
-			glGenBuffersARB(1, &bones_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(Vector4ub), &bones[0], GL_STATIC_DRAW_ARB);
-	}
-	if (weights.size())
-	{
-		if (weights_vbo_id == 0)
-			glGenBuffersARB(1, &weights_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4f), &weights[0], GL_STATIC_DRAW_ARB);
-	}
+	if ((data = STREAM_DATA(bones, BONES_STREAM)))
+		uploadBuffer(bones_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4ub), data);
+	if ((data = STREAM_DATA(weights, WEIGHTS_STREAM)))
+		uploadBuffer(weights_vbo_id, GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4f), data);
 
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
-	// Indices
-	if (m_indices.size())
+	// Indices, 16 bits when all the vertices can be addressed
+	if (num_indices)
 	{
-		if (indices_vbo_id == 0)
-			glGenBuffersARB(1, &indices_vbo_id);
-		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW_ARB);
+		const unsigned int* indices = (const unsigned int*)STREAM_DATA(m_indices, INDICES_STREAM);
+
+		//the levels of detail go after the indices of the mesh
+		std::vector<unsigned int> all_indices;
+		unsigned int num_lod_indices = getNumLODIndices();
+		if (num_lod_indices)
+		{
+			const unsigned int* lod_data = lod_indices.size() ? &lod_indices[0] : mapped_lod_indices;
+			all_indices.resize(num_indices + num_lod_indices);
+			memcpy(&all_indices[0], indices, num_indices * sizeof(unsigned int));
+			memcpy(&all_indices[num_indices], lod_data, num_lod_indices * sizeof(unsigned int));
+			indices = &all_indices[0];
+			num_indices += num_lod_indices;
+		}
+
+		if (num_vertices <= 0xFFFF)
+		{
+			std::vector<unsigned short> indices16(num_indices);
+			for (unsigned int i = 0; i < num_indices; ++i)
+				indices16[i] = (unsigned short)indices[i];
+			index_size = 2;
+			uploadBuffer(indices_vbo_id, GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(unsigned short), &indices16[0]);
+		}
+		else
+		{
+			index_size = 4;
+			uploadBuffer(indices_vbo_id, GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(unsigned int), indices);
+		}
 	}
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
@@ -224,7 +301,7 @@ void Mesh::uploadToVRAM()
 	if (use_vao)
 	{
 		enableBuffers(nullptr);
-		glBindVertexArray(0);
+		bindVertexArray(0);
 	}
 	*/
 
@@ -253,20 +330,26 @@ void Mesh::enableBuffers(Shader* sh)
 	int offset_normal = 0;
 	int offset_uv = 0;
 
-	if (interleaved.size())
+	if (isInterleaved())
 	{
 		spacing = sizeof(tInterleaved);
 		offset_normal = sizeof(Vector3f);
 		offset_uv = sizeof(Vector3f) + sizeof(Vector3f);
 	}
 
+	if (sh)
+		setDequantizationUniforms(sh);
+
 	if (vertex_location != -1)
 	{
 		glEnableVertexAttribArray(vertex_location);
 		if (vertices_vbo_id || interleaved_vbo_id)
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+			bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
+			if (quantization & MESH_OPTIMIZE_QUANTIZE_POSITIONS)
+				glVertexAttribPointer(vertex_location, 3, GL_SHORT, GL_TRUE, sizeof(int16) * 4, 0);
+			else
+				glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
 		}
 		else
 			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
@@ -274,7 +357,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	normal_location = -1;
-	if (normals.size() || spacing)
+	if (normals.size() || normals_vbo_id || spacing)
 	{
 		normal_location = !sh ? 1 : sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
@@ -282,8 +365,11 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(normal_location);
 			if (normals_vbo_id || interleaved_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
+				if (quantization & MESH_OPTIMIZE_QUANTIZE_NORMALS)
+					glVertexAttribPointer(normal_location, 2, GL_SHORT, GL_TRUE, 0, 0);
+				else
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
 			}
 			else
 				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
@@ -292,7 +378,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv_location = -1;
-	if (uvs.size() || spacing)
+	if (uvs.size() || uvs_vbo_id || spacing)
 	{
 		uv_location = !sh ? 2 : sh->getAttribLocation("a_coord");
 		if (uv_location != -1)
@@ -300,8 +386,11 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(uv_location);
 			if (uvs_vbo_id || interleaved_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				bindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
+				if (quantization & MESH_OPTIMIZE_QUANTIZE_UVS)
+					glVertexAttribPointer(uv_location, 2, GL_HALF_FLOAT, GL_FALSE, 0, 0);
+				else
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
 			}
 			else
 				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
@@ -310,7 +399,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv1_location = -1;
-	if (m_uvs1.size())
+	if (m_uvs1.size() || uvs1_vbo_id)
 	{
 		uv1_location = !sh ? 3 : sh->getAttribLocation("a_coord1");
 		if (uv1_location != -1)
@@ -318,8 +407,8 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(uv1_location);
 			if (uvs1_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, uvs1_vbo_id);
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+				bindBuffer(GL_ARRAY_BUFFER, uvs1_vbo_id);
+				glVertexAttribPointer(uv1_location, 2, (quantization & MESH_OPTIMIZE_QUANTIZE_UVS) ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, 0, (void*)0);
 			}
 			else
 				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, &m_uvs1[0]);
@@ -328,7 +417,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (colors.size() || colors_vbo_id)
 	{
 		color_location = !sh ? 4 : sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -336,7 +425,7 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(color_location);
 			if (colors_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
+				bindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
 				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
@@ -346,7 +435,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (bones.size() || bones_vbo_id)
 	{
 		bones_location = !sh ? 5 : sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -354,7 +443,7 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(bones_location);
 			if (bones_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, bones_vbo_id);
+				bindBuffer(GL_ARRAY_BUFFER, bones_vbo_id);
 				glVertexAttribPointer(bones_location, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, NULL);
 			}
 			else
@@ -362,7 +451,7 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (weights.size() || weights_vbo_id)
 	{
 		weights_location = !sh ? 6 : sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -370,7 +459,7 @@ void Mesh::enableBuffers(Shader* sh)
 			glEnableVertexAttribArray(weights_location);
 			if (weights_vbo_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
+				bindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
 				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
@@ -380,7 +469,19 @@ void Mesh::enableBuffers(Shader* sh)
 
 }
 
-void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
+//the GPU buffers of quantized streams must be decoded in the vertex shader, when rendering from RAM they are in float
+void Mesh::setDequantizationUniforms(Shader* sh)
+{
+	static const sUniformID u_quant_offset("u_quant_offset");
+	static const sUniformID u_quant_scale("u_quant_scale");
+	static const sUniformID u_quant_normals("u_quant_normals");
+	bool positions = (quantization & MESH_OPTIMIZE_QUANTIZE_POSITIONS) && vertices_vbo_id;
+	sh->setUniform(u_quant_offset, positions ? box.center : Vector3f(0.0f, 0.0f, 0.0f));
+	sh->setUniform(u_quant_scale, positions ? box.halfsize : Vector3f(1.0f, 1.0f, 1.0f));
+	sh->setUniform(u_quant_normals, (quantization & MESH_OPTIMIZE_QUANTIZE_NORMALS) && normals_vbo_id);
+}
+
+void Mesh::render(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
     //return;
 
@@ -390,14 +491,14 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
 	checkGLErrors();
 
 	//draw call
-	drawCall(primitive, submesh_id, num_instances);
+	drawCall(primitive, submesh_id, num_instances, lod);
 	checkGLErrors();
 
 	//unbind them
@@ -405,75 +506,83 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	checkGLErrors();
 }
 
-void Mesh::getSubmeshStartAndSize(int submesh_id, unsigned int& start, unsigned int& size)
+void Mesh::getSubmeshStartAndSize(int submesh_id, unsigned int& start, unsigned int& size, int lod)
 {
 	start = 0; //in primitives
-	size = (int)vertices.size();
-	if (m_indices.size())
-		size = (int)m_indices.size();
-	else
-		if (interleaved.size())
-			size = (int)interleaved.size();
+	size = getNumIndices();
+	if (!size)
+		size = getNumVertices();
+
+	if (lod > 0 && lod <= (int)lods.size())
+	{
+		sMeshLOD& level = lods[lod - 1];
+		start = level.start;
+		size = level.length;
+		if (submesh_id > -1 && submeshes.size())
+		{
+			assert(submesh_id < submeshes.size() && "this mesh doesnt have as many submeshes");
+			sIndexRange& range = lod_ranges[level.first_range + submesh_id];
+			start = range.start;
+			size = range.length;
+		}
+		start += getNumIndices(); //after the base indices
+		return;
+	}
+
 	if (submesh_id > -1)
 	{
 		assert(submesh_id < submeshes.size() && "this mesh doesnt have as many submeshes");
 		sSubmeshInfo& submesh = submeshes[submesh_id];
 		start = submesh.start;
-		size = submesh.start + submesh.length;
+		size = submesh.length;
 	}
 }
 
-void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
 	unsigned int start;
 	unsigned int size;
-	getSubmeshStartAndSize(submesh_id, start, size);
+	getSubmeshStartAndSize(submesh_id, start, size, lod);
 
 	//DRAW
-	if (m_indices.size())
+	if (getNumIndices())
 	{
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			#ifdef OPENGL_ES3
-				glDrawElementsInstanced(primitive, size, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3u)), num_instances);
-            #else
-				assert(0 && "not supported in OpenGL ES2");
-            #endif
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			glDrawElementsInstanced(primitive, size, index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(size_t)(start * index_size), num_instances);
+			bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		}
 		else
 		{
 			if (indices_vbo_id)
 			{
 				/*if (size != 90)*/ {
-					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-					glDrawElements(primitive, size, GL_UNSIGNED_INT,(void *) (start * sizeof(Vector3u)));
-					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+					bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+					glDrawElements(primitive, size, index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(size_t)(start * index_size));
+					bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 				}
 				checkGLErrors();
 			}
+			else if (start >= m_indices.size()) //level of detail
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&lod_indices[0] + (start - m_indices.size())));
 			else
-				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its a vector3u pointer)
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its an unsigned int pointer
 		}
 	}
 	else //not indexed
 	{
 		if (num_instances > 0)
-		{
-			#ifdef OPENGL_ES3
-				glDrawArraysInstanced(primitive, start, size, num_instances);
-            #else
-				assert(0 && "not supported in OpenGL ES2");
-            #endif
-		}
+			glDrawArraysInstanced(primitive, start, size, num_instances);
 		else
 			glDrawArrays(primitive, start, size);
 	}
 
 	num_triangles_rendered += (size / 3) * (num_instances ? num_instances : 1);
 	num_meshes_rendered++;
+	if (num_instances > 1)
+		num_draws_saved += num_instances - 1;
 }
 
 void Mesh::disableBuffers(Shader* shader)
@@ -485,7 +594,7 @@ void Mesh::disableBuffers(Shader* shader)
 	if (color_location != -1) glDisableVertexAttribArray(color_location);
 	if (bones_location != -1) glDisableVertexAttribArray(bones_location);
 	if (weights_location != -1) glDisableVertexAttribArray(weights_location);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if it crashes here, COMMENT THIS LINE ****************************
+	bindBuffer(GL_ARRAY_BUFFER, 0);    //if it crashes here, COMMENT THIS LINE ****************************
 	checkGLErrors();
 }
 
@@ -499,26 +608,26 @@ void Mesh::drawUsingVAO(unsigned int primitive, int submesh_id)
 	{
 		assert(vertices_vbo_id || interleaved_vbo_id); //geometry is not in the VRAM
 		glGenVertexArrays(1, &vao_id);
-		glBindVertexArray(vao_id);
+		bindVertexArray(vao_id);
 		enableBuffers(nullptr);
-		//enable also indices buffer
+		//enable also indices buffer (already uploaded)
 		if (indices_vbo_id != 0)
-		{
 			glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW_ARB);
-		}
-		glBindVertexArray(0);
+		bindVertexArray(0);
 	}
 
-	glBindVertexArray(vao_id);
+	if (Shader::current)
+		setDequantizationUniforms(Shader::current);
+
+	bindVertexArray(vao_id);
 	if (indices_vbo_id)
 	{
-		glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3u)));
+		glDrawElements(primitive, size, index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)(size_t)(start * index_size));
 		//glDrawElementsBaseVertex(primitive,size, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * start), 0); //allows to specify offset for vertex buffers also, not only for indices
 	}
 	else
 		glDrawArrays(primitive, start, size);
-	glBindVertexArray(0);
+	bindVertexArray(0);
 
 	num_triangles_rendered += (size / 3);
 	num_meshes_rendered++;
@@ -528,66 +637,68 @@ GLuint instances_buffer_id = 0;
 unsigned int total_instances = 0;
 
 //should be faster but in some system it is slower
-void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances)
+void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int num_instances, int submesh_id, int lod)
 {
 	if (!num_instances)
 		return;
 
-	if (glVertexAttribDivisorARB == nullptr)
-		return;//not suported
+	//initialize global buffer for models so we dont resize every time
+	if (instances_buffer_id == 0)
+	{
+		glGenBuffersARB(1, &instances_buffer_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+		total_instances = 256;
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, total_instances * sizeof(Matrix44), nullptr, GL_STREAM_DRAW);
+	}
+	if (total_instances < num_instances)
+	{
+		while (total_instances < num_instances)
+			total_instances *= 2;
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, total_instances * sizeof(Matrix44), nullptr, GL_STREAM_DRAW);
+	}
 
-	#ifdef OPENGL_ES3
-		Shader* shader = Shader::current;
-		assert(shader && "shader must be enabled");
+	//upload models
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+	glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, num_instances * sizeof(Matrix44), instanced_models);
 
-		//initialize global buffer for models so we dont resize every time
-		if (instances_buffer_id == 0)
-		{
-			glGenBuffersARB(1, &instances_buffer_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-			total_instances = 256;
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, total_instances * sizeof(Matrix44), nullptr, GL_STREAM_DRAW_ARB);
-			//glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
-		}
-		else if (total_instances < num_instances)
-		{
-			total_instances *= 2;
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, total_instances * sizeof(Matrix44), nullptr, GL_STREAM_DRAW_ARB);
-		}
+	renderInstanced(primitive, instances_buffer_id, 0, num_instances, submesh_id, lod);
+}
 
-		//upload models
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-		glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, total_instances * sizeof(Matrix44), instanced_models);
+//renders using the models stored in a GPU buffer, starting from first_instance (allows to share one buffer for many meshes)
+void Mesh::renderInstanced(unsigned int primitive, unsigned int buffer_id, int first_instance, int num_instances, int submesh_id, int lod)
+{
+	if (!num_instances || !buffer_id)
+		return;
 
-		int attribLocation = shader->getAttribLocation("u_model");
-		assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
-		if (attribLocation == -1)
-			return; //this shader doesnt support instanced model
+	Shader* shader = Shader::current;
+	assert(shader && "shader must be enabled");
 
-		//mat4 count as 4 different attributes of vec4... (thanks opengl...)
-		for (int k = 0; k < 4; ++k)
-		{
-			glEnableVertexAttribArray(attribLocation + k );
-			int offset = sizeof(float) * 4 * k;
-			const Uint8* addr = (Uint8*) offset;
-			glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr);
-			glVertexAttribDivisorARB(attribLocation + k, 1); // This makes it instanced!
-		}
+	int attribLocation = shader->getAttribLocation("u_model");
+	assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
+	if (attribLocation == -1)
+		return; //this shader doesnt support instanced model
 
-		//regular render
-		render(primitive, -1, num_instances);
+	//mat4 count as 4 different attributes of vec4... (thanks opengl...)
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, buffer_id);
+	for (int k = 0; k < 4; ++k)
+	{
+		glEnableVertexAttribArray(attribLocation + k );
+		size_t offset = sizeof(Matrix44) * first_instance + sizeof(float) * 4 * k;
+		const Uint8* addr = (Uint8*) offset;
+		glVertexAttribPointer(attribLocation + k, 4, GL_FLOAT, false, sizeof(Matrix44), addr);
+		glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
+	}
 
-		//disable instanced attribs
-		for (int k = 0; k < 4; ++k)
-		{
-			glDisableVertexAttribArray(attribLocation + k);
-			glVertexAttribDivisorARB(attribLocation + k, 0);
-		}
-		
-    #else
-		assert(0 && "not supported");
-    #endif
+	//regular render
+	render(primitive, submesh_id, num_instances, lod);
+
+	//disable instanced attribs
+	for (int k = 0; k < 4; ++k)
+	{
+		glDisableVertexAttribArray(attribLocation + k);
+		glVertexAttribDivisor(attribLocation + k, 0);
+	}
 }
 
 /*
@@ -610,64 +721,31 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 bool Mesh::createCollisionModel(bool is_static)
 {
 	if (collision_model)
-		return true;
-
-	double time = getTime();
-	std::cout << "Creating collision model for: " << this->name << " (" << (interleaved.size() ? interleaved.size() : vertices.size()) / 3 << ") ...";
+	{
+		if (collision_model->isValid())
+			return true;
+		//the buffers changed since it was built
+		delete collision_model;
+		collision_model = NULL;
+	}
 
-	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
+	//the BVH needs the vertices in memory
+	if (!loadCPUData())
+		return false;
 
-	if (m_indices.size()) //indexed
-	{
-		collision_model->setTriangleNumber((int)m_indices.size() / 3);
+	double time = getTime();
+	std::cout << "Creating collision model for: " << this->name << " (" << (m_indices.size() ? m_indices.size() : getNumVertices()) / 3 << ") ...";
 
-		if (interleaved.size())
-			for (unsigned int i = 0; i < m_indices.size(); i+=3)
-			{
-				auto v1 = interleaved[m_indices[i+0]];
-				auto v2 = interleaved[m_indices[i+1]];
-				auto v3 = interleaved[m_indices[i+2]];
-				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-			}
-		else
-		for (unsigned int i = 0; i < m_indices.size(); i+=3)
-		{
-			auto v1 = vertices[m_indices[i+0]];
-			auto v2 = vertices[m_indices[i+1]];
-			auto v3 = vertices[m_indices[i+2]];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
-	}
-	else if (interleaved.size()) //is interleaved
-	{
-		collision_model->setTriangleNumber(interleaved.size() / 3);
-		for (unsigned int i = 0; i < interleaved.size(); i+=3)
-		{
-			auto v1 = interleaved[i];
-			auto v2 = interleaved[i+1];
-			auto v3 = interleaved[i+2];
-			collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-		}
-	}
-	else if (vertices.size()) //non interleaved
-	{
-		collision_model->setTriangleNumber((int)vertices.size() / 3);
-		for (unsigned int i = 0; i < (int)vertices.size(); i+=3)
-		{
-			auto v1 = vertices[i];
-			auto v2 = vertices[i + 1];
-			auto v3 = vertices[i + 2];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
-	}
-	else
+	//the BVH references the mesh vertices, isValid tells if they were reallocated
+	MeshBVH* bvh = new MeshBVH();
+	if (!bvh->build(this))
 	{
 		assert(0 && "mesh without vertices, cannot create collision model");
 		std::cout << "[ERROR]" << std::endl;
+		delete bvh;
 		return false;
 	}
-	collision_model->finalize();
-	this->collision_model = collision_model;
+	collision_model = bvh;
 
 	std::cout << "[OK] Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 
@@ -675,9 +753,9 @@ bool Mesh::createCollisionModel(bool is_static)
 }
 
 //help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-bool Mesh::testRayCollision(Matrix44 model, Vector3f start, Vector3f front, Vector3f& collision, Vector3f& normal, float max_ray_dist, bool in_object_space )
+bool Mesh::testRayCollision(Matrix44 model, Vector3f start, Vector3f front, Vector3f& collision, Vector3f& normal, float max_ray_dist, bool in_object_space, int submesh_id )
 {
-	if (!this->collision_model)
+	if (!this->collision_model || !collision_model->isValid())
 	{
 		//test first against bounding before creating collision model
 		BoundingBox aabb = transformBoundingBox(model, box);
@@ -688,54 +766,79 @@ bool Mesh::testRayCollision(Matrix44 model, Vector3f start, Vector3f front, Vect
 			return false;
 	}
 
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
+	assert(collision_model && "collision model must be created before using it, call createCollisionModel");
 
-	collision_model->setTransform( model.m );
-	if (collision_model->rayCollision( start.v , front.v, true,0.0, max_ray_dist) == false)
-		return false;
+	//ray to object space, direction is not normalized so distances remain in world units
+	Matrix44 inv = model;
+	inv.inverse();
+	Vector3f local_start = inv * start;
+	Vector3f local_front = inv.rotateVector(front);
 
-	collision_model->getCollisionPoint( collision.v, in_object_space);
+	//only the triangles of the submesh
+	uint32 first_triangle = 0;
+	uint32 last_triangle = 0xFFFFFFFF;
+	if (submesh_id > -1)
+	{
+		unsigned int start, size;
+		getSubmeshStartAndSize(submesh_id, start, size);
+		first_triangle = start / 3;
+		last_triangle = (start + size) / 3;
+	}
 
-	float t1[9],t2[9];
-	collision_model->getCollidingTriangles(t1,t2, in_object_space);
+	sRayHit hit;
+	hit.t = max_ray_dist;
+	hit.triangle = -1;
+	if (!collision_model->testRay(local_start, local_front, hit, first_triangle, last_triangle))
+		return false;
 
-	Vector3f v1;
-	Vector3f v2;
-	v1=Vector3f(t1[3]-t1[0],t1[4]-t1[1],t1[5]-t1[2]);
-	v2=Vector3f(t1[6]-t1[0],t1[7]-t1[1],t1[8]-t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	Vector3f a, b, c;
+	collision_model->getTriangle(hit.triangle, a, b, c);
+	collision = local_start + local_front * hit.t;
+	normal = cross(b - a, c - a);
+	if (!in_object_space)
+	{
+		collision = model * collision;
+		normal = model.rotateVector(normal);
+	}
+	normal.normalize();
 
 	return true;
 }
 
+int Mesh::testRaysCollision(const Matrix44& model, int num_rays, const Vector3f* origins, const Vector3f* directions, sRayHit* hits)
+{
+	if (!this->collision_model || !collision_model->isValid())
+		if (!createCollisionModel())
+			return 0;
+
+	Matrix44 inv = model;
+	inv.inverse();
+	std::vector<Vector3f> local_origins(num_rays);
+	std::vector<Vector3f> local_directions(num_rays);
+	for (int i = 0; i < num_rays; ++i)
+	{
+		local_origins[i] = inv * origins[i];
+		local_directions[i] = inv.rotateVector(directions[i]);
+	}
+	return collision_model->testRays(&local_origins[0], &local_directions[0], hits, num_rays);
+}
+
 bool Mesh::testSphereCollision(Matrix44 model, Vector3f center, float radius, Vector3f& collision, Vector3f& normal)
 {
-	if (!this->collision_model)
+	if (!this->collision_model || !collision_model->isValid())
 		if (!createCollisionModel())
 			return false;
 
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
+	assert(collision_model && "collision model must be created before using it, call createCollisionModel");
 
-	collision_model->setTransform(model.m);
-	if (collision_model->sphereCollision(center.v, radius) == false)
+	int triangle = -1;
+	if (!collision_model->testSphere(model, center, radius, collision, triangle))
 		return false;
 
-	collision_model->getCollisionPoint(collision.v, false);
-
-	float t1[9], t2[9];
-	collision_model->getCollidingTriangles(t1, t2, false);
-
-	Vector3f v1;
-	Vector3f v2;
-	v1 = Vector3f(t1[3] - t1[0], t1[4] - t1[1], t1[5] - t1[2]);
-	v2 = Vector3f(t1[6] - t1[0], t1[7] - t1[1], t1[8] - t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	Vector3f a, b, c;
+	collision_model->getTriangle(triangle, a, b, c);
+	normal = model.rotateVector(cross(b - a, c - a));
+	normal.normalize();
 
 	return true;
 }
@@ -745,6 +848,10 @@ bool Mesh::interleaveBuffers()
 	if (!vertices.size() || !normals.size() || !uvs.size())
 		return false;
 
+	//quantized streams have their own formats
+	if (quantization & MESH_OPTIMIZE_QUANTIZE)
+		return false;
+
 	assert(vertices.size() == normals.size() && normals.size() == uvs.size());
 
 	interleaved.resize(vertices.size());
@@ -760,6 +867,11 @@ bool Mesh::interleaveBuffers()
 	normals.resize(0);
 	uvs.resize(0);
 
+	//the collision model was pointing to the old vertices
+	if (collision_model)
+		delete collision_model;
+	collision_model = NULL;
+
 	return true;
 }
 
@@ -777,132 +889,249 @@ typedef struct
 	int num_bones;
 	int num_submeshes;
 	Matrix44 bind_matrix;
-	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
-	char extra[32]; //unused
+	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Uvs1
+	unsigned int offsets[8]; //from the start of the file, aligned to MESH_BIN_ALIGNMENT
+	unsigned int bones_info_offset;
+	unsigned int submeshes_offset;
+	uint32 quantization; //quantized streams
+	sMeshOptimizationStats optimization_stats;
+	float uv_density;
+	int num_lods; //without the mesh itself
+	int num_lod_ranges;
+	int num_lod_indices;
+	unsigned int lods_offset;
+	unsigned int lod_ranges_offset;
+	unsigned int lod_indices_offset; //aligned, it is used from the file mapping
+	char extra[4]; //unused
 } sMeshInfo;
 
+//bytes per element of every stream
+static size_t getStreamElementSize(int stream, bool interleaved, uint32 quantization)
+{
+	switch (stream)
+	{
+		case VERTICES_STREAM: return interleaved ? sizeof(Mesh::tInterleaved) : ((quantization & MESH_OPTIMIZE_QUANTIZE_POSITIONS) ? sizeof(int16) * 4 : sizeof(Vector3f));
+		case NORMALS_STREAM: return (quantization & MESH_OPTIMIZE_QUANTIZE_NORMALS) ? sizeof(int16) * 2 : sizeof(Vector3f);
+		case UVS_STREAM: return (quantization & MESH_OPTIMIZE_QUANTIZE_UVS) ? sizeof(uint16) * 2 : sizeof(Vector2f);
+		case COLORS_STREAM: return sizeof(Vector4f);
+		case INDICES_STREAM: return sizeof(unsigned int);
+		case BONES_STREAM: return sizeof(Vector4ub);
+		case WEIGHTS_STREAM: return sizeof(Vector4f);
+		case UVS1_STREAM: return (quantization & MESH_OPTIMIZE_QUANTIZE_UVS) ? sizeof(uint16) * 2 : sizeof(Vector2f);
+	}
+	return 0;
+}
+
+//the file is mapped and the streams are left there, the CPU vectors are only filled when calling loadCPUData
 bool Mesh::readBin(const char* filename)
 {
-	FILE *f;
 	assert(filename);
 
-	struct stat stbuffer;
-
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL)
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
+	{
+		delete file;
 		return false;
+	}
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	const char* data = file->data;
+	size_t size = file->size;
 
 	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
+	if ( size < 4 + sizeof(sMeshInfo) || memcmp(data,"MBIN",4) != 0 )
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
-	char* pos = data + 4;
 	sMeshInfo info;
-	memcpy(&info,pos,sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
+	memcpy(&info, data + 4, sizeof(sMeshInfo));
 
 	if(info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
 	{
 		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
-	if (info.streams[0] == 'I')
+	//check every stream is inside the file before using it
+	bool interleaved = info.streams[VERTICES_STREAM] == 'I';
+	if (interleaved && (info.quantization & MESH_OPTIMIZE_QUANTIZE))
 	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
+		std::cout << "[ERROR] loading BIN: interleaved streams cannot be quantized: " << filename << std::endl;
+		delete file;
+		return false;
 	}
-	else if (info.streams[0] == 'V')
+	for (int i = 0; i < NUM_MESH_STREAMS; ++i)
 	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(Vector3f) * info.size);
-		pos += sizeof(Vector3f) * info.size;
+		mapped_streams[i] = NULL;
+		if (info.streams[i] == ' ')
+			continue;
+		size_t bytes = getStreamElementSize(i, interleaved, info.quantization) * (i == INDICES_STREAM ? info.num_indices : info.size);
+		if (info.offsets[i] % MESH_BIN_ALIGNMENT || (size_t)info.offsets[i] + bytes > size)
+		{
+			std::cout << "[ERROR] loading BIN: corrupted stream: " << filename << std::endl;
+			delete file;
+			return false;
+		}
+		mapped_streams[i] = data + info.offsets[i];
 	}
-
-	if (info.streams[1] == 'N')
+	if ((size_t)info.bones_info_offset + sizeof(BoneInfo) * info.num_bones > size || (size_t)info.submeshes_offset + sizeof(sSubmeshInfo) * info.num_submeshes > size ||
+		(size_t)info.lods_offset + sizeof(sMeshLOD) * info.num_lods > size || (size_t)info.lod_ranges_offset + sizeof(sIndexRange) * info.num_lod_ranges > size ||
+		info.lod_indices_offset % MESH_BIN_ALIGNMENT || (size_t)info.lod_indices_offset + sizeof(unsigned int) * info.num_lod_indices > size)
 	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0],pos,sizeof(Vector3f) * info.size);
-		pos += sizeof(Vector3f) * info.size;
+		std::cout << "[ERROR] loading BIN: corrupted content: " << filename << std::endl;
+		delete file;
+		return false;
 	}
 
-	if (info.streams[2] == 'U')
-	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0],pos,sizeof(Vector2f) * info.size);
-		pos += sizeof(Vector2f) * info.size;
-	}
+	releaseMappedFile();
+	mapped_file = file;
+	mapped_filename = filename;
+	mapped_interleaved = interleaved;
+	mapped_num_vertices = info.size;
+	mapped_num_indices = info.streams[INDICES_STREAM] == 'I' ? info.num_indices : 0;
+	mapped_lod_indices = info.num_lod_indices ? (const unsigned int*)(data + info.lod_indices_offset) : NULL;
+	mapped_num_lod_indices = info.num_lod_indices;
 
-	if (info.streams[3] == 'C')
-	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0],pos,sizeof(Vector4f) * info.size);
-		pos += sizeof(Vector4f) * info.size;
-	}
+	//small data is copied
+	bones_info.resize(info.num_bones);
+	if (info.num_bones)
+		memcpy((void*)&bones_info[0], data + info.bones_info_offset, sizeof(BoneInfo) * info.num_bones);
+
+	submeshes.resize(info.num_submeshes);
+	if (info.num_submeshes)
+		memcpy(&submeshes[0], data + info.submeshes_offset, sizeof(sSubmeshInfo) * info.num_submeshes);
+
+	lods.resize(info.num_lods);
+	if (info.num_lods)
+		memcpy(&lods[0], data + info.lods_offset, sizeof(sMeshLOD) * info.num_lods);
+	lod_ranges.resize(info.num_lod_ranges);
+	if (info.num_lod_ranges)
+		memcpy(&lod_ranges[0], data + info.lod_ranges_offset, sizeof(sIndexRange) * info.num_lod_ranges);
 
-	if (info.streams[4] == 'I')
+	aabb_max = info.aabb_max;
+	aabb_min = info.aabb_min;
+	box.center = info.center;
+	box.halfsize = info.halfsize;
+	radius = info.radius;
+	bind_matrix = info.bind_matrix;
+	quantization = info.quantization;
+	optimization_stats = info.optimization_stats;
+	uv_density = info.uv_density;
+
+	return true;
+}
+
+template<typename T> void copyStream(std::vector<T>& vector, const char* data, unsigned int num)
+{
+	if (!data)
+		return;
+	vector.resize(num);
+	memcpy((void*)&vector[0], data, sizeof(T) * num);
+}
+
+bool Mesh::loadCPUData()
+{
+	//unmapped after the upload, map it again
+	if (!mapped_file && mapped_filename.size())
 	{
-		m_indices.resize(info.num_indices);
-		memcpy((void*)&m_indices[0], pos, sizeof(unsigned int) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
+		std::string filename = mapped_filename;
+		if (!readBin(filename.c_str()))
+		{
+			std::cout << "[ERROR] cannot map again: " << filename << std::endl;
+			return false;
+		}
 	}
 
-	if (info.streams[5] == 'B')
+	if (!mapped_file)
+		return getNumVertices() != 0;
+
+	unsigned int num = mapped_num_vertices;
+	if (mapped_interleaved)
+		copyStream(interleaved, mapped_streams[VERTICES_STREAM], num);
+	else if (quantization & MESH_OPTIMIZE_QUANTIZE_POSITIONS)
 	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(Vector4ub) * info.size);
-		pos += sizeof(Vector4ub) * info.size;
+		vertices.resize(num);
+		dequantizePositions((const int16*)mapped_streams[VERTICES_STREAM], num, box, &vertices[0]);
 	}
+	else
+		copyStream(vertices, mapped_streams[VERTICES_STREAM], num);
 
-	if (info.streams[6] == 'W')
+	//the vectors are always in float
+	if ((quantization & MESH_OPTIMIZE_QUANTIZE_NORMALS) && mapped_streams[NORMALS_STREAM])
 	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(Vector4f) * info.size);
-		pos += sizeof(Vector4f) * info.size;
+		normals.resize(num);
+		dequantizeNormals((const int16*)mapped_streams[NORMALS_STREAM], num, &normals[0]);
 	}
-
-	if (info.streams[7] == 'u')
+	else
+		copyStream(normals, mapped_streams[NORMALS_STREAM], num);
+	if ((quantization & MESH_OPTIMIZE_QUANTIZE_UVS) && mapped_streams[UVS_STREAM])
 	{
-		m_uvs1.resize(info.size);
-		memcpy((void*)&m_uvs1[0], pos, sizeof(Vector2f) * info.size);
-		pos += sizeof(Vector2f) * info.size;
+		uvs.resize(num);
+		dequantizeUVs((const uint16*)mapped_streams[UVS_STREAM], num, &uvs[0]);
 	}
-
-	if (info.num_bones)
+	else
+		copyStream(uvs, mapped_streams[UVS_STREAM], num);
+	if ((quantization & MESH_OPTIMIZE_QUANTIZE_UVS) && mapped_streams[UVS1_STREAM])
 	{
-		bones_info.resize(info.num_bones);
-		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
-		pos += sizeof(BoneInfo) * info.num_bones;
+		m_uvs1.resize(num);
+		dequantizeUVs((const uint16*)mapped_streams[UVS1_STREAM], num, &m_uvs1[0]);
 	}
+	else
+		copyStream(m_uvs1, mapped_streams[UVS1_STREAM], num);
 
-	aabb_max = info.aabb_max;
-	aabb_min = info.aabb_min;
-	box.center = info.center;
-	box.halfsize = info.halfsize;
-	radius = info.radius;
-	bind_matrix = info.bind_matrix;
+	copyStream(colors, mapped_streams[COLORS_STREAM], num);
+	copyStream(m_indices, mapped_streams[INDICES_STREAM], mapped_num_indices);
+	copyStream(lod_indices, (const char*)mapped_lod_indices, mapped_num_lod_indices);
+	copyStream(bones, mapped_streams[BONES_STREAM], num);
+	copyStream(weights, mapped_streams[WEIGHTS_STREAM], num);
 
-	submeshes.resize(info.num_submeshes);
-	memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
-	pos += sizeof(sSubmeshInfo) * info.num_submeshes;
+	releaseMappedFile();
+	return getNumVertices() != 0;
+}
 
-	createCollisionModel();
-	return true;
+void Mesh::unmapFile()
+{
+	if (mapped_file)
+		delete mapped_file;
+	mapped_file = NULL;
+	for (int i = 0; i < NUM_MESH_STREAMS; ++i)
+		mapped_streams[i] = NULL;
+	mapped_lod_indices = NULL;
+}
+
+void Mesh::releaseMappedFile()
+{
+	unmapFile();
+	mapped_filename.clear();
+	mapped_interleaved = false;
+	mapped_num_vertices = 0;
+	mapped_num_indices = 0;
+	mapped_num_lod_indices = 0;
+}
+
+//writes the stream padded to MESH_BIN_ALIGNMENT and returns its offset in the file
+static unsigned int writeAligned(FILE* f, const void* data, size_t bytes)
+{
+	static const char zeros[MESH_BIN_ALIGNMENT] = { 0 };
+	long pos = ftell(f);
+	long padding = (MESH_BIN_ALIGNMENT - pos % MESH_BIN_ALIGNMENT) % MESH_BIN_ALIGNMENT;
+	if (padding)
+		fwrite(zeros, padding, 1, f);
+	if (bytes)
+		fwrite(data, bytes, 1, f);
+	return (unsigned int)(pos + padding);
 }
 
 bool Mesh::writeBin(const char* filename)
 {
-	assert( vertices.size() || interleaved.size() );
+	if (!loadCPUData())
+	{
+		assert(0 && "mesh without vertices");
+		return false;
+	}
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
@@ -930,47 +1159,85 @@ bool Mesh::writeBin(const char* filename)
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
+	info.quantization = interleaved.size() ? 0 : quantization;
+	info.optimization_stats = optimization_stats;
+	info.uv_density = getUVDensity();
+	info.num_lods = lods.size();
+	info.num_lod_ranges = lod_ranges.size();
+	info.num_lod_indices = lod_indices.size();
 
 	info.streams[0] = interleaved.size() ? 'I' : 'V';
-	info.streams[1] = normals.size() ? 'N' : ' ';
-	info.streams[2] = uvs.size() ? 'U' : ' ';
+	info.streams[1] = normals.size() && !interleaved.size() ? 'N' : ' ';
+	info.streams[2] = uvs.size() && !interleaved.size() ? 'U' : ' ';
 	info.streams[3] = colors.size() ? 'C' : ' ';
 	info.streams[4] = m_indices.size() ? 'I' : ' ';
 	info.streams[5] = bones.size() ? 'B' : ' ';
 	info.streams[6] = weights.size() ? 'W' : ' ';
 	info.streams[7] = m_uvs1.size() ? 'u' : ' '; //uv second set
 
-	//write info
+	//header is written again at the end with the offsets
 	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
 
 	//write streams
 	if (interleaved.size())
-		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
+		info.offsets[0] = writeAligned(f, &interleaved[0], interleaved.size() * sizeof(tInterleaved));
 	else
 	{
-		fwrite((void*)&vertices[0], vertices.size() * sizeof(Vector3f), 1, f);
-		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(Vector3f), 1, f);
-		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(Vector2f), 1, f);
+		unsigned int num = (unsigned int)vertices.size();
+		std::vector<int16> quantized;
+		if (quantization & MESH_OPTIMIZE_QUANTIZE_POSITIONS)
+		{
+			quantized.resize(num * 4);
+			quantizePositions(&vertices[0], num, box, &quantized[0]);
+			info.offsets[0] = writeAligned(f, &quantized[0], quantized.size() * sizeof(int16));
+		}
+		else
+			info.offsets[0] = writeAligned(f, &vertices[0], vertices.size() * sizeof(Vector3f));
+
+		if (normals.size() && (quantization & MESH_OPTIMIZE_QUANTIZE_NORMALS))
+		{
+			quantized.resize(num * 2);
+			quantizeNormals(&normals[0], num, &quantized[0]);
+			info.offsets[1] = writeAligned(f, &quantized[0], num * 2 * sizeof(int16));
+		}
+		else if (normals.size())
+			info.offsets[1] = writeAligned(f, &normals[0], normals.size() * sizeof(Vector3f));
+
+		if (uvs.size() && (quantization & MESH_OPTIMIZE_QUANTIZE_UVS))
+		{
+			quantized.resize(num * 2);
+			quantizeUVs(&uvs[0], num, (uint16*)&quantized[0]);
+			info.offsets[2] = writeAligned(f, &quantized[0], num * 2 * sizeof(uint16));
+		}
+		else if (uvs.size())
+			info.offsets[2] = writeAligned(f, &uvs[0], uvs.size() * sizeof(Vector2f));
 	}
 
 	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(Vector4f), 1, f);
-
+		info.offsets[3] = writeAligned(f, &colors[0], colors.size() * sizeof(Vector4f));
 	if (m_indices.size())
-		fwrite((void*)&m_indices[0], m_indices.size() * sizeof(unsigned int), 1, f);
-
+		info.offsets[4] = writeAligned(f, &m_indices[0], m_indices.size() * sizeof(unsigned int));
 	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
+		info.offsets[5] = writeAligned(f, &bones[0], bones.size() * sizeof(Vector4ub));
 	if (weights.size())
-		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4f), 1, f);
-	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
-	if (m_uvs1.size())
-		fwrite((void*)&m_uvs1[0], m_uvs1.size() * sizeof(Vector2f), 1, f);
+		info.offsets[6] = writeAligned(f, &weights[0], weights.size() * sizeof(Vector4f));
+	if (m_uvs1.size() && (info.quantization & MESH_OPTIMIZE_QUANTIZE_UVS))
+	{
+		std::vector<uint16> quantized(m_uvs1.size() * 2);
+		quantizeUVs(&m_uvs1[0], (unsigned int)m_uvs1.size(), &quantized[0]);
+		info.offsets[7] = writeAligned(f, &quantized[0], quantized.size() * sizeof(uint16));
+	}
+	else if (m_uvs1.size())
+		info.offsets[7] = writeAligned(f, &m_uvs1[0], m_uvs1.size() * sizeof(Vector2f));
+
+	info.bones_info_offset = writeAligned(f, bones_info.size() ? &bones_info[0] : NULL, bones_info.size() * sizeof(BoneInfo));
+	info.submeshes_offset = writeAligned(f, submeshes.size() ? &submeshes[0] : NULL, submeshes.size() * sizeof(sSubmeshInfo));
+	info.lods_offset = writeAligned(f, lods.size() ? &lods[0] : NULL, lods.size() * sizeof(sMeshLOD));
+	info.lod_ranges_offset = writeAligned(f, lod_ranges.size() ? &lod_ranges[0] : NULL, lod_ranges.size() * sizeof(sIndexRange));
+	info.lod_indices_offset = writeAligned(f, lod_indices.size() ? &lod_indices[0] : NULL, lod_indices.size() * sizeof(unsigned int));
 
-	fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
+	fseek(f, 4, SEEK_SET);
+	fwrite((void*)&info, sizeof(sMeshInfo), 1, f);
 
 	fclose(f);
 	return true;
@@ -1106,139 +1373,385 @@ bool Mesh::loadASE(const char* filename)
 	return true;
 }
 
-bool Mesh::loadOBJ(const char* filename)
-{
-	std::string data;
-	if(!readFile(filename,data))
-		return false;
-	char* pos = &data[0];
-	char line[255];
-	int i = 0;
+//OBJ parsing works in place over the mapped file, big files are split in chunks of lines parsed in parallel
+#define OBJ_CHUNK_SIZE (4 << 20) //bytes
+
+//a corner of a face, indices start at 0 and -1 means not present
+struct sOBJCorner {
+	int position;
+	int uv;
+	int normal;
+	uint8 relative; //bit per index, negative indices are relative to the chunk and need its base added when merging
+};
+
+//group or material change, in the order they appear
+struct sOBJEvent {
+	unsigned int corner; //corners before the event inside the chunk
+	char type; //'g' or 'u'
+	char name[64];
+};
+
+struct sOBJChunk {
+	const char* start;
+	const char* end;
+	std::vector<Vector3f> positions;
+	std::vector<Vector3f> normals;
+	std::vector<Vector2f> uvs;
+	std::vector<sOBJCorner> corners; //three per triangle
+	std::vector<sOBJEvent> events;
+	Vector3f aabb_min;
+	Vector3f aabb_max;
+};
 
-	std::vector<Vector3f> indexed_positions;
-	std::vector<Vector3f> indexed_normals;
-	std::vector<Vector2f> indexed_uvs;
+static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
 
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	aabb_min.set(max_float,max_float,max_float);
-	aabb_max.set(min_float,min_float,min_float);
+inline const char* skipOBJSpaces(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
 
-	unsigned int vertex_i = 0;
+inline bool isOBJDigit(char c) { return c >= '0' && c <= '9'; }
 
-	sSubmeshInfo submesh_info;
-	int last_submesh_vertex = 0;
-	memset(&submesh_info, 0, sizeof(submesh_info));
+//like strtof but without locale nor null terminator, precise enough for floats
+static const char* parseOBJFloat(const char* p, const char* end, float& result)
+{
+	p = skipOBJSpaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool fraction = false;
+	for (; p < end; ++p)
+	{
+		if (*p == '.' && !fraction)
+		{
+			fraction = true;
+			continue;
+		}
+		if (!isOBJDigit(*p))
+			break;
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				digits++;
+			if (fraction)
+				exponent--;
+		}
+		else if (!fraction)
+			exponent++;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negative_exp = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative_exp = *p++ == '-';
+		int exp = 0;
+		for (; p < end && isOBJDigit(*p); ++p)
+			if (exp < 1000)
+				exp = exp * 10 + (*p - '0');
+		exponent += negative_exp ? -exp : exp;
+	}
+
+	double value = (double)mantissa;
+	if (exponent < 0)
+		value = exponent >= -22 ? value / powers_of_ten[-exponent] : value * pow(10.0, exponent);
+	else if (exponent > 0)
+		value = exponent <= 22 ? value * powers_of_ten[exponent] : value * pow(10.0, exponent);
+	result = (float)(negative ? -value : value);
+	return p;
+}
 
-	//parse file
-	while(*pos != 0)
+//returns 0 if there is no number
+static const char* parseOBJIndex(const char* p, const char* end, int& result)
+{
+	bool negative = false;
+	if (p < end && *p == '-')
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
+		negative = true;
+		p++;
+	}
+	int value = 0;
+	for (; p < end && isOBJDigit(*p); ++p)
+		value = value * 10 + (*p - '0');
+	result = negative ? -value : value;
+	return p;
+}
 
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
+//from OBJ index (1 based or negative) to 0 based, relative ones are resolved with the chunk counts
+inline int resolveOBJIndex(int index, int count, uint8& relative, uint8 bit)
+{
+	if (index > 0)
+		return index - 1;
+	if (index < 0)
+	{
+		relative |= bit;
+		return count + index;
+	}
+	return -1;
+}
 
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
+static void parseOBJName(const char* p, const char* end, char* name)
+{
+	p = skipOBJSpaces(p, end);
+	int i = 0;
+	while (p < end && i < 63 && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+		name[i++] = *p++;
+	name[i] = 0;
+}
 
-		if (tokens.empty()) continue;
+static void parseOBJChunk(sOBJChunk& chunk)
+{
+	const char* p = chunk.start;
+	const char* end = chunk.end;
+	chunk.aabb_min.set(FLT_MAX, FLT_MAX, FLT_MAX);
+	chunk.aabb_max.set(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	sOBJCorner polygon[64]; //corners of the current face, bigger polygons are truncated
 
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3f v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
+	while (p < end)
+	{
+		p = skipOBJSpaces(p, end);
+		const char* line_end = (const char*)memchr(p, '\n', end - p);
+		if (!line_end)
+			line_end = end;
 
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() >= 3)
+		if (p + 1 < line_end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
 		{
-			Vector2f v((float)atof(tokens[1].c_str()), 1.0 - (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
+			Vector3f v;
+			p = parseOBJFloat(p + 1, line_end, v.x);
+			p = parseOBJFloat(p, line_end, v.y);
+			p = parseOBJFloat(p, line_end, v.z);
+			chunk.positions.push_back(v);
+			chunk.aabb_min.setMin(v);
+			chunk.aabb_max.setMax(v);
 		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
+		else if (p + 2 < line_end && p[0] == 'v' && p[1] == 't')
 		{
-			Vector3f v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
+			Vector2f v;
+			p = parseOBJFloat(p + 2, line_end, v.x);
+			p = parseOBJFloat(p, line_end, v.y);
+			v.y = 1.0f - v.y;
+			chunk.uvs.push_back(v);
 		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
+		else if (p + 2 < line_end && p[0] == 'v' && p[1] == 'n')
 		{
-			//process mesh: ????
-			//if (uvs.size() == 0 && indexed_uvs.size() )
-			//	uvs.resize(1);
+			Vector3f v;
+			p = parseOBJFloat(p + 2, line_end, v.x);
+			p = parseOBJFloat(p, line_end, v.y);
+			p = parseOBJFloat(p, line_end, v.z);
+			chunk.normals.push_back(v);
 		}
-		else if (tokens[0] == "usemtl") //surface? it appears one time before the faces
+		else if (p + 1 < line_end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
 		{
-			if (last_submesh_vertex != vertices.size())
+			int num = 0;
+			p++;
+			while (num < 64)
 			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy(submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
+				p = skipOBJSpaces(p, line_end);
+				if (p >= line_end || !(isOBJDigit(*p) || *p == '-'))
+					break;
+				//v, v/vt, v//vn or v/vt/vn
+				int v = 0, vt = 0, vn = 0;
+				p = parseOBJIndex(p, line_end, v);
+				if (p < line_end && *p == '/')
+				{
+					p = parseOBJIndex(p + 1, line_end, vt);
+					if (p < line_end && *p == '/')
+						p = parseOBJIndex(p + 1, line_end, vn);
+				}
+				sOBJCorner& corner = polygon[num++];
+				corner.relative = 0;
+				corner.position = resolveOBJIndex(v, (int)chunk.positions.size(), corner.relative, 1);
+				corner.uv = resolveOBJIndex(vt, (int)chunk.uvs.size(), corner.relative, 2);
+				corner.normal = resolveOBJIndex(vn, (int)chunk.normals.size(), corner.relative, 4);
+				while (p < line_end && *p != ' ' && *p != '\t') //anything else in the corner
+					p++;
 			}
-			else
-				strcpy(submesh_info.material, tokens[1].c_str());
-		}
-		else if (tokens[0] == "g") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
+			//triangle fan
+			for (int i = 2; i < num; ++i)
 			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy( submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i - 1]);
+				chunk.corners.push_back(polygon[i]);
 			}
 		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
+		else if ((p + 1 < line_end && p[0] == 'g' && (p[1] == ' ' || p[1] == '\t')) || (line_end - p > 7 && memcmp(p, "usemtl", 6) == 0))
 		{
-			Vector3f v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
+			sOBJEvent event;
+			event.corner = (unsigned int)chunk.corners.size();
+			event.type = p[0] == 'g' ? 'g' : 'u';
+			parseOBJName(p + (event.type == 'g' ? 1 : 6), line_end, event.name);
+			chunk.events.push_back(event);
+		}
 
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
-			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
+		p = line_end + 1;
+	}
+}
 
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
+bool Mesh::loadOBJ(const char* filename)
+{
+	MappedFile file;
+	if (!file.open(filename))
+		return false;
+	const char* data = file.data;
+	size_t size = file.size;
 
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
-				}
+	//split in chunks that start at the beginning of a line
+	std::vector<sOBJChunk> chunks;
+	size_t offset = 0;
+	while (offset < size)
+	{
+		size_t chunk_end = offset + OBJ_CHUNK_SIZE;
+		if (chunk_end >= size)
+			chunk_end = size;
+		else
+		{
+			const char* line_end = (const char*)memchr(data + chunk_end, '\n', size - chunk_end);
+			chunk_end = line_end ? (line_end - data) + 1 : size;
+		}
+		chunks.push_back(sOBJChunk());
+		chunks.back().start = data + offset;
+		chunks.back().end = data + chunk_end;
+		offset = chunk_end;
+	}
+
+	TaskManager::background.parallelFor(0, (int)chunks.size(), [&chunks](int start, int end) {
+		for (int i = start; i < end; ++i)
+			parseOBJChunk(chunks[i]);
+	});
+
+	//all the data in the file
+	std::vector<Vector3f> indexed_positions;
+	std::vector<Vector3f> indexed_normals;
+	std::vector<Vector2f> indexed_uvs;
+	size_t num_positions = 0, num_normals = 0, num_uvs = 0, num_corners = 0;
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		num_positions += chunks[i].positions.size();
+		num_normals += chunks[i].normals.size();
+		num_uvs += chunks[i].uvs.size();
+		num_corners += chunks[i].corners.size();
+	}
+	indexed_positions.reserve(num_positions);
+	indexed_normals.reserve(num_normals);
+	indexed_uvs.reserve(num_uvs);
+
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	aabb_min.set(max_float, max_float, max_float);
+	aabb_max.set(min_float, min_float, min_float);
+
+	//a vertex for every different combination of position, uv and normal, found through the list of vertices of every position
+	std::vector<int> first_vertex(num_positions, -1);
+	std::vector<int> next_vertex;
+	std::vector<sOBJCorner> unique_corners;
+	next_vertex.reserve(num_corners / 2);
+	unique_corners.reserve(num_corners / 2);
+	m_indices.resize(num_corners);
+
+	sSubmeshInfo submesh_info;
+	unsigned int last_submesh_vertex = 0;
+	memset(&submesh_info, 0, sizeof(submesh_info));
+
+	unsigned int corner_index = 0;
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		sOBJChunk& chunk = chunks[i];
+		int base_position = (int)indexed_positions.size();
+		int base_uv = (int)indexed_uvs.size();
+		int base_normal = (int)indexed_normals.size();
+		indexed_positions.insert(indexed_positions.end(), chunk.positions.begin(), chunk.positions.end());
+		indexed_uvs.insert(indexed_uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+		indexed_normals.insert(indexed_normals.end(), chunk.normals.begin(), chunk.normals.end());
+		if (chunk.positions.size())
+		{
+			aabb_min.setMin(chunk.aabb_min);
+			aabb_max.setMax(chunk.aabb_max);
+		}
 
-				if (indexed_normals.size() > 0)
+		size_t next_event = 0;
+		for (size_t j = 0; j <= chunk.corners.size(); ++j)
+		{
+			//groups and materials split the submeshes
+			for (; next_event < chunk.events.size() && chunk.events[next_event].corner == j; ++next_event)
+			{
+				sOBJEvent& event = chunk.events[next_event];
+				if (last_submesh_vertex != corner_index)
 				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
+					submesh_info.length = corner_index - submesh_info.start;
+					last_submesh_vertex = corner_index;
+					submeshes.push_back(submesh_info);
+					memset(&submesh_info, 0, sizeof(submesh_info));
+					strcpy(submesh_info.name, event.name);
+					if (event.type == 'u')
+						strcpy(submesh_info.material, event.name);
+					submesh_info.start = last_submesh_vertex;
 				}
+				else if (event.type == 'u')
+					strcpy(submesh_info.material, event.name);
+			}
+			if (j == chunk.corners.size())
+				break;
+
+			sOBJCorner corner = chunk.corners[j];
+			if (corner.relative & 1) corner.position += base_position;
+			if (corner.relative & 2) corner.uv += base_uv;
+			if (corner.relative & 4) corner.normal += base_normal;
+			if (corner.position < 0 || corner.position >= (int)num_positions)
+			{
+				std::cout << "[ERROR] loading OBJ: vertex index out of range: " << filename << std::endl;
+				m_indices.clear();
+				submeshes.clear();
+				return false;
+			}
+			if (corner.uv >= (int)num_uvs)
+				corner.uv = -1;
+			if (corner.normal >= (int)num_normals)
+				corner.normal = -1;
+
+			int vertex = first_vertex[corner.position];
+			while (vertex != -1 && (unique_corners[vertex].uv != corner.uv || unique_corners[vertex].normal != corner.normal))
+				vertex = next_vertex[vertex];
+			if (vertex == -1)
+			{
+				vertex = (int)unique_corners.size();
+				unique_corners.push_back(corner);
+				next_vertex.push_back(first_vertex[corner.position]);
+				first_vertex[corner.position] = vertex;
 			}
+			m_indices[corner_index++] = vertex;
 		}
 	}
 
+	//final streams
+	size_t num_vertices = unique_corners.size();
+	vertices.resize(num_vertices);
+	if (num_uvs)
+		uvs.resize(num_vertices);
+	if (num_normals)
+		normals.resize(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+	{
+		const sOBJCorner& corner = unique_corners[i];
+		vertices[i] = indexed_positions[corner.position];
+		if (num_uvs)
+			uvs[i] = corner.uv >= 0 ? indexed_uvs[corner.uv] : Vector2f();
+		if (num_normals)
+			normals[i] = corner.normal >= 0 ? indexed_normals[corner.normal] : Vector3f();
+	}
+
 	box.center = (aabb_max + aabb_min) * 0.5f;
 	box.halfsize = (aabb_max - box.center);
 	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
 
-	submesh_info.length = vertices.size() - last_submesh_vertex;
+	submesh_info.length = corner_index - last_submesh_vertex;
 	submeshes.push_back(submesh_info);
 	return true;
 }
@@ -1621,9 +2134,39 @@ void Mesh::updateBoundingBox()
 	box.halfsize = aabb_max - box.center;
 }
 
+void Mesh::computeUVDensity()
+{
+	unsigned int num_vertices = interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size();
+	bool has_uvs = interleaved.size() || uvs.size() == vertices.size();
+	if (!num_vertices || !has_uvs)
+	{
+		//mapped or without uvs, assume the uvs cover the mesh once
+		uv_density = radius > 0.0f ? 0.5f / radius : 1.0f;
+		return;
+	}
+
+	double area = 0.0, uv_area = 0.0;
+	unsigned int num_indices = m_indices.size() ? (unsigned int)m_indices.size() : num_vertices;
+	for (unsigned int i = 0; i + 2 < num_indices; i += 3)
+	{
+		unsigned int a = m_indices.size() ? m_indices[i] : i;
+		unsigned int b = m_indices.size() ? m_indices[i + 1] : i + 1;
+		unsigned int c = m_indices.size() ? m_indices[i + 2] : i + 2;
+		const Vector3f& pa = interleaved.size() ? interleaved[a].vertex : vertices[a];
+		const Vector3f& pb = interleaved.size() ? interleaved[b].vertex : vertices[b];
+		const Vector3f& pc = interleaved.size() ? interleaved[c].vertex : vertices[c];
+		const Vector2f& ua = interleaved.size() ? interleaved[a].uv : uvs[a];
+		const Vector2f& ub = interleaved.size() ? interleaved[b].uv : uvs[b];
+		const Vector2f& uc = interleaved.size() ? interleaved[c].uv : uvs[c];
+		area += (pb - pa).cross(pc - pa).length() * 0.5;
+		uv_area += fabs((ub.x - ua.x) * (uc.y - ua.y) - (uc.x - ua.x) * (ub.y - ua.y)) * 0.5;
+	}
+	uv_density = area > 0.0 ? (float)sqrt(uv_area / area) : 0.0f;
+}
+
 Mesh* wire_box = NULL;
 
-void Mesh::renderBounding( const Matrix44& model, bool world_bounding )
+Mesh* Mesh::getWireBox()
 {
 	if (!wire_box)
 	{
@@ -1631,6 +2174,12 @@ void Mesh::renderBounding( const Matrix44& model, bool world_bounding )
 		wire_box->createWireBox();
 		wire_box->uploadToVRAM();
 	}
+	return wire_box;
+}
+
+void Mesh::renderBounding( const Matrix44& model, bool world_bounding )
+{
+	getWireBox();
 
 	Shader* sh = Shader::getDefaultShader("flat");
 	sh->enable();
@@ -1713,20 +2262,18 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 	//try loading the binary version
 	if (use_binary && m->readBin(binfilename.c_str()) )
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
-		{
-			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
-		}
-
+		//streams are uploaded straight from the file mapping, without interleaving
 		if (auto_upload_to_vram)
 		{
 			std::cout << "[VRAM] ";
 			m->uploadToVRAM();
+			m->unmapFile(); //loadCPUData maps it again if the vectors are needed
 		}
+		else
+			m->loadCPUData(); //rendering from RAM needs the vectors
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
+		std::cout << "[OK BIN]  Faces: " << m->getNumVertices() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		m->registerMesh(name);
 		return m;
 	}
 
@@ -1746,6 +2293,13 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 		return NULL;
 	}
 
+	//weld, reorder and quantize, the result is stored in the MBIN
+	if (optimize_flags)
+	{
+		std::cout << "[OPT] ";
+		optimizeMesh(m, optimize_flags);
+	}
+
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
 	{
@@ -1760,7 +2314,7 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 		m->uploadToVRAM();
 	}
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	std::cout << "[OK]  Faces: " << m->getNumVertices() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	if (use_binary)
 	{
 		std::cout << "\t\t Writing .BIN ... ";
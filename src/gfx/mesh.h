@@ -3,22 +3,33 @@
 
 #include <vector>
 #include "../core/math.h"
+#include "mesh_bvh.h"
 
 #include <map>
 #include <string>
+#include <atomic>
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
 	Matrix44 bind_pose;
 };
 
+class MappedFile;
+
 namespace GFX {
 
 	class Shader; //for binding
 	class Skeleton; //for skinned meshes
 
-	//version from 11/5/2020
-#define MESH_BIN_VERSION 11 //this is used to regenerate bins if the format changes
+	//version 12: streams stored at aligned offsets so they can be used directly from a file mapping
+	//version 13: quantized streams and optimization stats
+	//version 14: levels of detail
+	//version 15: uv density
+#define MESH_BIN_VERSION 15 //this is used to regenerate bins if the format changes
+#define MESH_BIN_ALIGNMENT 64 //in bytes, for every stream in the file
+
+	//order of the streams in the MBIN
+	enum eMeshStream { VERTICES_STREAM, NORMALS_STREAM, UVS_STREAM, COLORS_STREAM, INDICES_STREAM, BONES_STREAM, WEIGHTS_STREAM, UVS1_STREAM, NUM_MESH_STREAMS };
 
 	struct sSubmeshInfo
 	{
@@ -28,6 +39,33 @@ namespace GFX {
 		int length;//in primitive
 	};
 
+	//filled by optimizeMesh (see mesh_optimizer.h), also stored in the MBIN
+	struct sMeshOptimizationStats
+	{
+		float acmr_before;
+		float acmr_after;
+		float atvr_before;
+		float atvr_after;
+		unsigned int vertices_before;
+		unsigned int vertices_after;
+	};
+
+	//range of indices, used by the levels of detail
+	struct sIndexRange
+	{
+		int start;
+		int length;
+	};
+
+	//simplified version of the triangles of the mesh, using the same vertices (see generateLODs in mesh_optimizer.h)
+	struct sMeshLOD
+	{
+		float error;		//max distance to the original surface, relative to the radius of the mesh
+		int start;			//in lod_indices, the ranges of all the submeshes are consecutive
+		int length;
+		int first_range;	//in lod_ranges, one per submesh (or one if the mesh has no submeshes)
+	};
+
 	class Mesh
 	{
 	public:
@@ -36,9 +74,11 @@ namespace GFX {
 		static bool interleave_meshes; //loaded meshes will me automatically interleaved
 		static bool use_vao; //use vertex array object
 		static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+		static uint32 optimize_flags; //eMeshOptimization steps applied to imported meshes (OBJ, ASE, MESH, glTF), 0 to skip
 		static long num_meshes_rendered;
 		static long num_triangles_rendered;
-		static uint32 s_last_index;
+		static long num_draws_saved; //draw calls avoided thanks to instancing
+		static std::atomic<uint32> s_last_index; //meshes can be created from worker threads
 
 		std::string name;
 		uint32 index; //used internally
@@ -61,6 +101,12 @@ namespace GFX {
 
 		std::vector<unsigned int> m_indices; //for indexed meshes
 
+		//levels of detail, the first one (lod 0) is the mesh itself so lods[0] is lod 1
+		//in the GPU the lod indices are stored after m_indices in the same buffer
+		std::vector<sMeshLOD> lods;
+		std::vector<sIndexRange> lod_ranges;
+		std::vector<unsigned int> lod_indices;
+
 		//for animated meshes
 		std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
 		std::vector< Vector4f > weights; //tells how much affect every bone
@@ -72,6 +118,12 @@ namespace GFX {
 		BoundingBox box;
 
 		float radius;
+		float uv_density; //sqrt of the area of the triangles in uv space divided by their area, -1 if not computed (see getUVDensity)
+
+		//MESH_OPTIMIZE_QUANTIZE_* flags, these streams are stored quantized in the GPU buffers and the MBIN (the vectors are always float)
+		//shaders must dequantize using the uniforms set in setDequantizationUniforms
+		uint32 quantization;
+		sMeshOptimizationStats optimization_stats;
 
 		unsigned int vao_id; //Vertex Array Object
 
@@ -85,35 +137,57 @@ namespace GFX {
 		unsigned int bones_vbo_id;
 		unsigned int weights_vbo_id;
 		unsigned int uvs1_vbo_id;
+		unsigned int index_size; //bytes per index in indices_vbo_id (2 or 4)
+
+		//when loaded from MBIN the vectors stay empty and the streams are read from the file mapping, call loadCPUData to fill them
+		MappedFile* mapped_file;
+		const char* mapped_streams[NUM_MESH_STREAMS]; //NULL if the stream is not in the file, VERTICES_STREAM could be interleaved
+		bool mapped_interleaved;
+		unsigned int mapped_num_vertices;
+		unsigned int mapped_num_indices;
+		const unsigned int* mapped_lod_indices;
+		unsigned int mapped_num_lod_indices;
+		std::string mapped_filename; //to map it again in loadCPUData once unmapped
 
 		Mesh();
 		~Mesh();
 
 		void clear();
 
-		void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
-		void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+		void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0, int lod = 0);
+		void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number, int submesh_id = -1, int lod = 0);
+		void renderInstanced(unsigned int primitive, unsigned int instances_buffer_id, int first_instance, int number, int submesh_id = -1, int lod = 0); //models already in a GPU buffer
 		void renderBounding(const Matrix44& model, bool world_bounding = true);
 		void renderFixedPipeline(int primitive); //sloooooooow
 		//void renderAnimated(unsigned int primitive, Skeleton *sk);
 
 		void enableBuffers(Shader* shader); //if shader is null the attrib locations must be POS=0, NORM=1, COORD=2, COORD1=3, COLOR=4, BONES=5, WEIGHTS=6
-		void drawCall(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
+		void drawCall(unsigned int primitive, int submesh_id = -1, int num_instances = 0, int lod = 0);
 		void disableBuffers(Shader* shader);
+		void setDequantizationUniforms(Shader* shader); //u_quant_offset, u_quant_scale and u_quant_normals
 
-		void getSubmeshStartAndSize(int submesh_id, unsigned int& start, unsigned int& size);
+		void getSubmeshStartAndSize(int submesh_id, unsigned int& start, unsigned int& size, int lod = 0); //lod ranges start after the base indices
 
 		bool readBin(const char* filename);
 		bool writeBin(const char* filename);
 
 		unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-		unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+		unsigned int getNumVertices() { return interleaved.size() ? (unsigned int)interleaved.size() : (vertices.size() ? (unsigned int)vertices.size() : mapped_num_vertices); }
+		unsigned int getNumIndices() { return m_indices.size() ? (unsigned int)m_indices.size() : mapped_num_indices; }
+		unsigned int getNumLODIndices() { return lod_indices.size() ? (unsigned int)lod_indices.size() : mapped_num_lod_indices; }
+		int getNumLODs() { return (int)lods.size() + 1; } //including the mesh itself
+		bool isInterleaved() { return interleaved.size() || mapped_interleaved; }
+
+		bool loadCPUData(); //copies the mapped streams to the vectors and releases the mapping (mapping the file again if needed), returns false if the mesh has no vertices
+		void unmapFile(); //closes the mapping once the streams are in VRAM, keeps the sizes so the mesh can still be rendered
+		void releaseMappedFile();
 
 		//collision testing
-		void* collision_model;
-		bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
+		MeshBVH* collision_model;
+		bool createCollisionModel(bool is_static = false); //is_static is ignored, kept for compatibility
 		//help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-		bool testRayCollision(Matrix44 model, Vector3f ray_origin, Vector3f ray_direction, Vector3f& collision, Vector3f& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false);
+		bool testRayCollision(Matrix44 model, Vector3f ray_origin, Vector3f ray_direction, Vector3f& collision, Vector3f& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false, int submesh_id = -1);
+		int testRaysCollision(const Matrix44& model, int num_rays, const Vector3f* origins, const Vector3f* directions, sRayHit* hits); //set hits[i].t to the max distance and triangle to -1 before, returns number of hits
 		bool testSphereCollision(Matrix44 model, Vector3f center, float radius, Vector3f& collision, Vector3f& normal);
 
 		//loader
@@ -131,9 +205,14 @@ namespace GFX {
 		void createGrid(float dist);
 
 		static Mesh* getQuad(); //get global quad
+		static Mesh* getWireBox(); //get global wire box, from -1 to 1
 
 		void updateBoundingBox();
 
+		//uv units per unit of the mesh, used to know the mips of the textures needed on screen
+		float getUVDensity() { if (uv_density < 0.0f) computeUVDensity(); return uv_density; }
+		void computeUVDensity(); //from the CPU data, uses the radius if the data is not available
+
 		//optimize meshes
 		void uploadToVRAM();
 		void drawUsingVAO(unsigned int primitive, int submesh_id = -1);
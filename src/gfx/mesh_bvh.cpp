@@ -0,0 +1,672 @@
+#include "mesh_bvh.h"
+
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+#include "mesh.h"
+#include "../extra/coldet/coldet.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define MESH_BVH_SSE
+	#include <emmintrin.h>
+#endif
+
+using namespace GFX;
+
+static_assert(sizeof(sMeshBVHNode) == 32, "BVH node must be 32 bytes");
+
+MeshBVH::MeshBVH()
+{
+	num_triangles = 0;
+	mesh = nullptr;
+	positions = nullptr;
+	stride = 0;
+	indices = nullptr;
+	num_vertices = 0;
+}
+
+size_t MeshBVH::getMemorySize() const
+{
+	return nodes.size() * sizeof(sMeshBVHNode) + triangles.size() * sizeof(uint32);
+}
+
+inline Vector3f fetchVertex(const float* positions, int stride, uint32 index)
+{
+	const float* p = positions + index * stride;
+	return Vector3f(p[0], p[1], p[2]);
+}
+
+void MeshBVH::getTriangle(uint32 index, Vector3f& a, Vector3f& b, Vector3f& c) const
+{
+	uint32 i = index * 3;
+	if (indices)
+	{
+		a = fetchVertex(positions, stride, indices[i]);
+		b = fetchVertex(positions, stride, indices[i + 1]);
+		c = fetchVertex(positions, stride, indices[i + 2]);
+	}
+	else
+	{
+		a = fetchVertex(positions, stride, i);
+		b = fetchVertex(positions, stride, i + 1);
+		c = fetchVertex(positions, stride, i + 2);
+	}
+}
+
+inline float halfArea(const Vector3f& min, const Vector3f& max)
+{
+	Vector3f e = max - min;
+	return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+//the pointers are only valid while the mesh keeps the same buffers
+static const float* getMeshPositions(const Mesh* mesh)
+{
+	if (mesh->interleaved.size())
+		return mesh->interleaved[0].vertex.v;
+	return mesh->vertices.size() ? mesh->vertices[0].v : nullptr;
+}
+
+bool MeshBVH::isValid() const
+{
+	if (!mesh || !positions)
+		return false;
+	const unsigned int* current_indices = mesh->m_indices.size() ? &mesh->m_indices[0] : nullptr;
+	uint32 current_vertices = (uint32)(mesh->interleaved.size() ? mesh->interleaved.size() : mesh->vertices.size());
+	return getMeshPositions(mesh) == positions && current_indices == indices && current_vertices == num_vertices &&
+		(indices ? mesh->m_indices.size() : num_vertices) == num_triangles * 3;
+}
+
+bool MeshBVH::build(Mesh* mesh)
+{
+	nodes.clear();
+	triangles.clear();
+	this->mesh = mesh;
+	positions = nullptr;
+	indices = nullptr;
+
+	num_vertices = mesh->getNumVertices();
+	if (!num_vertices || !getMeshPositions(mesh))
+		return false;
+
+	//read directly from the mesh buffers
+	positions = getMeshPositions(mesh);
+	stride = mesh->interleaved.size() ? (int)(sizeof(Mesh::tInterleaved) / sizeof(float)) : 3;
+	indices = mesh->m_indices.size() ? &mesh->m_indices[0] : nullptr;
+	num_triangles = (uint32)(indices ? mesh->m_indices.size() : num_vertices) / 3;
+	if (!num_triangles)
+		return false;
+
+	//temporary info per triangle
+	std::vector<Vector3f> centroids(num_triangles);
+	std::vector<Vector3f> tri_min(num_triangles);
+	std::vector<Vector3f> tri_max(num_triangles);
+	triangles.resize(num_triangles);
+	for (uint32 i = 0; i < num_triangles; ++i)
+	{
+		Vector3f a, b, c;
+		getTriangle(i, a, b, c);
+		tri_min[i] = a; tri_min[i].setMin(b); tri_min[i].setMin(c);
+		tri_max[i] = a; tri_max[i].setMax(b); tri_max[i].setMax(c);
+		centroids[i] = (a + b + c) * (1.0f / 3.0f);
+		triangles[i] = i;
+	}
+
+	nodes.reserve(num_triangles * 2);
+	nodes.resize(1);
+	nodes[0].left_first = 0;
+	nodes[0].count = num_triangles;
+	updateNodeBounds(0, tri_min, tri_max);
+	subdivide(0, 0, centroids, tri_min, tri_max);
+	nodes.shrink_to_fit();
+	return true;
+}
+
+void MeshBVH::updateNodeBounds(int node_index, std::vector<Vector3f>& tri_min, std::vector<Vector3f>& tri_max)
+{
+	sMeshBVHNode& node = nodes[node_index];
+	node.min.set(FLT_MAX, FLT_MAX, FLT_MAX);
+	node.max.set(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = node.left_first; i < node.left_first + node.count; ++i)
+	{
+		node.min.setMin(tri_min[triangles[i]]);
+		node.max.setMax(tri_max[triangles[i]]);
+	}
+}
+
+//binned SAH: tests NUM_BINS - 1 split planes per axis and keeps the cheapest one
+void MeshBVH::subdivide(int node_index, int depth, std::vector<Vector3f>& centroids, std::vector<Vector3f>& tri_min, std::vector<Vector3f>& tri_max)
+{
+	sMeshBVHNode node = nodes[node_index];
+	if (node.count <= MAX_LEAF_TRIANGLES || depth >= MAX_DEPTH)
+		return;
+
+	Vector3f cmin(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vector3f cmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = node.left_first; i < node.left_first + node.count; ++i)
+	{
+		cmin.setMin(centroids[triangles[i]]);
+		cmax.setMax(centroids[triangles[i]]);
+	}
+
+	struct sBin { Vector3f min; Vector3f max; int count; };
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_split = 0;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = cmax.v[axis] - cmin.v[axis];
+		if (extent <= 0.0f)
+			continue;
+		float scale = NUM_BINS / extent;
+
+		sBin bins[NUM_BINS];
+		for (int b = 0; b < NUM_BINS; ++b)
+		{
+			bins[b].min.set(FLT_MAX, FLT_MAX, FLT_MAX);
+			bins[b].max.set(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			bins[b].count = 0;
+		}
+		for (int i = node.left_first; i < node.left_first + node.count; ++i)
+		{
+			uint32 tri = triangles[i];
+			int b = std::min(NUM_BINS - 1, (int)((centroids[tri].v[axis] - cmin.v[axis]) * scale));
+			bins[b].count++;
+			bins[b].min.setMin(tri_min[tri]);
+			bins[b].max.setMax(tri_max[tri]);
+		}
+
+		//sweep from both sides to get the area and count at every side of every plane
+		float left_area[NUM_BINS - 1], right_area[NUM_BINS - 1];
+		int left_count[NUM_BINS - 1], right_count[NUM_BINS - 1];
+		Vector3f lmin(FLT_MAX, FLT_MAX, FLT_MAX), lmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		Vector3f rmin(FLT_MAX, FLT_MAX, FLT_MAX), rmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		int lsum = 0, rsum = 0;
+		for (int b = 0; b < NUM_BINS - 1; ++b)
+		{
+			lsum += bins[b].count;
+			left_count[b] = lsum;
+			if (bins[b].count) { lmin.setMin(bins[b].min); lmax.setMax(bins[b].max); }
+			left_area[b] = lsum ? halfArea(lmin, lmax) : 0.0f;
+
+			int rb = NUM_BINS - 1 - b;
+			rsum += bins[rb].count;
+			right_count[rb - 1] = rsum;
+			if (bins[rb].count) { rmin.setMin(bins[rb].min); rmax.setMax(bins[rb].max); }
+			right_area[rb - 1] = rsum ? halfArea(rmin, rmax) : 0.0f;
+		}
+
+		for (int b = 0; b < NUM_BINS - 1; ++b)
+		{
+			if (!left_count[b] || !right_count[b])
+				continue;
+			float cost = left_count[b] * left_area[b] + right_count[b] * right_area[b];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	//not worth splitting
+	float leaf_cost = node.count * halfArea(node.min, node.max);
+	if (best_axis == -1 || best_cost >= leaf_cost)
+		return;
+
+	//partition triangles
+	float extent = cmax.v[best_axis] - cmin.v[best_axis];
+	float scale = NUM_BINS / extent;
+	int i = node.left_first;
+	int j = node.left_first + node.count - 1;
+	while (i <= j)
+	{
+		int b = std::min(NUM_BINS - 1, (int)((centroids[triangles[i]].v[best_axis] - cmin.v[best_axis]) * scale));
+		if (b <= best_split)
+			i++;
+		else
+			std::swap(triangles[i], triangles[j--]);
+	}
+	int left_count = i - node.left_first;
+
+	int left = (int)nodes.size();
+	nodes.resize(left + 2);
+	nodes[left].left_first = node.left_first;
+	nodes[left].count = left_count;
+	nodes[left + 1].left_first = i;
+	nodes[left + 1].count = node.count - left_count;
+	nodes[node_index].left_first = left;
+	nodes[node_index].count = 0;
+
+	updateNodeBounds(left, tri_min, tri_max);
+	updateNodeBounds(left + 1, tri_min, tri_max);
+	subdivide(left, depth + 1, centroids, tri_min, tri_max);
+	subdivide(left + 1, depth + 1, centroids, tri_min, tri_max);
+}
+
+//Moller-Trumbore, returns true if hit closer than hit.t
+inline bool rayTriangle(const Vector3f& origin, const Vector3f& dir, const Vector3f& a, const Vector3f& b, const Vector3f& c, float& t, float& u, float& v)
+{
+	Vector3f e1 = b - a;
+	Vector3f e2 = c - a;
+	Vector3f p = cross(dir, e2);
+	float det = dot(e1, p);
+	if (fabs(det) < 1e-12f)
+		return false; //parallel
+	float inv_det = 1.0f / det;
+	Vector3f s = origin - a;
+	u = dot(s, p) * inv_det;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	Vector3f q = cross(s, e1);
+	v = dot(dir, q) * inv_det;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	t = dot(e2, q) * inv_det;
+	return t > 0.0f;
+}
+
+#ifdef MESH_BVH_SSE
+//returns distance to the box (or FLT_MAX if not hit)
+inline float rayBoxSSE(const sMeshBVHNode& node, const __m128 origin, const __m128 inv_dir, float max_t)
+{
+	//loads min + left_first, the fourth lane is ignored
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min.v), origin), inv_dir);
+	__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max.v), origin), inv_dir);
+	__m128 vmin = _mm_min_ps(t1, t2);
+	__m128 vmax = _mm_max_ps(t1, t2);
+	//horizontal max/min of the first three lanes
+	__m128 tnear = _mm_max_ss(_mm_max_ss(vmin, _mm_shuffle_ps(vmin, vmin, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(vmin, vmin));
+	__m128 tfar = _mm_min_ss(_mm_min_ss(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(vmax, vmax));
+	float n = _mm_cvtss_f32(tnear);
+	float f = _mm_cvtss_f32(tfar);
+	if (f < n || f < 0.0f || n > max_t)
+		return FLT_MAX;
+	return n;
+}
+#else
+inline float rayBox(const sMeshBVHNode& node, const Vector3f& origin, const Vector3f& inv_dir, float max_t)
+{
+	float t1 = (node.min.x - origin.x) * inv_dir.x, t2 = (node.max.x - origin.x) * inv_dir.x;
+	float n = std::min(t1, t2), f = std::max(t1, t2);
+	t1 = (node.min.y - origin.y) * inv_dir.y; t2 = (node.max.y - origin.y) * inv_dir.y;
+	n = std::max(n, std::min(t1, t2)); f = std::min(f, std::max(t1, t2));
+	t1 = (node.min.z - origin.z) * inv_dir.z; t2 = (node.max.z - origin.z) * inv_dir.z;
+	n = std::max(n, std::min(t1, t2)); f = std::min(f, std::max(t1, t2));
+	if (f < n || f < 0.0f || n > max_t)
+		return FLT_MAX;
+	return n;
+}
+#endif
+
+bool MeshBVH::testRay(const Vector3f& origin, const Vector3f& direction, sRayHit& hit, uint32 first_triangle, uint32 last_triangle) const
+{
+	if (nodes.empty())
+		return false;
+
+	Vector3f inv_dir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+#ifdef MESH_BVH_SSE
+	__m128 origin4 = _mm_set_ps(0.0f, origin.z, origin.y, origin.x);
+	__m128 inv_dir4 = _mm_set_ps(0.0f, inv_dir.z, inv_dir.y, inv_dir.x);
+	#define RAY_BOX(node) rayBoxSSE(node, origin4, inv_dir4, hit.t)
+#else
+	#define RAY_BOX(node) rayBox(node, origin, inv_dir, hit.t)
+#endif
+
+	bool collided = false;
+	int stack[MAX_DEPTH + 2];
+	int stack_size = 0;
+	int current = 0;
+	if (RAY_BOX(nodes[0]) == FLT_MAX)
+		return false;
+
+	while (true)
+	{
+		const sMeshBVHNode& node = nodes[current];
+		if (node.count) //leaf
+		{
+			for (int i = node.left_first; i < node.left_first + node.count; ++i)
+			{
+				if (triangles[i] < first_triangle || triangles[i] >= last_triangle)
+					continue;
+				Vector3f a, b, c;
+				float t, u, v;
+				getTriangle(triangles[i], a, b, c);
+				if (!rayTriangle(origin, direction, a, b, c, t, u, v) || t >= hit.t)
+					continue;
+				hit.t = t;
+				hit.u = u;
+				hit.v = v;
+				hit.triangle = triangles[i];
+				collided = true;
+			}
+			if (!stack_size)
+				break;
+			current = stack[--stack_size];
+			continue;
+		}
+
+		//closest child first, the other one to the stack
+		int child1 = node.left_first;
+		int child2 = node.left_first + 1;
+		float dist1 = RAY_BOX(nodes[child1]);
+		float dist2 = RAY_BOX(nodes[child2]);
+		if (dist1 > dist2)
+		{
+			std::swap(dist1, dist2);
+			std::swap(child1, child2);
+		}
+		if (dist1 == FLT_MAX)
+		{
+			if (!stack_size)
+				break;
+			current = stack[--stack_size];
+		}
+		else
+		{
+			current = child1;
+			if (dist2 != FLT_MAX)
+			{
+				assert(stack_size < MAX_DEPTH + 2 && "BVH too deep");
+				stack[stack_size++] = child2;
+			}
+		}
+	}
+	#undef RAY_BOX
+
+	return collided;
+}
+
+int MeshBVH::testRays(const Vector3f* origins, const Vector3f* directions, sRayHit* hits, int num_rays) const
+{
+	if (nodes.empty())
+		return 0;
+
+	for (int i = 0; i < num_rays; i += 4)
+		testRayPacket(origins + i, directions + i, hits + i, std::min(4, num_rays - i));
+
+	int num_hits = 0;
+	for (int i = 0; i < num_rays; ++i)
+		if (hits[i].triangle != -1)
+			num_hits++;
+	return num_hits;
+}
+
+#ifdef MESH_BVH_SSE
+
+inline __m128 select4(__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+//four rays traversing together, a node is visited if any of the rays hits it
+void MeshBVH::testRayPacket(const Vector3f* origins, const Vector3f* directions, sRayHit* hits, int num_rays) const
+{
+	//SoA layout, unused lanes get a negative max distance so they never hit
+	float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], tmax[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		bool used = i < num_rays;
+		ox[i] = used ? origins[i].x : 0.0f; oy[i] = used ? origins[i].y : 0.0f; oz[i] = used ? origins[i].z : 0.0f;
+		dx[i] = used ? directions[i].x : 1.0f; dy[i] = used ? directions[i].y : 1.0f; dz[i] = used ? directions[i].z : 1.0f;
+		tmax[i] = used ? hits[i].t : -1.0f;
+	}
+	__m128 Ox = _mm_loadu_ps(ox), Oy = _mm_loadu_ps(oy), Oz = _mm_loadu_ps(oz);
+	__m128 Dx = _mm_loadu_ps(dx), Dy = _mm_loadu_ps(dy), Dz = _mm_loadu_ps(dz);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 Ix = _mm_div_ps(one, Dx), Iy = _mm_div_ps(one, Dy), Iz = _mm_div_ps(one, Dz);
+	__m128 T = _mm_loadu_ps(tmax);
+
+	//returns mask of rays hitting the box
+	auto testBox = [&](const sMeshBVHNode& node) -> int {
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.x), Ox), Ix);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.x), Ox), Ix);
+		__m128 tn = _mm_min_ps(t1, t2), tf = _mm_max_ps(t1, t2);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.y), Oy), Iy);
+		t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.y), Oy), Iy);
+		tn = _mm_max_ps(tn, _mm_min_ps(t1, t2)); tf = _mm_min_ps(tf, _mm_max_ps(t1, t2));
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.z), Oz), Iz);
+		t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.z), Oz), Iz);
+		tn = _mm_max_ps(tn, _mm_min_ps(t1, t2)); tf = _mm_min_ps(tf, _mm_max_ps(t1, t2));
+		tn = _mm_max_ps(tn, zero);
+		__m128 mask = _mm_and_ps(_mm_cmpge_ps(tf, tn), _mm_cmple_ps(tn, T));
+		return _mm_movemask_ps(mask);
+	};
+
+	int stack[MAX_DEPTH + 2];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size)
+	{
+		const sMeshBVHNode& node = nodes[stack[--stack_size]];
+		if (!testBox(node))
+			continue;
+
+		if (!node.count)
+		{
+			assert(stack_size + 2 <= MAX_DEPTH + 2 && "BVH too deep");
+			stack[stack_size++] = node.left_first + 1;
+			stack[stack_size++] = node.left_first;
+			continue;
+		}
+
+		//Moller-Trumbore for the four rays at once
+		for (int i = node.left_first; i < node.left_first + node.count; ++i)
+		{
+			Vector3f a, b, c;
+			getTriangle(triangles[i], a, b, c);
+			Vector3f e1 = b - a;
+			Vector3f e2 = c - a;
+			__m128 E1x = _mm_set1_ps(e1.x), E1y = _mm_set1_ps(e1.y), E1z = _mm_set1_ps(e1.z);
+			__m128 E2x = _mm_set1_ps(e2.x), E2y = _mm_set1_ps(e2.y), E2z = _mm_set1_ps(e2.z);
+			//p = cross(d, e2)
+			__m128 Px = _mm_sub_ps(_mm_mul_ps(Dy, E2z), _mm_mul_ps(Dz, E2y));
+			__m128 Py = _mm_sub_ps(_mm_mul_ps(Dz, E2x), _mm_mul_ps(Dx, E2z));
+			__m128 Pz = _mm_sub_ps(_mm_mul_ps(Dx, E2y), _mm_mul_ps(Dy, E2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(E1x, Px), _mm_mul_ps(E1y, Py)), _mm_mul_ps(E1z, Pz));
+			__m128 inv_det = _mm_div_ps(one, det);
+			//s = o - a
+			__m128 Sx = _mm_sub_ps(Ox, _mm_set1_ps(a.x)), Sy = _mm_sub_ps(Oy, _mm_set1_ps(a.y)), Sz = _mm_sub_ps(Oz, _mm_set1_ps(a.z));
+			__m128 U = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Sx, Px), _mm_mul_ps(Sy, Py)), _mm_mul_ps(Sz, Pz)), inv_det);
+			//q = cross(s, e1)
+			__m128 Qx = _mm_sub_ps(_mm_mul_ps(Sy, E1z), _mm_mul_ps(Sz, E1y));
+			__m128 Qy = _mm_sub_ps(_mm_mul_ps(Sz, E1x), _mm_mul_ps(Sx, E1z));
+			__m128 Qz = _mm_sub_ps(_mm_mul_ps(Sx, E1y), _mm_mul_ps(Sy, E1x));
+			__m128 V = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Dx, Qx), _mm_mul_ps(Dy, Qy)), _mm_mul_ps(Dz, Qz)), inv_det);
+			__m128 Tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(E2x, Qx), _mm_mul_ps(E2y, Qy)), _mm_mul_ps(E2z, Qz)), inv_det);
+
+			__m128 mask = _mm_cmpge_ps(U, zero);
+			mask = _mm_and_ps(mask, _mm_cmpge_ps(V, zero));
+			mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(U, V), one));
+			mask = _mm_and_ps(mask, _mm_cmpgt_ps(Tt, zero));
+			mask = _mm_and_ps(mask, _mm_cmplt_ps(Tt, T));
+			int bits = _mm_movemask_ps(mask); //parallel triangles give inf/nan and fail the tests
+			if (!bits)
+				continue;
+
+			T = select4(mask, Tt, T);
+			float us[4], vs[4], ts[4];
+			_mm_storeu_ps(us, U);
+			_mm_storeu_ps(vs, V);
+			_mm_storeu_ps(ts, Tt);
+			for (int k = 0; k < num_rays; ++k)
+			{
+				if (!(bits & (1 << k)))
+					continue;
+				hits[k].t = ts[k];
+				hits[k].u = us[k];
+				hits[k].v = vs[k];
+				hits[k].triangle = triangles[i];
+			}
+		}
+	}
+}
+
+#else
+
+void MeshBVH::testRayPacket(const Vector3f* origins, const Vector3f* directions, sRayHit* hits, int num_rays) const
+{
+	for (int i = 0; i < num_rays; ++i)
+		testRay(origins[i], directions[i], hits[i]);
+}
+
+#endif
+
+//from Real-Time Collision Detection (Ericson)
+Vector3f closestPointInTriangle(const Vector3f& p, const Vector3f& a, const Vector3f& b, const Vector3f& c)
+{
+	Vector3f ab = b - a, ac = c - a, ap = p - a;
+	float d1 = dot(ab, ap), d2 = dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) return a;
+	Vector3f bp = p - b;
+	float d3 = dot(ab, bp), d4 = dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) return b;
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+	Vector3f cp = p - c;
+	float d5 = dot(ab, cp), d6 = dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) return c;
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+bool MeshBVH::testSphere(const Matrix44& model, const Vector3f& center, float radius, Vector3f& collision, int& triangle) const
+{
+	if (nodes.empty())
+		return false;
+
+	//nodes are tested in object space with a conservative radius, triangles in world space
+	Matrix44 inv = model;
+	inv.inverse();
+	Vector3f local_center = inv * center;
+	float scale = std::max(Vector3f(inv.m[0], inv.m[1], inv.m[2]).length(), std::max(Vector3f(inv.m[4], inv.m[5], inv.m[6]).length(), Vector3f(inv.m[8], inv.m[9], inv.m[10]).length()));
+	float local_radius = radius * scale;
+
+	float best_dist2 = radius * radius;
+	bool collided = false;
+	int stack[MAX_DEPTH + 2];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size)
+	{
+		const sMeshBVHNode& node = nodes[stack[--stack_size]];
+
+		//sphere vs box
+		Vector3f closest = local_center;
+		closest.setMax(node.min);
+		closest.setMin(node.max);
+		Vector3f diff = closest - local_center;
+		if (dot(diff, diff) > local_radius * local_radius)
+			continue;
+
+		if (!node.count)
+		{
+			assert(stack_size + 2 <= MAX_DEPTH + 2 && "BVH too deep");
+			stack[stack_size++] = node.left_first;
+			stack[stack_size++] = node.left_first + 1;
+			continue;
+		}
+
+		for (int i = node.left_first; i < node.left_first + node.count; ++i)
+		{
+			Vector3f a, b, c;
+			getTriangle(triangles[i], a, b, c);
+			Vector3f p = closestPointInTriangle(center, model * a, model * b, model * c);
+			Vector3f d = p - center;
+			float dist2 = dot(d, d);
+			if (dist2 > best_dist2)
+				continue;
+			best_dist2 = dist2;
+			collision = p;
+			triangle = triangles[i];
+			collided = true;
+		}
+	}
+	return collided;
+}
+
+//*********************************************
+
+void GFX::benchmarkMeshCollision(Mesh* mesh, int num_rays)
+{
+	typedef std::chrono::high_resolution_clock clock;
+	if (!mesh || !mesh->loadCPUData())
+		return;
+
+	//random rays from outside the bounding box towards points inside
+	std::vector<Vector3f> origins(num_rays);
+	std::vector<Vector3f> directions(num_rays);
+	float size = mesh->box.halfsize.length() * 2.0f + 0.001f;
+	for (int i = 0; i < num_rays; ++i)
+	{
+		Vector3f dir(random(2.0f, -1), random(2.0f, -1), random(2.0f, -1));
+		dir.normalize();
+		Vector3f target = mesh->box.center + mesh->box.halfsize * Vector3f(random(2.0f, -1), random(2.0f, -1), random(2.0f, -1));
+		origins[i] = target - dir * size;
+		directions[i] = dir;
+	}
+
+	//coldet
+	auto start = clock::now();
+	CollisionModel3D* coldet = newCollisionModel3D(true);
+	MeshBVH bvh;
+	bvh.build(mesh); //only used to iterate triangles
+	coldet->setTriangleNumber(bvh.num_triangles);
+	for (uint32 i = 0; i < bvh.num_triangles; ++i)
+	{
+		Vector3f a, b, c;
+		bvh.getTriangle(i, a, b, c);
+		coldet->addTriangle(a.v, b.v, c.v);
+	}
+	coldet->finalize();
+	double coldet_build = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	Matrix44 identity;
+	coldet->setTransform(identity.m);
+
+	int coldet_hits = 0;
+	start = clock::now();
+	for (int i = 0; i < num_rays; ++i)
+		if (coldet->rayCollision(origins[i].v, directions[i].v, true, 0.0f, 3.4e+38F))
+			coldet_hits++;
+	double coldet_time = std::chrono::duration<double, std::nano>(clock::now() - start).count() / num_rays;
+	delete coldet;
+
+	//bvh
+	start = clock::now();
+	bvh.build(mesh);
+	double bvh_build = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+	std::vector<sRayHit> hits(num_rays);
+	int bvh_hits = 0;
+	start = clock::now();
+	for (int i = 0; i < num_rays; ++i)
+	{
+		hits[i].t = 3.4e+38F;
+		hits[i].triangle = -1;
+		if (bvh.testRay(origins[i], directions[i], hits[i]))
+			bvh_hits++;
+	}
+	double bvh_time = std::chrono::duration<double, std::nano>(clock::now() - start).count() / num_rays;
+
+	for (int i = 0; i < num_rays; ++i)
+	{
+		hits[i].t = 3.4e+38F;
+		hits[i].triangle = -1;
+	}
+	start = clock::now();
+	int packet_hits = bvh.testRays(&origins[0], &directions[0], &hits[0], num_rays);
+	double packet_time = std::chrono::duration<double, std::nano>(clock::now() - start).count() / num_rays;
+
+	std::cout << " + Collision benchmark: " << mesh->name << " (" << bvh.num_triangles << " tris, " << num_rays << " rays)" << std::endl;
+	std::cout << "\tcoldet:     build " << coldet_build << "ms, " << coldet_time << "ns/ray, hits " << coldet_hits << std::endl;
+	std::cout << "\tBVH:        build " << bvh_build << "ms, " << bvh_time << "ns/ray, hits " << bvh_hits << ", " << bvh.nodes.size() << " nodes, " << bvh.getMemorySize() / 1024 << "KBs" << std::endl;
+	std::cout << "\tBVH packet: " << packet_time << "ns/ray, hits " << packet_hits << std::endl;
+}
@@ -0,0 +1,74 @@
+/*  Bounding Volume Hierarchy of the triangles of a mesh, used to test rays and spheres against it.
+	Built with the Surface Area Heuristic, it doesnt duplicate the vertex data, only stores
+	a permutation of the triangles so every leaf references a consecutive range of them.
+*/
+
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <vector>
+#include "../core/math.h"
+
+namespace GFX {
+
+	class Mesh;
+
+	//result of testing a ray against a mesh
+	struct sRayHit {
+		float t;		//distance along the ray, set it to the max distance before testing
+		int triangle;	//index of the triangle in the mesh, -1 if no hit
+		float u, v;		//barycentric coordinates of the hit inside the triangle
+	};
+
+	//32 bytes, two nodes per cache line
+	struct sMeshBVHNode {
+		Vector3f min;
+		int left_first; //first triangle if leaf (count > 0), left child otherwise (right child is left + 1)
+		Vector3f max;
+		int count;		//number of triangles, 0 if not leaf
+	};
+
+	class MeshBVH
+	{
+	public:
+		static const int MAX_LEAF_TRIANGLES = 4;
+		static const int NUM_BINS = 12;
+		static const int MAX_DEPTH = 48; //nodes at this depth become leafs, bounds the traversal stacks
+
+		std::vector<sMeshBVHNode> nodes;
+		std::vector<uint32> triangles; //triangle indices sorted by leaf
+		uint32 num_triangles;
+
+		MeshBVH();
+
+		bool build(Mesh* mesh);
+		bool isValid() const; //false if the mesh buffers were reallocated after the build, it must be rebuilt
+		size_t getMemorySize() const;
+		void getTriangle(uint32 index, Vector3f& a, Vector3f& b, Vector3f& c) const;
+
+		//all these work in object space
+		bool testRay(const Vector3f& origin, const Vector3f& direction, sRayHit& hit, uint32 first_triangle = 0, uint32 last_triangle = 0xFFFFFFFF) const; //only triangles in [first, last) are tested
+		int testRays(const Vector3f* origins, const Vector3f* directions, sRayHit* hits, int num_rays) const; //in packets of four, returns number of hits
+
+		//finds the closest point of the mesh inside the sphere (the test is done in world space using the model)
+		bool testSphere(const Matrix44& model, const Vector3f& center, float radius, Vector3f& collision, int& triangle) const;
+
+	private:
+		//vertex data, owned by the mesh
+		const Mesh* mesh;
+		const float* positions;
+		int stride; //in floats
+		const unsigned int* indices;
+		uint32 num_vertices;
+
+		void subdivide(int node_index, int depth, std::vector<Vector3f>& centroids, std::vector<Vector3f>& tri_min, std::vector<Vector3f>& tri_max);
+		void updateNodeBounds(int node_index, std::vector<Vector3f>& tri_min, std::vector<Vector3f>& tri_max);
+		void testRayPacket(const Vector3f* origins, const Vector3f* directions, sRayHit* hits, int num_rays) const;
+	};
+
+	//prints build time, memory and time per ray of coldet and MeshBVH for the given mesh
+	void benchmarkMeshCollision(Mesh* mesh, int num_rays = 10000);
+
+};
+
+#endif
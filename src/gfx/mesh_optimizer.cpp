@@ -0,0 +1,861 @@
+#include "mesh_optimizer.h"
+
+#include <vector>
+#include <queue>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cassert>
+
+#include "../core/math.h"
+#include "mesh.h"
+
+using namespace GFX;
+
+//values from Tom Forsyth "Linear-Speed Vertex Cache Optimisation"
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_MAX_VALENCE 64
+
+//score tables, built once (thread safe as meshes can be optimized from the workers)
+struct sForsythScores {
+	float cache_position[FORSYTH_CACHE_SIZE];
+	float valence[FORSYTH_MAX_VALENCE];
+
+	sForsythScores()
+	{
+		const float cache_decay_power = 1.5f;
+		const float last_triangle_score = 0.75f;
+		const float valence_boost_scale = 2.0f;
+		const float valence_boost_power = 0.5f;
+
+		for (int i = 0; i < FORSYTH_CACHE_SIZE; ++i)
+		{
+			if (i < 3) //vertices of the last triangle get a fixed score so it is not repeated
+				cache_position[i] = last_triangle_score;
+			else
+				cache_position[i] = powf(1.0f - (i - 3) / (float)(FORSYTH_CACHE_SIZE - 3), cache_decay_power);
+		}
+
+		//vertices with few triangles left are preferred to get rid of them
+		valence[0] = 0.0f;
+		for (int i = 1; i < FORSYTH_MAX_VALENCE; ++i)
+			valence[i] = valence_boost_scale * powf((float)i, -valence_boost_power);
+	}
+};
+
+inline float vertexScore(const sForsythScores& scores, int cache_position, unsigned int remaining)
+{
+	if (remaining == 0)
+		return -1.0f; //not used anymore
+	float score = cache_position >= 0 ? scores.cache_position[cache_position] : 0.0f;
+	return score + scores.valence[remaining < FORSYTH_MAX_VALENCE ? remaining : FORSYTH_MAX_VALENCE - 1];
+}
+
+void GFX::optimizeVertexCache(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices)
+{
+	unsigned int num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+	static const sForsythScores scores;
+
+	//triangles using every vertex
+	std::vector<unsigned int> remaining(num_vertices, 0);
+	for (unsigned int i = 0; i < num_triangles * 3; ++i)
+		remaining[indices[i]]++;
+	std::vector<unsigned int> offsets(num_vertices + 1, 0);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		offsets[i + 1] = offsets[i] + remaining[i];
+	std::vector<unsigned int> adjacency(num_triangles * 3);
+	std::vector<unsigned int> filled(num_vertices, 0);
+	for (unsigned int i = 0; i < num_triangles * 3; ++i)
+	{
+		unsigned int v = indices[i];
+		adjacency[offsets[v] + filled[v]++] = i / 3;
+	}
+
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		vertex_score[i] = vertexScore(scores, -1, remaining[i]);
+
+	std::vector<uint8> emitted(num_triangles, 0);
+	int best = -1;
+	float best_score = -1.0f;
+	for (unsigned int i = 0; i < num_triangles; ++i)
+	{
+		float score = vertex_score[indices[i * 3]] + vertex_score[indices[i * 3 + 1]] + vertex_score[indices[i * 3 + 2]];
+		if (score > best_score)
+		{
+			best_score = score;
+			best = i;
+		}
+	}
+
+	std::vector<unsigned int> output(num_triangles * 3);
+	int cache[FORSYTH_CACHE_SIZE + 3];
+	int cache_size = 0;
+	unsigned int first_not_emitted = 0;
+
+	for (unsigned int n = 0; n < num_triangles; ++n)
+	{
+		//nothing in the cache is useful, take the next one
+		if (best == -1)
+		{
+			while (emitted[first_not_emitted])
+				first_not_emitted++;
+			best = first_not_emitted;
+		}
+
+		emitted[best] = 1;
+		const unsigned int* tri = indices + best * 3;
+		memcpy(&output[n * 3], tri, sizeof(unsigned int) * 3);
+
+		//remove the triangle from the vertices adjacency
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = tri[k];
+			unsigned int* adj = &adjacency[offsets[v]];
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+				if (adj[j] == (unsigned int)best)
+				{
+					adj[j] = adj[remaining[v] - 1];
+					remaining[v]--;
+					break;
+				}
+		}
+
+		//new vertices go to the front of the LRU cache
+		int new_cache[FORSYTH_CACHE_SIZE + 3];
+		int new_size = 0;
+		for (int k = 0; k < 3; ++k)
+			new_cache[new_size++] = tri[k];
+		for (int i = 0; i < cache_size; ++i)
+		{
+			int v = cache[i];
+			if (v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2])
+				new_cache[new_size++] = v;
+		}
+
+		//update scores of the vertices in the cache (also the ones that just left)
+		for (int i = 0; i < new_size; ++i)
+		{
+			int v = new_cache[i];
+			cache_position[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+			vertex_score[v] = vertexScore(scores, cache_position[v], remaining[v]);
+		}
+
+		//and of their triangles, the best one will be the next
+		best = -1;
+		best_score = -1.0f;
+		for (int i = 0; i < new_size; ++i)
+		{
+			int v = new_cache[i];
+			const unsigned int* adj = &adjacency[offsets[v]];
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+			{
+				unsigned int t = adj[j];
+				float score = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+				if (score > best_score)
+				{
+					best_score = score;
+					best = t;
+				}
+			}
+		}
+
+		cache_size = new_size < FORSYTH_CACHE_SIZE ? new_size : FORSYTH_CACHE_SIZE;
+		memcpy(cache, new_cache, sizeof(int) * cache_size);
+	}
+
+	memcpy(indices, &output[0], sizeof(unsigned int) * num_triangles * 3);
+}
+
+sVertexCacheStats GFX::computeVertexCacheStats(const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, int cache_size)
+{
+	sVertexCacheStats stats;
+	stats.acmr = stats.atvr = 0.0f;
+	unsigned int num_triangles = (indices ? num_indices : num_vertices) / 3;
+	if (!num_triangles || !num_vertices)
+		return stats;
+
+	//FIFO cache using timestamps, a vertex is in the cache if less than cache_size vertices entered after it
+	std::vector<unsigned int> timestamp(num_vertices, 0);
+	unsigned int time = cache_size + 1;
+	unsigned int misses = 0;
+	for (unsigned int i = 0; i < num_triangles * 3; ++i)
+	{
+		unsigned int v = indices ? indices[i] : i;
+		if (time - timestamp[v] > (unsigned int)cache_size)
+		{
+			timestamp[v] = time++;
+			misses++;
+		}
+	}
+
+	stats.acmr = misses / (float)num_triangles;
+	stats.atvr = misses / (float)num_vertices;
+	return stats;
+}
+
+#define INVALID_INDEX 0xFFFFFFFF
+
+//raw view of a per vertex stream
+struct sStreamView {
+	const uint8* data;
+	size_t size; //bytes per vertex
+};
+
+template<typename T> void addStreamView(std::vector<sStreamView>& views, const std::vector<T>& stream)
+{
+	if (!stream.size())
+		return;
+	sStreamView view;
+	view.data = (const uint8*)&stream[0];
+	view.size = sizeof(T);
+	views.push_back(view);
+}
+
+//moves every vertex to remap[i] (several vertices can go to the same one if they are equal)
+template<typename T> void remapStream(std::vector<T>& stream, const std::vector<unsigned int>& remap, unsigned int new_size)
+{
+	if (!stream.size())
+		return;
+	std::vector<T> result(new_size);
+	for (size_t i = 0; i < remap.size(); ++i)
+		if (remap[i] != INVALID_INDEX)
+			result[remap[i]] = stream[i];
+	stream.swap(result);
+}
+
+static void remapVertices(Mesh* mesh, const std::vector<unsigned int>& remap, unsigned int new_size)
+{
+	remapStream(mesh->vertices, remap, new_size);
+	remapStream(mesh->normals, remap, new_size);
+	remapStream(mesh->uvs, remap, new_size);
+	remapStream(mesh->m_uvs1, remap, new_size);
+	remapStream(mesh->colors, remap, new_size);
+	remapStream(mesh->bones, remap, new_size);
+	remapStream(mesh->weights, remap, new_size);
+}
+
+//FNV-1a of all the attributes of the vertex
+static uint32 hashVertex(const std::vector<sStreamView>& views, unsigned int index)
+{
+	uint32 hash = 2166136261u;
+	for (size_t i = 0; i < views.size(); ++i)
+	{
+		const uint8* data = views[i].data + index * views[i].size;
+		for (size_t j = 0; j < views[i].size; ++j)
+			hash = (hash ^ data[j]) * 16777619u;
+	}
+	return hash;
+}
+
+static bool equalVertices(const std::vector<sStreamView>& views, unsigned int a, unsigned int b)
+{
+	for (size_t i = 0; i < views.size(); ++i)
+		if (memcmp(views[i].data + a * views[i].size, views[i].data + b * views[i].size, views[i].size) != 0)
+			return false;
+	return true;
+}
+
+//returns the number of unique vertices
+static unsigned int weldVertices(Mesh* mesh)
+{
+	unsigned int num_vertices = (unsigned int)mesh->vertices.size();
+	std::vector<sStreamView> views;
+	addStreamView(views, mesh->vertices);
+	addStreamView(views, mesh->normals);
+	addStreamView(views, mesh->uvs);
+	addStreamView(views, mesh->m_uvs1);
+	addStreamView(views, mesh->colors);
+	addStreamView(views, mesh->bones);
+	addStreamView(views, mesh->weights);
+
+	//open addressing table with the first vertex of every kind
+	unsigned int table_size = 1;
+	while (table_size < num_vertices * 2)
+		table_size *= 2;
+	std::vector<unsigned int> table(table_size, INVALID_INDEX);
+	std::vector<unsigned int> remap(num_vertices);
+	unsigned int num_unique = 0;
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		unsigned int slot = hashVertex(views, i) & (table_size - 1);
+		while (table[slot] != INVALID_INDEX && !equalVertices(views, table[slot], i))
+			slot = (slot + 1) & (table_size - 1);
+		if (table[slot] == INVALID_INDEX)
+		{
+			table[slot] = i;
+			remap[i] = num_unique++;
+		}
+		else
+			remap[i] = remap[table[slot]];
+	}
+
+	if (num_unique == num_vertices)
+		return num_vertices;
+
+	for (size_t i = 0; i < mesh->m_indices.size(); ++i)
+		mesh->m_indices[i] = remap[mesh->m_indices[i]];
+	remapVertices(mesh, remap, num_unique);
+	return num_unique;
+}
+
+//vertices are renumbered in the order they appear in the index buffer, unused ones are removed
+static void optimizeVertexFetch(Mesh* mesh)
+{
+	std::vector<unsigned int> remap(mesh->vertices.size(), INVALID_INDEX);
+	unsigned int num_used = 0;
+	for (size_t i = 0; i < mesh->m_indices.size(); ++i)
+	{
+		unsigned int& index = mesh->m_indices[i];
+		if (remap[index] == INVALID_INDEX)
+			remap[index] = num_used++;
+		index = remap[index];
+	}
+	//the levels of detail only use vertices of the mesh
+	for (size_t i = 0; i < mesh->lod_indices.size(); ++i)
+		mesh->lod_indices[i] = remap[mesh->lod_indices[i]];
+	remapVertices(mesh, remap, num_used);
+}
+
+//renumbers from 0 the vertices used by a range of indices, so the per vertex tables are sized to the range and not to the whole mesh
+//vertices[local] is the index in the mesh, returns the number of local vertices
+static unsigned int compactVertices(const unsigned int* indices, unsigned int num_indices, std::vector<unsigned int>& local_indices, std::vector<unsigned int>& vertices)
+{
+	vertices.assign(indices, indices + num_indices);
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+	local_indices.resize(num_indices);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		local_indices[i] = (unsigned int)(std::lower_bound(vertices.begin(), vertices.end(), indices[i]) - vertices.begin());
+	return (unsigned int)vertices.size();
+}
+
+static void optimizeSubmeshVertexCache(unsigned int* indices, unsigned int num_indices)
+{
+	if (num_indices < 6)
+		return;
+	std::vector<unsigned int> local_indices, vertices;
+	unsigned int num_local = compactVertices(indices, num_indices, local_indices, vertices);
+	optimizeVertexCache(&local_indices[0], num_indices, num_local);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		indices[i] = vertices[local_indices[i]];
+}
+
+bool GFX::optimizeMesh(Mesh* mesh, uint32 flags)
+{
+	assert(mesh);
+	if (!mesh->loadCPUData()) //streams could be in a file mapping
+		return false;
+
+	//all the steps work with separated streams
+	bool was_interleaved = mesh->interleaved.size() != 0;
+	if (was_interleaved)
+	{
+		size_t num = mesh->interleaved.size();
+		mesh->vertices.resize(num);
+		mesh->normals.resize(num);
+		mesh->uvs.resize(num);
+		for (size_t i = 0; i < num; ++i)
+		{
+			mesh->vertices[i] = mesh->interleaved[i].vertex;
+			mesh->normals[i] = mesh->interleaved[i].normal;
+			mesh->uvs[i] = mesh->interleaved[i].uv;
+		}
+		mesh->interleaved.clear();
+	}
+
+	unsigned int num_vertices = (unsigned int)mesh->vertices.size();
+	sMeshOptimizationStats& stats = mesh->optimization_stats;
+	sVertexCacheStats before = computeVertexCacheStats(mesh->m_indices.size() ? &mesh->m_indices[0] : NULL, (unsigned int)mesh->m_indices.size(), num_vertices);
+	stats.acmr_before = before.acmr;
+	stats.atvr_before = before.atvr;
+	stats.vertices_before = num_vertices;
+
+	//submesh ranges stay the same, when not indexed they were vertex ranges
+	if (!mesh->m_indices.size() && (flags & (MESH_OPTIMIZE_WELD | MESH_OPTIMIZE_VERTEX_CACHE | MESH_OPTIMIZE_VERTEX_FETCH | MESH_OPTIMIZE_LODS)))
+	{
+		mesh->m_indices.resize(num_vertices);
+		for (unsigned int i = 0; i < num_vertices; ++i)
+			mesh->m_indices[i] = i;
+	}
+
+	if (flags & MESH_OPTIMIZE_WELD)
+		num_vertices = weldVertices(mesh);
+
+	//every submesh is drawn on its own so they are optimized separately
+	if ((flags & MESH_OPTIMIZE_VERTEX_CACHE) && mesh->m_indices.size())
+	{
+		if (mesh->submeshes.size())
+			for (size_t i = 0; i < mesh->submeshes.size(); ++i)
+			{
+				sSubmeshInfo& submesh = mesh->submeshes[i];
+				if (submesh.start >= 0 && submesh.start + submesh.length <= (int)mesh->m_indices.size())
+					optimizeSubmeshVertexCache(&mesh->m_indices[submesh.start], submesh.length);
+			}
+		else
+			optimizeVertexCache(&mesh->m_indices[0], (unsigned int)mesh->m_indices.size(), num_vertices);
+	}
+
+	//before reordering the vertices so the lods are remapped with the mesh
+	if ((flags & MESH_OPTIMIZE_LODS) && mesh->m_indices.size())
+		generateLODs(mesh);
+
+	if ((flags & MESH_OPTIMIZE_VERTEX_FETCH) && mesh->m_indices.size())
+	{
+		optimizeVertexFetch(mesh);
+		num_vertices = (unsigned int)mesh->vertices.size();
+	}
+
+	sVertexCacheStats after = computeVertexCacheStats(mesh->m_indices.size() ? &mesh->m_indices[0] : NULL, (unsigned int)mesh->m_indices.size(), num_vertices);
+	stats.acmr_after = after.acmr;
+	stats.atvr_after = after.atvr;
+	stats.vertices_after = num_vertices;
+
+	mesh->quantization = flags & MESH_OPTIMIZE_QUANTIZE;
+	if (mesh->quantization & MESH_OPTIMIZE_QUANTIZE_POSITIONS)
+		mesh->updateBoundingBox(); //every vertex must be inside the box
+
+	//the collision model was pointing to the old vertices
+	if (mesh->collision_model)
+		delete mesh->collision_model;
+	mesh->collision_model = NULL;
+
+	//quantized meshes use separated streams
+	if (was_interleaved)
+		mesh->interleaveBuffers();
+	return true;
+}
+
+//quadric error metric (Garland and Heckbert), sum of the squared distances to a set of planes stored as a symmetric 4x4 matrix
+struct sQuadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+	void addPlane(double a, double b, double c, double d)
+	{
+		a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+		b2 += b * b; bc += b * c; bd += b * d;
+		c2 += c * c; cd += c * d;
+		d2 += d * d;
+	}
+
+	void add(const sQuadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double evaluate(const Vector3f& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double result = a2 * x * x + b2 * y * y + c2 * z * z + d2 + 2.0 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z);
+		return result > 0.0 ? result : 0.0; //rounding
+	}
+};
+
+//moving the vertex from into the vertex to
+struct sEdgeCollapse {
+	float cost;
+	unsigned int from, to;
+	unsigned int version_from, version_to; //to discard it if any of the vertices changed after adding it
+
+	bool operator<(const sEdgeCollapse& other) const { return cost > other.cost; } //cheapest first in a priority_queue
+};
+
+static bool isCollapseFlipping(const std::vector<unsigned int>& triangles, const std::vector<bool>& dead, const std::vector<unsigned int>& around, const Vector3f* positions, unsigned int from, unsigned int to)
+{
+	for (size_t i = 0; i < around.size(); ++i)
+	{
+		unsigned int t = around[i];
+		const unsigned int* tri = &triangles[t * 3];
+		if (dead[t] || tri[0] == to || tri[1] == to || tri[2] == to)
+			continue; //removed by the collapse
+		Vector3f a = positions[tri[0]], b = positions[tri[1]], c = positions[tri[2]];
+		Vector3f before = (b - a).cross(c - a);
+		if (tri[0] == from) a = positions[to];
+		else if (tri[1] == from) b = positions[to];
+		else c = positions[to];
+		Vector3f after = (b - a).cross(c - a);
+		if (before.dot(after) <= 0.25f * before.length() * after.length()) //flipped, degenerated or rotated more than ~75 degrees (creates folds)
+			return true;
+	}
+	return false;
+}
+
+unsigned int GFX::simplifyTriangles(unsigned int* result, const unsigned int* indices, unsigned int num_indices, const Vector3f* positions, unsigned int num_vertices, unsigned int target_num_indices, float max_error, float* result_error)
+{
+	unsigned int num_triangles = num_indices / 3;
+	std::vector<unsigned int> triangles(indices, indices + num_triangles * 3);
+	std::vector<bool> dead(num_triangles, false);
+
+	//triangles around every vertex, a collapsed vertex passes its triangles to the target
+	std::vector< std::vector<unsigned int> > vertex_triangles(num_vertices);
+	for (unsigned int t = 0; t < num_triangles; ++t)
+		for (int k = 0; k < 3; ++k)
+			vertex_triangles[triangles[t * 3 + k]].push_back(t);
+
+	//vertices of open edges cannot move: borders of the mesh and seams (the vertices are split where the attributes change)
+	std::unordered_set<unsigned long long> edges; //uint64 is 32 bits in some compilers
+	edges.reserve(num_triangles * 3);
+	for (unsigned int i = 0; i < num_triangles * 3; ++i)
+		edges.insert(((unsigned long long)triangles[i] << 32) | triangles[i % 3 == 2 ? i - 2 : i + 1]);
+	std::vector<bool> locked(num_vertices, false);
+	for (unsigned int i = 0; i < num_triangles * 3; ++i)
+	{
+		unsigned int a = triangles[i];
+		unsigned int b = triangles[i % 3 == 2 ? i - 2 : i + 1];
+		if (!edges.count(((unsigned long long)b << 32) | a))
+			locked[a] = locked[b] = true;
+	}
+
+	//planes of the triangles around every vertex
+	std::vector<sQuadric> quadrics(num_vertices);
+	for (unsigned int t = 0; t < num_triangles; ++t)
+	{
+		const unsigned int* tri = &triangles[t * 3];
+		Vector3f normal = (positions[tri[1]] - positions[tri[0]]).cross(positions[tri[2]] - positions[tri[0]]);
+		float length = normal.length();
+		if (length == 0.0f)
+			continue;
+		normal = normal * (1.0f / length);
+		float d = -normal.dot(positions[tri[0]]);
+		for (int k = 0; k < 3; ++k)
+			quadrics[tri[k]].addPlane(normal.x, normal.y, normal.z, d);
+	}
+
+	std::vector<unsigned int> versions(num_vertices, 0);
+	std::vector<bool> removed(num_vertices, false);
+	std::priority_queue<sEdgeCollapse> heap;
+	auto addCollapse = [&](unsigned int from, unsigned int to)
+	{
+		sQuadric q = quadrics[from];
+		q.add(quadrics[to]);
+		sEdgeCollapse collapse = { (float)q.evaluate(positions[to]), from, to, versions[from], versions[to] };
+		heap.push(collapse);
+	};
+	for (unsigned int t = 0; t < num_triangles; ++t)
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int a = triangles[t * 3 + k];
+			unsigned int b = triangles[t * 3 + (k + 1) % 3];
+			if (!locked[a]) addCollapse(a, b);
+			if (!locked[b]) addCollapse(b, a);
+		}
+
+	//cheapest collapses first till reaching the target
+	unsigned int num_alive = num_triangles;
+	double max_cost = (double)max_error * max_error;
+	double error = 0.0;
+	while (num_alive * 3 > target_num_indices && !heap.empty())
+	{
+		sEdgeCollapse collapse = heap.top();
+		heap.pop();
+		unsigned int from = collapse.from;
+		unsigned int to = collapse.to;
+		if (removed[from] || removed[to] || collapse.version_from != versions[from] || collapse.version_to != versions[to])
+			continue; //outdated
+		if (collapse.cost > max_cost)
+			break;
+		std::vector<unsigned int>& around = vertex_triangles[from];
+		if (isCollapseFlipping(triangles, dead, around, positions, from, to))
+			continue;
+
+		for (size_t i = 0; i < around.size(); ++i)
+		{
+			unsigned int t = around[i];
+			if (dead[t])
+				continue;
+			unsigned int* tri = &triangles[t * 3];
+			if (tri[0] == to || tri[1] == to || tri[2] == to)
+			{
+				dead[t] = true;
+				num_alive--;
+				continue;
+			}
+			for (int k = 0; k < 3; ++k)
+				if (tri[k] == from)
+					tri[k] = to;
+			vertex_triangles[to].push_back(t);
+		}
+		std::vector<unsigned int>().swap(around);
+		removed[from] = true;
+		quadrics[to].add(quadrics[from]);
+		versions[to]++;
+		error = std::max(error, (double)collapse.cost);
+
+		//the costs of the edges of the target changed, the dead triangles are removed from its list
+		std::vector<unsigned int>& target_triangles = vertex_triangles[to];
+		size_t num = 0;
+		for (size_t i = 0; i < target_triangles.size(); ++i)
+		{
+			unsigned int t = target_triangles[i];
+			if (dead[t])
+				continue;
+			target_triangles[num++] = t;
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int other = triangles[t * 3 + k];
+				if (other == to)
+					continue;
+				if (!locked[to]) addCollapse(to, other);
+				if (!locked[other]) addCollapse(other, to);
+			}
+		}
+		target_triangles.resize(num);
+	}
+
+	//the remaining triangles keep their order
+	unsigned int num_result = 0;
+	for (unsigned int t = 0; t < num_triangles; ++t)
+		if (!dead[t])
+		{
+			result[num_result++] = triangles[t * 3];
+			result[num_result++] = triangles[t * 3 + 1];
+			result[num_result++] = triangles[t * 3 + 2];
+		}
+	if (result_error)
+		*result_error = (float)sqrt(error);
+	return num_result;
+}
+
+int GFX::generateLODs(Mesh* mesh, int max_lods, float max_error)
+{
+	assert(mesh);
+	mesh->lods.clear();
+	mesh->lod_ranges.clear();
+	mesh->lod_indices.clear();
+	if (!mesh->loadCPUData() || !mesh->m_indices.size())
+		return 0;
+
+	//positions of the vertices
+	std::vector<Vector3f> interleaved_positions;
+	const Vector3f* positions = mesh->vertices.size() ? &mesh->vertices[0] : NULL;
+	unsigned int num_vertices = (unsigned int)mesh->vertices.size();
+	if (mesh->interleaved.size())
+	{
+		num_vertices = (unsigned int)mesh->interleaved.size();
+		interleaved_positions.resize(num_vertices);
+		for (unsigned int i = 0; i < num_vertices; ++i)
+			interleaved_positions[i] = mesh->interleaved[i].vertex;
+		positions = &interleaved_positions[0];
+	}
+
+	//the errors are relative to the size of the mesh
+	Vector3f min = positions[0], max = positions[0];
+	for (unsigned int i = 1; i < num_vertices; ++i)
+	{
+		min.setMin(positions[i]);
+		max.setMax(positions[i]);
+	}
+	float radius = (max - min).length() * 0.5f;
+	if (radius == 0.0f)
+		return 0;
+
+	//every level is built from the previous one, starting from the submeshes
+	std::vector<sIndexRange> ranges;
+	if (mesh->submeshes.size())
+		for (size_t i = 0; i < mesh->submeshes.size(); ++i)
+		{
+			sIndexRange range = { mesh->submeshes[i].start, mesh->submeshes[i].length };
+			ranges.push_back(range);
+		}
+	else
+	{
+		sIndexRange range = { 0, (int)mesh->m_indices.size() };
+		ranges.push_back(range);
+	}
+	std::vector<unsigned int> source = mesh->m_indices;
+	std::vector<unsigned int> simplified;
+	std::vector<unsigned int> local_indices, local_vertices; //every range is simplified with its own vertices
+	std::vector<Vector3f> local_positions;
+	float previous_error = 0.0f;
+
+	for (int level = 0; level < max_lods; ++level)
+	{
+		sMeshLOD lod;
+		lod.start = (int)mesh->lod_indices.size();
+		lod.first_range = (int)mesh->lod_ranges.size();
+		int num_before = 0;
+		float level_error = 0.0f;
+		std::vector<sIndexRange> new_ranges(ranges.size());
+		for (size_t i = 0; i < ranges.size(); ++i)
+		{
+			const sIndexRange& range = ranges[i];
+			num_before += range.length;
+			new_ranges[i].start = (int)mesh->lod_indices.size();
+			new_ranges[i].length = 0;
+			if (range.start < 0 || range.length < 3 || range.start + range.length > (int)source.size())
+				continue;
+			unsigned int num_local = compactVertices(&source[range.start], range.length, local_indices, local_vertices);
+			local_positions.resize(num_local);
+			for (unsigned int j = 0; j < num_local; ++j)
+				local_positions[j] = positions[local_vertices[j]];
+			simplified.resize(range.length);
+			float error = 0.0f;
+			unsigned int num = simplifyTriangles(&simplified[0], &local_indices[0], range.length, &local_positions[0], num_local, (range.length / 6) * 3, max_error * radius, &error);
+			optimizeVertexCache(&simplified[0], num, num_local);
+			for (unsigned int j = 0; j < num; ++j)
+				simplified[j] = local_vertices[simplified[j]];
+			mesh->lod_indices.insert(mesh->lod_indices.end(), simplified.begin(), simplified.begin() + num);
+			new_ranges[i].length = num;
+			level_error = std::max(level_error, error);
+		}
+		lod.length = (int)mesh->lod_indices.size() - lod.start;
+
+		//not worth it if it cannot remove enough triangles
+		if (lod.length == 0 || lod.length > num_before * 0.8f)
+		{
+			mesh->lod_indices.resize(lod.start);
+			break;
+		}
+
+		//errors add up as every level comes from the previous one
+		lod.error = previous_error + level_error / radius;
+		previous_error = lod.error;
+		mesh->lods.push_back(lod);
+		mesh->lod_ranges.insert(mesh->lod_ranges.end(), new_ranges.begin(), new_ranges.end());
+
+		source.assign(mesh->lod_indices.begin() + lod.start, mesh->lod_indices.end());
+		for (size_t i = 0; i < new_ranges.size(); ++i)
+			new_ranges[i].start -= lod.start;
+		ranges = new_ranges;
+	}
+
+	return (int)mesh->lods.size();
+}
+
+void GFX::quantizePositions(const Vector3f* positions, unsigned int num, const BoundingBox& box, int16* result)
+{
+	Vector3f inv_halfsize(box.halfsize.x > 0.0f ? 1.0f / box.halfsize.x : 0.0f, box.halfsize.y > 0.0f ? 1.0f / box.halfsize.y : 0.0f, box.halfsize.z > 0.0f ? 1.0f / box.halfsize.z : 0.0f);
+	for (unsigned int i = 0; i < num; ++i)
+	{
+		Vector3f p = positions[i] - box.center;
+		int16* q = result + i * 4;
+		q[0] = (int16)floorf(clamp(p.x * inv_halfsize.x, -1.0f, 1.0f) * 32767.0f + 0.5f);
+		q[1] = (int16)floorf(clamp(p.y * inv_halfsize.y, -1.0f, 1.0f) * 32767.0f + 0.5f);
+		q[2] = (int16)floorf(clamp(p.z * inv_halfsize.z, -1.0f, 1.0f) * 32767.0f + 0.5f);
+		q[3] = 0;
+	}
+}
+
+//same as the GPU does with normalized shorts
+inline float snormToFloat(int16 v) { return v < -32767 ? -1.0f : v / 32767.0f; }
+
+void GFX::dequantizePositions(const int16* quantized, unsigned int num, const BoundingBox& box, Vector3f* result)
+{
+	for (unsigned int i = 0; i < num; ++i)
+	{
+		const int16* q = quantized + i * 4;
+		result[i].set(box.center.x + snormToFloat(q[0]) * box.halfsize.x, box.center.y + snormToFloat(q[1]) * box.halfsize.y, box.center.z + snormToFloat(q[2]) * box.halfsize.z);
+	}
+}
+
+void GFX::quantizeNormals(const Vector3f* normals, unsigned int num, int16* result)
+{
+	for (unsigned int i = 0; i < num; ++i)
+	{
+		//project to the octahedron and unfold the bottom half
+		const Vector3f& n = normals[i];
+		float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		float x = sum > 0.0f ? n.x / sum : 0.0f;
+		float y = sum > 0.0f ? n.y / sum : 0.0f;
+		if (n.z < 0.0f)
+		{
+			float ox = x;
+			x = (1.0f - fabsf(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+			y = (1.0f - fabsf(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+		}
+		result[i * 2] = (int16)floorf(clamp(x, -1.0f, 1.0f) * 32767.0f + 0.5f);
+		result[i * 2 + 1] = (int16)floorf(clamp(y, -1.0f, 1.0f) * 32767.0f + 0.5f);
+	}
+}
+
+void GFX::dequantizeNormals(const int16* quantized, unsigned int num, Vector3f* result)
+{
+	for (unsigned int i = 0; i < num; ++i)
+	{
+		float x = snormToFloat(quantized[i * 2]);
+		float y = snormToFloat(quantized[i * 2 + 1]);
+		float z = 1.0f - fabsf(x) - fabsf(y);
+		if (z < 0.0f)
+		{
+			float ox = x;
+			x = (1.0f - fabsf(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+			y = (1.0f - fabsf(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+		}
+		Vector3f n(x, y, z);
+		float length = n.length();
+		result[i] = length > 0.0f ? n * (1.0f / length) : n;
+	}
+}
+
+void GFX::quantizeUVs(const Vector2f* uvs, unsigned int num, uint16* result)
+{
+	for (unsigned int i = 0; i < num; ++i)
+	{
+		result[i * 2] = floatToHalf(uvs[i].x);
+		result[i * 2 + 1] = floatToHalf(uvs[i].y);
+	}
+}
+
+void GFX::dequantizeUVs(const uint16* quantized, unsigned int num, Vector2f* result)
+{
+	for (unsigned int i = 0; i < num; ++i)
+		result[i].set(halfToFloat(quantized[i * 2]), halfToFloat(quantized[i * 2 + 1]));
+}
+
+uint16 GFX::floatToHalf(float v)
+{
+	uint32 f;
+	memcpy(&f, &v, sizeof(f));
+	uint32 sign = (f >> 16) & 0x8000;
+	uint32 float_exp = (f >> 23) & 0xFF;
+	uint32 mantissa = f & 0x7FFFFF;
+	int exp = (int)float_exp - 127 + 15;
+
+	if (float_exp == 0xFF) //inf or nan
+		return (uint16)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if (exp >= 31) //too big, inf
+		return (uint16)(sign | 0x7C00);
+	if (exp <= 0) //denormal
+	{
+		if (exp < -10)
+			return (uint16)sign;
+		mantissa |= 0x800000;
+		uint32 shift = 14 - exp;
+		uint32 result = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1) //round
+			result++;
+		return (uint16)(sign | result);
+	}
+
+	uint32 result = sign | (exp << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) //round, if it overflows the exponent is increased which is correct
+		result++;
+	return (uint16)result;
+}
+
+float GFX::halfToFloat(uint16 h)
+{
+	uint32 sign = (h & 0x8000) << 16;
+	uint32 exp = (h >> 10) & 0x1F;
+	uint32 mantissa = h & 0x3FF;
+	uint32 f;
+	if (exp == 0)
+	{
+		float v = ldexpf((float)mantissa, -24); //zero or denormal
+		return sign ? -v : v;
+	}
+	if (exp == 31)
+		f = sign | 0x7F800000 | (mantissa << 13);
+	else
+		f = sign | ((exp - 15 + 127) << 23) | (mantissa << 13);
+	float result;
+	memcpy(&result, &f, sizeof(result));
+	return result;
+}
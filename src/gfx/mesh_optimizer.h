@@ -0,0 +1,66 @@
+/*  Processing of the geometry of the meshes to make them faster to render.
+	The optimization stage (optimizeMesh) welds duplicated vertices, reorders the triangles for the
+	post-transform cache and the vertices for fetch locality, and marks which attributes must be
+	stored quantized in the GPU buffers and in the MBIN (the CPU vectors are always in float).
+	It also builds the levels of detail, simplifying the triangles with edge collapses sorted by
+	their quadric error, keeping the vertices of borders and seams in place.
+*/
+
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "../core/math.h"
+
+namespace GFX {
+
+	class Mesh;
+
+	enum eMeshOptimization {
+		MESH_OPTIMIZE_WELD = 1,				//merge vertices with identical attributes (non indexed meshes become indexed)
+		MESH_OPTIMIZE_VERTEX_CACHE = 2,		//reorder triangles for the post-transform cache
+		MESH_OPTIMIZE_VERTEX_FETCH = 4,		//reorder vertices in the order they are used
+		MESH_OPTIMIZE_QUANTIZE_POSITIONS = 8,	//16 bits per component relative to the mesh box
+		MESH_OPTIMIZE_QUANTIZE_NORMALS = 16,	//octahedral encoding in two 16 bits components
+		MESH_OPTIMIZE_QUANTIZE_UVS = 32,		//half floats
+		MESH_OPTIMIZE_LODS = 64,				//simplified versions of the triangles (see generateLODs), opt-in as it is the slowest step
+		MESH_OPTIMIZE_DEFAULT = MESH_OPTIMIZE_WELD | MESH_OPTIMIZE_VERTEX_CACHE | MESH_OPTIMIZE_VERTEX_FETCH,
+		MESH_OPTIMIZE_QUANTIZE = MESH_OPTIMIZE_QUANTIZE_POSITIONS | MESH_OPTIMIZE_QUANTIZE_NORMALS | MESH_OPTIMIZE_QUANTIZE_UVS
+	};
+
+	//post-transform cache efficiency of an index buffer, simulated with a FIFO cache
+	struct sVertexCacheStats {
+		float acmr; //average cache miss ratio, vertices transformed per triangle (0.5 is ideal, 3 is the worst)
+		float atvr; //average transformed vertex ratio, vertices transformed per vertex in the mesh (1 is ideal)
+	};
+
+	//runs the selected steps on the CPU data of the mesh (must be called before uploading it), safe to call from any thread
+	//returns false if the mesh has no vertices
+	bool optimizeMesh(Mesh* mesh, uint32 flags = MESH_OPTIMIZE_DEFAULT);
+
+	//reorders the triangles of an index buffer so consecutive triangles reuse the vertices in the post-transform cache (Forsyth's algorithm)
+	void optimizeVertexCache(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices);
+
+	//collapses edges (moving a vertex into a neighbour) till there are target_num_indices or the next collapse would move the surface more than max_error
+	//the vertices stay the same, writes the new indices in result (num_indices max) and returns how many, result_error is the max distance reached
+	unsigned int simplifyTriangles(unsigned int* result, const unsigned int* indices, unsigned int num_indices, const Vector3f* positions, unsigned int num_vertices, unsigned int target_num_indices, float max_error, float* result_error = NULL);
+
+	//fills the lods of an indexed mesh, every level has half the triangles of the previous one (every submesh on its own)
+	//max_error is relative to the radius, stops when a level cannot remove enough triangles, returns the number of levels
+	int generateLODs(Mesh* mesh, int max_lods = 3, float max_error = 0.2f);
+
+	//if indices is NULL the mesh is not indexed (every vertex is transformed)
+	sVertexCacheStats computeVertexCacheStats(const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, int cache_size = 16);
+
+	//quantization, used by the mesh when uploading and storing the streams
+	void quantizePositions(const Vector3f* positions, unsigned int num, const BoundingBox& box, int16* result); //4 components per vertex, w is padding
+	void dequantizePositions(const int16* quantized, unsigned int num, const BoundingBox& box, Vector3f* result);
+	void quantizeNormals(const Vector3f* normals, unsigned int num, int16* result); //2 components per vertex
+	void dequantizeNormals(const int16* quantized, unsigned int num, Vector3f* result);
+	void quantizeUVs(const Vector2f* uvs, unsigned int num, uint16* result); //2 half floats per vertex
+	void dequantizeUVs(const uint16* quantized, unsigned int num, Vector2f* result);
+
+	uint16 floatToHalf(float v);
+	float halfToFloat(uint16 h);
+};
+
+#endif
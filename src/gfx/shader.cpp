@@ -5,6 +5,7 @@
 #include <functional> 
 #include <cctype>
 #include <locale>
+#include <set>
 
 #include "../utils/utils.h"
 
@@ -63,6 +64,15 @@ std::map<std::string, Shader::UberShader*> Shader::s_ubershaders;
 std::map<std::string,Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
+sUniformStats Shader::s_uniform_stats = { 0, 0, 0 };
+bool Shader::use_binary_cache = true;
+std::string Shader::s_binary_cache_filename = "data/shaders.cache";
+int Shader::s_num_binaries_loaded = 0;
+int Shader::s_num_programs_compiled = 0;
+bool Shader::s_parallel_compile = false;
+int Shader::max_compiles_per_frame = 1;
+std::string Shader::s_variants_filename = "data/shader_variants.txt";
+int Shader::s_num_pending_variants = 0;
 std::vector<char> Shader::lines_with_error;
 
 Shader::Shader()
@@ -71,6 +81,8 @@ Shader::Shader()
 		Shader::init();
 	program = vs = fs = cs = 0;
 	compiled = false;
+	compiling = false;
+	binary_key = 0;
 	from_atlas = false;
 
 }
@@ -195,7 +207,248 @@ bool Shader::hasInfoLog() const
 
 // ******************************************
 
+//the binaries of the linked programs are stored on disk and loaded instead of compiling the same sources again
+//the file has a header with the driver (the binaries of other drivers are rejected) and then the programs
+//appended as they are linked, if there are several with the same key the last one is used
+
+//OSX only has program binaries in the core profile, not with the GLSL 1.10 atlas
+#ifndef __APPLE__
+	#define SHADER_BINARY_CACHE
+#endif
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+	#define GL_PROGRAM_BINARY_LENGTH 0x8741
+	#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#define SHADER_CACHE_MAGIC 0x53525447 //"GTRS"
+#define SHADER_CACHE_VERSION 1
+
+struct sProgramBinary {
+	unsigned int format;
+	std::vector<unsigned char> data;
+	bool used; //loaded or saved in this run, the others are removed when compacting
+};
+
+static std::map<unsigned long long, sProgramBinary> s_program_binaries;
+static bool s_program_binaries_loaded = false;
+static bool s_program_binaries_compacted = false;
+
+//FNV-1a
+static unsigned long long hashString(const std::string& str, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < str.size(); ++i)
+		hash = (hash ^ (unsigned char)str[i]) * 1099511628211ULL;
+	return hash;
+}
+
+static unsigned long long getDriverHash()
+{
+	std::string driver;
+	GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (int i = 0; i < 3; ++i)
+	{
+		const char* str = (const char*)glGetString(names[i]);
+		driver += std::string(str ? str : "") + "\n";
+	}
+	return hashString(driver);
+}
+
+static void loadProgramBinaries()
+{
+	s_program_binaries_loaded = true;
+#ifdef SHADER_BINARY_CACHE
+	GLint num_formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+	if (num_formats <= 0)
+	{
+		std::cout << " - Program binaries not supported, the shaders are always compiled" << std::endl;
+		Shader::use_binary_cache = false;
+		return;
+	}
+
+	unsigned long long driver = getDriverHash();
+	FILE* file = fopen(Shader::s_binary_cache_filename.c_str(), "rb");
+	if (file)
+	{
+		unsigned int header[2] = { 0, 0 };
+		unsigned long long file_driver = 0;
+		bool valid = fread(header, sizeof(header), 1, file) == 1 && fread(&file_driver, sizeof(file_driver), 1, file) == 1 &&
+			header[0] == SHADER_CACHE_MAGIC && header[1] == SHADER_CACHE_VERSION && file_driver == driver;
+		while (valid)
+		{
+			unsigned long long key = 0;
+			unsigned int info[2] = { 0, 0 }; //format and size
+			if (fread(&key, sizeof(key), 1, file) != 1 || fread(info, sizeof(info), 1, file) != 1 || !info[1])
+				break;
+			sProgramBinary& binary = s_program_binaries[key];
+			binary.format = info[0];
+			binary.used = false;
+			binary.data.resize(info[1]);
+			if (fread(&binary.data[0], info[1], 1, file) != 1)
+			{
+				s_program_binaries.erase(key); //truncated
+				break;
+			}
+		}
+		fclose(file);
+		if (valid)
+			return;
+		std::cout << " - Shader cache of another driver or version, it is created again" << std::endl;
+	}
+
+	file = fopen(Shader::s_binary_cache_filename.c_str(), "wb");
+	if (!file)
+		return;
+	unsigned int header[2] = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION };
+	fwrite(header, sizeof(header), 1, file);
+	fwrite(&driver, sizeof(driver), 1, file);
+	fclose(file);
+#endif
+}
+
+//the program is ready to use if it returns true
+static bool loadProgramBinary(GLuint program, unsigned long long key)
+{
+#ifdef SHADER_BINARY_CACHE
+	auto it = s_program_binaries.find(key);
+	if (it == s_program_binaries.end())
+		return false;
+	const sProgramBinary& binary = it->second;
+	glProgramBinary(program, binary.format, &binary.data[0], (GLsizei)binary.data.size());
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	glGetError(); //an unknown format is an error, not only a failed link
+	if (linked)
+	{
+		it->second.used = true;
+		return true;
+	}
+	//rejected by the driver, it is compiled from the sources and stored again
+	s_program_binaries.erase(it);
+#endif
+	return false;
+}
+
+static void saveProgramBinary(GLuint program, unsigned long long key)
+{
+#ifdef SHADER_BINARY_CACHE
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	sProgramBinary& binary = s_program_binaries[key];
+	binary.data.resize(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, NULL, &format, &binary.data[0]);
+	binary.format = format;
+	binary.used = true;
+
+	FILE* file = fopen(Shader::s_binary_cache_filename.c_str(), "ab");
+	if (!file)
+		return;
+	unsigned int info[2] = { binary.format, (unsigned int)length };
+	fwrite(&key, sizeof(key), 1, file);
+	fwrite(info, sizeof(info), 1, file);
+	fwrite(&binary.data[0], length, 1, file);
+	fclose(file);
+#endif
+}
+
+//the file only grows while running (edited shaders, binaries rejected), it is written again with the programs used
+static void compactProgramBinaries()
+{
+	s_program_binaries_compacted = true;
+#ifdef SHADER_BINARY_CACHE
+	if (!s_program_binaries_loaded || !Shader::use_binary_cache)
+		return;
+	size_t num_before = s_program_binaries.size();
+	for (auto it = s_program_binaries.begin(); it != s_program_binaries.end(); )
+	{
+		if (it->second.used)
+			++it;
+		else
+			it = s_program_binaries.erase(it);
+	}
+
+	FILE* file = fopen(Shader::s_binary_cache_filename.c_str(), "wb");
+	if (!file)
+		return;
+	unsigned int header[2] = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION };
+	unsigned long long driver = getDriverHash();
+	fwrite(header, sizeof(header), 1, file);
+	fwrite(&driver, sizeof(driver), 1, file);
+	for (auto& it : s_program_binaries)
+	{
+		unsigned int info[2] = { it.second.format, (unsigned int)it.second.data.size() };
+		fwrite(&it.first, sizeof(it.first), 1, file);
+		fwrite(info, sizeof(info), 1, file);
+		fwrite(&it.second.data[0], info[1], 1, file);
+	}
+	fclose(file);
+	if (num_before != s_program_binaries.size())
+		std::cout << " + Shader cache: " << (num_before - s_program_binaries.size()) << " unused programs removed" << std::endl;
+#endif
+}
+
+//with KHR_parallel_shader_compile the driver compiles and links in its threads, asking for the status
+//before GL_COMPLETION_STATUS_KHR is true would wait for it
+#ifndef GL_COMPLETION_STATUS_KHR
+	#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRY * MaxShaderCompilerThreads_func)(GLuint count);
+
+static void initParallelCompile()
+{
+#ifndef __APPLE__
+	if (!SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile") && !SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile"))
+		return;
+	MaxShaderCompilerThreads_func max_threads = (MaxShaderCompilerThreads_func)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+	if (!max_threads)
+		max_threads = (MaxShaderCompilerThreads_func)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+	if (max_threads)
+		max_threads(0xFFFFFFFF); //as many as the driver wants
+	Shader::s_parallel_compile = true;
+	std::cout << " + Shaders compiled in parallel by the driver" << std::endl;
+#endif
+}
+
+//appends the variant to s_variants_filename the first time it is compiled, to prewarm it the next runs
+static void recordVariant(const std::string& name, uint64 macros)
+{
+	static std::set<std::string> recorded;
+	static bool loaded = false;
+	if (!loaded)
+	{
+		std::string content;
+		if (readFile(Shader::s_variants_filename, content))
+		{
+			std::vector<std::string> lines = split(content, '\n');
+			recorded.insert(lines.begin(), lines.end());
+		}
+		loaded = true;
+	}
+
+	std::string line = name + " " + std::to_string(macros);
+	if (!recorded.insert(line).second)
+		return;
+	FILE* file = fopen(Shader::s_variants_filename.c_str(), "ab");
+	if (!file)
+		return;
+	fprintf(file, "%s\n", line.c_str());
+	fclose(file);
+}
+
 bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
+{
+	if (!beginCompile(vsm, psm))
+		return false;
+	return finishCompile();
+}
+
+bool Shader::beginCompile(const std::string& vsm, const std::string& psm)
 {
 	assert(glGetError() == GL_NO_ERROR);
 
@@ -206,25 +459,75 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	}
 
 	if (program != 0)
+	{
 		glDeleteProgram(program);
+		resetGPUState();
+	}
 	program = glCreateProgram();
 	assert (glGetError() == GL_NO_ERROR);
+	compiled = false;
 
-	if (!createVertexShaderObject(vsm))
+	//the sources include the macros, the driver is checked when loading the file
+	binary_key = 0;
+	if (use_binary_cache)
+	{
+		if (!s_program_binaries_loaded)
+			loadProgramBinaries();
+		binary_key = hashString(psm, hashString(vsm) ^ 0xFF);
+	}
+	if (use_binary_cache && loadProgramBinary(program, binary_key))
+	{
+		s_num_binaries_loaded++;
+		onLinked();
+		return true;
+	}
+#ifdef SHADER_BINARY_CACHE
+	if (use_binary_cache)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+
+	//the results are checked in finishCompile, asking for them would wait for the driver
+	createShaderObject(GL_VERTEX_SHADER, vs, vsm, false);
+	createShaderObject(GL_FRAGMENT_SHADER, fs, psm, false);
+	glLinkProgram(program);
+	assert (glGetError() == GL_NO_ERROR);
+
+	compiling = true;
+	pending_vs = vsm;
+	pending_fs = psm;
+	return true;
+}
+
+bool Shader::isCompileReady()
+{
+	if (!compiling || !s_parallel_compile)
+		return true;
+	GLint done = 0;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+	return done != 0;
+}
+
+bool Shader::finishCompile()
+{
+	if (!compiling)
+		return compiled;
+	compiling = false;
+	std::string vsm, psm;
+	vsm.swap(pending_vs);
+	psm.swap(pending_fs);
+
+	if (!checkShaderObject(vs, vsm))
 	{
 		printf("Vertex shader compilation failed\n");
 		return false;
 	}
 
-	if (!createFragmentShaderObject(psm))
+	if (!checkShaderObject(fs, psm))
 	{
 		printf("Fragment shader compilation failed\n");
 		return false;
 	}
 
-	glLinkProgram(program);
-	assert (glGetError() == GL_NO_ERROR);
-
 	GLint linked=0;
     
 	glGetProgramiv(program,GL_LINK_STATUS,&linked);
@@ -241,12 +544,23 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	validate();
 #endif
 
-	compiled = true;
-	locations.clear(); //regenerate table
+	onLinked();
+	s_num_programs_compiled++;
+	if (use_binary_cache)
+		saveProgramBinary(program, binary_key);
 
 	return true;
 }
 
+void Shader::onLinked()
+{
+	compiled = true;
+	locations.clear(); //regenerate table
+	uniform_locations.clear();
+	block_indices.clear();
+	resolveUniforms();
+}
+
 bool Shader::validate()
 {
 	glValidateProgram(program);
@@ -282,7 +596,7 @@ bool Shader::createComputeShaderObject(const std::string& shader)
 }
 
 
-bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::string& code)
+bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::string& code, bool check)
 {
 	if (handle != 0)
 		glDeleteShader(handle);
@@ -300,6 +614,17 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 	glCompileShader(handle);
 	assert( glGetError() == GL_NO_ERROR );
 
+	if (check && !checkShaderObject(handle, fullcode))
+		return false;
+
+	glAttachShader(program,handle);
+	assert( glGetError() == GL_NO_ERROR );
+
+	return true;
+}
+
+bool Shader::checkShaderObject(GLuint handle, const std::string& fullcode)
+{
 	GLint compile=0;
 	glGetShaderiv(handle,GL_COMPILE_STATUS,&compile);
 	assert( glGetError() == GL_NO_ERROR );
@@ -323,9 +648,6 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 		return false;
 	}
 
-	glAttachShader(program,handle);
-	assert( glGetError() == GL_NO_ERROR );
-
 	return true;
 }
 
@@ -358,9 +680,12 @@ void Shader::release()
 		glDeleteProgram(program);
 		assert (glGetError() == GL_NO_ERROR);
 		program = 0;
+		resetGPUState(); //the name can be given to another program
 	}
 
 	locations.clear();
+	uniform_locations.clear();
+	block_indices.clear();
 
 	compiled = false;
 }
@@ -373,7 +698,7 @@ void Shader::enable()
 
 	current = this;
 
-	glUseProgram(program);
+	useProgram(program);
     GLuint err = glGetError();
 	assert (err == GL_NO_ERROR);
 
@@ -381,18 +706,16 @@ void Shader::enable()
 }
 
 
+//the program stays bound, enabling it again does not need to bind it (see useProgram)
 void Shader::disable()
 {
 	current = NULL;
-
-	glUseProgram(0);
-	//glActiveTexture(GL_TEXTURE0);
-	assert (glGetError() == GL_NO_ERROR);
 }
 
 void Shader::disableShaders()
 {
-	glUseProgram(0);
+	current = NULL;
+	useProgram(0);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
@@ -458,6 +781,7 @@ GLint Shader::getLocation(const char* varname, bool is_block )
 		return 0;
 
 	GLint loc = 0;
+	s_uniform_stats.by_name++;
 
 	loctable::iterator cur = locations.find(varname);
 	
@@ -483,6 +807,127 @@ GLint Shader::getLocation(const char* varname, bool is_block )
 	return loc;
 }
 
+//names of the uniforms interned by sUniformID, in a function to be ready when the static ids are created
+static std::vector<std::string>& getUniformNames()
+{
+	static std::vector<std::string> names;
+	return names;
+}
+
+//global index of the blocks, -1 if not bound
+static std::vector<int>& getBlockBindings()
+{
+	static std::vector<int> bindings;
+	return bindings;
+}
+
+sUniformID::sUniformID(const char* name)
+{
+	index = Shader::registerUniformName(name);
+}
+
+int Shader::registerUniformName(const char* name)
+{
+	assert(name);
+	std::vector<std::string>& names = getUniformNames();
+	for (size_t i = 0; i < names.size(); ++i)
+		if (names[i] == name)
+			return (int)i;
+	names.push_back(name);
+	getBlockBindings().push_back(-1);
+	return (int)names.size() - 1;
+}
+
+void Shader::resolveUniforms()
+{
+	const std::vector<std::string>& names = getUniformNames();
+	const std::vector<int>& bindings = getBlockBindings();
+	size_t first = uniform_locations.size();
+	uniform_locations.resize(names.size(), -1);
+	block_indices.resize(names.size(), -1);
+	if (!program)
+		return;
+	for (size_t i = first; i < names.size(); ++i)
+	{
+		uniform_locations[i] = glGetUniformLocation(program, names[i].c_str());
+		GLuint block = glGetUniformBlockIndex(program, names[i].c_str());
+		block_indices[i] = block == GL_INVALID_INDEX ? -1 : (GLint)block;
+		if (block_indices[i] != -1 && bindings[i] != -1)
+			glUniformBlockBinding(program, block, bindings[i]);
+	}
+}
+
+void Shader::setBlockBinding(const sUniformID& block, int global_index)
+{
+	getBlockBindings()[block.index] = global_index;
+	for (auto it : s_Shaders)
+	{
+		Shader* shader = it.second;
+		if (shader->program && shader->getBlockIndex(block) != -1)
+			glUniformBlockBinding(shader->program, shader->block_indices[block.index], global_index);
+	}
+}
+
+void Shader::setUniform(const sUniformID& id, int input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	CHECK_SHADER_VAR(loc, id.index);
+	glUniform1i(loc, input);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform(const sUniformID& id, float input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	CHECK_SHADER_VAR(loc, id.index);
+	glUniform1f(loc, input);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform(const sUniformID& id, const Vector2f& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	CHECK_SHADER_VAR(loc, id.index);
+	glUniform2f(loc, input.x, input.y);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform(const sUniformID& id, const Vector3f& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	CHECK_SHADER_VAR(loc, id.index);
+	glUniform3f(loc, input.x, input.y, input.z);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform(const sUniformID& id, const Vector4f& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	CHECK_SHADER_VAR(loc, id.index);
+	glUniform4f(loc, input.x, input.y, input.z, input.w);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform(const sUniformID& id, const Matrix44& input)
+{
+	assert(current == this);
+	GLint loc = getLocation(id);
+	CHECK_SHADER_VAR(loc, id.index);
+	glUniformMatrix4fv(loc, 1, GL_FALSE, input.m);
+	assert(glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform(const sUniformID& id, Texture* texture, int slot)
+{
+	bindTexture(slot, texture->texture_type, texture->texture_id);
+	setUniform(id, slot);
+}
+
 int Shader::getAttribLocation(const char* varname)
 {
 	int loc = glGetAttribLocation(program, varname);
@@ -520,10 +965,8 @@ int Shader::getUniformBlockLocation(const char* varname)
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
-	glActiveTexture(GL_TEXTURE0 + slot);
-	glBindTexture(tex->texture_type, tex->texture_id);
+	bindTexture(slot, tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
-	glActiveTexture(GL_TEXTURE0 + slot);
 }
 
 /*
@@ -737,6 +1180,7 @@ void Shader::init()
 		IMPORT_GLEXT( glUniform4fv );
 		IMPORT_GLEXT( glUniformMatrix4fv );
 	#endif
+		initParallelCompile();
 	}
 	
 	firsttime = false;
@@ -930,6 +1374,11 @@ bool Shader::LoadAtlas(const char* filename, const char* base_path_cstr)
 		return false;
 	}
 
+	double time = getTime();
+	int num_loaded = s_num_binaries_loaded;
+	int num_compiled = s_num_programs_compiled;
+	s_program_binaries_compacted = false; //once the new programs are compiled
+
 	//separate subfiles
 	s_shader_atlas_filename = filename;
 	std::vector<std::string> lines = tokenize(content, "\n");
@@ -988,7 +1437,19 @@ bool Shader::LoadAtlas(const char* filename, const char* base_path_cstr)
 			std::vector<std::string> macros_tokens;
 			if (macros.size())
 				macros_tokens = tokenize(macros, ",");
-			s_ubershaders[name] = new UberShader( name, vs_filename, fs_filename, macros_tokens);
+			UberShader* ubershader = new UberShader( name, vs_filename, fs_filename, macros_tokens);
+			//the variants queued when reloading are compiled again with the new code
+			auto old = s_ubershaders.find(name);
+			if (old != s_ubershaders.end())
+			{
+				for (auto it : old->second->pending_shaders)
+				{
+					delete it.second;
+					ubershader->pending_shaders[it.first] = NULL;
+				}
+				old->second->pending_shaders.clear();
+			}
+			s_ubershaders[name] = ubershader;
 		}
 		else //regular shader
 		{
@@ -1015,6 +1476,7 @@ bool Shader::LoadAtlas(const char* filename, const char* base_path_cstr)
 		}
 	}
 
+	std::cout << " + Shader atlas: " << (s_num_programs_compiled - num_compiled) << " compiled, " << (s_num_binaries_loaded - num_loaded) << " from the cache, Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	return true;
 }
 
@@ -1073,7 +1535,7 @@ std::string Shader::ExpandIncludes(std::string name, std::string content, std::m
 	return subfile_content;
 }
 
-Shader* Shader::CompileShader(const char* name, const char* vs_code, const char* fs_code, const char* macros = nullptr)
+Shader* Shader::CompileShader(const char* name, const char* vs_code, const char* fs_code, const char* macros = nullptr, bool async)
 {
 	//expand macros
 	std::string macros_str = "";
@@ -1107,6 +1569,18 @@ Shader* Shader::CompileShader(const char* name, const char* vs_code, const char*
 	vs = version_vs + "\n" + macros_str + "\n" + vs;
 	fs = version_fs + "\n" + macros_str + "\n" + fs;
 
+	//a new one, the one with the same name is still used while this one compiles
+	if (async)
+	{
+		Shader* shader = new Shader();
+		if (!shader->beginCompile(vs, fs))
+		{
+			delete shader;
+			return nullptr;
+		}
+		return shader;
+	}
+
 	Shader* shader = NULL;
 	bool is_new = false;
 	auto it2 = s_Shaders.find(name);
@@ -1149,6 +1623,36 @@ bool Shader::GetShaderFile(const char* filename, std::string& content)
 	return false;
 }
 
+std::string Shader::UberShader::getVariantName(uint64 macros, std::string* macros_str)
+{
+	if (macros_str && macros)
+	{
+		int bit = 1;
+		int max_macros = this->macros.size() < 64 ? this->macros.size() : 64;
+		for (int i = 0; i < max_macros; ++i)
+		{
+			if (macros & bit << i)
+				*macros_str += this->macros[i] + ",";
+		}
+		*macros_str = macros_str->substr(0, macros_str->size() - 1); //remove last comma
+	}
+	return name + "[" + std::to_string(macros) + "]";
+}
+
+Shader* Shader::UberShader::createVariant(uint64 macros, bool async)
+{
+	std::string vs_code;
+	std::string fs_code;
+
+	if( !Shader::GetShaderFile(this->vs_name.c_str(),vs_code) ||
+		!Shader::GetShaderFile(this->fs_name.c_str(), fs_code) )
+		return nullptr;
+
+	std::string macros_str;
+	std::string fullname = getVariantName(macros, &macros_str);
+	return Shader::CompileShader(fullname.c_str(), vs_code.c_str(), fs_code.c_str(), macros_str.c_str(), async);
+}
+
 Shader* Shader::UberShader::get(uint64 macros)
 {
 	auto it = compiled_shaders.find(macros);
@@ -1158,38 +1662,114 @@ Shader* Shader::UberShader::get(uint64 macros)
 	if (has_error)
 		return nullptr;
 
-	std::string fullname = name + "[" + std::to_string(macros) + "]";
+	//started in the background, wait for it
+	auto it2 = pending_shaders.find(macros);
+	if (it2 != pending_shaders.end())
+	{
+		Shader* pending = it2->second;
+		pending_shaders.erase(it2);
+		s_num_pending_variants--;
+		if (pending)
+			return finishVariant(macros, pending);
+	}
 
-	std::string vs_code;
-	std::string fs_code;
+	Shader* shader = createVariant(macros, false);
+	if (!shader)
+	{
+		has_error = true;
+		return nullptr;
+	}
+	compiled_shaders[macros] = shader;
+	shader->vs_filename = this->vs_name;
+	shader->fs_filename = this->fs_name;
+	shader->from_atlas = true;
+	recordVariant(name, macros);
+	std::cout << " + Shader from Ubershader: " << TermColor::CYAN << getVariantName(macros) << TermColor::DEFAULT << std::endl;
+	return shader;
+}
 
-	if( !Shader::GetShaderFile(this->vs_name.c_str(),vs_code) ||
-		!Shader::GetShaderFile(this->fs_name.c_str(), fs_code) )
+Shader* Shader::UberShader::getAsync(uint64 macros)
+{
+	auto it = compiled_shaders.find(macros);
+	if (it != compiled_shaders.end() && it->second)
+		return it->second;
+
+	if (has_error)
 		return nullptr;
 
-	std::string macros_str;
-	if (macros)
+	if (it == compiled_shaders.end())
+		requestVariant(macros);
+
+	//the fallback is compiled at once the first time
+	if (macros == fallback_macros)
+		return get(macros);
+	return getAsync(fallback_macros);
+}
+
+void Shader::UberShader::requestVariant(uint64 macros)
+{
+	if (compiled_shaders.find(macros) != compiled_shaders.end() || pending_shaders.find(macros) != pending_shaders.end())
+		return;
+	pending_shaders[macros] = NULL;
+	s_num_pending_variants++;
+}
+
+void Shader::UberShader::updateVariants(int& num_started)
+{
+	for (auto it = pending_shaders.begin(); it != pending_shaders.end(); )
 	{
-		int bit = 1;
-		int max_macros = this->macros.size() < 64 ? this->macros.size() : 64;
-		for (int i = 0; i < max_macros; ++i)
+		Shader* shader = it->second;
+		if (!shader)
 		{
-			if (macros & bit << i)
-				macros_str += this->macros[i] + ",";
+			//without the extension the driver usually compiles when asked, so only a few every frame
+			if (has_error || (!s_parallel_compile && num_started >= max_compiles_per_frame))
+			{
+				++it;
+				continue;
+			}
+			num_started++;
+			shader = it->second = createVariant(it->first, true);
+			if (!shader)
+			{
+				compiled_shaders[it->first] = NULL;
+				it = pending_shaders.erase(it);
+				s_num_pending_variants--;
+				continue;
+			}
+			if (!s_parallel_compile) //checked the next frame
+			{
+				++it;
+				continue;
+			}
+		}
+		if (!shader->isCompileReady())
+		{
+			++it;
+			continue;
 		}
-		macros_str = macros_str.substr(0, macros_str.size() - 1); //remove last comma
+		finishVariant(it->first, shader);
+		it = pending_shaders.erase(it);
+		s_num_pending_variants--;
 	}
+}
 
-	Shader* shader = Shader::CompileShader(fullname.c_str(), vs_code.c_str(), fs_code.c_str(), macros_str.c_str() );
-	if (!shader)
+Shader* Shader::UberShader::finishVariant(uint64 macros, Shader* shader)
+{
+	std::string fullname = getVariantName(macros);
+	if (!shader->finishCompile())
 	{
-		has_error = true;
+		delete shader;
+		compiled_shaders[macros] = NULL; //getAsync keeps returning the fallback
+		std::cout << " * Compilation error in shader at atlas: " << fullname << std::endl;
 		return nullptr;
 	}
+	//the old one with the same name (before reloading the atlas) could still be referenced, it is not deleted
+	s_Shaders[fullname] = shader;
 	compiled_shaders[macros] = shader;
 	shader->vs_filename = this->vs_name;
 	shader->fs_filename = this->fs_name;
 	shader->from_atlas = true;
+	recordVariant(name, macros);
 	std::cout << " + Shader from Ubershader: " << TermColor::CYAN << fullname << TermColor::DEFAULT << std::endl;
 	return shader;
 }
@@ -1200,6 +1780,39 @@ void Shader::UberShader::clear()
 	//no need to delete shaders, as they are already in the global s_shaders container
 }
 
+void Shader::UpdateCompilations()
+{
+	if (!s_num_pending_variants)
+	{
+		if (!s_program_binaries_compacted)
+			compactProgramBinaries();
+		return;
+	}
+	int num_started = 0;
+	for (auto it : s_ubershaders)
+		if(it.second->pending_shaders.size())
+			it.second->updateVariants(num_started);
+}
+
+void Shader::PrewarmVariants()
+{
+	std::string content;
+	if (!readFile(s_variants_filename, content))
+		return;
+	std::vector<std::string> lines = split(content, '\n');
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		std::vector<std::string> tokens = tokenize(lines[i], " ");
+		if (tokens.size() != 2)
+			continue;
+		UberShader* ubershader = GetUberShader(tokens[0].c_str());
+		if (ubershader)
+			ubershader->requestVariant((uint64)strtoull(tokens[1].c_str(), NULL, 10));
+	}
+	if(s_num_pending_variants)
+		std::cout << " + Shader variants to prewarm: " << s_num_pending_variants << std::endl;
+}
+
 Shader::UberShader* Shader::GetUberShader(const char* name)
 {
 	auto it = s_ubershaders.find(name);
@@ -1236,6 +1849,7 @@ void BufferObject::deallocate()
 	if (!id)
 		return;
 	glDeleteBuffers(1, &id);
+	resetGPUState();
 	id = size = 0;
 }
 
@@ -1251,9 +1865,9 @@ void BufferObject::allocate(int size)
 	}
 
 	//allocate
-	glBindBuffer(type, id);
+	bindBuffer(type, id);
 	glBufferData(type, size, 0, GL_STREAM_DRAW);
-	glBindBuffer(type, 0);
+	bindBuffer(type, 0);
 }
 
 void BufferObject::updateFromPointer(const void* data, int size)
@@ -1268,9 +1882,10 @@ void BufferObject::updateFromPointer(const void* data, int size)
 	}
 
 	//allocate and upload
-	glBindBuffer(type, id);
+	bindBuffer(type, id);
 	glBufferData(type, size, data, GL_STREAM_DRAW);
-	glBindBuffer(type, 0);
+	Shader::s_uniform_stats.buffer_updates++;
+	bindBuffer(type, 0);
 }
 
 void BufferObject::readToPointer(void* data, int size)
@@ -1278,9 +1893,9 @@ void BufferObject::readToPointer(void* data, int size)
 	assert(size && id);
 
 	//allocate and upload
-	glBindBuffer(type, id);
+	bindBuffer(type, id);
 	glGetBufferSubData( type, 0, size, data );
-	glBindBuffer(type, 0);
+	bindBuffer(type, 0);
 }
 
 
@@ -1296,14 +1911,14 @@ void BufferObject::bind(Shader* shader, int index, int start, int length)
 
 	if (length == -1 && start == 0) //it matters to use base instead of range?
 	{
-		glBindBufferBase(type, index, id);
+		bindBufferRange(type, index, id);
 	}
 	else
 	{
 		if (length == -1)
 			length = size - start;
 		assert(start >= 0 && (start + length) <= size);
-		glBindBufferRange(type, index, id, start, length);
+		bindBufferRange(type, index, id, start, length);
 	}
 }
 
@@ -25,6 +25,20 @@ namespace GFX {
 	class Texture;
 	class UBO;
 
+	//name of a uniform (or uniform block) interned once, every shader keeps the locations in an array indexed by it
+	//so setting it does not search the name, declare them static: static const GFX::sUniformID u_model("u_model");
+	struct sUniformID {
+		int index;
+		explicit sUniformID(const char* name);
+	};
+
+	//calls to set uniforms since the last reset (the renderer resets them every frame)
+	struct sUniformStats {
+		int by_name;		//setUniform with the name, searched in the table of the shader
+		int by_id;			//setUniform with a sUniformID
+		int buffer_updates;	//uniform buffers uploaded
+	};
+
 	class Shader
 	{
 		int last_slot;
@@ -45,6 +59,10 @@ namespace GFX {
 
 		//internal functions
 		bool compileFromMemory(const std::string& vsm, const std::string& psm);
+		//compileFromMemory in two steps, the driver can compile in its threads (see s_parallel_compile) until finishCompile
+		bool beginCompile(const std::string& vsm, const std::string& psm);
+		bool isCompileReady(); //finishCompile would not wait
+		bool finishCompile();
 		void release();
 		void enable();
 		void disable();
@@ -69,6 +87,16 @@ namespace GFX {
 		//for textures you must specify an slot (a number from 0 to 16) where this texture is stored in the shader
 		void setUniform(const char* varname, Texture* texture, int slot) { assert(current == this); setTexture(varname, texture, slot); }
 
+		//same with the interned ids, faster for the uniforms set on every draw
+		void setUniform(const sUniformID& id, bool input) { setUniform(id, (int)input); }
+		void setUniform(const sUniformID& id, int input);
+		void setUniform(const sUniformID& id, float input);
+		void setUniform(const sUniformID& id, const Vector2f& input);
+		void setUniform(const sUniformID& id, const Vector3f& input);
+		void setUniform(const sUniformID& id, const Vector4f& input);
+		void setUniform(const sUniformID& id, const Matrix44& input);
+		void setUniform(const sUniformID& id, Texture* texture, int slot);
+
 
 		void setInt(const char* varname, const int& input) { setUniform1(varname, input); }
 		void setFloat(const char* varname, const float& input) { setUniform1(varname, input); }
@@ -121,6 +149,10 @@ namespace GFX {
 		std::string fs_filename;
 		std::string macros;
 		bool compiled;
+		bool compiling; //between beginCompile and finishCompile
+		std::string pending_vs; //sources kept to print the errors in finishCompile
+		std::string pending_fs;
+		unsigned long long binary_key; //of the sources in the binary cache
 		bool from_atlas;
 
 		GLuint vs;
@@ -135,11 +167,13 @@ namespace GFX {
 		bool createVertexShaderObject(const std::string& shader);
 		bool createFragmentShaderObject(const std::string& shader);
 		bool createComputeShaderObject(const std::string& shader); //not used yet
-		bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
+		bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader, bool check = true);
+		bool checkShaderObject(GLuint handle, const std::string& shader); //prints the errors
 		void saveShaderInfoLog(GLuint obj);
 		void saveProgramInfoLog(GLuint obj);
 
 		bool validate();
+		void onLinked(); //resets the locations
 
 		//This is to speed up shader usage (save locations locally)
 		//HACK: uses original const char* value instead of string because uniform names will always come from const char* inside the code (are we sure??)
@@ -149,6 +183,34 @@ namespace GFX {
 		GLint getLocation(const char* varname, bool is_block = false);
 		loctable locations;
 
+		//locations (or block indices) of every sUniformID, -1 if the shader does not have it, resolved after linking
+		std::vector<GLint> uniform_locations;
+		std::vector<GLint> block_indices;
+		void resolveUniforms(); //also for the ids registered after linking
+		GLint getLocation(const sUniformID& id) { s_uniform_stats.by_id++; if (id.index >= (int)uniform_locations.size()) resolveUniforms(); return uniform_locations[id.index]; }
+		GLint getBlockIndex(const sUniformID& id) { if (id.index >= (int)block_indices.size()) resolveUniforms(); return block_indices[id.index]; }
+
+		static int registerUniformName(const char* name); //returns the index of the id, the same for the same name
+		static sUniformStats s_uniform_stats;
+
+		//the linked programs are stored in s_binary_cache_filename and loaded instead of compiled the next runs
+		//(the key is the hash of the sources with the macros, the file is created again if the driver changes)
+		//once the atlas and the prewarmed variants are compiled the file is rewritten with only the programs used in this run
+		static bool use_binary_cache;
+		static std::string s_binary_cache_filename;
+		static int s_num_binaries_loaded;
+		static int s_num_programs_compiled;
+		//the blocks with this name are bound to the global index in all the shaders, the ones linked later too
+		static void setBlockBinding(const sUniformID& block, int global_index);
+
+		//variants of the UberShaders compiled without stalling the frame (see UberShader::getAsync)
+		static bool s_parallel_compile;			//KHR_parallel_shader_compile, the driver compiles in its own threads
+		static int max_compiles_per_frame;		//without the extension, variants started every frame
+		static std::string s_variants_filename;	//variants used, compiled in advance the next runs
+		static int s_num_pending_variants;
+		static void UpdateCompilations();		//once per frame, finishes the ready variants and starts the queued ones
+		static void PrewarmVariants();			//queues the variants stored in s_variants_filename
+
 		//Shader Atlas stuff ************************
 		//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
 		//this is a way to load a single file that contains all the shaders 
@@ -156,7 +218,8 @@ namespace GFX {
 		static std::map<std::string, std::string> s_shader_files; //stores strings with shadercode
 
 		//compiles and stores shader, if exist it will recompile it!
-		static Shader* CompileShader(const char* name, const char* vs_code, const char* fs_code, const char* macros);
+		//if async it is not stored nor checked, call finishCompile
+		static Shader* CompileShader(const char* name, const char* vs_code, const char* fs_code, const char* macros, bool async = false);
 		static std::string ExpandIncludes(std::string name, std::string content, std::map<std::string, std::string>& subfiles, const std::string& base_path);
 		static bool LoadAtlas(const char* filename, const char* base_path = nullptr);
 		static bool GetShaderFile(const char* filename, std::string& content);
@@ -170,15 +233,25 @@ namespace GFX {
 			bool has_error;
 			std::vector<std::string> macros;
 			std::map<std::string,int> macros_index;
-			std::map<uint64,Shader*> compiled_shaders;
+			std::map<uint64,Shader*> compiled_shaders; //NULL for the variants that failed asynchronously
+			std::map<uint64,Shader*> pending_shaders; //queued (NULL) or compiling
+			uint64 fallback_macros; //variant used while the requested one compiles
 			UberShader(std::string name, std::string vs_name, std::string fs_name, std::vector<std::string> macros) {
 				has_error = false;
+				fallback_macros = 0;
 				this->name = name, this->vs_name = vs_name, this->fs_name = fs_name, this->macros = macros;
 				for (size_t i = 0; i < macros.size(); ++i) 
 					macros_index[ macros[i] ] = i;
 			}
 			Shader* get(uint64 macros);
+			//returns the variant if it is ready, otherwise it is queued and the fallback is returned
+			Shader* getAsync(uint64 macros);
+			void requestVariant(uint64 macros); //queues it to compile in the next frames
+			void updateVariants(int& num_started);
 			void clear();
+			std::string getVariantName(uint64 macros, std::string* macros_str = NULL);
+			Shader* createVariant(uint64 macros, bool async);
+			Shader* finishVariant(uint64 macros, Shader* shader);
 			int getMacroIndex(const char* name) { auto it = macros_index.find(name); return it == macros_index.end() ? -1 : it->second; }
 		};
 		static std::map<std::string, UberShader*> s_ubershaders;
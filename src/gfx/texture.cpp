@@ -8,6 +8,8 @@
 #include "fbo.h"
 #include "mesh.h"
 #include "shader.h"
+#include "texture_streamer.h"
+#include "texture_encoder.h"
 
 #include "../utils/utils.h"
 #include "../extra/picopng.h"
@@ -58,6 +60,8 @@ namespace GFX
 	int Texture::default_mag_filter = GL_LINEAR;
 	int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 	FBO* Texture::global_fbo = NULL;
+	bool Texture::use_compression = true;
+	bool Texture::use_bc7 = false;
 
 	Texture::Texture()
 	{
@@ -70,6 +74,7 @@ namespace GFX
 		type = 0;
 		texture_type = GL_TEXTURE_2D;
 		loading = false;
+		streaming = NULL;
 		index = s_last_index++;
 		sTextures.insert(std::pair<unsigned int, Texture*>(index, this));
 		near_far.set(0.1f, 1000.0f);
@@ -78,6 +83,7 @@ namespace GFX
 	Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
 	{
 		loading = false;
+		streaming = NULL;
 		texture_id = 0;
 		index = s_last_index++;
 		sTextures.insert(std::pair<unsigned int, Texture*>(index, this));
@@ -88,6 +94,7 @@ namespace GFX
 	Texture::Texture(::Image* img)
 	{
 		loading = false;
+		streaming = NULL;
 		texture_id = 0;
 		index = s_last_index++;
 		sTextures.insert(std::pair<unsigned int, Texture*>(index,this));
@@ -105,13 +112,17 @@ namespace GFX
 
 	void Texture::clear()
 	{
+		if (streaming)
+			TextureStreamer::instance.stopStreaming(this);
+
 		if (texture_id)
 		{
-			glBindTexture(this->texture_type, 0);
+			bindTexture(this->texture_type, 0);
 
 			//external textures are handled by an outside system (like Android OS)
 			if (texture_type != GL_TEXTURE_EXTERNAL_OES)
 				glDeleteTextures(1, &texture_id);
+			resetGPUState(); //the name can be given to another texture
 
 			if (!loading) //when loading the texture of 1x1 is replaced with the new one
 				stdlog("Destroy texture: " + filename);
@@ -225,7 +236,7 @@ namespace GFX
 		if (texture_id == 0)
 			glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
 
-		glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+		bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 		uploadCubemap(format, type, mipmaps, data, internal_format);
 	}
 
@@ -256,7 +267,7 @@ namespace GFX
 		return texture;
 	}
 
-	Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap)
+	Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap, eTextureSemantic semantic)
 	{
 		//disable loading textures in thread
 		//return Get(filename, mipmaps, wrap);
@@ -276,13 +287,13 @@ namespace GFX
 		temp->loading = true;
 
 		//add action to BG Thread 
-		LoadTextureTask* task = new LoadTextureTask(filename);
+		LoadTextureTask* task = new LoadTextureTask(filename, semantic, use_compression, use_bc7);
 		TaskManager::background.addTask(task);
 
 		return temp;
 	}
 
-	Texture* Texture::DecodeAsync(const char* filename, std::vector<uint8>& buffer, bool mipmaps, bool wrap)
+	Texture* Texture::DecodeAsync(const char* filename, std::vector<uint8>& buffer, bool mipmaps, bool wrap, eTextureSemantic semantic)
 	{
 		//check if exists
 		Texture* texture = Find(filename);
@@ -299,7 +310,7 @@ namespace GFX
 		temp->loading = true;
 
 		//add action to BG Thread 
-		LoadTextureTask* task = new LoadTextureTask(filename,buffer);
+		LoadTextureTask* task = new LoadTextureTask(filename, buffer, semantic);
 		TaskManager::background.addTask(task);
 
 		return temp;
@@ -317,6 +328,13 @@ namespace GFX
 			setName(filename);
 			return true;
 		}
+		if (ext == "dds" || ext == "ktx")
+		{
+			if (!loadKTX(filename))
+				return false;
+			setName(filename);
+			return true;
+		}
 
 		//image based textures
 		::Image* image = new ::Image();
@@ -343,14 +361,14 @@ namespace GFX
 		// We have to synchronously upload for now because Image class is not ref-counted
 		create(image->width, image->height, (image->num_channels == 3 ? GL_RGB : GL_RGBA), type, mipmaps, image->data, 0);
 
-		glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+		bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 		//glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		//glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		//if (mipmaps)
 		//	generateMipmaps();
-		glBindTexture(GL_TEXTURE_2D, 0);
+		bindTexture(GL_TEXTURE_2D, 0);
 	}
 
 	void Texture::upload(::Image* img)
@@ -371,7 +389,7 @@ namespace GFX
 		assert(texture_id && "Must create texture before uploading data.");
 		assert(texture_type == GL_TEXTURE_2D && "Texture type does not match.");
 
-		glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+		bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 		if (internal_format == 0)
 		{
@@ -392,7 +410,7 @@ namespace GFX
 		if (data && this->mipmaps)
 			generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
 
-		glBindTexture(this->texture_type, 0);
+		bindTexture(this->texture_type, 0);
 		assert(checkGLErrors() && "Error uploading texture");
 	}
 
@@ -401,7 +419,7 @@ namespace GFX
 		assert(texture_id && "Must create texture before uploading data.");
 		assert(texture_type == GL_TEXTURE_3D && "Texture type does not match.");
 
-		glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+		bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 		glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, depth, 0, format, type, data);
 
@@ -414,7 +432,7 @@ namespace GFX
 		if (data && this->mipmaps)
 			generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D);
 
-		glBindTexture(this->texture_type, 0);
+		bindTexture(this->texture_type, 0);
 		assert(checkGLErrors() && "Error uploading texture");
 	}
 	*/
@@ -425,7 +443,7 @@ namespace GFX
 		assert(texture_type == GL_TEXTURE_CUBE_MAP && "Texture type does not match.");
 		//assert(glGetError() == GL_NO_ERROR);
 
-		glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+		bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
 		int w = ((int)this->width) >> level;
@@ -466,7 +484,7 @@ namespace GFX
 			//	generateMipmaps();
 		}
 
-		glBindTexture(this->texture_type, 0);
+		bindTexture(this->texture_type, 0);
 		assert(glGetError() == GL_NO_ERROR && "Error creating texture");
 	}
 
@@ -526,7 +544,7 @@ namespace GFX
 		assert(glGetError() == GL_NO_ERROR);
 		if (texture_id == 0)
 			glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-		glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+		bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 		glTexImage3D(this->texture_type, 0, format, width, height, num_textures, 0, dataFormat, type, data);
 		assert(glGetError() == GL_NO_ERROR);
 
@@ -554,51 +572,157 @@ namespace GFX
 		return loadKTX(buffer);
 	}
 
-	bool Texture::loadKTX(std::vector<unsigned char>& buffer)
+	void Texture::beginUpload(unsigned int width, unsigned int height, int num_channels, unsigned int compressed_format, int num_levels, bool wrap)
 	{
-		std::vector<unsigned char> out_image;
+		assert(width && height && num_levels > 0 && "texture must have a size");
+		assert((compressed_format || num_channels == 3 || num_channels == 4) && "only RGB and RGBA");
+
+		//a new texture, the levels of the previous one (the 1x1 while loading) cannot be mixed with the new ones
+		//only the GL name is released, clear() would also remove it from sTexturesLoaded while it is still loading
+		if (texture_id != 0)
+		{
+			bindTexture(this->texture_type, 0);
+			glDeleteTextures(1, &texture_id);
+			resetGPUState(); //the name can be given to another texture
+			texture_id = 0;
+		}
 
+		this->width = (float)width;
+		this->height = (float)height;
+		this->depth = 0;
+		this->format = (compressed_format || num_channels == 4) ? GL_RGBA : GL_RGB;
+		this->internal_format = compressed_format ? compressed_format : (num_channels == 4 ? GL_RGBA8 : GL_RGB8);
+		this->type = GL_UNSIGNED_BYTE;
+		this->texture_type = GL_TEXTURE_2D;
+		this->mipmaps = num_levels > 1;
+
+		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
+		bindTexture(this->texture_type, texture_id);
+		//incomplete until the last level is uploaded, then uploadLevel lowers the base level
+		glTexParameteri(this->texture_type, GL_TEXTURE_BASE_LEVEL, num_levels - 1);
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, (this->mipmaps && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		if (compressed_format == GL_COMPRESSED_RED_RGTC1)
+		{
+			glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_G, GL_RED);
+			glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_B, GL_RED);
+		}
+		bindTexture(this->texture_type, 0);
+	}
+
+	//data is the whole level, the compressed levels are always uploaded whole
+	void Texture::uploadLevel(int level, const uint8* data, int first_row, int num_rows)
+	{
+		assert(texture_id && data);
+		int w = std::max((int)width >> level, 1);
+		int h = std::max((int)height >> level, 1);
+		if (num_rows == -1)
+			num_rows = h - first_row;
+		assert(first_row >= 0 && num_rows > 0 && first_row + num_rows <= h);
+		int block_bytes = getBlockBytes(internal_format);
+
+		bindTexture(this->texture_type, texture_id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1); //rows of the small RGB mips are not aligned to 4 bytes
+		if (block_bytes)
+		{
+			assert(first_row == 0 && num_rows == h);
+			glCompressedTexImage2D(this->texture_type, level, internal_format, w, h, 0, ((w + 3) / 4) * ((h + 3) / 4) * block_bytes, data);
+		}
+		else if (first_row == 0 && num_rows == h)
+			glTexImage2D(this->texture_type, level, internal_format, w, h, 0, format, GL_UNSIGNED_BYTE, data);
+		else
+		{
+			if (first_row == 0) //allocated with the first slice
+				glTexImage2D(this->texture_type, level, internal_format, w, h, 0, format, GL_UNSIGNED_BYTE, NULL);
+			glTexSubImage2D(this->texture_type, level, 0, first_row, w, num_rows, format, GL_UNSIGNED_BYTE, data + first_row * w * (format == GL_RGBA ? 4 : 3));
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		//complete from this level
+		if (first_row + num_rows == h)
+			glTexParameteri(this->texture_type, GL_TEXTURE_BASE_LEVEL, level);
+		bindTexture(this->texture_type, 0);
+	}
+
+	bool Texture::loadKTX(std::vector<unsigned char>& buffer)
+	{
 		ddsktx_texture_info tc = { 0 };
-		if (!ddsktx_parse(&tc, &buffer[0], buffer.size(), NULL))
+		if (buffer.empty() || !ddsktx_parse(&tc, &buffer[0], buffer.size(), NULL))
 			return false;
 
-		this->texture_type = GL_TEXTURE_2D;
-		if (tc.flags & DDSKTX_TEXTURE_FLAG_CUBEMAP)
-			this->texture_type = GL_TEXTURE_CUBE_MAP;
-		else if (tc.flags & DDSKTX_TEXTURE_FLAG_VOLUME)
-			this->texture_type = GL_TEXTURE_3D;
+		if (tc.flags & (DDSKTX_TEXTURE_FLAG_CUBEMAP | DDSKTX_TEXTURE_FLAG_VOLUME))
+		{
+			std::cout << "DDS/KTX cubemaps and volumes not supported" << std::endl;
+			return false;
+		}
+
+		//block compressed or one of the plain formats
+		unsigned int block_format = getBlockGLFormat(tc.format);
+		unsigned int format = 0;
+		if (tc.format == DDSKTX_FORMAT_RGBA8)
+			format = GL_RGBA;
+		else if (tc.format == DDSKTX_FORMAT_RGB8)
+			format = GL_RGB;
+		else if (tc.format == DDSKTX_FORMAT_R8)
+			format = GL_RED;
+		if (!block_format && !format)
+		{
+			std::cout << "DDS/KTX format not supported: " << ddsktx_format_str(tc.format) << std::endl;
+			return false;
+		}
 
+		this->texture_type = GL_TEXTURE_2D;
 		if (texture_id == 0)
 			glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-		glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+		bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 		for (int mip = 0; mip < tc.num_mips; mip++) {
 			ddsktx_sub_data sub_data;
 			ddsktx_get_sub(&tc, &sub_data, &buffer[0], buffer.size(), 0, 0, mip);
-			// Fill/Set texture sub resource data (mips in this case)
-			/*
-			if (ddsktx_format_compressed(tc.format))
-				//glCompressedTexImage2D(this->texture_type,mip,
+			if (block_format)
+				glCompressedTexImage2D(this->texture_type, mip, block_format, sub_data.width, sub_data.height, 0, sub_data.size_bytes, sub_data.buff);
 			else
-				glTexImage2D(this->texture_type, mip, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data);
-				//glTexImage2D(..);
-			*/
+				glTexImage2D(this->texture_type, mip, format, sub_data.width, sub_data.height, 0, format, GL_UNSIGNED_BYTE, sub_data.buff);
 		}
-
-		return true;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		this->width = (float)tc.width;
+		this->height = (float)tc.height;
+		this->format = block_format ? GL_RGBA : format;
+		this->internal_format = block_format ? block_format : format;
+		this->type = GL_UNSIGNED_BYTE;
+		this->mipmaps = tc.num_mips > 1;
+
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, tc.num_mips - 1);
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		//one channel textures are grey
+		if (block_format == GL_COMPRESSED_RED_RGTC1 || format == GL_RED)
+		{
+			glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_G, GL_RED);
+			glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_B, GL_RED);
+		}
+		bindTexture(this->texture_type, 0);
+		return checkGLErrors();
 	}
 
 
 	void Texture::bind()
 	{
 		//glEnable(this->texture_type); //enable the textures 
-		glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+		bindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 	}
 
 	void Texture::unbind()
 	{
 		//glDisable(this->texture_type); //disable the textures 
-		glBindTexture(this->texture_type, 0);	//disable the id of the texture we are going to use
+		bindTexture(this->texture_type, 0);	//disable the id of the texture we are going to use
 	}
 
 	void Texture::UnbindAll()
@@ -606,9 +730,9 @@ namespace GFX
 		glDisable(GL_TEXTURE_CUBE_MAP);
 		glDisable(GL_TEXTURE_2D);
 		glDisable(GL_TEXTURE_3D);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-		glBindTexture(GL_TEXTURE_3D, 0);
+		bindTexture(GL_TEXTURE_2D, 0);
+		bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		bindTexture(GL_TEXTURE_3D, 0);
 	}
 
 	void Texture::generateMipmaps()
@@ -617,7 +741,7 @@ namespace GFX
 		if (!glGenerateMipmapEXT)
 			return;
 
-		glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+		bindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter); //set the mag filter
 		if (this->texture_type == GL_TEXTURE_CUBE_MAP)
 		{
@@ -626,7 +750,7 @@ namespace GFX
 		}
 		glGenerateMipmapEXT(this->texture_type);
 #else
-		glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+		bindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter);
 		glGenerateMipmap(this->texture_type);
 #endif
@@ -642,8 +766,7 @@ namespace GFX
 		if (shader->getUniformLocation("u_texture") != -1)
 			shader->setUniform("u_texture", this, 0);
 		assert(glGetError() == GL_NO_ERROR);
-		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_CULL_FACE);
+		setGPUState(GFX_STATE_NONE, GFX_STATE_DEPTH_TEST_MASK | GFX_STATE_CULL_MASK);
 		quad->render(GL_TRIANGLES);
 		assert(glGetError() == GL_NO_ERROR);
 		shader->disable();
@@ -683,9 +806,8 @@ namespace GFX
 		{
 			if (format == GL_DEPTH_COMPONENT) //to clone depth buffer
 			{
-				glEnable(GL_DEPTH_TEST); //we need to use the depth buffer
-				glDepthFunc(GL_ALWAYS); //but ignore the test, every fragment should update the depth
-				glColorMask(false, false, false, false); //block drawing to colors
+				//we need to use the depth buffer but ignore the test, every fragment should update the depth, and block drawing to colors
+				setGPUState(GFX_STATE_DEPTH_TEST_ALWAYS | GFX_STATE_WRITE_Z, GFX_STATE_DEPTH_TEST_MASK | GFX_STATE_WRITE_MASK);
 				if (!shader)
 					shader = Shader::getDefaultShader("screen_depth");
 			}
@@ -695,23 +817,19 @@ namespace GFX
 			shader->enable();
 			shader->setUniform("u_texture", this, 0);
 			shader->setUniform("u_color", Vector4f(1, 1, 1, 1));
-			glDisable(GL_CULL_FACE);
+			setGPUState(GFX_STATE_NONE, GFX_STATE_CULL_MASK);
 			quad->render(GL_TRIANGLES);
-			glColorMask(true, true, true, true);
-			glDisable(GL_DEPTH_TEST);
-			glDepthFunc(GL_LESS);
+			setGPUState(GFX_STATE_WRITE_RGB | GFX_STATE_WRITE_A, GFX_STATE_DEPTH_TEST_MASK | GFX_STATE_WRITE_RGB | GFX_STATE_WRITE_A);
 			return;
 		}
 
-		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_BLEND);
+		setGPUState(GFX_STATE_NONE, GFX_STATE_DEPTH_TEST_MASK | GFX_STATE_BLEND_MASK);
 		FBO* fbo = getGlobalFBO(destination);
 		fbo->bind();
 		if (!shader && format == GL_DEPTH_COMPONENT)
 		{
 			shader = Shader::getDefaultShader("screen_depth");
-			glDepthFunc(GL_ALWAYS);
-			glEnable(GL_DEPTH_TEST);
+			setGPUState(GFX_STATE_DEPTH_TEST_ALWAYS, GFX_STATE_DEPTH_TEST_MASK);
 			Mesh* quad = Mesh::getQuad();
 			shader->enable();
 			if (shader->getUniformLocation("u_texture") != -1)
@@ -722,8 +840,7 @@ namespace GFX
 		else
 			toViewport(shader);
 		fbo->unbind();
-		glDisable(GL_DEPTH_TEST);
-		glDepthFunc(GL_LESS);
+		setGPUState(GFX_STATE_NONE, GFX_STATE_DEPTH_TEST_MASK);
 	}
 
 };
@@ -1105,90 +1222,174 @@ GFX::Texture* CubemapFromHDRE(const char* filename, GFX::Texture* output)
 
 //*********************
 
-LoadTextureTask::LoadTextureTask(const char* str)
+LoadTextureTask::LoadTextureTask(const char* str, GFX::eTextureSemantic semantic, bool compress, bool high_quality)
 {
 	filename = str;
-	image = NULL;
+	this->semantic = semantic;
+	this->compress = compress;
+	this->high_quality = high_quality;
 }
 
-LoadTextureTask::LoadTextureTask(const char* filename, std::vector<uint8>& buffer)
+LoadTextureTask::LoadTextureTask(const char* filename, std::vector<uint8>& buffer, GFX::eTextureSemantic semantic)
 {
 	this->filename = filename;
-	image = NULL;
 	this->buffer = buffer;
+	this->semantic = semantic;
+	compress = false; //no file to store the cache next to
+	high_quality = false;
 }
 
 void LoadTextureTask::onExecute()
 {
-	image = new Image();
+	std::vector< std::vector<uint8> > levels;
+	int width = 0, height = 0, num_channels = 4;
 
-	if (buffer.size())
+	//the blocks were encoded in a previous run
+	std::vector<uint8> compressed;
+	unsigned int compressed_format = 0;
+	if (compress && GFX::readCompressedCache(filename.c_str(), semantic, high_quality, compressed))
+		compressed_format = GFX::readCompressedMips(compressed, 0, levels, &width, &height);
+
+	if (!compressed_format)
 	{
-		double time = getTime();
-		std::cout << " + Image decoding: " << TermColor::YELLOW << filename << TermColor::DEFAULT << " ... ";
-		std::string ext = toLowerCase(getExtension(filename));
-		if(ext == "png")
-			image->loadPNG(buffer);
-		else if(ext == "jpg" || ext == "jpeg")
-			image->loadJPG(buffer);
-		if (!image->width)
+		Image image;
+		if (buffer.size())
 		{
-			delete image;
-			image = NULL;
-			std::cout << TermColor::RED << "[ERROR]: unsupported format" << TermColor::DEFAULT << std::endl;
+			double time = getTime();
+			std::cout << " + Image decoding: " << TermColor::YELLOW << filename << TermColor::DEFAULT << " ... ";
+			//the names of the embedded images do not always have an extension
+			std::string ext = toLowerCase(getExtension(filename));
+			bool png = buffer.size() > 4 && buffer[0] == 0x89 && buffer[1] == 'P' && buffer[2] == 'N' && buffer[3] == 'G';
+			if (png || ext == "png")
+				image.loadPNG(buffer);
+			else if (ext == "jpg" || ext == "jpeg" || (buffer.size() > 2 && buffer[0] == 0xFF && buffer[1] == 0xD8))
+				image.loadJPG(buffer);
+			if (!image.width)
+			{
+				std::cout << TermColor::RED << "[ERROR]: unsupported format" << TermColor::DEFAULT << std::endl;
+				return;
+			}
+			std::cout << "[OK] Size: " << image.width << "x" << image.height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		}
+		else if (!image.load(filename.c_str()))
 			return;
+
+		//encode it and store it for the next time
+		if (compress)
+		{
+			double time = getTime();
+			std::cout << " + Image compressing: " << TermColor::YELLOW << filename << TermColor::DEFAULT << " ... ";
+			if (GFX::compressImage(&image, semantic, high_quality, compressed))
+			{
+				if (!GFX::writeCompressedCache(filename.c_str(), compressed))
+					std::cout << TermColor::RED << "[ERROR]: cannot write " << GFX::getCompressedCacheName(filename.c_str()) << TermColor::DEFAULT << " ";
+				std::cout << "[OK] Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+				compressed_format = GFX::readCompressedMips(compressed, 0, levels, &width, &height);
+			}
+			else
+				std::cout << TermColor::RED << "[ERROR]: unsupported image" << TermColor::DEFAULT << std::endl;
+		}
+
+		//the mips are built here instead of in the GPU while uploading (only power of two, like Texture::create)
+		if (!compressed_format)
+		{
+			width = image.width;
+			height = image.height;
+			num_channels = image.num_channels;
+			if (isPowerOfTwo(width) && isPowerOfTwo(height))
+				GFX::buildMipChain(image.data, width, height, num_channels, semantic, 0, levels);
+			else
+				levels.push_back(std::vector<uint8>(image.data, image.data + width * height * num_channels));
 		}
-		std::cout << "[OK] Size: " << image->width << "x" << image->height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-	}
-	else if (!image->load(filename.c_str()))
-	{
-		delete image;
-		image = NULL;
-		return;
 	}
 
-	//image loaded, ready to go back to main thread
-	UploadTextureTask* upload_task = new UploadTextureTask(filename.c_str(), image);
+	//ready to go back to main thread
+	UploadTextureTask* upload_task = new UploadTextureTask(filename.c_str(), levels, width, height, num_channels, compressed_format, semantic, buffer.empty());
 	TaskManager::foreground.addTask(upload_task);
 }
 
-UploadTextureTask::UploadTextureTask(const char* filename, Image* image)
+size_t UploadTextureTask::max_bytes_per_step = 1024 * 1024;
+
+UploadTextureTask::UploadTextureTask(const char* filename, std::vector< std::vector<uint8> >& levels, int width, int height, int num_channels, unsigned int compressed_format, GFX::eTextureSemantic semantic, bool streamable)
 {
 	this->filename = filename;
-	this->image = image;
-	assert(image && "image cannot be null");
+	this->levels.swap(levels);
+	this->width = width;
+	this->height = height;
+	this->num_channels = num_channels;
+	this->compressed_format = compressed_format;
+	this->semantic = semantic;
+	this->streamable = streamable;
+	level = -1;
+	row = 0;
 }
 
 void UploadTextureTask::onExecute()
 {
 	GFX::Texture* texture = NULL;
-	if (!image)
+	if (levels.empty())
 	{
 		std::cerr << "Image is null: " << filename << std::endl;
 		return;
 	}
-	assert(image && "image cant be null");
-
 	//in case somehow it got loaded while I was loading it in the background
 	auto it = GFX::Texture::sTexturesLoaded.find(filename);
 	if (it == GFX::Texture::sTexturesLoaded.end())
 	{
-		/*
-		//create texture
-		if (!texture)
-			texture = new Texture();
-		*/
-		delete image;
 		std::cout << "Warning: image loaded in background not found foreground thread" << std::endl;
 		return;
 	}
 
 	texture = it->second;
 
-	//upload to GPU
-	texture->loadFromImage(image);
-	texture->loading = false;
+	if (level == -1)
+	{
+		//only the small mips if it is streamed
+		GFX::sTextureMips mips;
+		mips.first_mip = 0;
+		mips.num_channels = num_channels;
+		mips.compressed_format = compressed_format;
+		mips.levels.swap(levels);
+		bool streamed = streamable && GFX::TextureStreamer::instance.startStreaming(texture, mips, width, height, semantic);
+		mips.levels.swap(levels);
+		if (streamed)
+		{
+			texture->loading = false;
+			return;
+		}
+		texture->beginUpload(width, height, num_channels, compressed_format, (int)levels.size());
+		level = (int)levels.size() - 1;
+	}
+
+	//from the coarsest level, the small ones go together
+	size_t bytes = 0;
+	while (level >= 0 && bytes < max_bytes_per_step)
+	{
+		int level_height = std::max(height >> level, 1);
+		int num_rows = level_height - row;
+		size_t row_bytes = levels[level].size() / level_height;
+		if (!compressed_format)
+			num_rows = std::min(num_rows, std::max((int)((max_bytes_per_step - bytes) / row_bytes), 1));
+		texture->uploadLevel(level, &levels[level][0], row, num_rows);
+		bytes += num_rows * row_bytes;
+		row += num_rows;
+		if (row < level_height)
+			continue;
+		std::vector<uint8>().swap(levels[level]); //free it
+		level--;
+		row = 0;
+	}
+
+	if (level < 0)
+	{
+		texture->loading = false;
+		GFX::checkGLErrors();
+		return;
+	}
 
-	//delete image
-	delete image;
+	//the rest in the next frames, the task is deleted after executing it
+	UploadTextureTask* next = new UploadTextureTask(filename.c_str(), levels, width, height, num_channels, compressed_format, semantic, streamable);
+	next->level = level;
+	next->row = row;
+	TaskManager::foreground.addTask(next);
 }
@@ -17,6 +17,7 @@ namespace GFX {
 	class Shader;
 	class FBO;
 	class Texture;
+	struct sTextureStreaming;
 };
 
 #ifndef OPENGL_ES3
@@ -105,6 +106,13 @@ public:
 
 namespace GFX {
 
+	//what the texture contains, to choose how it is compressed (see texture_encoder.h)
+	enum eTextureSemantic {
+		TEXTURE_COLOR,		//albedo, emissive
+		TEXTURE_NORMALMAP,	//tangent space normals
+		TEXTURE_DATA		//metallic-roughness, occlusion (linear values)
+	};
+
 	// TEXTURE CLASS
 	class Texture
 	{
@@ -112,6 +120,8 @@ namespace GFX {
 		static int default_mag_filter;
 		static int default_min_filter;
 		static FBO* global_fbo;
+		static bool use_compression;	//textures loaded with GetAsync are block compressed and cached in a DDS next to the file
+		static bool use_bc7;			//BC7 for color and data instead of BC1/BC3, better quality but needs GL 4.2 (not in OSX)
 
 		//a general struct to store all the information about a TGA file
 
@@ -141,6 +151,9 @@ namespace GFX {
 		//original data info
 		::Image image;
 
+		//mips loaded on demand, NULL if the texture is not streamed (see texture_streamer.h)
+		sTextureStreaming* streaming;
+
 		Texture();
 		Texture(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 		Texture(::Image* img);
@@ -162,6 +175,11 @@ namespace GFX {
 		void uploadCubemap(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8** data = NULL, unsigned int internal_format = 0, int level = 0);
 		void uploadAsArray(unsigned int texture_size, bool mipmaps = true);
 
+		//progressive upload of a chain built on the CPU: allocates the texture and then every level is uploaded from the last one
+		//(or in slices of rows), the texture samples the uploaded levels meanwhile. compressed_format is 0 if the levels are pixels
+		void beginUpload(unsigned int width, unsigned int height, int num_channels, unsigned int compressed_format, int num_levels, bool wrap = true);
+		void uploadLevel(int level, const uint8* data, int first_row = 0, int num_rows = -1);
+
 		bool loadKTX(const char* filename);
 		bool loadKTX(std::vector<unsigned char>& buffer);
 
@@ -180,8 +198,8 @@ namespace GFX {
 
 		//load using the manager (caching loaded ones to avoid reloading them)
 		static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
-		static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true);
-		static Texture* DecodeAsync(const char* filename, std::vector<uint8>& buffer, bool mipmaps = true, bool wrap = true);
+		static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true, eTextureSemantic semantic = TEXTURE_COLOR);
+		static Texture* DecodeAsync(const char* filename, std::vector<uint8>& buffer, bool mipmaps = true, bool wrap = true, eTextureSemantic semantic = TEXTURE_COLOR);
 		static Texture* Find(const char* filename);
 		void setName(const char* name) {
 			filename = name;
@@ -208,26 +226,40 @@ GFX::Texture* CubemapFromHDRE(const char* filename, GFX::Texture* output = nullp
 bool isPowerOfTwo(int n);
 
 //When loading textures asyncrhonously, first we load them from the hard drive in a background thread
+//(every texture in its own task, so they are decoded in all the workers) and build the mips there,
 //afterwards we pass the data to the main thread as bg threads cannot access opengl, and main thread
-//uploads to GPU. While loading a fake 1x1 texture is created
+//uploads to GPU a few mips every frame. While loading a fake 1x1 texture is created
 
 class LoadTextureTask : public Task {
 public:
 	std::string filename;
 	std::vector<uint8> buffer;
-	Image* image;
+	GFX::eTextureSemantic semantic;
+	bool compress;		//read the DDS cached next to the file or create it
+	bool high_quality;	//BC7
 
-	LoadTextureTask(const char* filename);
-	LoadTextureTask(const char* filename, std::vector<uint8>& buffer);
+	LoadTextureTask(const char* filename, GFX::eTextureSemantic semantic = GFX::TEXTURE_COLOR, bool compress = false, bool high_quality = false);
+	LoadTextureTask(const char* filename, std::vector<uint8>& buffer, GFX::eTextureSemantic semantic = GFX::TEXTURE_COLOR);
 	void onExecute();
 };
 
+//uploads the levels from the coarsest one, a slice of max_bytes_per_step every execution, and adds itself again to the
+//foreground tasks until it is done, so the uploads of many textures are spread over the frames (see TaskManager::fetchTasks)
 class UploadTextureTask : public Task {
 public:
-	std::string filename;
-	Image* image;
+	static size_t max_bytes_per_step;
 
-	UploadTextureTask(const char* filename, Image* image);
+	std::string filename;
+	std::vector< std::vector<uint8> > levels; //from mip 0, pixels or blocks
+	int width, height;
+	int num_channels;
+	unsigned int compressed_format; //GL format of the blocks, 0 if the levels are pixels
+	GFX::eTextureSemantic semantic;
+	bool streamable; //the image comes from a file that can be read again to stream the mips
+	int level;	//next level to upload, -1 before starting
+	int row;	//first row of the level not uploaded yet
+
+	UploadTextureTask(const char* filename, std::vector< std::vector<uint8> >& levels, int width, int height, int num_channels, unsigned int compressed_format, GFX::eTextureSemantic semantic, bool streamable = false);
 	void onExecute();
 };
 
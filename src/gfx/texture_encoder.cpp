@@ -0,0 +1,800 @@
+#include "texture_encoder.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <cstdio>
+#include <cassert>
+#include <sys/stat.h>
+
+#include "../core/task.h"
+#include "../utils/utils.h"
+#include "../extra/dds-ktx.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_ENCODER_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace GFX;
+
+#define DDS_MAGIC 0x20534444		//"DDS "
+#define DDS_FOURCC_DX10 0x30315844	//"DX10"
+#define DDS_CACHE_TAG 0x43525447	//"GTRC", stored in the reserved words of the header with the version and the settings
+#define DDS_CACHE_VERSION 3		//2: mips of the colors averaged in linear space, 3: size and time of the source in the header
+#define DDS_CACHE_STAMP 12			//first of the four words with the size and time of the source
+#define DDS_HEADER_WORDS 37			//magic, header and DX10 header
+
+//pixels of a 4x4 block, one array per channel (0..255)
+struct sPixelBlock {
+	float channels[4][16];
+};
+
+static void fetchBlock(const uint8* rgba, int width, int height, int block_x, int block_y, sPixelBlock& block)
+{
+	//the blocks on the borders repeat the last row and column
+	for (int y = 0; y < 4; ++y)
+	{
+		const uint8* row = rgba + std::min(block_y * 4 + y, height - 1) * width * 4;
+		for (int x = 0; x < 4; ++x)
+		{
+			const uint8* pixel = row + std::min(block_x * 4 + x, width - 1) * 4;
+			for (int c = 0; c < 4; ++c)
+				block.channels[c][y * 4 + x] = pixel[c];
+		}
+	}
+}
+
+//writes the closest palette entry of every pixel (comparing num_channels from first_channel) and returns the squared error
+static float findClosest(const sPixelBlock& block, int first_channel, int num_channels, const float (*palette)[4], int num_entries, uint8* indices)
+{
+#ifdef TEXTURE_ENCODER_SSE
+	__m128 total = _mm_setzero_ps();
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 pixels[4];
+		for (int c = 0; c < num_channels; ++c)
+			pixels[c] = _mm_loadu_ps(&block.channels[first_channel + c][i]);
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i best_index = _mm_setzero_si128();
+		for (int e = 0; e < num_entries; ++e)
+		{
+			__m128 distance = _mm_setzero_ps();
+			for (int c = 0; c < num_channels; ++c)
+			{
+				__m128 diff = _mm_sub_ps(pixels[c], _mm_set1_ps(palette[e][first_channel + c]));
+				distance = _mm_add_ps(distance, _mm_mul_ps(diff, diff));
+			}
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+			best = _mm_min_ps(distance, best);
+			best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(e)), _mm_andnot_si128(closer, best_index));
+		}
+		int result[4];
+		_mm_storeu_si128((__m128i*)result, best_index);
+		for (int j = 0; j < 4; ++j)
+			indices[i + j] = (uint8)result[j];
+		total = _mm_add_ps(total, best);
+	}
+	float sums[4];
+	_mm_storeu_ps(sums, total);
+	return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+	float total = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		float best = FLT_MAX;
+		for (int e = 0; e < num_entries; ++e)
+		{
+			float distance = 0.0f;
+			for (int c = 0; c < num_channels; ++c)
+			{
+				float diff = block.channels[first_channel + c][i] - palette[e][first_channel + c];
+				distance += diff * diff;
+			}
+			if (distance < best)
+			{
+				best = distance;
+				indices[i] = (uint8)e;
+			}
+		}
+		total += best;
+	}
+	return total;
+#endif
+}
+
+//endpoints at both ends of the line that fits the pixels best (the principal axis of their covariance)
+static void fitLine(const sPixelBlock& block, int first_channel, int num_channels, float* start, float* end)
+{
+	float mean[4] = { 0, 0, 0, 0 };
+	float min_value[4], max_value[4];
+	for (int c = 0; c < num_channels; ++c)
+	{
+		const float* values = block.channels[first_channel + c];
+		min_value[c] = max_value[c] = values[0];
+		for (int i = 0; i < 16; ++i)
+		{
+			mean[c] += values[i];
+			min_value[c] = std::min(min_value[c], values[i]);
+			max_value[c] = std::max(max_value[c], values[i]);
+		}
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[4][4];
+	memset(covariance, 0, sizeof(covariance));
+	for (int i = 0; i < 16; ++i)
+		for (int a = 0; a < num_channels; ++a)
+			for (int b = 0; b < num_channels; ++b)
+				covariance[a][b] += (block.channels[first_channel + a][i] - mean[a]) * (block.channels[first_channel + b][i] - mean[b]);
+
+	//power iteration, starting from the diagonal of the box
+	float axis[4];
+	for (int c = 0; c < num_channels; ++c)
+		axis[c] = max_value[c] - min_value[c];
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[4] = { 0, 0, 0, 0 };
+		float largest = 0.0f;
+		for (int a = 0; a < num_channels; ++a)
+		{
+			for (int b = 0; b < num_channels; ++b)
+				next[a] += covariance[a][b] * axis[b];
+			largest = std::max(largest, fabsf(next[a]));
+		}
+		if (largest < 1e-6f)
+			break;
+		for (int c = 0; c < num_channels; ++c)
+			axis[c] = next[c] / largest;
+	}
+	float length = 0.0f;
+	for (int c = 0; c < num_channels; ++c)
+		length += axis[c] * axis[c];
+	length = sqrtf(length);
+	if (length < 1e-6f)
+	{
+		//all the pixels are the same
+		for (int c = 0; c < num_channels; ++c)
+			start[c] = end[c] = mean[c];
+		return;
+	}
+
+	float min_t = FLT_MAX, max_t = -FLT_MAX;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < num_channels; ++c)
+			t += (block.channels[first_channel + c][i] - mean[c]) * axis[c];
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+	min_t /= length * length;
+	max_t /= length * length;
+	for (int c = 0; c < num_channels; ++c)
+	{
+		start[c] = std::min(std::max(mean[c] + axis[c] * min_t, 0.0f), 255.0f);
+		end[c] = std::min(std::max(mean[c] + axis[c] * max_t, 0.0f), 255.0f);
+	}
+}
+
+//least squares endpoints for the indices chosen, weights[e] is how much of the end has the palette entry e
+static void refitEndpoints(const sPixelBlock& block, int first_channel, int num_channels, const uint8* indices, const float* weights, float* start, float* end)
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		float b = weights[indices[i]];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < num_channels; ++c)
+		{
+			ax[c] += a * block.channels[first_channel + c][i];
+			bx[c] += b * block.channels[first_channel + c][i];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return; //all the pixels use the same entry
+	for (int c = 0; c < num_channels; ++c)
+	{
+		start[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+		end[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+	}
+}
+
+static uint16 packRGB565(const float* color)
+{
+	int r = std::min(std::max((int)(color[0] * 31.0f / 255.0f + 0.5f), 0), 31);
+	int g = std::min(std::max((int)(color[1] * 63.0f / 255.0f + 0.5f), 0), 63);
+	int b = std::min(std::max((int)(color[2] * 31.0f / 255.0f + 0.5f), 0), 31);
+	return (uint16)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(uint16 value, float* color)
+{
+	int r = value >> 11, g = (value >> 5) & 63, b = value & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+	color[3] = 255.0f;
+}
+
+//two RGB565 endpoints and 2 bits per pixel, always in the four colors mode (first endpoint greater)
+static void encodeBC1(const sPixelBlock& block, uint8* result)
+{
+	static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float start[4], end[4];
+	fitLine(block, 0, 3, start, end);
+
+	uint16 best_endpoints[2] = { 0, 0 };
+	uint8 best_indices[16];
+	float best_error = FLT_MAX;
+	for (int iteration = 0; iteration < 2; ++iteration)
+	{
+		uint16 c0 = packRGB565(start);
+		uint16 c1 = packRGB565(end);
+		if (c0 < c1)
+			std::swap(c0, c1);
+		float palette[4][4];
+		unpackRGB565(c0, palette[0]);
+		unpackRGB565(c1, palette[1]);
+		for (int c = 0; c < 4; ++c)
+		{
+			palette[2][c] = (palette[0][c] * 2.0f + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + palette[1][c] * 2.0f) / 3.0f;
+		}
+		uint8 indices[16];
+		float error = findClosest(block, 0, 3, palette, c0 == c1 ? 1 : 4, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_endpoints[0] = c0;
+			best_endpoints[1] = c1;
+			memcpy(best_indices, indices, 16);
+		}
+		if (c0 == c1 || error == 0.0f)
+			break;
+		memcpy(start, palette[0], sizeof(start));
+		memcpy(end, palette[1], sizeof(end));
+		refitEndpoints(block, 0, 3, indices, weights, start, end);
+	}
+
+	uint32 bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= (uint32)best_indices[i] << (i * 2);
+	result[0] = best_endpoints[0] & 0xFF;
+	result[1] = best_endpoints[0] >> 8;
+	result[2] = best_endpoints[1] & 0xFF;
+	result[3] = best_endpoints[1] >> 8;
+	for (int i = 0; i < 4; ++i)
+		result[4 + i] = (bits >> (i * 8)) & 0xFF;
+}
+
+//two 8 bits endpoints and 3 bits per pixel, always in the eight values mode (first endpoint greater)
+static void encodeBC4(const sPixelBlock& block, int channel, uint8* result)
+{
+	static const float weights[8] = { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f };
+	const float* values = block.channels[channel];
+	float start = values[0], end = values[0];
+	for (int i = 1; i < 16; ++i)
+	{
+		start = std::max(start, values[i]);
+		end = std::min(end, values[i]);
+	}
+
+	int best_endpoints[2] = { 0, 0 };
+	uint8 best_indices[16];
+	float best_error = FLT_MAX;
+	for (int iteration = 0; iteration < 2; ++iteration)
+	{
+		int a0 = (int)(start + 0.5f);
+		int a1 = (int)(end + 0.5f);
+		if (a0 < a1)
+			std::swap(a0, a1);
+		float palette[8][4];
+		for (int e = 0; e < 8; ++e)
+			palette[e][channel] = a0 * (1.0f - weights[e]) + a1 * weights[e];
+		uint8 indices[16];
+		float error = findClosest(block, channel, 1, palette, a0 == a1 ? 1 : 8, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_endpoints[0] = a0;
+			best_endpoints[1] = a1;
+			memcpy(best_indices, indices, 16);
+		}
+		if (a0 == a1 || error == 0.0f)
+			break;
+		start = (float)a0;
+		end = (float)a1;
+		refitEndpoints(block, channel, 1, indices, weights, &start, &end);
+	}
+
+	unsigned long long bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= (unsigned long long)best_indices[i] << (i * 3);
+	result[0] = (uint8)best_endpoints[0];
+	result[1] = (uint8)best_endpoints[1];
+	for (int i = 0; i < 6; ++i)
+		result[2 + i] = (bits >> (i * 8)) & 0xFF;
+}
+
+static void writeBits(uint8* result, int& position, unsigned int value, int num_bits)
+{
+	for (int i = 0; i < num_bits; ++i, ++position)
+		if ((value >> i) & 1)
+			result[position >> 3] |= 1 << (position & 7);
+}
+
+//mode 6: two RGBA endpoints of 7 bits plus one shared lowest bit each, and 4 bits per pixel
+static void encodeBC7(const sPixelBlock& block, uint8* result)
+{
+	static const int weights_int[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	float weights[16];
+	for (int e = 0; e < 16; ++e)
+		weights[e] = weights_int[e] / 64.0f;
+	float start[4], end[4];
+	fitLine(block, 0, 4, start, end);
+
+	int best_endpoints[2][4];
+	int best_pbits[2] = { 0, 0 };
+	uint8 best_indices[16];
+	float best_error = FLT_MAX;
+	for (int iteration = 0; iteration < 2; ++iteration)
+	{
+		//the four combinations of the lowest bits
+		for (int pbits = 0; pbits < 4; ++pbits)
+		{
+			int pbit[2] = { pbits & 1, pbits >> 1 };
+			int endpoints[2][4];
+			int decoded[2][4];
+			for (int c = 0; c < 4; ++c)
+			{
+				endpoints[0][c] = std::min(std::max((int)((start[c] - pbit[0]) * 0.5f + 0.5f), 0), 127);
+				endpoints[1][c] = std::min(std::max((int)((end[c] - pbit[1]) * 0.5f + 0.5f), 0), 127);
+				decoded[0][c] = (endpoints[0][c] << 1) | pbit[0];
+				decoded[1][c] = (endpoints[1][c] << 1) | pbit[1];
+			}
+			float palette[16][4];
+			for (int e = 0; e < 16; ++e)
+				for (int c = 0; c < 4; ++c)
+					palette[e][c] = (float)(((64 - weights_int[e]) * decoded[0][c] + weights_int[e] * decoded[1][c] + 32) >> 6);
+			uint8 indices[16];
+			float error = findClosest(block, 0, 4, palette, 16, indices);
+			if (error < best_error)
+			{
+				best_error = error;
+				memcpy(best_endpoints, endpoints, sizeof(endpoints));
+				best_pbits[0] = pbit[0];
+				best_pbits[1] = pbit[1];
+				memcpy(best_indices, indices, 16);
+			}
+		}
+		if (best_error == 0.0f)
+			break;
+		for (int c = 0; c < 4; ++c)
+		{
+			start[c] = (float)((best_endpoints[0][c] << 1) | best_pbits[0]);
+			end[c] = (float)((best_endpoints[1][c] << 1) | best_pbits[1]);
+		}
+		refitEndpoints(block, 0, 4, best_indices, weights, start, end);
+	}
+
+	//the index of the first pixel is stored without its highest bit, it must be 0
+	if (best_indices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(best_endpoints[0][c], best_endpoints[1][c]);
+		std::swap(best_pbits[0], best_pbits[1]);
+		for (int i = 0; i < 16; ++i)
+			best_indices[i] = 15 - best_indices[i];
+	}
+
+	memset(result, 0, 16);
+	int position = 0;
+	writeBits(result, position, 1 << 6, 7); //mode 6
+	for (int c = 0; c < 4; ++c)
+	{
+		writeBits(result, position, best_endpoints[0][c], 7);
+		writeBits(result, position, best_endpoints[1][c], 7);
+	}
+	writeBits(result, position, best_pbits[0], 1);
+	writeBits(result, position, best_pbits[1], 1);
+	writeBits(result, position, best_indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		writeBits(result, position, best_indices[i], 4);
+	assert(position == 128);
+}
+
+static int getFormatBlockBytes(eBlockFormat format)
+{
+	return (format == BLOCK_BC1 || format == BLOCK_BC4) ? 8 : 16;
+}
+
+void GFX::encodeBlocks(const uint8* rgba, int width, int height, eBlockFormat format, uint8* result, bool parallel)
+{
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	int block_bytes = getFormatBlockBytes(format);
+
+	auto encodeRows = [=](int first_row, int last_row) {
+		sPixelBlock block;
+		for (int y = first_row; y < last_row; ++y)
+			for (int x = 0; x < blocks_x; ++x)
+			{
+				fetchBlock(rgba, width, height, x, y, block);
+				uint8* dest = result + (y * blocks_x + x) * block_bytes;
+				switch (format)
+				{
+					case BLOCK_BC1: encodeBC1(block, dest); break;
+					case BLOCK_BC3: encodeBC4(block, 3, dest); encodeBC1(block, dest + 8); break;
+					case BLOCK_BC4: encodeBC4(block, 0, dest); break;
+					case BLOCK_BC5: encodeBC4(block, 0, dest); encodeBC4(block, 1, dest + 8); break;
+					case BLOCK_BC7: encodeBC7(block, dest); break;
+					default: assert(0 && "unknown block format");
+				}
+			}
+	};
+
+	//chunks of a few hundred blocks
+	if (parallel && blocks_y > 1)
+		TaskManager::background.parallelFor(0, blocks_y, encodeRows, std::max(1, 256 / blocks_x));
+	else
+		encodeRows(0, blocks_y);
+}
+
+//the mips are averaged with 12 bits per channel (0..4095), in linear space for the sRGB colors
+struct sMipTables {
+	uint16 from_srgb[256];
+	uint16 from_unorm[256];
+	uint8 to_srgb[4096];
+	uint8 to_unorm[4096];
+
+	sMipTables() {
+		for (int i = 0; i < 256; ++i)
+		{
+			float v = i / 255.0f;
+			float linear = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+			from_srgb[i] = (uint16)(linear * 4095.0f + 0.5f);
+			from_unorm[i] = (uint16)(v * 4095.0f + 0.5f);
+		}
+		for (int i = 0; i < 4096; ++i)
+		{
+			float v = i / 4095.0f;
+			float srgb = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = (uint8)std::min((int)(srgb * 255.0f + 0.5f), 255);
+			to_unorm[i] = (uint8)(v * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const sMipTables& getMipTables()
+{
+	static sMipTables tables; //thread safe initialization
+	return tables;
+}
+
+//averages every 2x2 block of the expanded rows (4 values per pixel), num_pixels is of the result
+static void averageRows(const uint16* row0, const uint16* row1, int num_pixels, uint16* result)
+{
+	int x = 0;
+#ifdef TEXTURE_ENCODER_SSE
+	//four source pixels from every row give two pixels
+	const __m128i round = _mm_set1_epi16(2);
+	for (; x + 2 <= num_pixels; x += 2)
+	{
+		__m128i left = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(row0 + x * 8)), _mm_loadu_si128((const __m128i*)(row1 + x * 8)));
+		__m128i right = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(row0 + x * 8 + 8)), _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 8)));
+		left = _mm_add_epi16(left, _mm_srli_si128(left, 8));
+		right = _mm_add_epi16(right, _mm_srli_si128(right, 8));
+		__m128i sum = _mm_unpacklo_epi64(left, right);
+		_mm_storeu_si128((__m128i*)(result + x * 4), _mm_srli_epi16(_mm_add_epi16(sum, round), 2));
+	}
+#endif
+	for (; x < num_pixels; ++x)
+		for (int c = 0; c < 4; ++c)
+			result[x * 4 + c] = (uint16)((row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c] + 2) >> 2);
+}
+
+//to 4 values per pixel, num_pixels can be one more than the width (the last column is repeated)
+static void expandRow(const uint8* source, int width, int num_channels, const uint16* color_table, const uint16* alpha_table, int num_pixels, uint16* result)
+{
+	for (int x = 0; x < num_pixels; ++x, result += 4)
+	{
+		const uint8* pixel = source + std::min(x, width - 1) * num_channels;
+		for (int c = 0; c < 4; ++c)
+			result[c] = c < num_channels ? (c == 3 ? alpha_table[pixel[c]] : color_table[pixel[c]]) : 0;
+	}
+}
+
+void GFX::downsamplePixels(const uint8* source, int width, int height, int num_channels, eTextureSemantic semantic, uint8* result, bool parallel)
+{
+	assert(num_channels >= 1 && num_channels <= 4);
+	const sMipTables& tables = getMipTables();
+	const uint16* color_table = semantic == TEXTURE_COLOR ? tables.from_srgb : tables.from_unorm;
+	const uint8* color_pack = semantic == TEXTURE_COLOR ? tables.to_srgb : tables.to_unorm;
+	int result_width = std::max(width / 2, 1);
+	int result_height = std::max(height / 2, 1);
+
+	auto downsampleRows = [=, &tables](int first_row, int last_row) {
+		std::vector<uint16> rows(result_width * 2 * 4 * 2 + result_width * 4);
+		uint16* row0 = &rows[0];
+		uint16* row1 = row0 + result_width * 2 * 4;
+		uint16* average = row1 + result_width * 2 * 4;
+		for (int y = first_row; y < last_row; ++y)
+		{
+			expandRow(source + std::min(y * 2, height - 1) * width * num_channels, width, num_channels, color_table, tables.from_unorm, result_width * 2, row0);
+			expandRow(source + std::min(y * 2 + 1, height - 1) * width * num_channels, width, num_channels, color_table, tables.from_unorm, result_width * 2, row1);
+			averageRows(row0, row1, result_width, average);
+
+			uint8* dest = result + y * result_width * num_channels;
+			for (int x = 0; x < result_width; ++x, dest += num_channels)
+			{
+				const uint16* pixel = average + x * 4;
+				for (int c = 0; c < num_channels; ++c)
+					dest[c] = c == 3 ? tables.to_unorm[pixel[c]] : color_pack[pixel[c]];
+				if (semantic != TEXTURE_NORMALMAP || num_channels < 3)
+					continue;
+				Vector3f normal(pixel[0] / 2047.5f - 1.0f, pixel[1] / 2047.5f - 1.0f, pixel[2] / 2047.5f - 1.0f);
+				if (normal.length() < 1e-4f)
+					continue;
+				normal.normalize();
+				for (int c = 0; c < 3; ++c)
+					dest[c] = (uint8)std::min(std::max((int)((normal[c] * 0.5f + 0.5f) * 255.0f + 0.5f), 0), 255);
+			}
+		}
+	};
+
+	//chunks of some thousands of pixels
+	if (parallel && result_height > 1 && result_width * result_height > 16384)
+		TaskManager::background.parallelFor(0, result_height, downsampleRows, std::max(1, 16384 / result_width));
+	else
+		downsampleRows(0, result_height);
+}
+
+void GFX::buildMipChain(const uint8* pixels, int width, int height, int num_channels, eTextureSemantic semantic, int first_mip, std::vector< std::vector<uint8> >& levels)
+{
+	assert(pixels && width && height);
+	levels.clear();
+	const uint8* source = pixels;
+	std::vector<uint8> previous, current;
+	for (int mip = 0; ; ++mip)
+	{
+		if (mip >= first_mip)
+		{
+			levels.push_back(std::vector<uint8>());
+			levels.back().assign(source, source + width * height * num_channels);
+		}
+		if (width == 1 && height == 1)
+			break;
+		current.resize(std::max(width / 2, 1) * std::max(height / 2, 1) * num_channels);
+		downsamplePixels(source, width, height, num_channels, semantic, &current[0]);
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+		previous.swap(current);
+		source = &previous[0];
+	}
+}
+
+eBlockFormat GFX::chooseBlockFormat(const Image* image, eTextureSemantic semantic, bool high_quality)
+{
+	if (semantic == TEXTURE_NORMALMAP)
+		return BLOCK_BC5;
+
+	bool grey = true;
+	bool alpha = false;
+	const uint8* pixel = image->data;
+	for (unsigned int i = 0; i < image->width * image->height; ++i, pixel += image->num_channels)
+	{
+		//some tolerance for the noise of the JPGs
+		if (abs(pixel[0] - pixel[1]) > 4 || abs(pixel[0] - pixel[2]) > 4)
+			grey = false;
+		if (image->num_channels == 4 && pixel[3] != 255)
+			alpha = true;
+	}
+	if (grey && !alpha)
+		return BLOCK_BC4;
+	if (high_quality)
+		return BLOCK_BC7;
+	return alpha ? BLOCK_BC3 : BLOCK_BC1;
+}
+
+bool GFX::compressImage(const Image* image, eTextureSemantic semantic, bool high_quality, std::vector<uint8>& result)
+{
+	if (!image || !image->data || (image->num_channels != 3 && image->num_channels != 4))
+		return false;
+
+	eBlockFormat format = chooseBlockFormat(image, semantic, high_quality);
+	static const uint32 dxgi_formats[BLOCK_FORMATS] = { 71, 77, 80, 83, 98 }; //DXGI_FORMAT_BCn_UNORM
+	int width = image->width;
+	int height = image->height;
+	int num_mips = 1;
+	while ((width >> (num_mips - 1)) > 1 || (height >> (num_mips - 1)) > 1)
+		num_mips++;
+
+	uint32 header[DDS_HEADER_WORDS];
+	memset(header, 0, sizeof(header));
+	header[0] = DDS_MAGIC;
+	header[1] = 124;
+	header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; //caps, height, width, pixel format, mips, linear size
+	header[3] = height;
+	header[4] = width;
+	header[5] = ((width + 3) / 4) * ((height + 3) / 4) * getFormatBlockBytes(format);
+	header[7] = num_mips;
+	header[8] = DDS_CACHE_TAG;
+	header[9] = DDS_CACHE_VERSION;
+	header[10] = semantic;
+	header[11] = high_quality ? 1 : 0;
+	header[19] = 32;	//pixel format size
+	header[20] = 0x4;	//fourcc
+	header[21] = DDS_FOURCC_DX10;
+	header[27] = 0x1000 | 0x400000 | 0x8; //texture, mipmap, complex
+	header[32] = dxgi_formats[format];
+	header[33] = 3; //2D
+	header[35] = 1; //array size
+	result.assign((uint8*)header, (uint8*)header + sizeof(header));
+
+	//everything in RGBA
+	std::vector<uint8> level(width * height * 4);
+	for (int i = 0; i < width * height; ++i)
+	{
+		const uint8* pixel = image->data + i * image->num_channels;
+		level[i * 4] = pixel[0];
+		level[i * 4 + 1] = pixel[1];
+		level[i * 4 + 2] = pixel[2];
+		level[i * 4 + 3] = image->num_channels == 4 ? pixel[3] : 255;
+	}
+
+	std::vector<uint8> next;
+	for (int mip = 0; mip < num_mips; ++mip)
+	{
+		size_t offset = result.size();
+		result.resize(offset + ((width + 3) / 4) * ((height + 3) / 4) * getFormatBlockBytes(format));
+		encodeBlocks(&level[0], width, height, format, &result[offset]);
+		if (mip == num_mips - 1)
+			break;
+		next.resize(std::max(width / 2, 1) * std::max(height / 2, 1) * 4);
+		downsamplePixels(&level[0], width, height, 4, semantic, &next[0]);
+		level.swap(next);
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+	}
+	return true;
+}
+
+std::string GFX::getCompressedCacheName(const char* filename)
+{
+	return std::string(filename) + ".dds";
+}
+
+//size and modification time of the source file, in four words
+static bool getSourceStamp(const char* filename, uint32* stamp)
+{
+	struct stat info;
+	if (stat(filename, &info) != 0)
+		return false;
+	unsigned long long size = (unsigned long long)info.st_size;
+	unsigned long long time = (unsigned long long)info.st_mtime;
+	stamp[0] = (uint32)size;
+	stamp[1] = (uint32)(size >> 32);
+	stamp[2] = (uint32)time;
+	stamp[3] = (uint32)(time >> 32);
+	return true;
+}
+
+bool GFX::readCompressedCache(const char* filename, eTextureSemantic semantic, bool high_quality, std::vector<uint8>& result)
+{
+	if (!readFileBin(getCompressedCacheName(filename), result))
+		return false;
+	if (result.size() < sizeof(uint32) * DDS_HEADER_WORDS)
+	{
+		result.clear();
+		return false;
+	}
+	const uint32* header = (const uint32*)&result[0];
+	if (header[0] != DDS_MAGIC || header[8] != DDS_CACHE_TAG || header[9] != DDS_CACHE_VERSION ||
+		header[10] != (uint32)semantic || header[11] != (high_quality ? 1u : 0u))
+	{
+		result.clear(); //from other settings or an old version, it must be encoded again
+		return false;
+	}
+
+	//the source was edited after encoding it (if only the cache is there it is used as it is)
+	uint32 stamp[4];
+	if (getSourceStamp(filename, stamp) && memcmp(stamp, header + DDS_CACHE_STAMP, sizeof(stamp)) != 0)
+	{
+		result.clear();
+		return false;
+	}
+	return true;
+}
+
+bool GFX::writeCompressedCache(const char* filename, const std::vector<uint8>& data)
+{
+	std::string cache_name = getCompressedCacheName(filename);
+	if (data.size() < sizeof(uint32) * DDS_HEADER_WORDS)
+		return false;
+
+	//the header is stamped with the source so the cache is encoded again when it changes
+	uint32 header[DDS_HEADER_WORDS];
+	memcpy(header, &data[0], sizeof(header));
+	if (!getSourceStamp(filename, header + DDS_CACHE_STAMP))
+		return false;
+
+	FILE* f = fopen(cache_name.c_str(), "wb");
+	if (!f)
+		return false;
+	size_t written = fwrite(header, 1, sizeof(header), f);
+	written += fwrite(&data[sizeof(header)], 1, data.size() - sizeof(header), f);
+	fclose(f);
+	return written == data.size();
+}
+
+unsigned int GFX::readCompressedMips(const std::vector<uint8>& data, int first_mip, std::vector< std::vector<uint8> >& levels, int* width, int* height)
+{
+	ddsktx_texture_info info;
+	memset(&info, 0, sizeof(info));
+	if (data.empty() || !ddsktx_parse(&info, &data[0], (int)data.size(), NULL))
+		return 0;
+	unsigned int gl_format = getBlockGLFormat(info.format);
+	if (!gl_format || (info.flags & (DDSKTX_TEXTURE_FLAG_CUBEMAP | DDSKTX_TEXTURE_FLAG_VOLUME)))
+		return 0;
+
+	if (width)
+		*width = info.width;
+	if (height)
+		*height = info.height;
+	levels.clear();
+	for (int mip = first_mip; mip < info.num_mips; ++mip)
+	{
+		ddsktx_sub_data sub;
+		ddsktx_get_sub(&info, &sub, &data[0], (int)data.size(), 0, 0, mip);
+		const uint8* bytes = (const uint8*)sub.buff;
+		levels.push_back(std::vector<uint8>(bytes, bytes + sub.size_bytes));
+	}
+	return gl_format;
+}
+
+unsigned int GFX::getBlockGLFormat(int ddsktx_format)
+{
+	switch (ddsktx_format)
+	{
+		case DDSKTX_FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case DDSKTX_FORMAT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case DDSKTX_FORMAT_BC4: return GL_COMPRESSED_RED_RGTC1;
+		case DDSKTX_FORMAT_BC5: return GL_COMPRESSED_RG_RGTC2;
+		case DDSKTX_FORMAT_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	return 0;
+}
+
+int GFX::getBlockBytes(unsigned int gl_format)
+{
+	switch (gl_format)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RED_RGTC1: return 8;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		case GL_COMPRESSED_RG_RGTC2:
+		case GL_COMPRESSED_RGBA_BPTC_UNORM: return 16;
+	}
+	return 0;
+}
+
+const char* GFX::getBlockFormatName(unsigned int gl_format)
+{
+	switch (gl_format)
+	{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+		case GL_COMPRESSED_RED_RGTC1: return "BC4";
+		case GL_COMPRESSED_RG_RGTC2: return "BC5";
+		case GL_COMPRESSED_RGBA_BPTC_UNORM: return "BC7";
+	}
+	return NULL;
+}
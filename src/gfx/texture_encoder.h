@@ -0,0 +1,75 @@
+/*  Block compression of the textures on the CPU.
+	The textures loaded with Texture::GetAsync are encoded the first time into a BCn format chosen from what
+	they contain (see eTextureSemantic), with the whole chain of mips, and stored as a DDS next to the source
+	file (image.png -> image.png.dds). The next runs read the DDS instead of decoding the image and upload
+	the blocks as they are, using 4 to 8 times less VRAM than RGBA.
+	The blocks of every mip are encoded in parallel, the closest color of the palette of every pixel is searched
+	four pixels at a time with SSE.
+	The rows are stored in the order of the image uploaded by loadFromImage, so the DDS is not flipped like
+	the ones exported by other tools, it is only meant to be read by Texture::loadKTX.
+	The mips of the textures that are not compressed are also built here in the workers (see buildMipChain), so the
+	main thread only has to upload them.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include "../core/includes.h"
+#include "texture.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_TEXTURE_SWIZZLE_G
+#define GL_TEXTURE_SWIZZLE_G 0x8E43
+#define GL_TEXTURE_SWIZZLE_B 0x8E44
+#endif
+
+namespace GFX {
+
+	enum eBlockFormat {
+		BLOCK_BC1,	//RGB, 4 bits per pixel
+		BLOCK_BC3,	//RGBA, BC1 for the color and BC4 for the alpha, 8 bits per pixel
+		BLOCK_BC4,	//one channel (grey images, replicated to RGB when sampling), 4 bits per pixel
+		BLOCK_BC5,	//two channels (XY of the normal maps), 8 bits per pixel
+		BLOCK_BC7,	//RGBA with better quality than BC1/BC3 (only mode 6, one pair of endpoints per block), 8 bits per pixel, needs GL 4.2
+		BLOCK_FORMATS
+	};
+
+	//to choose the format, BC5 normal maps need the z rebuilt in the shader: z = sqrt(1 - dot(xy,xy)) with xy in [-1,1]
+	//grey images are stored in BC4, color and data in BC1 (BC3 with alpha) or BC7 if high_quality
+	eBlockFormat chooseBlockFormat(const Image* image, eTextureSemantic semantic, bool high_quality);
+
+	//encodes the mips of the image and returns the DDS file in result, safe to call from any thread
+	bool compressImage(const Image* image, eTextureSemantic semantic, bool high_quality, std::vector<uint8>& result);
+
+	//encodes a level (rgba has 4 bytes per pixel), the blocks are width/4 x height/4 rounded up, in rows
+	void encodeBlocks(const uint8* rgba, int width, int height, eBlockFormat format, uint8* result, bool parallel = true);
+
+	//averages every 2x2 block of pixels (width and height are of the source) with SSE, in linear space for TEXTURE_COLOR
+	//(the colors are sRGB) and normalizing again the normals of TEXTURE_NORMALMAP, safe to call from any thread
+	void downsamplePixels(const uint8* source, int width, int height, int num_channels, eTextureSemantic semantic, uint8* result, bool parallel = true);
+	//the chain of mips down to 1x1 (the first one is the source), levels[i] is the mip first_mip + i
+	void buildMipChain(const uint8* pixels, int width, int height, int num_channels, eTextureSemantic semantic, int first_mip, std::vector< std::vector<uint8> >& levels);
+
+	//the DDS cached for a file, only valid if it was encoded with the same semantic and quality from the same source (size and modification time)
+	std::string getCompressedCacheName(const char* filename);
+	bool readCompressedCache(const char* filename, eTextureSemantic semantic, bool high_quality, std::vector<uint8>& result);
+	bool writeCompressedCache(const char* filename, const std::vector<uint8>& data);
+
+	//mips of a DDS/KTX from first_mip to the end, returns the GL format of the blocks (0 if not compressed), width and height are of mip 0
+	unsigned int readCompressedMips(const std::vector<uint8>& data, int first_mip, std::vector< std::vector<uint8> >& levels, int* width = NULL, int* height = NULL);
+
+	unsigned int getBlockGLFormat(int ddsktx_format); //GL format of the blocks of a ddsktx_format, 0 if not supported
+	int getBlockBytes(unsigned int gl_format); //bytes per 4x4 block, 0 if it is not a block format
+	const char* getBlockFormatName(unsigned int gl_format); //NULL if it is not a block format
+};
@@ -0,0 +1,400 @@
+#include "texture_streamer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+#include <cstring>
+
+#include "texture.h"
+#include "texture_encoder.h"
+#include "gfx.h"
+#include "../utils/utils.h"
+
+using namespace GFX;
+
+TextureStreamer TextureStreamer::instance;
+
+TextureStreamer::TextureStreamer()
+{
+	enabled = true;
+	budget = 256 * 1024 * 1024;
+	initial_size = 64;
+	max_loading = 4;
+	unused_frames = 300;
+	mip_bias = 0.0f;
+	frame = 0;
+	blit_fbos[0] = blit_fbos[1] = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+size_t TextureStreamer::getChainBytes(int width, int height, int num_channels, int first_mip, unsigned int compressed_format)
+{
+	size_t bytes = 0;
+	int bytes_per_pixel = num_channels == 3 ? 4 : num_channels;
+	int block_bytes = getBlockBytes(compressed_format);
+	for (int mip = first_mip; ; ++mip)
+	{
+		int w = std::max(width >> mip, 1);
+		int h = std::max(height >> mip, 1);
+		if (block_bytes)
+			bytes += (size_t)((w + 3) / 4) * ((h + 3) / 4) * block_bytes;
+		else
+			bytes += (size_t)w * h * bytes_per_pixel;
+		if (w == 1 && h == 1)
+			break;
+	}
+	return bytes;
+}
+
+void TextureStreamer::buildMips(const Image* image, int first_mip, eTextureSemantic semantic, sTextureMips& result)
+{
+	assert(image && image->data);
+	result.first_mip = first_mip;
+	result.num_channels = image->num_channels;
+	result.compressed_format = 0;
+	buildMipChain(image->data, image->width, image->height, image->num_channels, semantic, first_mip, result.levels);
+}
+
+bool TextureStreamer::startStreaming(Texture* texture, sTextureMips& mips, int width, int height, eTextureSemantic semantic, bool wrap)
+{
+	assert(texture);
+	if (!enabled || mips.first_mip != 0 || !isPowerOfTwo(width) || !isPowerOfTwo(height))
+		return false;
+	if (!mips.compressed_format && mips.num_channels != 3 && mips.num_channels != 4)
+		return false;
+
+	//it needs the whole chain
+	int num_mips = 1;
+	while ((width >> (num_mips - 1)) > 1 || (height >> (num_mips - 1)) > 1)
+		num_mips++;
+	if ((int)mips.levels.size() != num_mips)
+		return false;
+	int initial_mip = 0;
+	while (std::max(width >> initial_mip, height >> initial_mip) > initial_size)
+		initial_mip++;
+	if (initial_mip == 0)
+		return false; //small enough to have it all
+
+	sTextureStreaming* streaming = new sTextureStreaming();
+	streaming->full_width = width;
+	streaming->full_height = height;
+	streaming->num_channels = mips.num_channels;
+	streaming->compressed_format = mips.compressed_format;
+	streaming->semantic = semantic;
+	streaming->num_mips = num_mips;
+	streaming->initial_mip = initial_mip;
+	streaming->resident_mip = num_mips; //nothing yet
+	streaming->required_mip = initial_mip;
+	streaming->target_mip = initial_mip;
+	streaming->loading_mip = -1;
+	streaming->last_used_frame = frame;
+	streaming->wrap = wrap;
+	streaming->failed = false;
+	texture->streaming = streaming;
+
+	//the finest mips are read again when needed
+	mips.levels.erase(mips.levels.begin(), mips.levels.begin() + initial_mip);
+	mips.first_mip = initial_mip;
+	recreateTexture(texture, initial_mip, &mips);
+	textures.push_back(texture);
+	return true;
+}
+
+void TextureStreamer::stopStreaming(Texture* texture)
+{
+	if (!texture->streaming)
+		return;
+	auto it = std::find(textures.begin(), textures.end(), texture);
+	if (it != textures.end())
+		textures.erase(it);
+	delete texture->streaming;
+	texture->streaming = NULL;
+}
+
+void TextureStreamer::requestTexture(Texture* texture, float uvs_per_pixel)
+{
+	sTextureStreaming* streaming = texture->streaming;
+	if (!streaming)
+		return;
+
+	//mip where one texel covers one pixel
+	float texels_per_pixel = uvs_per_pixel * sqrtf((float)streaming->full_width * streaming->full_height);
+	int mip = texels_per_pixel > 1.0f ? (int)floorf(log2f(texels_per_pixel) + mip_bias) : 0;
+	mip = std::min(std::max(mip, 0), streaming->initial_mip);
+	if (streaming->last_used_frame != frame || mip < streaming->required_mip)
+		streaming->required_mip = mip;
+	streaming->last_used_frame = frame;
+}
+
+void TextureStreamer::update()
+{
+	stats.num_textures = (int)textures.size();
+	stats.num_evicted = 0;
+	stats.num_loading = 0;
+
+	//mips wanted by every texture, the ones not used for a while go back to the initial mips
+	size_t total = 0;
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		sTextureStreaming* streaming = textures[i]->streaming;
+		if (frame - streaming->last_used_frame > unused_frames)
+			streaming->target_mip = streaming->initial_mip;
+		else
+			streaming->target_mip = streaming->required_mip;
+		total += getBytes(streaming, streaming->target_mip);
+		if (streaming->loading_mip != -1)
+			stats.num_loading++;
+	}
+	stats.required_bytes = total;
+
+	//over budget, drop one mip at a time starting with the textures used longer ago and the most detailed
+	if (total > budget)
+	{
+		std::vector<Texture*> order = textures;
+		std::sort(order.begin(), order.end(), [](Texture* a, Texture* b) {
+			if (a->streaming->last_used_frame != b->streaming->last_used_frame)
+				return a->streaming->last_used_frame < b->streaming->last_used_frame;
+			return a->streaming->target_mip < b->streaming->target_mip;
+		});
+		bool changed = true;
+		while (total > budget && changed)
+		{
+			changed = false;
+			for (size_t i = 0; i < order.size() && total > budget; ++i)
+			{
+				sTextureStreaming* streaming = order[i]->streaming;
+				if (streaming->target_mip >= streaming->initial_mip)
+					continue;
+				total -= getBytes(streaming, streaming->target_mip) - getBytes(streaming, streaming->target_mip + 1);
+				streaming->target_mip++;
+				changed = true;
+			}
+		}
+	}
+
+	//drop the mips not needed and start loading the missing ones
+	stats.resident_bytes = 0;
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		Texture* texture = textures[i];
+		sTextureStreaming* streaming = texture->streaming;
+		if (streaming->target_mip > streaming->resident_mip)
+		{
+			recreateTexture(texture, streaming->target_mip, NULL);
+			stats.num_evicted++;
+		}
+		else if (streaming->target_mip < streaming->resident_mip && streaming->loading_mip == -1 && !streaming->failed && stats.num_loading < max_loading)
+		{
+			streaming->loading_mip = streaming->target_mip;
+			TaskManager::background.addTask(new StreamTextureTask(texture->filename.c_str(), streaming->target_mip, streaming->compressed_format != 0, streaming->semantic));
+			stats.num_loading++;
+		}
+		stats.resident_bytes += getBytes(streaming, streaming->resident_mip);
+	}
+
+	frame++;
+}
+
+void TextureStreamer::applyMips(Texture* texture, sTextureMips* mips)
+{
+	sTextureStreaming* streaming = texture->streaming;
+	assert(streaming);
+	streaming->loading_mip = -1;
+	if (!mips)
+	{
+		streaming->failed = true;
+		return;
+	}
+
+	//the budget could have changed while loading
+	int first_mip = std::max(mips->first_mip, streaming->target_mip);
+	if (first_mip < streaming->resident_mip && mips->num_channels == streaming->num_channels && mips->compressed_format == streaming->compressed_format)
+	{
+		recreateTexture(texture, first_mip, mips);
+		stats.num_uploaded++;
+	}
+	delete mips;
+}
+
+//creates a new texture with the chain from first_mip, the mips are taken from the current texture if it has them or from mips
+void TextureStreamer::recreateTexture(Texture* texture, int first_mip, const sTextureMips* mips)
+{
+	sTextureStreaming* streaming = texture->streaming;
+	if (streaming->compressed_format)
+	{
+		recreateCompressedTexture(texture, first_mip, mips);
+		return;
+	}
+	unsigned int format = streaming->num_channels == 3 ? GL_RGB : GL_RGBA;
+	unsigned int internal_format = streaming->num_channels == 3 ? GL_RGB8 : GL_RGBA8;
+	int num_levels = streaming->num_mips - first_mip;
+
+	GLuint texture_id = 0;
+	glGenTextures(1, &texture_id);
+	bindTexture(GL_TEXTURE_2D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); //rows of the small RGB mips are not aligned to 4 bytes
+	for (int level = 0; level < num_levels; ++level)
+	{
+		int mip = first_mip + level;
+		const uint8* data = NULL;
+		if (mip < streaming->resident_mip && mips && mip >= mips->first_mip && mip - mips->first_mip < (int)mips->levels.size())
+			data = &mips->levels[mip - mips->first_mip][0];
+		glTexImage2D(GL_TEXTURE_2D, level, internal_format, std::max(streaming->full_width >> mip, 1), std::max(streaming->full_height >> mip, 1), 0, format, GL_UNSIGNED_BYTE, data);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, streaming->wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, streaming->wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	bindTexture(GL_TEXTURE_2D, 0);
+
+	//copy in the GPU the mips that were already resident
+	if (texture->texture_id && streaming->resident_mip < streaming->num_mips)
+	{
+		GLint previous_read = 0, previous_draw = 0;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_read);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_draw);
+		if (!blit_fbos[0])
+			glGenFramebuffers(2, blit_fbos);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, blit_fbos[0]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, blit_fbos[1]);
+		for (int mip = std::max(first_mip, streaming->resident_mip); mip < streaming->num_mips; ++mip)
+		{
+			int w = std::max(streaming->full_width >> mip, 1);
+			int h = std::max(streaming->full_height >> mip, 1);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->texture_id, mip - streaming->resident_mip);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture_id, mip - first_mip);
+			glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		}
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, previous_read);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous_draw);
+	}
+
+	if (texture->texture_id)
+	{
+		glDeleteTextures(1, &texture->texture_id);
+		resetGPUState();
+	}
+	texture->texture_id = texture_id;
+	texture->texture_type = GL_TEXTURE_2D;
+	texture->width = (float)std::max(streaming->full_width >> first_mip, 1);
+	texture->height = (float)std::max(streaming->full_height >> first_mip, 1);
+	texture->format = format;
+	texture->internal_format = internal_format;
+	texture->type = GL_UNSIGNED_BYTE;
+	texture->mipmaps = true;
+	streaming->resident_mip = first_mip;
+	checkGLErrors();
+}
+
+//the blocks of the resident mips are read back, they cannot be copied with a blit
+void TextureStreamer::recreateCompressedTexture(Texture* texture, int first_mip, const sTextureMips* mips)
+{
+	sTextureStreaming* streaming = texture->streaming;
+	int num_levels = streaming->num_mips - first_mip;
+	std::vector< std::vector<uint8> > readback(num_levels);
+	std::vector<const uint8*> data(num_levels, (const uint8*)NULL);
+	std::vector<int> sizes(num_levels, 0);
+	for (int level = 0; level < num_levels; ++level)
+	{
+		int mip = first_mip + level;
+		int w = std::max(streaming->full_width >> mip, 1);
+		int h = std::max(streaming->full_height >> mip, 1);
+		sizes[level] = ((w + 3) / 4) * ((h + 3) / 4) * getBlockBytes(streaming->compressed_format);
+		if (mip < streaming->resident_mip && mips && mip >= mips->first_mip && mip - mips->first_mip < (int)mips->levels.size())
+			data[level] = &mips->levels[mip - mips->first_mip][0];
+		else if (texture->texture_id && mip >= streaming->resident_mip)
+		{
+			readback[level].resize(sizes[level]);
+			bindTexture(GL_TEXTURE_2D, texture->texture_id);
+			glGetCompressedTexImage(GL_TEXTURE_2D, mip - streaming->resident_mip, &readback[level][0]);
+			data[level] = &readback[level][0];
+		}
+	}
+
+	GLuint texture_id = 0;
+	glGenTextures(1, &texture_id);
+	bindTexture(GL_TEXTURE_2D, texture_id);
+	for (int level = 0; level < num_levels; ++level)
+	{
+		int mip = first_mip + level;
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, streaming->compressed_format, std::max(streaming->full_width >> mip, 1), std::max(streaming->full_height >> mip, 1), 0, sizes[level], data[level]);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, streaming->wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, streaming->wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	if (streaming->compressed_format == GL_COMPRESSED_RED_RGTC1)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+	}
+	bindTexture(GL_TEXTURE_2D, 0);
+
+	if (texture->texture_id)
+	{
+		glDeleteTextures(1, &texture->texture_id);
+		resetGPUState();
+	}
+	texture->texture_id = texture_id;
+	texture->texture_type = GL_TEXTURE_2D;
+	texture->width = (float)std::max(streaming->full_width >> first_mip, 1);
+	texture->height = (float)std::max(streaming->full_height >> first_mip, 1);
+	texture->format = GL_RGBA;
+	texture->internal_format = streaming->compressed_format;
+	texture->type = GL_UNSIGNED_BYTE;
+	texture->mipmaps = true;
+	streaming->resident_mip = first_mip;
+	checkGLErrors();
+}
+
+StreamTextureTask::StreamTextureTask(const char* filename, int first_mip, bool compressed, eTextureSemantic semantic)
+{
+	this->filename = filename;
+	this->first_mip = first_mip;
+	this->compressed = compressed;
+	this->semantic = semantic;
+}
+
+void StreamTextureTask::onExecute()
+{
+	sTextureMips* mips = NULL;
+	Image image;
+	std::vector<uint8> data;
+	if (compressed)
+	{
+		//the DDS was written when the texture was loaded
+		if (readFileBin(getCompressedCacheName(filename.c_str()), data))
+		{
+			mips = new sTextureMips();
+			mips->first_mip = first_mip;
+			mips->num_channels = 4;
+			mips->compressed_format = readCompressedMips(data, first_mip, mips->levels);
+			if (!mips->compressed_format)
+			{
+				delete mips;
+				mips = NULL;
+			}
+		}
+	}
+	else if (image.load(filename.c_str()))
+	{
+		mips = new sTextureMips();
+		TextureStreamer::buildMips(&image, first_mip, semantic, *mips);
+	}
+
+	//the texture could be deleted while loading, it is searched again in the main thread
+	std::string name = filename;
+	TaskManager::foreground.addTask([name, mips]() {
+		Texture* texture = Texture::Find(name.c_str());
+		if (texture && texture->streaming)
+			TextureStreamer::instance.applyMips(texture, mips);
+		else
+			delete mips;
+	});
+}
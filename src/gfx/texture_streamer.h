@@ -0,0 +1,115 @@
+/*  Streaming of the mips of the textures.
+	The textures loaded with Texture::GetAsync only upload their smallest mips at first. Every frame the renderer
+	tells which mip of every visible texture is needed (from the density of the uvs of the mesh and its size on screen),
+	the finer mips are decoded from disk in the background and uploaded when ready, and when the streamed textures
+	need more memory than the budget the mips of the least used ones are dropped.
+	The GPU always holds a complete chain from the finest resident mip to 1x1, so the texture is recreated when it
+	changes, copying in the GPU the mips it already had.
+	Block compressed textures (see texture_encoder.h) read their mips from the DDS instead of decoding the image,
+	and as the blocks cannot be blitted, the mips kept when dropping the finest ones are read back from the GPU.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include "../core/includes.h"
+#include "../core/math.h"
+#include "../core/task.h"
+#include "texture.h"
+
+namespace GFX {
+
+	class Texture;
+
+	//state of a streamed texture, in Texture::streaming
+	struct sTextureStreaming {
+		int full_width, full_height;	//size of mip 0
+		int num_channels;
+		unsigned int compressed_format; //GL format of the blocks, 0 if not compressed
+		eTextureSemantic semantic;		//to build the mips of the image the same way when streaming them
+		int num_mips;			//of the full chain
+		int initial_mip;		//coarsest mip kept, uploaded when loading
+		int resident_mip;		//finest mip in the GPU (level 0 of the texture)
+		int required_mip;		//finest mip requested this frame
+		int target_mip;			//mip to have in the GPU after applying the budget
+		int loading_mip;		//mip being loaded in the background, -1 if none
+		long last_used_frame;
+		bool wrap;
+		bool failed;			//the file could not be loaded again, it stays with the resident mips
+	};
+
+	//mips decoded in the background, levels[i] is the mip first_mip + i
+	struct sTextureMips {
+		int first_mip;
+		int num_channels;
+		unsigned int compressed_format; //the levels are blocks of this GL format, 0 if they are pixels
+		std::vector< std::vector<uint8> > levels;
+	};
+
+	struct sTextureStreamingStats {
+		size_t resident_bytes;	//VRAM used by the streamed textures
+		size_t required_bytes;	//what they would use with the mips required, before applying the budget
+		int num_textures;
+		int num_loading;
+		int num_evicted;		//textures that dropped mips in the last update
+		int num_uploaded;		//textures that got finer mips since the start
+	};
+
+	class TextureStreamer
+	{
+	public:
+		static TextureStreamer instance;
+
+		bool enabled;			//when false the textures are uploaded with all the mips
+		size_t budget;			//bytes of VRAM for the streamed textures
+		int initial_size;		//textures start with the mips of this size (in pixels) or smaller
+		int max_loading;		//textures loading in the background at the same time
+		int unused_frames;		//frames without being requested before going back to the initial mips
+		float mip_bias;			//added to the required mip, positive values save memory
+
+		std::vector<Texture*> textures;
+		sTextureStreamingStats stats;
+		long frame;
+
+		TextureStreamer();
+
+		//uploads the smallest mips of the chain (from mip 0 to 1x1, pixels or blocks) and starts streaming the texture (from the main thread)
+		//returns false if it is not worth it or cannot be streamed, then the mips are left untouched to upload them normally
+		bool startStreaming(Texture* texture, sTextureMips& mips, int width, int height, eTextureSemantic semantic, bool wrap = true);
+		void stopStreaming(Texture* texture); //when the texture is deleted
+
+		//the texture is used on screen, uvs_per_pixel is the size of a pixel in uv space
+		void requestTexture(Texture* texture, float uvs_per_pixel);
+
+		//fits the required mips in the budget, drops the mips not needed and starts loading the missing ones, once per frame
+		void update();
+
+		//uploads the mips loaded in the background (called from the main thread), mips is NULL if the load failed
+		void applyMips(Texture* texture, sTextureMips* mips);
+
+		//bytes in VRAM of the chain from first_mip to the end (RGB is stored as RGBA by most drivers)
+		static size_t getChainBytes(int width, int height, int num_channels, int first_mip, unsigned int compressed_format = 0);
+		//builds the chain of the image (see buildMipChain), keeping the mips from first_mip
+		static void buildMips(const Image* image, int first_mip, eTextureSemantic semantic, sTextureMips& result);
+
+	private:
+		unsigned int blit_fbos[2]; //to copy the mips between textures
+
+		void recreateTexture(Texture* texture, int first_mip, const sTextureMips* mips);
+		void recreateCompressedTexture(Texture* texture, int first_mip, const sTextureMips* mips);
+		size_t getBytes(const sTextureStreaming* streaming, int first_mip) { return getChainBytes(streaming->full_width, streaming->full_height, streaming->num_channels, first_mip, streaming->compressed_format); }
+	};
+
+	//loads the image (or its DDS if compressed) in a worker and sends the mips to the main thread
+	class StreamTextureTask : public Task {
+	public:
+		std::string filename;
+		int first_mip;
+		bool compressed;
+		eTextureSemantic semantic;
+
+		StreamTextureTask(const char* filename, int first_mip, bool compressed = false, eTextureSemantic semantic = TEXTURE_COLOR);
+		void onExecute();
+	};
+};
@@ -8,6 +8,11 @@
 #include "../gfx/mesh.h"
 
 #include <sys/stat.h>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+
+static void decomposeMatrix(const Matrix44& m, Vector3f& position, Quaternion& rotation, Vector3f& scale);
 
 Skeleton::Skeleton()
 {
@@ -39,13 +44,11 @@ void Skeleton::computeFinalBoneMatrices( std::vector<Matrix44>& bone_matrices, G
 
 	updateGlobalMatrices();
 
-	bone_matrices.resize(mesh->bones_info.size());
-	#pragma omp for  
-	for (int i = 0; i < mesh->bones_info.size(); ++i)
-	{
-		BoneInfo& bone_info = mesh->bones_info[i];
-		bone_matrices[i] = mesh->bind_matrix * bone_info.bind_pose * getBoneMatrix( bone_info.name, false ); //use globals
-	}
+	//the bone mapping and bind matrices are computed only the first time
+	const SkinBinding* binding = SkinBinding::Get(mesh, this);
+	bone_matrices.resize(binding->getNumBones());
+	if (bone_matrices.size())
+		binding->computePalette(global_bone_matrices, &bone_matrices[0]); //use globals
 }
 
 void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 layer)
@@ -78,19 +81,19 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 		result->num_bones = a->num_bones;
 	}
 
-	//blend bones locally
-	#pragma omp for  
-	for (int i = 0; i < result->num_bones; ++i)
-	{
-		Skeleton::Bone& bone = result->bones[i];
-		Skeleton::Bone& boneA = a->bones[i];
-		Skeleton::Bone& boneB = b->bones[i];
-		if ( layer != 0xFF && !(bone.layer & layer) ) //not in the same layer
-			continue;
-		#pragma omp for  
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp( boneA.model.m[j], boneB.model.m[j], w);
-	}
+	//blend bones locally, the bones out of the layer keep the pose of A
+	float data_a[sPose::NUM_CHANNELS * 128];
+	float data_b[sPose::NUM_CHANNELS * 128];
+	float weights[128];
+	sPose pose_a, pose_b;
+	pose_a.setBuffer(data_a, a->num_bones);
+	pose_b.setBuffer(data_b, b->num_bones);
+	a->getPose(pose_a);
+	b->getPose(pose_b);
+	for (int i = 0; i < sPose::getPaddedSize(result->num_bones); ++i)
+		weights[i] = (i < result->num_bones && (layer == 0xFF || (result->bones[i].layer & layer))) ? w : 0.0f;
+	blendPoses(pose_a, pose_b, weights, pose_a);
+	result->setPose(pose_a);
 }
 
 void Skeleton::renderSkeleton(Camera* camera, Matrix44 model, Vector4f color, bool render_points)
@@ -132,6 +135,8 @@ void Skeleton::applyTransformToBones(const char* root, Matrix44 transform)
 	if (!bone)
 		return;
 	bone->model = bone->model * transform;
+	int index = (int)(bone - bones);
+	decomposeMatrix(bone->model, local_positions[index], local_rotations[index], local_scales[index]);
 }
 
 void Skeleton::updateGlobalMatrices()
@@ -146,6 +151,38 @@ void Skeleton::updateGlobalMatrices()
 	}
 }
 
+void Skeleton::decomposeLocalMatrices()
+{
+	for (int i = 0; i < num_bones; ++i)
+		decomposeMatrix(bones[i].model, local_positions[i], local_rotations[i], local_scales[i]);
+}
+
+void Skeleton::getPose(sPose& pose) const
+{
+	assert(pose.num_bones == num_bones);
+	for (int i = 0; i < num_bones; ++i)
+	{
+		pose.channels[sPose::TX][i] = local_positions[i].x; pose.channels[sPose::TY][i] = local_positions[i].y; pose.channels[sPose::TZ][i] = local_positions[i].z;
+		pose.channels[sPose::QX][i] = local_rotations[i].x; pose.channels[sPose::QY][i] = local_rotations[i].y;
+		pose.channels[sPose::QZ][i] = local_rotations[i].z; pose.channels[sPose::QW][i] = local_rotations[i].w;
+		pose.channels[sPose::SX][i] = local_scales[i].x; pose.channels[sPose::SY][i] = local_scales[i].y; pose.channels[sPose::SZ][i] = local_scales[i].z;
+	}
+}
+
+void Skeleton::setPose(const sPose& pose)
+{
+	assert(pose.num_bones == num_bones);
+	for (int i = 0; i < num_bones; ++i)
+	{
+		local_positions[i].set(pose.channels[sPose::TX][i], pose.channels[sPose::TY][i], pose.channels[sPose::TZ][i]);
+		Quaternion& rotation = local_rotations[i];
+		rotation.x = pose.channels[sPose::QX][i]; rotation.y = pose.channels[sPose::QY][i];
+		rotation.z = pose.channels[sPose::QZ][i]; rotation.w = pose.channels[sPose::QW][i];
+		local_scales[i].set(pose.channels[sPose::SX][i], pose.channels[sPose::SY][i], pose.channels[sPose::SZ][i]);
+	}
+	composePoseMatrices(pose, &bones[0].model, sizeof(Bone));
+}
+
 void Skeleton::assignLayer( Bone* bone, uint8 layer )
 {
 	if (!bone)
@@ -164,20 +201,517 @@ void Skeleton::assignLayer( Bone* bone, uint8 layer )
 Animation::Animation()
 {
 	duration = 0.0f;
-	keyframes = NULL;
+	samples_per_second = 0.0f;
 	num_keyframes = 0;
 	num_animated_bones = 0;
 }
 
-Animation::~Animation()
+//rotations are stored with the largest component dropped (it can be recovered from the other three),
+//the rest are in [-1/sqrt(2), 1/sqrt(2)] and are stored in 15 bits, the index of the dropped one goes in the high bits
+#define ROTATION_KEY_RANGE 32767.0f
+
+static void encodeRotation(Quaternion q, uint16* result)
 {
-	if (keyframes)
-		delete[] keyframes;
+	float c[4] = { q.x, q.y, q.z, q.w };
+	int largest = 0;
+	for (int i = 1; i < 4; ++i)
+		if (fabs(c[i]) > fabs(c[largest]))
+			largest = i;
+	float sign = c[largest] < 0.0f ? -1.0f : 1.0f; //q and -q are the same rotation, so the dropped one is always positive
+	int j = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i == largest)
+			continue;
+		float v = clamp(c[i] * sign * (float)M_SQRT2 * 0.5f + 0.5f, 0.0f, 1.0f);
+		result[j++] = (uint16)(v * ROTATION_KEY_RANGE + 0.5f);
+	}
+	result[0] |= (largest & 1) << 15;
+	result[1] |= (largest >> 1) << 15;
 }
 
-void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
+static Quaternion decodeRotation(const uint16* key)
+{
+	int largest = (key[0] >> 15) | ((key[1] >> 15) << 1);
+	float c[4];
+	float sum = 0.0f;
+	int j = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i == largest)
+			continue;
+		float v = ((key[j++] & 0x7FFF) * (2.0f / ROTATION_KEY_RANGE) - 1.0f) * (float)M_SQRT1_2;
+		c[i] = v;
+		sum += v * v;
+	}
+	c[largest] = sqrtf(std::max(0.0f, 1.0f - sum));
+	return Quaternion(c[0], c[1], c[2], c[3]);
+}
+
+//normalized lerp, takes the shortest path
+static Quaternion nlerpRotation(const Quaternion& a, const Quaternion& b, float f)
+{
+	float sign = (a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w) < 0.0f ? -1.0f : 1.0f;
+	Quaternion q(a.x + (b.x * sign - a.x) * f, a.y + (b.y * sign - a.y) * f, a.z + (b.z * sign - a.z) * f, a.w + (b.w * sign - a.w) * f);
+	q.normalize();
+	return q;
+}
+
+static float rotationError(const Quaternion& a, const Quaternion& b)
+{
+	float d = fabs(a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w);
+	return 2.0f * acosf(std::min(d, 1.0f)); //angle in radians
+}
+
+//splits a local matrix in translation, rotation and scale (shear is lost)
+static void decomposeMatrix(const Matrix44& m, Vector3f& position, Quaternion& rotation, Vector3f& scale)
+{
+	position.set(m.m[12], m.m[13], m.m[14]);
+	Vector3f x(m.m[0], m.m[1], m.m[2]);
+	Vector3f y(m.m[4], m.m[5], m.m[6]);
+	Vector3f z(m.m[8], m.m[9], m.m[10]);
+	scale.set(x.length(), y.length(), z.length());
+	if (x.cross(y).dot(z) < 0.0f) //mirrored
+		scale.x *= -1.0f;
+	Matrix44 r;
+	for (int i = 0; i < 3; ++i)
+	{
+		float s = scale.v[i] != 0.0f ? 1.0f / scale.v[i] : 0.0f;
+		r.m[i * 4 + 0] = m.m[i * 4 + 0] * s;
+		r.m[i * 4 + 1] = m.m[i * 4 + 1] * s;
+		r.m[i * 4 + 2] = m.m[i * 4 + 2] * s;
+	}
+	rotation.fromMatrix(r);
+	rotation.normalize();
+}
+
+static void composeMatrix(const Vector3f& position, const Quaternion& q, const Vector3f& scale, Matrix44& m)
+{
+	float x2 = q.x + q.x, y2 = q.y + q.y, z2 = q.z + q.z;
+	float xx = q.x * x2, yy = q.y * y2, zz = q.z * z2;
+	float xy = q.x * y2, xz = q.x * z2, yz = q.y * z2;
+	float wx = q.w * x2, wy = q.w * y2, wz = q.w * z2;
+	m.m[0] = (1.0f - yy - zz) * scale.x; m.m[1] = (xy + wz) * scale.x; m.m[2] = (xz - wy) * scale.x; m.m[3] = 0.0f;
+	m.m[4] = (xy - wz) * scale.y; m.m[5] = (1.0f - xx - zz) * scale.y; m.m[6] = (yz + wx) * scale.y; m.m[7] = 0.0f;
+	m.m[8] = (xz + wy) * scale.z; m.m[9] = (yz - wx) * scale.z; m.m[10] = (1.0f - xx - yy) * scale.z; m.m[11] = 0.0f;
+	m.m[12] = position.x; m.m[13] = position.y; m.m[14] = position.z; m.m[15] = 1.0f;
+}
+
+//greedy keyframe reduction: keeps a key only where interpolating from the previous one fails
+//fits(a,b) must test every sample between a and b, the first and last samples are always kept
+template<typename T>
+static void reduceKeys(int num_samples, T fits, std::vector<int>& keys)
+{
+	keys.clear();
+	keys.push_back(0);
+	int a = 0;
+	while (a < num_samples - 1)
+	{
+		int b = a + 1;
+		while (b + 1 < num_samples && fits(a, b + 1))
+			b++;
+		keys.push_back(b);
+		a = b;
+	}
+}
+
+void Animation::compressKeyframes(const Matrix44* keyframes)
+{
+	assert(keyframes && num_keyframes > 0 && num_keyframes <= 0xFFFF);
+
+	const float rotation_tolerance = 0.002f; //radians
+	const float scale_tolerance = 0.0001f;
+
+	tracks.resize(num_animated_bones * NUM_TRACK_TYPES);
+	key_times.clear();
+	rotation_keys.clear();
+	vector_keys.clear();
+
+	int n = num_keyframes;
+	std::vector<Vector3f> positions(n), scales(n);
+	std::vector<Quaternion> rotations(n), decoded(n);
+	std::vector<uint16> encoded(n * 3);
+	std::vector<int> keys;
+
+	for (int i = 0; i < num_animated_bones; ++i)
+	{
+		float extent = 0.0f;
+		for (int s = 0; s < n; ++s)
+		{
+			decomposeMatrix(keyframes[s * num_animated_bones + i], positions[s], rotations[s], scales[s]);
+			extent = std::max(extent, positions[s].length());
+		}
+		float position_tolerance = 0.0001f * (1.0f + extent);
+
+		//rotations, compared once quantized so the error doesnt accumulate
+		for (int s = 0; s < n; ++s)
+		{
+			encodeRotation(rotations[s], &encoded[s * 3]);
+			decoded[s] = decodeRotation(&encoded[s * 3]);
+		}
+		auto fitsRotation = [&](int a, int b) {
+			for (int s = a + 1; s < b; ++s)
+				if (rotationError(nlerpRotation(decoded[a], decoded[b], (s - a) / (float)(b - a)), rotations[s]) > rotation_tolerance)
+					return false;
+			return true;
+		};
+		sTrack& rotation_track = tracks[i * NUM_TRACK_TYPES + ROTATION_TRACK];
+		bool constant = true;
+		for (int s = 1; s < n && constant; ++s)
+			constant = rotationError(decoded[0], rotations[s]) <= rotation_tolerance;
+		if (constant)
+			keys.assign(1, 0);
+		else
+			reduceKeys(n, fitsRotation, keys);
+		rotation_track.first_key = (uint32)key_times.size();
+		rotation_track.first_value = (uint32)rotation_keys.size() / 3;
+		rotation_track.num_keys = (uint32)keys.size();
+		for (int k : keys)
+		{
+			if (keys.size() > 1)
+				key_times.push_back((uint16)k);
+			rotation_keys.insert(rotation_keys.end(), &encoded[k * 3], &encoded[k * 3] + 3);
+		}
+
+		//translation and scale
+		for (int type = TRANSLATION_TRACK; type < NUM_TRACK_TYPES; type += 2)
+		{
+			std::vector<Vector3f>& values = type == TRANSLATION_TRACK ? positions : scales;
+			float tolerance = type == TRANSLATION_TRACK ? position_tolerance : scale_tolerance;
+			auto fitsVector = [&](int a, int b) {
+				for (int s = a + 1; s < b; ++s)
+					if ((lerp(values[a], values[b], (s - a) / (float)(b - a)) - values[s]).length() > tolerance)
+						return false;
+				return true;
+			};
+			constant = true;
+			for (int s = 1; s < n && constant; ++s)
+				constant = (values[s] - values[0]).length() <= tolerance;
+			if (constant)
+				keys.assign(1, 0);
+			else
+				reduceKeys(n, fitsVector, keys);
+			sTrack& track = tracks[i * NUM_TRACK_TYPES + type];
+			track.first_key = (uint32)key_times.size();
+			track.first_value = (uint32)vector_keys.size();
+			track.num_keys = (uint32)keys.size();
+			for (int k : keys)
+			{
+				if (keys.size() > 1)
+					key_times.push_back((uint16)k);
+				vector_keys.push_back(values[k]);
+			}
+		}
+	}
+}
+
+size_t Animation::getMemorySize() const
+{
+	return tracks.size() * sizeof(sTrack) + key_times.size() * sizeof(uint16) + rotation_keys.size() * sizeof(uint16) + vector_keys.size() * sizeof(Vector3f);
+}
+
+//finds the keys around the sample (a and b relative to the track) and the interpolation factor
+static inline void findTrackKeys(const Animation::sTrack& track, const uint16* key_times, float sample, int num_samples, bool loop, int& a, int& b, float& f)
+{
+	if (track.num_keys == 1)
+	{
+		a = b = 0;
+		f = 0.0f;
+		return;
+	}
+	const uint16* times = key_times + track.first_key;
+	int last = track.num_keys - 1;
+	if (sample >= times[last])
+	{
+		//after the last key it goes back to the first one (like the original samples did)
+		a = last;
+		b = loop ? 0 : last;
+		f = loop ? (sample - times[last]) / (float)(num_samples - times[last]) : 0.0f;
+		return;
+	}
+	//last key with time <= sample, without branches (the compiler uses conditional moves)
+	int base = 0;
+	int n = last;
+	while (n > 1)
+	{
+		int half = n >> 1;
+		base = times[base + half] <= sample ? base + half : base;
+		n -= half;
+	}
+	a = base;
+	b = base + 1;
+	f = (sample - times[a]) / (float)(times[b] - times[a]);
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ANIMATION_SSE
+	#include <emmintrin.h>
+#endif
+
+//keys of four bones to be decoded and interpolated together
+//(pointers to the keys instead of copies, vectors built from scalar stores would stall on store forwarding)
+struct sAnimationLanes {
+	const uint16* qa[4];
+	const uint16* qb[4];
+	const Vector3f* ta[4];
+	const Vector3f* tb[4];
+	const Vector3f* sa[4];
+	const Vector3f* sb[4];
+	float fr[4], ft[4], fs[4];
+	int bone[4];
+	float result[sPose::NUM_CHANNELS][4]; //in SoA
+};
+
+#ifdef ANIMATION_SSE
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b) //mask ? a : b
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline void decodeRotations4(const uint16* const keys[4], __m128 q[4])
+{
+	__m128i r0 = _mm_setr_epi32(keys[0][0], keys[1][0], keys[2][0], keys[3][0]);
+	__m128i r1 = _mm_setr_epi32(keys[0][1], keys[1][1], keys[2][1], keys[3][1]);
+	__m128i r2 = _mm_setr_epi32(keys[0][2], keys[1][2], keys[2][2], keys[3][2]);
+	__m128i value_mask = _mm_set1_epi32(0x7FFF);
+	__m128 scale = _mm_set1_ps(2.0f / ROTATION_KEY_RANGE);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 sqrt1_2 = _mm_set1_ps((float)M_SQRT1_2);
+	__m128 c0 = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(r0, value_mask)), scale), one), sqrt1_2);
+	__m128 c1 = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(r1, value_mask)), scale), one), sqrt1_2);
+	__m128 c2 = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(r2, value_mask)), scale), one), sqrt1_2);
+	__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, c0), _mm_mul_ps(c1, c1)), _mm_mul_ps(c2, c2));
+	__m128 largest = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, sum), _mm_setzero_ps()));
+	__m128i index = _mm_or_si128(_mm_srli_epi32(r0, 15), _mm_slli_epi32(_mm_srli_epi32(r1, 15), 1));
+	__m128 is0 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_setzero_si128()));
+	__m128 is1 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(1)));
+	__m128 is2 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(2)));
+	__m128 is3 = _mm_castsi128_ps(_mm_cmpeq_epi32(index, _mm_set1_epi32(3)));
+	q[0] = select4(is0, largest, c0);
+	q[1] = select4(is0, c0, select4(is1, largest, c1));
+	q[2] = select4(_mm_or_ps(is0, is1), c1, select4(is2, largest, c2));
+	q[3] = select4(is3, largest, c2);
+}
+
+//a + (b - a) * f for rotations, taking the shortest path and normalizing the result
+static inline void nlerpRotations4(const __m128 a[4], const __m128 b[4], __m128 f, __m128 result[4])
+{
+	__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+	__m128 sign = _mm_and_ps(dot, _mm_set1_ps(-0.0f));
+	for (int j = 0; j < 4; ++j)
+		result[j] = _mm_add_ps(a[j], _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(b[j], sign), a[j]), f));
+	__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(result[0], result[0]), _mm_mul_ps(result[1], result[1])), _mm_add_ps(_mm_mul_ps(result[2], result[2]), _mm_mul_ps(result[3], result[3]))));
+	__m128 inv_len = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(len, _mm_set1_ps(1e-12f)));
+	for (int j = 0; j < 4; ++j)
+		result[j] = _mm_mul_ps(result[j], inv_len);
+}
+#endif
+
+void sPose::setBuffer(float* data, int num_bones)
+{
+	this->num_bones = num_bones;
+	int padded = getPaddedSize(num_bones);
+	for (int i = 0; i < NUM_CHANNELS; ++i)
+		channels[i] = data + i * padded;
+}
+
+void sPose::copy(const sPose& pose)
 {
-	assert(keyframes && skeleton.num_bones);
+	assert(pose.num_bones == num_bones);
+	for (int i = 0; i < NUM_CHANNELS; ++i)
+		memcpy(channels[i], pose.channels[i], sizeof(float) * num_bones);
+}
+
+void blendPoses(const sPose& a, const sPose& b, const float* weights, sPose& result)
+{
+	assert(a.num_bones == b.num_bones && a.num_bones == result.num_bones);
+	const int QX = sPose::QX;
+#ifdef ANIMATION_SSE
+	for (int i = 0; i < a.num_bones; i += 4)
+	{
+		__m128 w = _mm_loadu_ps(weights + i);
+		for (int c = sPose::TX; c <= sPose::SZ; ++c)
+		{
+			if (c == QX)
+				c = sPose::SX; //rotations below
+			__m128 va = _mm_loadu_ps(a.channels[c] + i);
+			_mm_storeu_ps(result.channels[c] + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.channels[c] + i), va), w)));
+		}
+		__m128 qa[4], qb[4], q[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			qa[j] = _mm_loadu_ps(a.channels[QX + j] + i);
+			qb[j] = _mm_loadu_ps(b.channels[QX + j] + i);
+		}
+		nlerpRotations4(qa, qb, w, q);
+		for (int j = 0; j < 4; ++j)
+			_mm_storeu_ps(result.channels[QX + j] + i, q[j]);
+	}
+#else
+	for (int i = 0; i < a.num_bones; ++i)
+	{
+		float w = weights[i];
+		for (int c = sPose::TX; c <= sPose::SZ; ++c)
+			if (c < QX || c > sPose::QW)
+				result.channels[c][i] = lerp(a.channels[c][i], b.channels[c][i], w);
+		Quaternion q = nlerpRotation(Quaternion(a.channels[QX][i], a.channels[QX + 1][i], a.channels[QX + 2][i], a.channels[QX + 3][i]),
+			Quaternion(b.channels[QX][i], b.channels[QX + 1][i], b.channels[QX + 2][i], b.channels[QX + 3][i]), w);
+		result.channels[QX][i] = q.x; result.channels[QX + 1][i] = q.y; result.channels[QX + 2][i] = q.z; result.channels[QX + 3][i] = q.w;
+	}
+#endif
+}
+
+void composePoseMatrices(const sPose& pose, Matrix44* matrices, size_t stride)
+{
+	#define POSE_MATRIX(i) (*(Matrix44*)((char*)matrices + (i) * stride))
+#ifdef ANIMATION_SSE
+	const float* const* c = pose.channels;
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 zero = _mm_setzero_ps();
+	for (int i = 0; i < pose.num_bones; i += 4)
+	{
+		__m128 qx = _mm_loadu_ps(c[sPose::QX] + i), qy = _mm_loadu_ps(c[sPose::QY] + i), qz = _mm_loadu_ps(c[sPose::QZ] + i), qw = _mm_loadu_ps(c[sPose::QW] + i);
+		__m128 sx = _mm_loadu_ps(c[sPose::SX] + i), sy = _mm_loadu_ps(c[sPose::SY] + i), sz = _mm_loadu_ps(c[sPose::SZ] + i);
+		__m128 x2 = _mm_add_ps(qx, qx), y2 = _mm_add_ps(qy, qy), z2 = _mm_add_ps(qz, qz);
+		__m128 xx = _mm_mul_ps(qx, x2), yy = _mm_mul_ps(qy, y2), zz = _mm_mul_ps(qz, z2);
+		__m128 xy = _mm_mul_ps(qx, y2), xz = _mm_mul_ps(qx, z2), yz = _mm_mul_ps(qy, z2);
+		__m128 wx = _mm_mul_ps(qw, x2), wy = _mm_mul_ps(qw, y2), wz = _mm_mul_ps(qw, z2);
+		__m128 rows[4][4] = {
+			{ _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx), _mm_mul_ps(_mm_add_ps(xy, wz), sx), _mm_mul_ps(_mm_sub_ps(xz, wy), sx), zero },
+			{ _mm_mul_ps(_mm_sub_ps(xy, wz), sy), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy), _mm_mul_ps(_mm_add_ps(yz, wx), sy), zero },
+			{ _mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_mul_ps(_mm_sub_ps(yz, wx), sz), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz), zero },
+			{ _mm_loadu_ps(c[sPose::TX] + i), _mm_loadu_ps(c[sPose::TY] + i), _mm_loadu_ps(c[sPose::TZ] + i), one }
+		};
+		//transpose to one matrix per bone
+		int num = std::min(4, pose.num_bones - i);
+		for (int r = 0; r < 4; ++r)
+		{
+			_MM_TRANSPOSE4_PS(rows[r][0], rows[r][1], rows[r][2], rows[r][3]);
+			for (int j = 0; j < num; ++j)
+				_mm_storeu_ps(POSE_MATRIX(i + j).m + r * 4, rows[r][j]);
+		}
+	}
+#else
+	for (int i = 0; i < pose.num_bones; ++i)
+		composeMatrix(Vector3f(pose.channels[sPose::TX][i], pose.channels[sPose::TY][i], pose.channels[sPose::TZ][i]),
+			Quaternion(pose.channels[sPose::QX][i], pose.channels[sPose::QY][i], pose.channels[sPose::QZ][i], pose.channels[sPose::QW][i]),
+			Vector3f(pose.channels[sPose::SX][i], pose.channels[sPose::SY][i], pose.channels[sPose::SZ][i]), POSE_MATRIX(i));
+#endif
+	#undef POSE_MATRIX
+}
+
+SkinBinding::SkinBinding(GFX::Mesh* mesh, const Skeleton* skeleton)
+{
+	assert(mesh && skeleton);
+	mesh_index = mesh->index;
+	int num = (int)mesh->bones_info.size();
+	bone_indices.resize(num);
+	bind_matrices.resize(num);
+	for (int i = 0; i < num; ++i)
+	{
+		BoneInfo& bone_info = mesh->bones_info[i];
+		auto it = skeleton->bones_by_name.find(bone_info.name);
+		bone_indices[i] = it != skeleton->bones_by_name.end() ? it->second : -1;
+		bind_matrices[i] = mesh->bind_matrix * bone_info.bind_pose;
+	}
+}
+
+//result = a * b, with the rows of b already loaded
+#ifdef ANIMATION_SSE
+static inline void multiplyRows4(const Matrix44& a, const __m128 b[4], __m128 result[4])
+{
+	for (int r = 0; r < 4; ++r)
+	{
+		const float* row = a.m + r * 4;
+		result[r] = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), b[0]), _mm_mul_ps(_mm_set1_ps(row[1]), b[1])),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[2]), b[2]), _mm_mul_ps(_mm_set1_ps(row[3]), b[3])));
+	}
+}
+
+static inline void loadRows4(const Matrix44* m, __m128 rows[4])
+{
+	static const Matrix44 identity;
+	if (!m)
+		m = &identity;
+	for (int r = 0; r < 4; ++r)
+		rows[r] = _mm_loadu_ps(m->m + r * 4);
+}
+#endif
+
+void SkinBinding::computePalette(const Matrix44* global_matrices, Matrix44* palette) const
+{
+	int num = getNumBones();
+	for (int i = 0; i < num; ++i)
+	{
+		int bone = bone_indices[i];
+#ifdef ANIMATION_SSE
+		__m128 b[4], result[4];
+		loadRows4(bone != -1 ? &global_matrices[bone] : NULL, b);
+		multiplyRows4(bind_matrices[i], b, result);
+		for (int r = 0; r < 4; ++r)
+			_mm_storeu_ps(palette[i].m + r * 4, result[r]);
+#else
+		palette[i] = bone != -1 ? bind_matrices[i] * global_matrices[bone] : bind_matrices[i];
+#endif
+	}
+}
+
+void SkinBinding::computePalette3x4(const Matrix44* global_matrices, Vector4f* palette) const
+{
+	int num = getNumBones();
+	for (int i = 0; i < num; ++i)
+	{
+		int bone = bone_indices[i];
+		Vector4f* rows = palette + i * 3;
+#ifdef ANIMATION_SSE
+		__m128 b[4], result[4];
+		loadRows4(bone != -1 ? &global_matrices[bone] : NULL, b);
+		multiplyRows4(bind_matrices[i], b, result);
+		_MM_TRANSPOSE4_PS(result[0], result[1], result[2], result[3]);
+		for (int r = 0; r < 3; ++r)
+			_mm_storeu_ps(&rows[r].x, result[r]);
+#else
+		Matrix44 m = bone != -1 ? bind_matrices[i] * global_matrices[bone] : bind_matrices[i];
+		for (int r = 0; r < 3; ++r)
+			rows[r].set(m.m[r], m.m[4 + r], m.m[8 + r], m.m[12 + r]);
+#endif
+	}
+}
+
+void SkinBinding::upload(GFX::Shader* shader, const Matrix44* global_matrices, bool compact) const
+{
+	int num = getNumBones();
+	if (!num)
+		return;
+	if (compact)
+	{
+		std::vector<Vector4f> palette(num * 3);
+		computePalette3x4(global_matrices, &palette[0]);
+		shader->setUniform4Array("u_bones3x4", &palette[0].x, num * 3);
+	}
+	else
+	{
+		std::vector<Matrix44> palette(num);
+		computePalette(global_matrices, &palette[0]);
+		shader->setUniform("u_bones", palette);
+	}
+}
+
+static std::mutex skin_bindings_mutex; //characters sharing a skeleton can be skinned from different workers
+const SkinBinding* SkinBinding::Get(GFX::Mesh* mesh, const Skeleton* skeleton)
+{
+	std::lock_guard<std::mutex> lock(skin_bindings_mutex);
+	for (size_t i = 0; i < skeleton->skin_bindings.size(); ++i)
+		if (skeleton->skin_bindings[i].mesh_index == mesh->index)
+			return &skeleton->skin_bindings[i];
+	skeleton->skin_bindings.emplace_back(mesh, skeleton);
+	return &skeleton->skin_bindings.back();
+}
+
+void Animation::samplePose(float t, sPose& pose, bool loop, bool interpolate, uint8 layers) const
+{
+	assert(tracks.size() && pose.num_bones >= skeleton.num_bones);
 
 	if (loop)
 	{
@@ -187,36 +721,188 @@ void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
 	}
 	else
 		t = clamp( t, 0.0f, duration - (1.0/samples_per_second) );
-	float v = samples_per_second * t;
-	int index = clamp(floor(v), 0, num_keyframes - 1);
-	int index2 = index + 1;
-	if (index2 >= num_keyframes)
-		index2 = 0;
-	float f = v - floor(v);
-
-	Matrix44* k = keyframes + index * num_animated_bones;
-	Matrix44* k2 = keyframes + index2 * num_animated_bones;
-
-	//compute local bones
-	#pragma omp for  
-	for (int i = 0; i < num_animated_bones; ++i)
+	float v = clamp(samples_per_second * t, 0.0f, (float)num_keyframes - 0.0001f);
+	if (!interpolate)
+		v = floor(v);
+
+	sAnimationLanes lanes;
+	int num_lanes = 0;
+	for (int i = 0; i <= num_animated_bones; ++i)
 	{
-		int bone_index = bones_map[i];
-		Skeleton::Bone& bone = skeleton.bones[bone_index];
-		if (layers != 0xFF && !(bone.layer & layers))
-			continue;
-		for (int j = 0; j < 16; ++j)
-			bone.model.m[j] = lerp(k[i].m[j], k2[i].m[j], f);
+		//gather
+		if (i < num_animated_bones)
+		{
+			int bone_index = bones_map[i];
+			if (layers != 0xFF && !(skeleton.bones[bone_index].layer & layers))
+				continue;
+			const sTrack* bone_tracks = &tracks[i * NUM_TRACK_TYPES];
+			int a, b;
+			float f;
+			findTrackKeys(bone_tracks[ROTATION_TRACK], key_times.data(), v, num_keyframes, loop, a, b, f);
+			lanes.qa[num_lanes] = &rotation_keys[(bone_tracks[ROTATION_TRACK].first_value + a) * 3];
+			lanes.qb[num_lanes] = &rotation_keys[(bone_tracks[ROTATION_TRACK].first_value + b) * 3];
+			lanes.fr[num_lanes] = f;
+			findTrackKeys(bone_tracks[TRANSLATION_TRACK], key_times.data(), v, num_keyframes, loop, a, b, f);
+			lanes.ta[num_lanes] = &vector_keys[bone_tracks[TRANSLATION_TRACK].first_value + a];
+			lanes.tb[num_lanes] = &vector_keys[bone_tracks[TRANSLATION_TRACK].first_value + b];
+			lanes.ft[num_lanes] = f;
+			findTrackKeys(bone_tracks[SCALE_TRACK], key_times.data(), v, num_keyframes, loop, a, b, f);
+			lanes.sa[num_lanes] = &vector_keys[bone_tracks[SCALE_TRACK].first_value + a];
+			lanes.sb[num_lanes] = &vector_keys[bone_tracks[SCALE_TRACK].first_value + b];
+			lanes.fs[num_lanes] = f;
+			lanes.bone[num_lanes++] = bone_index;
+			if (num_lanes < 4)
+				continue;
+		}
+		if (!num_lanes)
+			break;
+
+		//pad with the first one
+		for (int j = num_lanes; j < 4; ++j)
+		{
+			lanes.qa[j] = lanes.qb[j] = lanes.qa[0];
+			lanes.ta[j] = lanes.tb[j] = lanes.ta[0];
+			lanes.sa[j] = lanes.sb[j] = lanes.sa[0];
+			lanes.fr[j] = lanes.ft[j] = lanes.fs[j] = 0.0f;
+		}
+
+#ifdef ANIMATION_SSE
+		//decode both keys and nlerp
+		__m128 qa[4], qb[4], q[4];
+		decodeRotations4(lanes.qa, qa);
+		decodeRotations4(lanes.qb, qb);
+		nlerpRotations4(qa, qb, _mm_setr_ps(lanes.fr[0], lanes.fr[1], lanes.fr[2], lanes.fr[3]), q);
+		for (int j = 0; j < 4; ++j)
+			_mm_storeu_ps(lanes.result[sPose::QX + j], q[j]);
+
+		//translation and scale
+		__m128 ft = _mm_setr_ps(lanes.ft[0], lanes.ft[1], lanes.ft[2], lanes.ft[3]);
+		__m128 fs = _mm_setr_ps(lanes.fs[0], lanes.fs[1], lanes.fs[2], lanes.fs[3]);
+		for (int j = 0; j < 3; ++j)
+		{
+			__m128 ta = _mm_setr_ps(lanes.ta[0]->v[j], lanes.ta[1]->v[j], lanes.ta[2]->v[j], lanes.ta[3]->v[j]);
+			__m128 tb = _mm_setr_ps(lanes.tb[0]->v[j], lanes.tb[1]->v[j], lanes.tb[2]->v[j], lanes.tb[3]->v[j]);
+			__m128 sa = _mm_setr_ps(lanes.sa[0]->v[j], lanes.sa[1]->v[j], lanes.sa[2]->v[j], lanes.sa[3]->v[j]);
+			__m128 sb = _mm_setr_ps(lanes.sb[0]->v[j], lanes.sb[1]->v[j], lanes.sb[2]->v[j], lanes.sb[3]->v[j]);
+			_mm_storeu_ps(lanes.result[sPose::TX + j], _mm_add_ps(ta, _mm_mul_ps(_mm_sub_ps(tb, ta), ft)));
+			_mm_storeu_ps(lanes.result[sPose::SX + j], _mm_add_ps(sa, _mm_mul_ps(_mm_sub_ps(sb, sa), fs)));
+		}
+#else
+		for (int j = 0; j < num_lanes; ++j)
+		{
+			Quaternion q = nlerpRotation(decodeRotation(lanes.qa[j]), decodeRotation(lanes.qb[j]), lanes.fr[j]);
+			Vector3f position = lerp(*lanes.ta[j], *lanes.tb[j], lanes.ft[j]);
+			Vector3f scale = lerp(*lanes.sa[j], *lanes.sb[j], lanes.fs[j]);
+			lanes.result[sPose::QX][j] = q.x; lanes.result[sPose::QY][j] = q.y; lanes.result[sPose::QZ][j] = q.z; lanes.result[sPose::QW][j] = q.w;
+			for (int k = 0; k < 3; ++k)
+			{
+				lanes.result[sPose::TX + k][j] = position.v[k];
+				lanes.result[sPose::SX + k][j] = scale.v[k];
+			}
+		}
+#endif
+
+		//scatter to the bones of the pose
+		for (int c = 0; c < sPose::NUM_CHANNELS; ++c)
+			for (int j = 0; j < num_lanes; ++j)
+				pose.channels[c][lanes.bone[j]] = lanes.result[c][j];
+		num_lanes = 0;
 	}
+}
+
+void Animation::sample(float t, bool loop, bool interpolate, uint8 layers)
+{
+	assert(tracks.size() && skeleton.num_bones);
 
+	float data[sPose::NUM_CHANNELS * 128];
+	sPose pose;
+	pose.setBuffer(data, skeleton.num_bones);
+	skeleton.getPose(pose);
+	samplePose(t, pose, loop, interpolate, layers);
+
+	skeleton.setPose(pose);
+}
+
+void Animation::assignTime(float t, bool loop, bool interpolate, uint8 layers)
+{
+	sample(t, loop, interpolate, layers);
 	skeleton.updateGlobalMatrices();
 }
 
+void benchmarkAnimation(Animation* anim, int num_samples)
+{
+	assert(anim && anim->tracks.size());
+	if (num_samples < 1)
+		num_samples = 1;
+	int num_bones = anim->num_animated_bones;
+
+	//rebuild the matrix per sample to compare with the old sampler
+	std::vector<Matrix44> keyframes(anim->num_keyframes * num_bones);
+	for (int s = 0; s < anim->num_keyframes; ++s)
+	{
+		anim->sample((s + 0.5f) / anim->samples_per_second, true, false);
+		for (int i = 0; i < num_bones; ++i)
+			keyframes[s * num_bones + i] = anim->skeleton.bones[anim->bones_map[i]].model;
+	}
+
+	std::vector<float> times(num_samples);
+	for (int i = 0; i < num_samples; ++i)
+		times[i] = random(anim->duration);
+
+	//matrices lerped per component (the v3 sampler)
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int k = 0; k < num_samples; ++k)
+	{
+		float v = anim->samples_per_second * times[k];
+		int index = clamp(floor(v), 0, anim->num_keyframes - 1);
+		int index2 = index + 1 < anim->num_keyframes ? index + 1 : 0;
+		float f = v - floor(v);
+		Matrix44* k1 = &keyframes[index * num_bones];
+		Matrix44* k2 = &keyframes[index2 * num_bones];
+		for (int i = 0; i < num_bones; ++i)
+		{
+			Skeleton::Bone& bone = anim->skeleton.bones[anim->bones_map[i]];
+			for (int j = 0; j < 16; ++j)
+				bone.model.m[j] = lerp(k1[i].m[j], k2[i].m[j], f);
+		}
+	}
+	std::chrono::duration<double, std::nano> matrix_time = std::chrono::high_resolution_clock::now() - start;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int k = 0; k < num_samples; ++k)
+		anim->sample(times[k]);
+	std::chrono::duration<double, std::nano> tracks_time = std::chrono::high_resolution_clock::now() - start;
+
+	double num = (double)num_samples * num_bones;
+	size_t matrix_memory = keyframes.size() * sizeof(Matrix44);
+	size_t memory = anim->getMemorySize();
+	int num_keys = 0, num_constant = 0;
+	for (auto& track : anim->tracks)
+	{
+		num_keys += track.num_keys;
+		num_constant += track.num_keys == 1;
+	}
+
+	std::cout << " + Animation benchmark: " << num_bones << " bones, " << anim->num_keyframes << " samples" << std::endl;
+	std::cout << "\tMatrices: " << matrix_memory / 1024.0 << " KB\t" << matrix_time.count() / num << " ns/bone" << std::endl;
+	std::cout << "\tTracks: " << memory / 1024.0 << " KB (x" << matrix_memory / (double)std::max(memory, (size_t)1) << " smaller)\t" << tracks_time.count() / num << " ns/bone" << std::endl;
+	std::cout << "\t" << anim->tracks.size() << " tracks, " << num_constant << " constant, " << num_keys << " keys" << std::endl;
+
+	anim->assignTime(0);
+}
 
 void Animation::operator = (Animation* anim)
 {
-	memcpy(this, anim, sizeof(Animation));
-	this->keyframes = NULL;
+	skeleton = anim->skeleton;
+	duration = anim->duration;
+	samples_per_second = anim->samples_per_second;
+	num_animated_bones = anim->num_animated_bones;
+	num_keyframes = anim->num_keyframes;
+	memcpy(bones_map, anim->bones_map, sizeof(bones_map));
+	tracks = anim->tracks;
+	key_times = anim->key_times;
+	rotation_keys = anim->rotation_keys;
+	vector_keys = anim->vector_keys;
 }
 
 bool Animation::load(const char* filename)
@@ -264,7 +950,10 @@ struct sAnimHeader {
 	int num_keyframes;
 	int num_bones;
 	int8 bones_map[128];
-	char extra[16];
+	int num_tracks;
+	int num_key_times;
+	int num_rotation_keys; //in uint16
+	int num_vector_keys;
 };
 
 bool Animation::writeABIN(const char* filename)
@@ -291,6 +980,10 @@ bool Animation::writeABIN(const char* filename)
 	header.num_keyframes = num_keyframes;
 	header.num_bones = skeleton.num_bones;
 	memcpy( header.bones_map, bones_map, sizeof(bones_map)  );
+	header.num_tracks = (int)tracks.size();
+	header.num_key_times = (int)key_times.size();
+	header.num_rotation_keys = (int)rotation_keys.size();
+	header.num_vector_keys = (int)vector_keys.size();
 
 	//write header
 	fwrite((void*)&header, sizeof(sAnimHeader), 1, f);
@@ -298,8 +991,11 @@ bool Animation::writeABIN(const char* filename)
 	//write skeleton
 	fwrite((void*)skeleton.bones, sizeof(skeleton.bones), 1, f);
 
-	//write keyframes
-	fwrite((void*)keyframes, sizeof(Matrix44) * num_keyframes * num_animated_bones, 1, f);
+	//write tracks
+	fwrite((void*)tracks.data(), sizeof(sTrack) * tracks.size(), 1, f);
+	fwrite((void*)key_times.data(), sizeof(uint16) * key_times.size(), 1, f);
+	fwrite((void*)rotation_keys.data(), sizeof(uint16) * rotation_keys.size(), 1, f);
+	fwrite((void*)vector_keys.data(), sizeof(Vector3f) * vector_keys.size(), 1, f);
 
 	fclose(f);
 	return true;
@@ -326,6 +1022,7 @@ bool Animation::loadABIN(const char* filename)
 	if (memcmp(data, "ABIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		delete[] data;
 		return false;
 	}
 
@@ -337,6 +1034,7 @@ bool Animation::loadABIN(const char* filename)
 	if (header.version != ANIM_BIN_VERSION || header.header_bytes != sizeof(sAnimHeader))
 	{
 		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		delete[] data;
 		return false;
 	}
 
@@ -352,11 +1050,27 @@ bool Animation::loadABIN(const char* filename)
 	memcpy( skeleton.bones, pos, sizeof(skeleton.bones) );
 	pos += sizeof(skeleton.bones);
 
-	//extract keyframes
-	assert(keyframes == NULL);
-	keyframes = new Matrix44[num_keyframes * num_animated_bones];
-	memcpy( keyframes, pos, sizeof(Matrix44)*num_keyframes * num_animated_bones );
-	pos += sizeof(Matrix44) * num_keyframes * num_animated_bones;
+	//extract tracks
+	size_t tracks_size = sizeof(sTrack) * header.num_tracks + sizeof(uint16) * (header.num_key_times + header.num_rotation_keys) + sizeof(Vector3f) * header.num_vector_keys;
+	if (header.num_tracks != num_animated_bones * NUM_TRACK_TYPES || (size_t)(pos - data) + tracks_size > size)
+	{
+		std::cout << "[ERROR] loading BIN: corrupted tracks: " << filename << std::endl;
+		delete[] data;
+		return false;
+	}
+	tracks.resize(header.num_tracks);
+	memcpy(tracks.data(), pos, sizeof(sTrack) * tracks.size());
+	pos += sizeof(sTrack) * tracks.size();
+	key_times.resize(header.num_key_times);
+	memcpy(key_times.data(), pos, sizeof(uint16) * key_times.size());
+	pos += sizeof(uint16) * key_times.size();
+	rotation_keys.resize(header.num_rotation_keys);
+	memcpy(rotation_keys.data(), pos, sizeof(uint16) * rotation_keys.size());
+	pos += sizeof(uint16) * rotation_keys.size();
+	vector_keys.resize(header.num_vector_keys);
+	memcpy(vector_keys.data(), pos, sizeof(Vector3f) * vector_keys.size());
+	pos += sizeof(Vector3f) * vector_keys.size();
+	skeleton.decomposeLocalMatrices();
 
 	//compute bone names map
 	for (int i = 0; i < skeleton.num_bones; ++i)
@@ -396,6 +1110,7 @@ bool Animation::loadSKANIM(const char* filename)
 	num_animated_bones = 0;
 
 	int current_keyframe = 0;
+	std::vector<Matrix44> keyframes; //all bones in every sample, compressed once loaded
 
 	while (*pos)
 	{
@@ -432,14 +1147,15 @@ bool Animation::loadSKANIM(const char* filename)
 			for (int j = 0; j < (int)bones_map_info.size(); ++j)
 				bones_map[j] = bones_map_info[j];
 			num_animated_bones = (int)bones_map_info.size();
-			assert(keyframes == NULL);
-			keyframes = new Matrix44[num_animated_bones * num_keyframes];
+			keyframes.resize(num_animated_bones * num_keyframes);
 		}
 		else if (type == 'K')
 		{
 			pos = fetchWord(pos, word);
 			//float time = atof(word);
-			Matrix44* k = keyframes + current_keyframe * num_animated_bones;
+			if (current_keyframe >= num_keyframes || keyframes.empty())
+				break;
+			Matrix44* k = &keyframes[current_keyframe * num_animated_bones];
 			current_keyframe++;
 			for (int j = 0; j < num_animated_bones; ++j)
 				pos = fetchMatrix44(pos, *(k + j));
@@ -468,6 +1184,13 @@ bool Animation::loadSKANIM(const char* filename)
 		skeleton.assignLayer(skeleton.getBone("mixamorig_LeftShoulder"), LEFT_ARM);
 	}
 
+	if (keyframes.empty())
+	{
+		delete[] data;
+		return false;
+	}
+	compressKeyframes(keyframes.data());
+	skeleton.decomposeLocalMatrices();
 	assignTime(0); //reset pose
 
 	delete[] data;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <deque>
 #include <cstring>
 #include <algorithm>
 #include <iostream>
@@ -8,8 +9,9 @@
 
 
 class Camera;
+class Skeleton;
 
-#define ANIM_BIN_VERSION 3
+#define ANIM_BIN_VERSION 4 //v4: compressed translation, rotation and scale tracks instead of matrices
 
 //defined layers for every body
 enum BODY_LAYERS {
@@ -26,6 +28,45 @@ enum BODY_LAYERS {
 //used to compare bone names in the map
 struct cmp_str { bool operator()(char const *a, char const *b) const { return std::strcmp(a, b) < 0; } };
 
+//local transforms of the bones of a skeleton in structure of arrays, one array of floats per channel
+//so four bones can be processed at once, the arrays must have room for num_bones rounded up to four
+struct sPose {
+	enum eChannel { TX, TY, TZ, QX, QY, QZ, QW, SX, SY, SZ, NUM_CHANNELS };
+	float* channels[NUM_CHANNELS];
+	int num_bones;
+
+	static int getPaddedSize(int num_bones) { return (num_bones + 3) & ~3; }
+	//data must have NUM_CHANNELS * getPaddedSize(num_bones) floats
+	void setBuffer(float* data, int num_bones);
+	void copy(const sPose& pose); //same number of bones
+};
+
+//result = lerp(a, b, weight) per bone, rotations are nlerped (result can be a or b), weights must be padded too
+void blendPoses(const sPose& a, const sPose& b, const float* weights, sPose& result);
+//composes the local matrix of every bone of the pose, stride is the bytes from one matrix to the next
+void composePoseMatrices(const sPose& pose, Matrix44* matrices, size_t stride = sizeof(Matrix44));
+
+//links the bones of a skinned mesh with the bones of a skeleton, created once per pair so the final
+//matrices dont need a bone name lookup and the bind matrices products every frame
+class SkinBinding {
+public:
+	uint32 mesh_index; //Mesh::index, unique for every mesh so it cannot be confused with a new mesh at the same address
+	std::vector<int> bone_indices; //bone of the skeleton for every bone of the mesh, -1 if not found
+	std::vector<Matrix44> bind_matrices; //mesh->bind_matrix * bind_pose of every bone of the mesh
+
+	SkinBinding(GFX::Mesh* mesh, const Skeleton* skeleton);
+	int getNumBones() const { return (int)bone_indices.size(); }
+
+	//final matrices ready for the shader from the global matrices of the skeleton (or of a character of the Animator)
+	void computePalette(const Matrix44* global_matrices, Matrix44* palette) const;
+	//same but only three rows of 4 floats per bone (the transposed first three columns, the last one is always 0,0,0,1)
+	void computePalette3x4(const Matrix44* global_matrices, Vector4f* palette) const;
+	//uploads the palette as mat4 u_bones[] or, if compact, as vec4 u_bones3x4[] with three vec4 per bone
+	void upload(GFX::Shader* shader, const Matrix44* global_matrices, bool compact = false) const;
+
+	//the bindings are stored in the skeleton and released with it, safe to call from any thread
+	static const SkinBinding* Get(GFX::Mesh* mesh, const Skeleton* skeleton);
+};
 
 //This class contains the bone structure hierarchy
 class Skeleton {
@@ -42,8 +83,15 @@ public:
 	Bone bones[128]; //max 128 bones
 	int num_bones;	//number of bones
 
+	//local transformation of every bone decomposed, the animations write here and compose Bone::model from it
+	//(if Bone::model is modified directly call decomposeLocalMatrices to keep them in sync)
+	Vector3f local_positions[128];
+	Quaternion local_rotations[128];
+	Vector3f local_scales[128];
+
 	Matrix44 global_bone_matrices[128]; //transform of every bone in global coordinates (according to the 0,0,0 and not the parent)
 	std::map<const char*, int, cmp_str> bones_by_name;	//map to get the bone index from its name, required to extract the final bones array
+	mutable std::deque<SkinBinding> skin_bindings; //one per mesh skinned with it, filled by SkinBinding::Get (a deque so they dont move)
 
 	Skeleton();
 
@@ -51,6 +99,9 @@ public:
 	Matrix44& getBoneMatrix(const char* name, bool local = true); //returns the local matrix of a bone
 	void applyTransformToBones(const char* root, Matrix44 transform); //given a bone name and matrix, it multiplies the matrix to the bone
 	void updateGlobalMatrices(); //updates the list of global matrices according to the local matrices
+	void decomposeLocalMatrices(); //fills the local translation, rotation and scale from the local matrices
+	void getPose(sPose& pose) const; //from the local translation, rotation and scale
+	void setPose(const sPose& pose); //sets the local translation, rotation and scale and composes the local matrices
 
 	void renderSkeleton(Camera* camera, Matrix44 model, Vector4f color = Vector4f(0.5, 0, 0.5, 1), bool render_points = false); //renders the skeleton with lines
 	void computeFinalBoneMatrices(std::vector<Matrix44>& bones, GFX::Mesh* mesh); //fills the std::vector with the bones ready for the shader
@@ -64,21 +115,40 @@ void blendSkeleton(Skeleton* a, Skeleton* b, float w, Skeleton* result, uint8 la
 class Animation {
 public:
 
+	enum eTrackType { TRANSLATION_TRACK, ROTATION_TRACK, SCALE_TRACK, NUM_TRACK_TYPES };
+
+	//keys of one component of a bone, removed where they can be interpolated from their neighbours
+	struct sTrack {
+		uint32 first_key;	//in key_times, not used if num_keys is 1
+		uint32 first_value;	//in rotation_keys (three per key) or vector_keys
+		uint32 num_keys;	//1 if the value is constant
+	};
+
 	Skeleton skeleton;
 
 	float duration;
 	float samples_per_second;
 	int num_animated_bones;
-	int num_keyframes;
+	int num_keyframes; //samples in the original animation, key times are in samples
 	int8 bones_map[128]; //maps from keyframe data index to bone
 
-	Matrix44* keyframes;
+	std::vector<sTrack> tracks; //NUM_TRACK_TYPES per animated bone
+	std::vector<uint16> key_times;
+	std::vector<uint16> rotation_keys; //quaternions stored as smallest three, 15 bits per component
+	std::vector<Vector3f> vector_keys; //translations and scales
 
 	Animation();
-	~Animation();	//we need the dtor to remove the keyframes memory
 
 	//change the skeleton to the given pose according to time
 	void assignTime(float time, bool loop = true, bool interpolate = true, uint8 layers = 0xFF);
+	//only the local transforms, without updating the global matrices
+	void sample(float time, bool loop = true, bool interpolate = true, uint8 layers = 0xFF);
+	//writes the animated bones in the pose (of a skeleton with the same bones), the rest are not modified, safe to call from several threads
+	void samplePose(float time, sPose& pose, bool loop = true, bool interpolate = true, uint8 layers = 0xFF) const;
+
+	//builds the tracks from num_keyframes * num_animated_bones local matrices
+	void compressKeyframes(const Matrix44* keyframes);
+	size_t getMemorySize() const; //of the tracks
 
 	//storage
 	bool load(const char* filename);
@@ -93,3 +163,6 @@ public:
 	void operator = (Animation* anim);
 };
 
+//prints memory and sampling time per bone of the tracks compared to a matrix per bone and sample
+void benchmarkAnimation(Animation* anim, int num_samples = 10000);
+
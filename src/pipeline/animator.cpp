@@ -0,0 +1,225 @@
+#include "animator.h"
+
+#include <cassert>
+#include <chrono>
+#include <algorithm>
+
+#include "../core/task.h"
+#include "../gfx/mesh.h"
+
+int Animator::addCharacter(Skeleton* skeleton)
+{
+	assert(skeleton && skeleton->num_bones > 0);
+	int num_bones = skeleton->num_bones;
+	int padded = sPose::getPaddedSize(num_bones);
+
+	sCharacter character;
+	character.skeleton = skeleton;
+	character.num_bones = num_bones;
+	character.first_bone = (int)parents.size();
+	character.active = true;
+	for (int i = 0; i < MAX_LAYERS; ++i)
+	{
+		sLayer& layer = character.layers[i];
+		layer.animation = NULL;
+		layer.time = 0.0f;
+		layer.weight = 1.0f;
+		layer.bone_layers = 0xFF;
+		layer.loop = true;
+	}
+
+	//hierarchy
+	int first = character.first_bone;
+	parents.resize(first + padded, -1);
+	bone_layers.resize(first + padded, 0);
+	for (int i = 0; i < num_bones; ++i)
+	{
+		assert(skeleton->bones[i].parent < i && "parents must go before their children");
+		parents[first + i] = skeleton->bones[i].parent;
+		bone_layers[first + i] = skeleton->bones[i].layer;
+	}
+
+	//rest pose, the padding is left as identity
+	rest_poses.resize((first + padded) * sPose::NUM_CHANNELS, 0.0f);
+	poses.resize(rest_poses.size(), 0.0f);
+	sPose rest;
+	rest.setBuffer(&rest_poses[first * sPose::NUM_CHANNELS], num_bones);
+	skeleton->getPose(rest);
+	for (int i = num_bones; i < padded; ++i)
+		rest.channels[sPose::QW][i] = rest.channels[sPose::SX][i] = rest.channels[sPose::SY][i] = rest.channels[sPose::SZ][i] = 1.0f;
+	memcpy(&poses[first * sPose::NUM_CHANNELS], &rest_poses[first * sPose::NUM_CHANNELS], sizeof(float) * padded * sPose::NUM_CHANNELS);
+
+	local_matrices.resize(first + padded);
+	global_matrices.resize(first + padded);
+
+	characters.push_back(character);
+	return (int)characters.size() - 1;
+}
+
+void Animator::clear()
+{
+	characters.clear();
+	rest_poses.clear();
+	poses.clear();
+	parents.clear();
+	bone_layers.clear();
+	local_matrices.clear();
+	global_matrices.clear();
+}
+
+void Animator::setLayer(int character, int layer, Animation* animation, float time, float weight, uint8 bone_layers, bool loop)
+{
+	assert(character >= 0 && character < (int)characters.size() && layer >= 0 && layer < MAX_LAYERS);
+	assert(!animation || animation->skeleton.num_bones == characters[character].num_bones);
+	sLayer& l = characters[character].layers[layer];
+	l.animation = animation;
+	l.time = time;
+	l.weight = weight;
+	l.bone_layers = bone_layers;
+	l.loop = loop;
+}
+
+sPose Animator::getPose(int character)
+{
+	sCharacter& c = characters[character];
+	sPose pose;
+	pose.setBuffer(&poses[c.first_bone * sPose::NUM_CHANNELS], c.num_bones);
+	return pose;
+}
+
+void Animator::update(float dt, bool parallel)
+{
+	for (auto& character : characters)
+	{
+		if (!character.active)
+			continue;
+		for (int i = 0; i < MAX_LAYERS; ++i)
+			character.layers[i].time += dt;
+	}
+	evaluate(parallel);
+}
+
+void Animator::evaluate(bool parallel)
+{
+	int num = (int)characters.size();
+	if (parallel)
+		TaskManager::background.parallelFor(0, num, [this](int first, int last) { evaluateCharacters(first, last); }, 4);
+	else
+		evaluateCharacters(0, num);
+}
+
+void Animator::evaluateCharacters(int first, int last)
+{
+	float scratch_data[sPose::NUM_CHANNELS * 128];
+	float weights[128];
+
+	for (int c = first; c < last; ++c)
+	{
+		sCharacter& character = characters[c];
+		if (!character.active)
+			continue;
+		int num_bones = character.num_bones;
+		int padded = sPose::getPaddedSize(num_bones);
+		int first_bone = character.first_bone;
+
+		//start from the rest pose
+		sPose pose = getPose(c);
+		memcpy(pose.channels[0], &rest_poses[first_bone * sPose::NUM_CHANNELS], sizeof(float) * padded * sPose::NUM_CHANNELS);
+
+		//layers
+		for (int i = 0; i < MAX_LAYERS; ++i)
+		{
+			sLayer& layer = character.layers[i];
+			if (!layer.animation || layer.weight <= 0.0f)
+				continue;
+			if (layer.weight >= 1.0f && layer.bone_layers == 0xFF) //overwrites
+			{
+				layer.animation->samplePose(layer.time, pose, layer.loop);
+				continue;
+			}
+			sPose scratch;
+			scratch.setBuffer(scratch_data, num_bones);
+			memcpy(scratch_data, pose.channels[0], sizeof(float) * padded * sPose::NUM_CHANNELS);
+			layer.animation->samplePose(layer.time, scratch, layer.loop);
+			const uint8* layers = &bone_layers[first_bone];
+			float w = std::min(layer.weight, 1.0f);
+			for (int j = 0; j < padded; ++j)
+				weights[j] = (layer.bone_layers == 0xFF || (layers[j] & layer.bone_layers)) ? w : 0.0f;
+			blendPoses(pose, scratch, weights, pose);
+		}
+
+		//local to global in a single pass, parents always go before their children
+		Matrix44* local = &local_matrices[first_bone];
+		Matrix44* global = &global_matrices[first_bone];
+		const int8* bone_parents = &parents[first_bone];
+		composePoseMatrices(pose, local);
+		for (int j = 0; j < num_bones; ++j)
+		{
+			int parent = bone_parents[j];
+			if (parent < 0)
+				global[j] = local[j];
+			else
+				global[j] = local[j] * global[parent];
+		}
+	}
+}
+
+void Animator::computeFinalBoneMatrices(int character, std::vector<Matrix44>& bone_matrices, GFX::Mesh* mesh)
+{
+	assert(mesh);
+	const SkinBinding* binding = SkinBinding::Get(mesh, characters[character].skeleton);
+	bone_matrices.resize(binding->getNumBones());
+	if (bone_matrices.size())
+		binding->computePalette(getGlobalMatrices(character), &bone_matrices[0]);
+}
+
+void benchmarkAnimator(Animation* animation, int num_characters)
+{
+	assert(animation && animation->tracks.size());
+	if (num_characters < 1)
+		num_characters = 1;
+	const int num_frames = 10;
+	const float dt = 1.0f / 60.0f;
+	int num_bones = animation->skeleton.num_bones;
+
+	std::vector<float> times(num_characters);
+	for (int i = 0; i < num_characters; ++i)
+		times[i] = random(animation->duration);
+
+	//one skeleton at a time
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < num_frames; ++f)
+		for (int i = 0; i < num_characters; ++i)
+			animation->assignTime(times[i] + f * dt);
+	std::chrono::duration<double, std::milli> skeleton_time = std::chrono::high_resolution_clock::now() - start;
+	animation->assignTime(0);
+
+	Animator animator;
+	for (int i = 0; i < num_characters; ++i)
+		animator.setLayer(animator.addCharacter(&animation->skeleton), 0, animation, times[i]);
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < num_frames; ++f)
+		animator.update(dt, false);
+	std::chrono::duration<double, std::milli> serial_time = std::chrono::high_resolution_clock::now() - start;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < num_frames; ++f)
+		animator.update(dt, true);
+	std::chrono::duration<double, std::milli> parallel_time = std::chrono::high_resolution_clock::now() - start;
+
+	//the upper body blended with another time
+	for (int i = 0; i < num_characters; ++i)
+		animator.setLayer(i, 1, animation, times[i] * 0.5f, 0.5f, UPPER_BODY);
+	start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < num_frames; ++f)
+		animator.update(dt, true);
+	std::chrono::duration<double, std::milli> layers_time = std::chrono::high_resolution_clock::now() - start;
+
+	double to_ns = 1000000.0 / ((double)num_characters * num_bones);
+	std::cout << " + Animator benchmark: " << num_characters << " characters x " << num_bones << " bones, " << TaskManager::background.getNumWorkers() << " workers" << std::endl;
+	std::cout << "\tassignTime per skeleton: " << skeleton_time.count() / num_frames << "ms/frame, " << skeleton_time.count() / num_frames * to_ns << "ns/bone" << std::endl;
+	std::cout << "\tAnimator, one thread:    " << serial_time.count() / num_frames << "ms/frame, " << serial_time.count() / num_frames * to_ns << "ns/bone" << std::endl;
+	std::cout << "\tAnimator, workers:       " << parallel_time.count() / num_frames << "ms/frame, " << parallel_time.count() / num_frames * to_ns << "ns/bone" << std::endl;
+	std::cout << "\tAnimator, two layers:    " << layers_time.count() / num_frames << "ms/frame, " << layers_time.count() / num_frames * to_ns << "ns/bone" << std::endl;
+}
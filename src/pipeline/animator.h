@@ -0,0 +1,61 @@
+/*  Evaluates the skeletal animation of many characters per frame in a single data oriented pass.
+	Instead of one Skeleton per character (big bones with names and children), every character has
+	a range in shared buffers: the local pose in structure of arrays, the parent index of every bone
+	and the local and global matrices. The characters are split between the workers of the TaskManager.
+*/
+
+#pragma once
+
+#include <vector>
+#include "animation.h"
+
+class Animator {
+public:
+	static const int MAX_LAYERS = 4;
+
+	//animations are applied in order, every one blended over the result of the previous ones
+	struct sLayer {
+		Animation* animation; //NULL if not used
+		float time;
+		float weight;
+		uint8 bone_layers; //only bones in these layers (BODY_LAYERS) are affected
+		bool loop;
+	};
+
+	struct sCharacter {
+		Skeleton* skeleton; //rest pose and bone names, not modified
+		sLayer layers[MAX_LAYERS];
+		int num_bones;
+		int first_bone;	//in the buffers, padded to four
+		bool active;
+	};
+
+	std::vector<sCharacter> characters;
+
+	//buffers of all the characters
+	std::vector<float> rest_poses;	//NUM_CHANNELS arrays of padded bones per character
+	std::vector<float> poses;
+	std::vector<int8> parents;		//parent of every bone inside its character, parents go before children
+	std::vector<uint8> bone_layers;
+	std::vector<Matrix44> local_matrices;
+	std::vector<Matrix44> global_matrices;
+
+	//the skeleton must have its bones sorted by hierarchy (like the ones loaded with the animations), returns the character index
+	int addCharacter(Skeleton* skeleton);
+	void clear();
+
+	void setLayer(int character, int layer, Animation* animation, float time = 0.0f, float weight = 1.0f, uint8 bone_layers = 0xFF, bool loop = true);
+
+	//advances the time of every layer and evaluates all the active characters
+	void update(float dt, bool parallel = true);
+	void evaluate(bool parallel = true);
+	void evaluateCharacters(int first, int last); //range of characters, used by the workers
+
+	sPose getPose(int character);
+	const Matrix44* getGlobalMatrices(int character) const { return &global_matrices[characters[character].first_bone]; }
+	//fills the std::vector with the bones ready for the shader (like Skeleton::computeFinalBoneMatrices)
+	void computeFinalBoneMatrices(int character, std::vector<Matrix44>& bone_matrices, GFX::Mesh* mesh);
+};
+
+//prints the time per frame of animating N characters with the skeleton of the animation, one skeleton at a time and batched
+void benchmarkAnimator(Animation* animation, int num_characters = 1000);
@@ -0,0 +1,211 @@
+#include "bvh.h"
+
+#include <algorithm> //nth_element
+#include <cassert>
+
+#include "prefab.h"
+#include "scene.h"
+#include "../gfx/mesh.h"
+
+using namespace SCN;
+
+void SceneBVH::addNodeItems(Node* node, BaseEntity* entity)
+{
+	if (node->mesh)
+	{
+		sItem item;
+		item.node = node;
+		item.entity = entity;
+		items.push_back(item);
+	}
+	for (size_t i = 0; i < node->children.size(); ++i)
+		addNodeItems(node->children[i], entity);
+}
+
+void SceneBVH::build(const std::vector<BaseEntity*>& entities)
+{
+	clear();
+	for (size_t i = 0; i < entities.size(); ++i)
+		addNodeItems(&entities[i]->root, entities[i]);
+	if (items.empty())
+		return;
+
+	nodes.reserve(items.size() * 2);
+	nodes.resize(1);
+	buildNode(0, 0, (int)items.size(), 0);
+}
+
+void SceneBVH::updateLeafBox(sBVHNode& bvh_node)
+{
+	bvh_node.min.set(3.4e+38F, 3.4e+38F, 3.4e+38F);
+	bvh_node.max.set(-3.4e+38F, -3.4e+38F, -3.4e+38F);
+	for (int i = bvh_node.first; i < bvh_node.first + bvh_node.count; ++i)
+	{
+		const BoundingBox& box = items[i].node->aabb;
+		bvh_node.min.setMin(box.center - box.halfsize);
+		bvh_node.max.setMax(box.center + box.halfsize);
+	}
+}
+
+//splits the items in the middle of the longest axis of their centers
+void SceneBVH::buildNode(int index, int start, int end, int depth)
+{
+	if (end - start <= MAX_LEAF_ITEMS || depth >= MAX_DEPTH)
+	{
+		nodes[index].first = start;
+		nodes[index].count = end - start;
+		updateLeafBox(nodes[index]);
+		return;
+	}
+
+	Vector3f cmin(3.4e+38F, 3.4e+38F, 3.4e+38F);
+	Vector3f cmax(-3.4e+38F, -3.4e+38F, -3.4e+38F);
+	for (int i = start; i < end; ++i)
+	{
+		cmin.setMin(items[i].node->aabb.center);
+		cmax.setMax(items[i].node->aabb.center);
+	}
+	Vector3f size = cmax - cmin;
+	int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+
+	int mid = (start + end) / 2;
+	std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end, [axis](const sItem& a, const sItem& b) {
+		return a.node->aabb.center.v[axis] < b.node->aabb.center.v[axis];
+	});
+
+	//children are stored together
+	int left = (int)nodes.size();
+	nodes.resize(left + 2);
+	nodes[index].first = left;
+	nodes[index].count = 0;
+	buildNode(left, start, mid, depth + 1);
+	buildNode(left + 1, mid, end, depth + 1);
+
+	nodes[index].min = nodes[left].min;
+	nodes[index].max = nodes[left].max;
+	nodes[index].min.setMin(nodes[left + 1].min);
+	nodes[index].max.setMax(nodes[left + 1].max);
+}
+
+void SceneBVH::refit()
+{
+	//children are always after their parent, so going backwards they are already updated
+	for (int i = (int)nodes.size() - 1; i >= 0; --i)
+	{
+		sBVHNode& bvh_node = nodes[i];
+		if (bvh_node.count)
+		{
+			updateLeafBox(bvh_node);
+			continue;
+		}
+		sBVHNode& left = nodes[bvh_node.first];
+		sBVHNode& right = nodes[bvh_node.first + 1];
+		bvh_node.min = left.min;
+		bvh_node.max = left.max;
+		bvh_node.min.setMin(right.min);
+		bvh_node.max.setMax(right.max);
+	}
+}
+
+//slab test, returns the distance where the ray enters the box
+inline bool rayBoxDistance(const SceneBVH::sBVHNode& bvh_node, const Vector3f& origin, const Vector3f& inv_dir, float max_dist, float& t_near)
+{
+	float t1 = (bvh_node.min.x - origin.x) * inv_dir.x;
+	float t2 = (bvh_node.max.x - origin.x) * inv_dir.x;
+	float tmin = std::min(t1, t2);
+	float tmax = std::max(t1, t2);
+	t1 = (bvh_node.min.y - origin.y) * inv_dir.y;
+	t2 = (bvh_node.max.y - origin.y) * inv_dir.y;
+	tmin = std::max(tmin, std::min(t1, t2));
+	tmax = std::min(tmax, std::max(t1, t2));
+	t1 = (bvh_node.min.z - origin.z) * inv_dir.z;
+	t2 = (bvh_node.max.z - origin.z) * inv_dir.z;
+	tmin = std::max(tmin, std::min(t1, t2));
+	tmax = std::min(tmax, std::max(t1, t2));
+	t_near = std::max(tmin, 0.0f);
+	return tmax >= t_near && t_near <= max_dist;
+}
+
+bool SceneBVH::testRay(const Ray& ray, uint8 layers, RayTestResult& result)
+{
+	num_mesh_tests = 0;
+	if (nodes.empty())
+		return false;
+
+	Vector3f dir = ray.direction;
+	dir.normalize();
+	Vector3f inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+	const Vector3f& origin = ray.origin;
+	bool collided = false;
+
+	//nodes pending to visit with the distance to their box, every level adds one at most (the sibling of the visited one)
+	struct sStackItem { int index; float t; };
+	sStackItem stack[MAX_DEPTH + 2];
+	int stack_size = 0;
+
+	float t;
+	if (!rayBoxDistance(nodes[0], origin, inv_dir, result.t, t))
+		return false;
+	stack[stack_size++] = { 0, t };
+
+	while (stack_size)
+	{
+		sStackItem current = stack[--stack_size];
+		if (current.t > result.t) //we already have something closer
+			continue;
+		sBVHNode& bvh_node = nodes[current.index];
+
+		if (bvh_node.count) //leaf
+		{
+			for (int i = bvh_node.first; i < bvh_node.first + bvh_node.count; ++i)
+			{
+				sItem& item = items[i];
+				Node* node = item.node;
+				if (!(item.entity->layers & layers) || !node->material || node->material->alpha_mode == SCN::eAlphaMode::BLEND)
+					continue;
+
+				Vector3f collision;
+				Vector3f normal;
+				num_mesh_tests++;
+				if (!node->mesh->testRayCollision(node->global_model, origin, dir, collision, normal, result.t, false, node->submesh_id))
+					continue;
+
+				float dist = origin.distance(collision);
+				if (dist > result.t)
+					continue;
+				result.t = dist;
+				result.collision = collision;
+				result.normal = normal;
+				result.entity = item.entity;
+				result.collided = true;
+				collided = true;
+			}
+			continue;
+		}
+
+		//push the farthest child first so the closest one is tested before
+		float t_left, t_right;
+		bool hit_left = rayBoxDistance(nodes[bvh_node.first], origin, inv_dir, result.t, t_left);
+		bool hit_right = rayBoxDistance(nodes[bvh_node.first + 1], origin, inv_dir, result.t, t_right);
+		assert(stack_size + 2 <= MAX_DEPTH + 2 && "BVH too deep");
+		if (hit_left && hit_right)
+		{
+			if (t_left < t_right)
+			{
+				stack[stack_size++] = { bvh_node.first + 1, t_right };
+				stack[stack_size++] = { bvh_node.first, t_left };
+			}
+			else
+			{
+				stack[stack_size++] = { bvh_node.first, t_left };
+				stack[stack_size++] = { bvh_node.first + 1, t_right };
+			}
+		}
+		else if (hit_left)
+			stack[stack_size++] = { bvh_node.first, t_left };
+		else if (hit_right)
+			stack[stack_size++] = { bvh_node.first + 1, t_right };
+	}
+
+	return collided;
+}
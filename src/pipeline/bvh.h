@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include "../core/math.h"
+
+namespace SCN {
+
+	//forward declarations
+	class Node;
+	class BaseEntity;
+	struct RayTestResult;
+
+	//Bounding Volume Hierarchy over the world bounding boxes of the nodes with mesh of the scene.
+	//It is rebuilt when the scene structure changes and refitted when only transforms change.
+	//Used to test rays against the scene testing only the meshes close to the ray.
+	class SceneBVH
+	{
+	public:
+		//every leaf references some items, the nodes of the scene
+		struct sItem {
+			Node* node;
+			BaseEntity* entity;
+		};
+
+		struct sBVHNode {
+			Vector3f min;
+			Vector3f max;
+			int first; //first item if leaf, left child otherwise (right child is always the next one)
+			int count; //number of items, 0 if not leaf
+		};
+
+		static const int MAX_LEAF_ITEMS = 4;
+		static const int MAX_DEPTH = 48; //deeper nodes are leaves with all their items, so testRay has a fixed size stack
+
+		std::vector<sItem> items;
+		std::vector<sBVHNode> nodes;
+		int num_mesh_tests; //meshes tested in the last testRay
+
+		SceneBVH() { num_mesh_tests = 0; }
+
+		void build(const std::vector<BaseEntity*>& entities);
+		void refit(); //update the boxes without changing the tree, call it after transforms change
+		void clear() { items.clear(); nodes.clear(); }
+
+		//finds the closest collision, returns true if found
+		bool testRay(const Ray& ray, uint8 layers, RayTestResult& result);
+
+	private:
+		void addNodeItems(Node* node, BaseEntity* entity);
+		void buildNode(int index, int start, int end, int depth);
+		void updateLeafBox(sBVHNode& bvh_node);
+	};
+
+};
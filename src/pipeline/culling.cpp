@@ -0,0 +1,367 @@
+#include "culling.h"
+
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "camera.h"
+#include "prefab.h"
+#include "../core/task.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define CULLING_SSE
+	#include <emmintrin.h>
+#endif
+
+using namespace SCN;
+
+const int MAX_VIEWS_PER_PASS = 8;
+const float EMPTY_HALFSIZE = -1e30f; //distance <= -radius is always true, so it is always outside
+
+void sCullingView::setPlanes(Camera* camera)
+{
+	memcpy(planes, camera->frustum, sizeof(planes));
+}
+
+int sCullingView::countVisible() const
+{
+	int count = 0;
+	for (size_t i = 0; i < visible.size(); ++i)
+		for (uint32 bits = visible[i]; bits; bits &= bits - 1)
+			count++;
+	return count;
+}
+
+void CullingBounds::clear()
+{
+	center_x.clear(); center_y.clear(); center_z.clear();
+	half_x.clear(); half_y.clear(); half_z.clear();
+	parents.clear();
+	levels.clear();
+	node_indices.clear();
+	structure_version = 0;
+}
+
+int CullingBounds::addLevel(int num)
+{
+	int first = getNumBoxes();
+	int size = first + ((num + LEVEL_ALIGN - 1) / LEVEL_ALIGN) * LEVEL_ALIGN;
+	center_x.resize(size, 0.0f);
+	center_y.resize(size, 0.0f);
+	center_z.resize(size, 0.0f);
+	half_x.resize(size, EMPTY_HALFSIZE);
+	half_y.resize(size, EMPTY_HALFSIZE);
+	half_z.resize(size, EMPTY_HALFSIZE);
+	parents.resize(size, -1);
+	if (levels.empty())
+		levels.push_back(0);
+	levels.push_back(size);
+	return first;
+}
+
+void CullingBounds::setBoxes(const BoundingBox* boxes, int num)
+{
+	clear();
+	addLevel(num);
+	for (int i = 0; i < num; ++i)
+		setBox(i, boxes[i]);
+}
+
+void CullingBounds::setBox(int index, const BoundingBox& box, int parent)
+{
+	assert(index >= 0 && index < getNumBoxes() && parent < index);
+	center_x[index] = box.center.x;
+	center_y[index] = box.center.y;
+	center_z[index] = box.center.z;
+	half_x[index] = box.halfsize.x;
+	half_y[index] = box.halfsize.y;
+	half_z[index] = box.halfsize.z;
+	parents[index] = parent;
+}
+
+void CullingBounds::setEmpty(int index, int parent)
+{
+	assert(index >= 0 && index < getNumBoxes() && parent < index);
+	center_x[index] = center_y[index] = center_z[index] = 0.0f;
+	half_x[index] = half_y[index] = half_z[index] = EMPTY_HALFSIZE;
+	parents[index] = parent;
+}
+
+void CullingBounds::update(const NodeHierarchy& hierarchy, bool parallel)
+{
+	int num_nodes = (int)hierarchy.nodes.size();
+
+	//same layout than the hierarchy but every level padded
+	if (structure_version != hierarchy.structure_version || (int)node_indices.size() != num_nodes)
+	{
+		clear();
+		node_indices.resize(num_nodes);
+		for (size_t l = 0; l + 1 < hierarchy.levels.size(); ++l)
+		{
+			int start = hierarchy.levels[l];
+			int first = addLevel(hierarchy.levels[l + 1] - start);
+			for (int i = start; i < hierarchy.levels[l + 1]; ++i)
+				node_indices[i] = first + i - start;
+		}
+		structure_version = hierarchy.structure_version;
+	}
+
+	//the boxes are copied every frame, it is cheaper than tracking which ones changed
+	auto copy_boxes = [this, &hierarchy](int start, int end) {
+		for (int i = start; i < end; ++i)
+		{
+			Node* node = hierarchy.nodes[i];
+			int parent = hierarchy.parents[i] == -1 ? -1 : node_indices[hierarchy.parents[i]];
+			if (node->has_bounds)
+				setBox(node_indices[i], node->subtree_aabb, parent);
+			else
+				setEmpty(node_indices[i], parent);
+		}
+	};
+	if (parallel)
+		TaskManager::background.parallelFor(0, num_nodes, copy_boxes, 4096);
+	else
+		copy_boxes(0, num_nodes);
+}
+
+//tests four boxes against the planes, starting with the one that rejected them last time
+//lanes are the boxes to test, returns the ones outside and fills the ones completely inside
+static inline int testBlock(const CullingBounds& bounds, int index, const float (*planes)[4], int lanes, int& inside_lanes, uint8& cached_plane)
+{
+	int outside = 0;
+	int inside = lanes;
+	int first_plane = cached_plane;
+#ifdef CULLING_SSE
+	__m128 cx = _mm_loadu_ps(&bounds.center_x[index]);
+	__m128 cy = _mm_loadu_ps(&bounds.center_y[index]);
+	__m128 cz = _mm_loadu_ps(&bounds.center_z[index]);
+	__m128 hx = _mm_loadu_ps(&bounds.half_x[index]);
+	__m128 hy = _mm_loadu_ps(&bounds.half_y[index]);
+	__m128 hz = _mm_loadu_ps(&bounds.half_z[index]);
+#endif
+	for (int k = 0; k < 6; ++k)
+	{
+		int p = k == 0 ? first_plane : (k - 1 < first_plane ? k - 1 : k);
+		const float* plane = planes[p];
+#ifdef CULLING_SSE
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), cx), _mm_mul_ps(_mm_set1_ps(plane[1]), cy)), _mm_mul_ps(_mm_set1_ps(plane[2]), cz)), _mm_set1_ps(plane[3]));
+		__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabs(plane[0])), hx), _mm_mul_ps(_mm_set1_ps(fabs(plane[1])), hy)), _mm_mul_ps(_mm_set1_ps(fabs(plane[2])), hz));
+		int plane_outside = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_sub_ps(_mm_setzero_ps(), radius))) & lanes;
+		inside &= _mm_movemask_ps(_mm_cmpgt_ps(distance, radius));
+#else
+		int plane_outside = 0;
+		for (int j = 0; j < 4; ++j)
+		{
+			int i = index + j;
+			float distance = plane[0] * bounds.center_x[i] + plane[1] * bounds.center_y[i] + plane[2] * bounds.center_z[i] + plane[3];
+			float radius = fabs(plane[0]) * bounds.half_x[i] + fabs(plane[1]) * bounds.half_y[i] + fabs(plane[2]) * bounds.half_z[i];
+			if (distance <= -radius)
+				plane_outside |= 1 << j;
+			if (distance <= radius)
+				inside &= ~(1 << j);
+		}
+		plane_outside &= lanes;
+#endif
+		if (plane_outside & ~outside)
+		{
+			outside |= plane_outside;
+			cached_plane = (uint8)p;
+		}
+		if (outside == lanes)
+			break;
+	}
+	inside_lanes = inside & ~outside;
+	return outside;
+}
+
+//culls the boxes of a range of words of the masks, the parents must have been culled before
+static void cullRange(const CullingBounds& bounds, sCullingView* views, int num_views, bool hierarchical, int first_word, int last_word)
+{
+	for (int w = first_word; w < last_word; ++w)
+	{
+		uint32 visible_bits[MAX_VIEWS_PER_PASS] = { 0 };
+		uint32 inside_bits[MAX_VIEWS_PER_PASS] = { 0 };
+		for (int block = 0; block < 8; ++block)
+		{
+			int index = w * 32 + block * 4;
+			const int* parents = &bounds.parents[index];
+			for (int v = 0; v < num_views; ++v)
+			{
+				sCullingView& view = views[v];
+				int lanes = 0xF;
+				int inherited = 0; //parent completely inside
+				if (hierarchical)
+				{
+					lanes = 0;
+					for (int j = 0; j < 4; ++j)
+					{
+						int parent = parents[j];
+						if (parent == -1)
+							lanes |= 1 << j;
+						else if (view.isInside(parent))
+							inherited |= 1 << j;
+						else if (view.isVisible(parent))
+							lanes |= 1 << j;
+					}
+				}
+
+				int visible = inherited;
+				int inside = 0;
+				if (lanes)
+					visible |= lanes & ~testBlock(bounds, index, view.planes, lanes, inside, view.plane_cache[index >> 2]);
+				visible_bits[v] |= (uint32)visible << (block * 4);
+				inside_bits[v] |= (uint32)(inside | inherited) << (block * 4);
+			}
+		}
+		for (int v = 0; v < num_views; ++v)
+		{
+			views[v].visible[w] = visible_bits[v];
+			views[v].inside[w] = inside_bits[v];
+		}
+	}
+}
+
+void SCN::cullBounds(const CullingBounds& bounds, sCullingView* views, int num_views, bool hierarchical, bool parallel)
+{
+	const int min_range = 32; //in words, 1024 boxes
+	int num_boxes = bounds.getNumBoxes();
+	assert(num_boxes % CullingBounds::LEVEL_ALIGN == 0);
+	int num_words = num_boxes / 32;
+	for (int v = 0; v < num_views; ++v)
+	{
+		views[v].visible.resize(num_words);
+		views[v].inside.resize(num_words);
+		views[v].plane_cache.resize(num_boxes / 4, 0);
+	}
+
+	for (int first_view = 0; first_view < num_views; first_view += MAX_VIEWS_PER_PASS)
+	{
+		sCullingView* pass_views = views + first_view;
+		int pass_num_views = std::min(num_views - first_view, MAX_VIEWS_PER_PASS);
+		auto cull = [&](int start, int end) { cullRange(bounds, pass_views, pass_num_views, hierarchical, start, end); };
+
+		//levels in order so the parents are ready before their children
+		if (!hierarchical)
+		{
+			if (parallel)
+				TaskManager::background.parallelFor(0, num_words, cull, min_range);
+			else
+				cull(0, num_words);
+			continue;
+		}
+		for (size_t l = 0; l + 1 < bounds.levels.size(); ++l)
+		{
+			int start = bounds.levels[l] / 32;
+			int end = bounds.levels[l + 1] / 32;
+			if (parallel)
+				TaskManager::background.parallelFor(start, end, cull, min_range);
+			else
+				cull(start, end);
+		}
+	}
+}
+
+void SCN::benchmarkCulling(int num_boxes)
+{
+	typedef std::chrono::high_resolution_clock clock;
+	typedef std::chrono::duration<double, std::milli> milliseconds;
+	const int num_passes = 10;
+	const int group_size = 64;
+	if (num_boxes < group_size)
+		num_boxes = group_size;
+	int num_groups = num_boxes / group_size;
+	num_boxes = num_groups * group_size;
+
+	Camera camera;
+	camera.lookAt(Vector3f(0, 10, 0), Vector3f(100, 0, 100), Vector3f(0, 1, 0));
+	camera.setPerspective(70, 16.0f / 9.0f, 0.1f, 1000.0f);
+	Camera shadow_camera;
+	shadow_camera.lookAt(Vector3f(0, 200, 0), Vector3f(50, 0, 20), Vector3f(0, 0, 1));
+	shadow_camera.setOrthographic(-300, 300, -300, 300, 1, 1000);
+
+	//clusters of boxes like the nodes of the prefabs
+	std::vector<BoundingBox> boxes(num_boxes);
+	std::vector<BoundingBox> groups(num_groups);
+	for (int g = 0; g < num_groups; ++g)
+	{
+		Vector3f center(random(2000.0f, -1000), random(40.0f, -20), random(2000.0f, -1000));
+		for (int i = 0; i < group_size; ++i)
+		{
+			BoundingBox& box = boxes[g * group_size + i];
+			box.center = center + Vector3f(random(40.0f, -20), random(20.0f, -10), random(40.0f, -20));
+			box.halfsize.set(random(2.0f) + 0.1f, random(2.0f) + 0.1f, random(2.0f) + 0.1f);
+			groups[g] = i ? mergeBoundingBoxes(groups[g], box) : box;
+		}
+	}
+
+	auto start = clock::now();
+	int num_visible = 0;
+	for (int p = 0; p < num_passes; ++p)
+	{
+		num_visible = 0;
+		for (int i = 0; i < num_boxes; ++i)
+			if (camera.testBoxInFrustum(boxes[i].center, boxes[i].halfsize) != CLIP_OUTSIDE)
+				num_visible++;
+	}
+	milliseconds camera_time = clock::now() - start;
+
+	CullingBounds flat;
+	flat.setBoxes(&boxes[0], num_boxes);
+	sCullingView views[2];
+	views[0].setPlanes(&camera);
+	views[1].setPlanes(&shadow_camera);
+	cullBounds(flat, views, 1, false, false); //fills the plane cache
+
+	start = clock::now();
+	for (int p = 0; p < num_passes; ++p)
+		cullBounds(flat, views, 1, false, false);
+	milliseconds flat_time = clock::now() - start;
+	int mismatches = 0;
+	for (int i = 0; i < num_boxes; ++i)
+		mismatches += views[0].isVisible(i) != (camera.testBoxInFrustum(boxes[i].center, boxes[i].halfsize) != CLIP_OUTSIDE);
+
+	start = clock::now();
+	for (int p = 0; p < num_passes; ++p)
+		cullBounds(flat, views, 1, false, true);
+	milliseconds parallel_time = clock::now() - start;
+
+	cullBounds(flat, views, 2, false, false);
+	start = clock::now();
+	for (int p = 0; p < num_passes; ++p)
+		cullBounds(flat, views, 2, false, false);
+	milliseconds two_views_time = clock::now() - start;
+
+	//groups first, then the boxes of the visible groups
+	CullingBounds tree;
+	tree.addLevel(num_groups);
+	int first_box = tree.addLevel(num_boxes);
+	for (int g = 0; g < num_groups; ++g)
+	{
+		tree.setBox(g, groups[g]);
+		for (int i = 0; i < group_size; ++i)
+			tree.setBox(first_box + g * group_size + i, boxes[g * group_size + i], g);
+	}
+	sCullingView tree_view;
+	tree_view.setPlanes(&camera);
+	cullBounds(tree, &tree_view, 1, true, false);
+	start = clock::now();
+	for (int p = 0; p < num_passes; ++p)
+		cullBounds(tree, &tree_view, 1, true, false);
+	milliseconds tree_time = clock::now() - start;
+	int tree_visible = 0;
+	for (int i = 0; i < num_boxes; ++i)
+		tree_visible += tree_view.isVisible(first_box + i);
+
+#ifdef CULLING_SSE
+	const char* path = "SSE2";
+#else
+	const char* path = "scalar";
+#endif
+	std::cout << " + Culling benchmark: " << num_boxes << " boxes, " << num_visible << " visible, " << path << " path, " << TaskManager::background.getNumWorkers() << " workers" << std::endl;
+	std::cout << "\tCamera::testBoxInFrustum: " << camera_time.count() / num_passes << "ms" << std::endl;
+	std::cout << "\tcullBounds:               " << flat_time.count() / num_passes << "ms (" << mismatches << " mismatches)" << std::endl;
+	std::cout << "\tcullBounds, workers:      " << parallel_time.count() / num_passes << "ms" << std::endl;
+	std::cout << "\tcullBounds, two views:    " << two_views_time.count() / num_passes << "ms (" << views[1].countVisible() << " visible in the second)" << std::endl;
+	std::cout << "\tcullBounds, hierarchical: " << tree_time.count() / num_passes << "ms (" << tree_visible << " visible, groups of " << group_size << ")" << std::endl;
+}
@@ -0,0 +1,73 @@
+/*  Frustum culling of many bounding boxes at once.
+	The world boxes are flattened in structure of arrays (every component of the center and halfsize
+	in its own array) so four boxes are tested against a plane with a few SSE instructions. The result
+	of every view is a bitmask with one bit per box. Several views (main camera, shadow cameras...)
+	are culled in the same pass so the boxes are loaded only once.
+	Boxes can be organized in levels (like the NodeHierarchy), then a box is only tested if its parent
+	overlaps the frustum: children of culled parents are culled and children of parents completely
+	inside are visible without testing them.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include "../core/math.h"
+
+class Camera;
+
+namespace SCN {
+
+	class NodeHierarchy;
+
+	//one camera to cull against, keeps the result of the last pass
+	struct sCullingView {
+		float planes[6][4];				//copied from the frustum of the camera
+		std::vector<uint32> visible;	//one bit per box
+		std::vector<uint32> inside;		//boxes completely inside the frustum
+		std::vector<uint8> plane_cache;	//per block of four boxes, last plane that rejected them, tested first in the next pass
+
+		sCullingView() { memset(planes, 0, sizeof(planes)); }
+		void setPlanes(Camera* camera);
+		bool isVisible(int index) const { return (visible[index >> 5] >> (index & 31)) & 1; }
+		bool isInside(int index) const { return (inside[index >> 5] >> (index & 31)) & 1; }
+		int countVisible() const;
+	};
+
+	class CullingBounds
+	{
+	public:
+		static const int LEVEL_ALIGN = 32; //levels start in a new word of the bitmasks so they can be culled in parallel
+
+		//padded to LEVEL_ALIGN, boxes without bounds have a negative halfsize so they are always outside
+		std::vector<float> center_x, center_y, center_z;
+		std::vector<float> half_x, half_y, half_z;
+		std::vector<int> parents;		//index of the parent box, -1 for roots
+		std::vector<int> levels;		//index where every level starts (plus one at the end)
+
+		//index of every node of the hierarchy in the boxes (filled by update)
+		std::vector<int> node_indices;
+		uint32 structure_version;
+
+		CullingBounds() { structure_version = 0; }
+
+		int getNumBoxes() const { return (int)center_x.size(); }
+		void clear();
+
+		//flat list of boxes, all in one level
+		void setBoxes(const BoundingBox* boxes, int num);
+		//adds a level of num boxes after the last one, returns the index of the first one
+		int addLevel(int num);
+		void setBox(int index, const BoundingBox& box, int parent = -1);
+		void setEmpty(int index, int parent = -1);
+
+		//copies the subtree bounds of all the nodes, rebuilding the levels if the hierarchy changed
+		void update(const NodeHierarchy& hierarchy, bool parallel = true);
+	};
+
+	//fills the masks of every view, if hierarchical boxes are only tested when their parent overlaps the view
+	void cullBounds(const CullingBounds& bounds, sCullingView* views, int num_views, bool hierarchical = true, bool parallel = true);
+
+	//prints the time of culling N random boxes with Camera::testBoxInFrustum and with cullBounds
+	void benchmarkCulling(int num_boxes = 100000);
+};
@@ -0,0 +1,311 @@
+#include "occlusion.h"
+
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "camera.h"
+#include "../gfx/mesh.h"
+#include "../core/task.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define OCCLUSION_SSE
+	#include <emmintrin.h>
+#endif
+
+using namespace SCN;
+
+const int TILE_SIZE = OcclusionBuffer::TILE_WIDTH * OcclusionBuffer::TILE_HEIGHT;
+
+OcclusionBuffer::OcclusionBuffer()
+{
+	width = height = 0;
+	tiles_x = tiles_y = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+void OcclusionBuffer::clear(Camera* camera, int width)
+{
+	float aspect = camera->type == Camera::PERSPECTIVE ? camera->aspect : (camera->right - camera->left) / (camera->top - camera->bottom);
+	aspect = clamp(fabs(aspect), 0.1f, 10.0f);
+	tiles_x = std::max(width / TILE_WIDTH, 1);
+	tiles_y = std::max((int)ceil(tiles_x * TILE_WIDTH / aspect / TILE_HEIGHT), 1);
+	this->width = tiles_x * TILE_WIDTH;
+	this->height = tiles_y * TILE_HEIGHT;
+	depth.assign(this->width * this->height, 1.0f);
+	tile_max_depth.assign(tiles_x * tiles_y, 1.0f);
+	viewprojection = camera->viewprojection_matrix;
+	memset(&stats, 0, sizeof(stats));
+}
+
+void OcclusionBuffer::rasterize(const std::vector<sOccluder>& occluders, bool parallel)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	int num = (int)occluders.size();
+	if (triangles.size() < occluders.size())
+		triangles.resize(occluders.size());
+	for (size_t i = 0; i < triangles.size(); ++i)
+		triangles[i].clear();
+
+	//every occluder transformed by one worker, then every row of tiles rasterized by one worker
+	auto setup = [this, &occluders](int first, int last) {
+		for (int i = first; i < last; ++i)
+			setupOccluder(occluders[i], triangles[i]);
+	};
+	auto raster = [this](int first, int last) { rasterizeTileRows(first, last); };
+	if (parallel)
+	{
+		TaskManager::background.parallelFor(0, num, setup);
+		TaskManager::background.parallelFor(0, tiles_y, raster);
+	}
+	else
+	{
+		setup(0, num);
+		raster(0, tiles_y);
+	}
+
+	stats.num_occluders += num;
+	for (int i = 0; i < num; ++i)
+		stats.num_triangles += (int)triangles[i].size();
+	stats.raster_time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void OcclusionBuffer::setupOccluder(const sOccluder& occluder, std::vector<sScreenTriangle>& result)
+{
+	GFX::Mesh* mesh = occluder.mesh;
+
+	//the CPU data must be loaded (Mesh::loadCPUData)
+	const float* positions = nullptr;
+	int stride = 3;
+	if (mesh->interleaved.size())
+	{
+		positions = mesh->interleaved[0].vertex.v;
+		stride = sizeof(GFX::Mesh::tInterleaved) / sizeof(float);
+	}
+	else if (mesh->vertices.size())
+		positions = mesh->vertices[0].v;
+	if (!positions)
+		return;
+	int num_vertices = (int)mesh->getNumVertices();
+	const unsigned int* indices = mesh->m_indices.size() ? &mesh->m_indices[0] : nullptr;
+	unsigned int start, size;
+	mesh->getSubmeshStartAndSize(occluder.submesh_id, start, size);
+
+	//all the vertices to clip space
+	Matrix44 mvp = occluder.model * viewprojection;
+	std::vector<Vector4f> clip(num_vertices);
+	for (int i = 0; i < num_vertices; ++i)
+	{
+		const float* p = positions + i * stride;
+		clip[i] = mvp * Vector4f(p[0], p[1], p[2], 1.0f);
+	}
+
+	Vector3f screen_scale(width * 0.5f, height * 0.5f, 1.0f);
+	auto toScreen = [&screen_scale](const Vector4f& v) {
+		float inv_w = 1.0f / v.w;
+		return Vector3f((v.x * inv_w + 1.0f) * screen_scale.x, (v.y * inv_w + 1.0f) * screen_scale.y, v.z * inv_w);
+	};
+
+	for (unsigned int i = start; i + 2 < start + size; i += 3)
+	{
+		const Vector4f* v[3];
+		float d[3]; //distance to the near plane
+		int num_inside = 0;
+		for (int j = 0; j < 3; ++j)
+		{
+			v[j] = &clip[indices ? indices[i + j] : i + j];
+			d[j] = v[j]->z + v[j]->w;
+			num_inside += d[j] >= 0.0f;
+		}
+		if (num_inside == 0)
+			continue;
+		if (num_inside == 3)
+		{
+			addTriangle(toScreen(*v[0]), toScreen(*v[1]), toScreen(*v[2]), occluder.two_sided, result);
+			continue;
+		}
+
+		//clipped by the near plane, keeps the order so the winding does not change
+		Vector4f polygon[4];
+		int num_points = 0;
+		for (int j = 0; j < 3; ++j)
+		{
+			int k = (j + 1) % 3;
+			if (d[j] >= 0.0f)
+				polygon[num_points++] = *v[j];
+			if ((d[j] >= 0.0f) != (d[k] >= 0.0f))
+			{
+				float t = d[j] / (d[j] - d[k]);
+				polygon[num_points++] = *v[j] * (1.0f - t) + *v[k] * t;
+			}
+		}
+		Vector3f first = toScreen(polygon[0]);
+		for (int j = 1; j + 1 < num_points; ++j)
+			addTriangle(first, toScreen(polygon[j]), toScreen(polygon[j + 1]), occluder.two_sided, result);
+	}
+}
+
+void OcclusionBuffer::addTriangle(const Vector3f& a, const Vector3f& b, const Vector3f& c, bool two_sided, std::vector<sScreenTriangle>& result)
+{
+	//counter clockwise is front facing
+	const Vector3f* v[3] = { &a, &b, &c };
+	float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+	if (area == 0.0f || (area < 0.0f && !two_sided))
+		return;
+	if (area < 0.0f)
+	{
+		std::swap(v[1], v[2]);
+		area = -area;
+	}
+
+	//pixels with the center inside the triangle, the edges are moved inwards later so only the ones completely covered are written
+	sScreenTriangle tri;
+	tri.min_x = std::max((int)ceil(std::min(a.x, std::min(b.x, c.x)) - 0.5f), 0);
+	tri.min_y = std::max((int)ceil(std::min(a.y, std::min(b.y, c.y)) - 0.5f), 0);
+	tri.max_x = std::min((int)floor(std::max(a.x, std::max(b.x, c.x)) - 0.5f), width - 1);
+	tri.max_y = std::min((int)floor(std::max(a.y, std::max(b.y, c.y)) - 0.5f), height - 1);
+	if (tri.min_x > tri.max_x || tri.min_y > tri.max_y)
+		return;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		const Vector3f& p0 = *v[i];
+		const Vector3f& p1 = *v[(i + 1) % 3];
+		tri.edge_a[i] = p0.y - p1.y;
+		tri.edge_b[i] = p1.x - p0.x;
+		tri.edge_c[i] = -(tri.edge_a[i] * p0.x + tri.edge_b[i] * p0.y);
+		tri.edge_c[i] -= (fabs(tri.edge_a[i]) + fabs(tri.edge_b[i])) * 0.5f; //tested at the center, this is the worst corner
+	}
+
+	const Vector3f& p0 = *v[0];
+	const Vector3f& p1 = *v[1];
+	const Vector3f& p2 = *v[2];
+	float inv_area = 1.0f / area;
+	tri.depth_a = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) * inv_area;
+	tri.depth_b = ((p1.x - p0.x) * (p2.z - p0.z) - (p2.x - p0.x) * (p1.z - p0.z)) * inv_area;
+	tri.depth_c = p0.z - tri.depth_a * p0.x - tri.depth_b * p0.y;
+	tri.depth_c += (fabs(tri.depth_a) + fabs(tri.depth_b)) * 0.5f; //farthest depth inside the pixel, not the one at the center
+	result.push_back(tri);
+}
+
+void OcclusionBuffer::rasterizeTileRows(int first_row, int last_row)
+{
+	int start_y = first_row * TILE_HEIGHT;
+	int end_y = last_row * TILE_HEIGHT - 1;
+
+	for (size_t o = 0; o < triangles.size(); ++o)
+	{
+		const std::vector<sScreenTriangle>& occluder_triangles = triangles[o];
+		for (size_t t = 0; t < occluder_triangles.size(); ++t)
+		{
+			const sScreenTriangle& tri = occluder_triangles[t];
+			int min_y = std::max(tri.min_y, start_y);
+			int max_y = std::min(tri.max_y, end_y);
+			int min_x = tri.min_x & ~3; //groups of four pixels, never crossing a tile
+#ifdef OCCLUSION_SSE
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			__m128 a0 = _mm_set1_ps(tri.edge_a[0]), a1 = _mm_set1_ps(tri.edge_a[1]), a2 = _mm_set1_ps(tri.edge_a[2]);
+			__m128 depth_a = _mm_set1_ps(tri.depth_a);
+#endif
+			for (int y = min_y; y <= max_y; ++y)
+			{
+				float py = y + 0.5f;
+				float* row = &depth[(y / TILE_HEIGHT) * tiles_x * TILE_SIZE + (y % TILE_HEIGHT) * TILE_WIDTH];
+#ifdef OCCLUSION_SSE
+				__m128 c0 = _mm_set1_ps(tri.edge_b[0] * py + tri.edge_c[0]);
+				__m128 c1 = _mm_set1_ps(tri.edge_b[1] * py + tri.edge_c[1]);
+				__m128 c2 = _mm_set1_ps(tri.edge_b[2] * py + tri.edge_c[2]);
+				__m128 depth_c = _mm_set1_ps(tri.depth_b * py + tri.depth_c);
+#endif
+				for (int x = min_x; x <= tri.max_x; x += 4)
+				{
+					float* pixels = row + (x / TILE_WIDTH) * TILE_SIZE + (x % TILE_WIDTH);
+#ifdef OCCLUSION_SSE
+					__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+					__m128 inside = _mm_and_ps(_mm_and_ps(
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), c0), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), c1), zero)),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), c2), zero));
+					if (!_mm_movemask_ps(inside))
+						continue;
+					__m128 old_depth = _mm_loadu_ps(pixels);
+					__m128 new_depth = _mm_min_ps(old_depth, _mm_add_ps(_mm_mul_ps(depth_a, px), depth_c));
+					_mm_storeu_ps(pixels, _mm_or_ps(_mm_and_ps(inside, new_depth), _mm_andnot_ps(inside, old_depth)));
+#else
+					for (int j = 0; j < 4; ++j)
+					{
+						float px = x + j + 0.5f;
+						if (tri.edge_a[0] * px + tri.edge_b[0] * py + tri.edge_c[0] < 0.0f ||
+							tri.edge_a[1] * px + tri.edge_b[1] * py + tri.edge_c[1] < 0.0f ||
+							tri.edge_a[2] * px + tri.edge_b[2] * py + tri.edge_c[2] < 0.0f)
+							continue;
+						pixels[j] = std::min(pixels[j], tri.depth_a * px + tri.depth_b * py + tri.depth_c);
+					}
+#endif
+				}
+			}
+		}
+	}
+
+	//farthest depth of every tile
+	for (int tile = first_row * tiles_x; tile < last_row * tiles_x; ++tile)
+	{
+		const float* pixels = &depth[tile * TILE_SIZE];
+		float max_depth = pixels[0];
+		for (int i = 1; i < TILE_SIZE; ++i)
+			max_depth = std::max(max_depth, pixels[i]);
+		tile_max_depth[tile] = max_depth;
+	}
+}
+
+bool OcclusionBuffer::isOccluded(const BoundingBox& box)
+{
+	if (depth.empty())
+		return false;
+	stats.num_tested++;
+
+	//screen rectangle and closest depth of the box
+	Vector2f rect_min(1.0f, 1.0f), rect_max(-1.0f, -1.0f);
+	float min_depth = 1.0f;
+	for (int i = 0; i < 8; ++i)
+	{
+		Vector3f corner = box.center + box.halfsize * Vector3f(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+		Vector4f v = viewprojection * Vector4f(corner.x, corner.y, corner.z, 1.0f);
+		if (v.z + v.w < 0.0f || v.w <= 0.0f)
+			return false; //crosses the near plane
+		float inv_w = 1.0f / v.w;
+		rect_min.x = std::min(rect_min.x, v.x * inv_w);
+		rect_min.y = std::min(rect_min.y, v.y * inv_w);
+		rect_max.x = std::max(rect_max.x, v.x * inv_w);
+		rect_max.y = std::max(rect_max.y, v.y * inv_w);
+		min_depth = std::min(min_depth, v.z * inv_w);
+	}
+
+	//every pixel touched by the rectangle
+	int min_x = std::max((int)floor((rect_min.x + 1.0f) * 0.5f * width), 0);
+	int min_y = std::max((int)floor((rect_min.y + 1.0f) * 0.5f * height), 0);
+	int max_x = std::min((int)floor((rect_max.x + 1.0f) * 0.5f * width), width - 1);
+	int max_y = std::min((int)floor((rect_max.y + 1.0f) * 0.5f * height), height - 1);
+	if (min_x > max_x || min_y > max_y)
+		return false;
+
+	for (int ty = min_y / TILE_HEIGHT; ty <= max_y / TILE_HEIGHT; ++ty)
+		for (int tx = min_x / TILE_WIDTH; tx <= max_x / TILE_WIDTH; ++tx)
+		{
+			//the whole tile is in front of the box
+			if (tile_max_depth[ty * tiles_x + tx] < min_depth)
+				continue;
+			int x0 = std::max(min_x, tx * TILE_WIDTH), x1 = std::min(max_x, tx * TILE_WIDTH + TILE_WIDTH - 1);
+			int y0 = std::max(min_y, ty * TILE_HEIGHT), y1 = std::min(max_y, ty * TILE_HEIGHT + TILE_HEIGHT - 1);
+			const float* pixels = &depth[(ty * tiles_x + tx) * TILE_SIZE];
+			for (int y = y0; y <= y1; ++y)
+				for (int x = x0; x <= x1; ++x)
+					if (pixels[(y % TILE_HEIGHT) * TILE_WIDTH + x % TILE_WIDTH] >= min_depth)
+						return false;
+		}
+
+	stats.num_culled++;
+	return true;
+}
@@ -0,0 +1,80 @@
+/*  Software occlusion culling on the CPU.
+	Some big opaque meshes in front of the camera (the occluders) are rasterized at low resolution into
+	a depth buffer and the boxes of the nodes are tested against it before adding them to the render queue,
+	so the objects hidden behind them are not drawn. Nothing is read back from the GPU.
+	The depth buffer is stored in tiles of 8x4 pixels (rasterized four pixels at a time with SSE) and keeps
+	the farthest depth of every tile, so most boxes are resolved checking a few tiles.
+	The occluders are rasterized conservatively: only the pixels completely inside a triangle are written, with
+	the farthest depth of the triangle in the pixel, so at this low resolution nothing visible is culled.
+*/
+
+#pragma once
+
+#include <vector>
+#include "../core/math.h"
+
+class Camera;
+
+namespace GFX {
+	class Mesh;
+}
+
+namespace SCN {
+
+	struct sOccluder {
+		GFX::Mesh* mesh;
+		int submesh_id;		//-1 for the whole mesh
+		Matrix44 model;
+		bool two_sided;		//back faces are rasterized too
+	};
+
+	//info of the last frame
+	struct sOcclusionStats {
+		double raster_time;	//ms, transforming and rasterizing the occluders
+		int num_occluders;
+		int num_triangles;	//rasterized, after clipping and removing back faces
+		int num_tested;		//boxes tested
+		int num_culled;		//boxes behind the occluders
+	};
+
+	class OcclusionBuffer
+	{
+	public:
+		static const int TILE_WIDTH = 8;
+		static const int TILE_HEIGHT = 4;
+
+		//triangle ready to rasterize, the edge functions are positive inside
+		struct sScreenTriangle {
+			float edge_a[3], edge_b[3], edge_c[3];	//a*x + b*y + c for every edge
+			float depth_a, depth_b, depth_c;		//depth plane
+			int min_x, min_y, max_x, max_y;			//pixels covered
+		};
+
+		int width, height;	//in pixels, multiples of the tile size
+		int tiles_x, tiles_y;
+		std::vector<float> depth;			//normalized device depth (-1 near, 1 far), tile after tile
+		std::vector<float> tile_max_depth;	//farthest depth of every tile
+		Matrix44 viewprojection;
+
+		sOcclusionStats stats;
+
+		OcclusionBuffer();
+
+		//clears the buffer to be used from this camera, width is the resolution (height depends on the aspect)
+		void clear(Camera* camera, int width = 256);
+		//transforms and rasterizes the occluders, the rows of tiles are split between the workers
+		void rasterize(const std::vector<sOccluder>& occluders, bool parallel = true);
+		//true if the box (world space) is completely behind what has been rasterized
+		bool isOccluded(const BoundingBox& box);
+
+		float getDepth(int x, int y) const { return depth[(y / TILE_HEIGHT * tiles_x + x / TILE_WIDTH) * TILE_WIDTH * TILE_HEIGHT + (y % TILE_HEIGHT) * TILE_WIDTH + x % TILE_WIDTH]; }
+
+	private:
+		std::vector< std::vector<sScreenTriangle> > triangles; //per occluder
+
+		void setupOccluder(const sOccluder& occluder, std::vector<sScreenTriangle>& result);
+		void addTriangle(const Vector3f& a, const Vector3f& b, const Vector3f& c, bool two_sided, std::vector<sScreenTriangle>& result);
+		void rasterizeTileRows(int first_row, int last_row);
+	};
+
+};
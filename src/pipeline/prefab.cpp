@@ -10,6 +10,7 @@
 #include "../utils/gltf_loader.h"
 #include "../utils/utils.h"
 #include "../core/math.h"
+#include "../core/task.h"
 
 #include <iostream>
 
@@ -17,10 +18,16 @@ using namespace SCN;
 
 int Node::s_NodeID = 0;
 Node* Node::s_selected = nullptr;
+uint32 Node::s_structure_version = 0;
 
 Node::Node() : parent(nullptr), mesh(nullptr), material(nullptr), visible(true)
 {
 	m_Id = s_NodeID++;
+	submesh_id = -1;
+	has_bounds = false;
+	transform_dirty = true;
+	lod = previous_lod = 0;
+	lod_change_time = 0;
 }
 
 Node::~Node()
@@ -47,18 +54,22 @@ void Node::clear()
 		children[i]->parent = NULL;
 		delete children[i]; //triggers clear
 	}
+	if (children.size())
+		s_structure_version++;
 	children.resize(0);
 }
 
+//bounding box in parent space, computed from the meshes (doesnt use the world space aabb)
 BoundingBox Node::getBoundingBox()
 {
-	aabb.center.set(0, 0, 0);
-	aabb.halfsize.set(0, 0, 0);
+	BoundingBox box;
+	box.center.set(0, 0, 0);
+	box.halfsize.set(0, 0, 0);
 	if (mesh)
-		aabb = mesh->box;
+		box = mesh->box;
 	for (int i = 0; i < children.size(); ++i)
-		aabb = mergeBoundingBoxes( children[i]->getBoundingBox(), aabb );
-	return transformBoundingBox(model, aabb);
+		box = mergeBoundingBoxes( children[i]->getBoundingBox(), box );
+	return transformBoundingBox(model, box);
 }
 
 void Node::removeChild(Node* child)
@@ -71,6 +82,7 @@ void Node::removeChild(Node* child)
 			continue;
 		child->parent = NULL;
 		children.erase(children.begin() + i);
+		s_structure_version++;
 		return;
 	}
 }
@@ -105,7 +117,7 @@ bool Node::testRay(const Ray& ray, Vector3f& result, int layers, float max_dist)
 	if (mesh && material && material->alpha_mode != SCN::eAlphaMode::BLEND)
 	{
 
-		collided = mesh->testRayCollision( getGlobalMatrix(), ray.origin, ray.direction, collision, normal, max_dist );
+		collided = mesh->testRayCollision( global_model, ray.origin, ray.direction, collision, normal, max_dist, false, submesh_id );
 		if (collided)
 			max_dist = ray.origin.distance(collision);
 	}
@@ -132,11 +144,13 @@ void Node::operator = (const Node& node)
 	clear(); //remove any children
 
 	mesh = node.mesh;
+	submesh_id = node.submesh_id;
 	material = node.material;
 	name = node.name;
 	visible = node.visible;
 	model = node.model;
 	aabb = node.aabb;
+	transform_dirty = true;
 
 	//clone children
 	for (int i = 0; i < node.children.size(); ++i)
@@ -148,23 +162,127 @@ void Node::operator = (const Node& node)
 	}
 }
 
-Prefab::Prefab()
+void NodeHierarchy::build(const std::vector<Node*>& roots)
 {
+	nodes.clear();
+	parents.clear();
+	first_child.clear();
+	levels.clear();
+
+	for (size_t i = 0; i < roots.size(); ++i)
+	{
+		nodes.push_back(roots[i]);
+		parents.push_back(-1);
+	}
+
+	//breadth first so nodes of the same depth are together
+	int start = 0;
+	while (start < (int)nodes.size())
+	{
+		levels.push_back(start);
+		int end = (int)nodes.size();
+		for (int i = start; i < end; ++i)
+		{
+			Node* node = nodes[i];
+			first_child.push_back((int)nodes.size());
+			node->transform_dirty = true;
+			for (size_t j = 0; j < node->children.size(); ++j)
+			{
+				nodes.push_back(node->children[j]);
+				parents.push_back(i);
+			}
+		}
+		start = end;
+	}
+	levels.push_back((int)nodes.size());
+
+	updated.resize(nodes.size());
+	subtree_updated.resize(nodes.size());
+	structure_version = Node::s_structure_version;
 }
 
-Prefab::~Prefab()
+void NodeHierarchy::updateTransformsRange(int start, int end)
 {
-	if (name.size())
+	for (int i = start; i < end; ++i)
 	{
-		auto it = sPrefabsLoaded.find(name);
-		if (it != sPrefabsLoaded.end())
-			sPrefabsLoaded.erase(it);
+		Node* node = nodes[i];
+		int parent_index = parents[i];
+		bool dirty = node->transform_dirty || (parent_index != -1 && updated[parent_index]);
+		updated[i] = dirty;
+		if (!dirty)
+			continue;
+		node->transform_dirty = false;
+		if (node->parent)
+			node->global_model = node->model * node->parent->global_model;
+		else
+			node->global_model = node->model;
+		if (node->mesh)
+			node->aabb = transformBoundingBox(node->global_model, node->mesh->box);
 	}
 }
 
+void NodeHierarchy::updateBoundsRange(int start, int end)
+{
+	for (int i = start; i < end; ++i)
+	{
+		Node* node = nodes[i];
+		int num_children = (int)node->children.size();
+		bool changed = updated[i] != 0;
+		for (int j = 0; j < num_children && !changed; ++j)
+			changed = subtree_updated[first_child[i] + j] != 0;
+		subtree_updated[i] = changed;
+		if (!changed)
+			continue;
+
+		node->has_bounds = node->mesh != nullptr;
+		if (node->has_bounds)
+			node->subtree_aabb = node->aabb;
+		for (int j = 0; j < num_children; ++j)
+		{
+			Node* child = nodes[first_child[i] + j];
+			if (!child->has_bounds)
+				continue;
+			node->subtree_aabb = node->has_bounds ? mergeBoundingBoxes(node->subtree_aabb, child->subtree_aabb) : child->subtree_aabb;
+			node->has_bounds = true;
+		}
+	}
+}
+
+int NodeHierarchy::update()
+{
+	const int min_range = 256; //below this it is not worth to send it to the workers
+	int num_levels = (int)levels.size() - 1;
+
+	//top-down: global matrices
+	for (int l = 0; l < num_levels; ++l)
+		TaskManager::background.parallelFor(levels[l], levels[l + 1], [this](int start, int end) { updateTransformsRange(start, end); }, min_range);
+
+	//bottom-up: bounding boxes of every subtree
+	for (int l = num_levels - 1; l >= 0; --l)
+		TaskManager::background.parallelFor(levels[l], levels[l + 1], [this](int start, int end) { updateBoundsRange(start, end); }, min_range);
+
+	num_updated = 0;
+	for (size_t i = 0; i < updated.size(); ++i)
+		num_updated += updated[i];
+	return num_updated;
+}
+
+Prefab::Prefab()
+{
+	has_bounding = false;
+	loading_state = LOADING_DONE;
+	loading_progress = 1.0f;
+}
+
+Prefab::~Prefab()
+{
+	unregisterPrefab();
+}
+
 void Prefab::updateBounding()
 {
 	bounding = root.getBoundingBox();
+	has_bounding = true;
 }
 
 std::map<std::string, Prefab*> Prefab::sPrefabsLoaded;
@@ -192,12 +310,34 @@ Prefab* Prefab::Get(const char* filename)
 	return prefab;
 }
 
+Prefab* Prefab::GetAsync(const char* filename)
+{
+	assert(filename);
+	std::map<std::string, Prefab*>::iterator it = sPrefabsLoaded.find(filename);
+	if (it != sPrefabsLoaded.end())
+		return it->second;
+
+	Prefab* prefab = new Prefab();
+	prefab->registerPrefab(filename);
+	loadGLTFAsync(prefab, filename);
+	return prefab;
+}
+
 void Prefab::registerPrefab(std::string name)
 {
 	this->name = name;
 	sPrefabsLoaded[name] = this;
 }
 
+void Prefab::unregisterPrefab()
+{
+	if (!name.size())
+		return;
+	auto it = sPrefabsLoaded.find(name);
+	if (it != sPrefabsLoaded.end() && it->second == this)
+		sPrefabsLoaded.erase(it);
+}
+
 Node* Prefab::getNodeByName(const char* name)
 {
 	auto it = nodes_by_name.find(name);
@@ -30,6 +30,7 @@ namespace SCN {
 	public:
 		static int s_NodeID;
 		static Node* s_selected;
+		static uint32 s_structure_version; //changes every time a node is added or removed from a tree
 		int m_Id;
 
 	public:
@@ -39,12 +40,21 @@ namespace SCN {
 		bool visible;
 
 		GFX::Mesh* mesh;
+		int submesh_id; //-1 renders the whole mesh
 		Material* material;
 
 		Matrix44 model;	//the matrix that defines where is the object (in relation to its parent)
 		Matrix44 global_model;	//the matrix that defines where is the object (in relation to the world)
 
 		BoundingBox aabb; //node bounding box in world space
+		BoundingBox subtree_aabb; //bounding box in world space of this node and all its children
+		bool has_bounds; //false if there is no mesh in this node or its children (subtree_aabb is not valid)
+		bool transform_dirty; //model changed and global_model must be updated, use markDirty
+
+		//level of detail of the mesh selected by the renderer, previous_lod is faded out during a while after a change
+		int lod;
+		int previous_lod;
+		long lod_change_time; //ms
 
 		//info to create the tree
 		Node* parent;
@@ -67,10 +77,17 @@ namespace SCN {
 			assert(child->parent == NULL);
 			children.push_back(child);
 			child->parent = this;
+			child->transform_dirty = true;
+			s_structure_version++;
 		}
 		void removeChild(Node* child);
 
+		//call it after changing the model so global_model and aabb are updated in the next NodeHierarchy::update
+		void markDirty() { transform_dirty = true; }
+		void setModel(const Matrix44& m) { model = m; transform_dirty = true; }
+
 		//compute the global matrix taking into account its parent
+		//if the node belongs to a scene better use global_model, it is updated every frame
 		Matrix44 getGlobalMatrix(bool fast = false) { 
 			if (parent)
 				global_model = model * (fast ? parent->global_model : parent->getGlobalMatrix());
@@ -85,6 +102,37 @@ namespace SCN {
 		void operator = (const Node& node);
 	};
 
+	//Flattened version of several trees of nodes, ordered by depth so every parent is before its children.
+	//Used to update global matrices and bounding boxes of the changed nodes in linear passes.
+	//Nodes in the same level are independent so big levels are split among the worker threads.
+	class NodeHierarchy
+	{
+	public:
+		std::vector<Node*> nodes;
+		std::vector<int> parents; //index in nodes, -1 for roots
+		std::vector<int> first_child; //index in nodes of the first child, children are consecutive
+		std::vector<int> levels; //index where every depth level starts (plus one at the end)
+		std::vector<uint8> updated; //global_model updated in this pass
+		std::vector<uint8> subtree_updated; //this node or any children updated in this pass
+		uint32 structure_version;
+		int num_updated; //nodes updated in the last pass
+
+		NodeHierarchy() { structure_version = 0; num_updated = 0; }
+
+		//flattens the trees, all nodes will be updated in the next pass
+		void build(const std::vector<Node*>& roots);
+		bool needsRebuild() { return structure_version != Node::s_structure_version; }
+
+		//updates global_model, aabb and subtree_aabb of dirty nodes and their children
+		int update();
+
+	private:
+		void updateTransformsRange(int start, int end);
+		void updateBoundsRange(int start, int end);
+	};
+
+	enum eLoadingState { LOADING_DONE, LOADING_IN_PROGRESS, LOADING_FAILED };
+
 	//a Prefab represent a set of objects in a tree structure
 	//used to load info from GLTF files
 	class Prefab
@@ -98,11 +146,16 @@ namespace SCN {
 		//root node which contains the tree
 		Node root;
 		BoundingBox bounding;
+		bool has_bounding; //while loading async it is false till the file is parsed
+
+		eLoadingState loading_state;
+		float loading_progress; //from 0 to 1
 
 		//ctor and dtor
 		Prefab();
 		~Prefab();
 
+		bool isLoaded() { return loading_state == LOADING_DONE; }
 		void updateBounding();
 		void updateNodesByName();
 		Node* getNodeByName(const char* name);
@@ -110,7 +163,9 @@ namespace SCN {
 		//Manager to cache loaded prefabs
 		static std::map<std::string, Prefab*> sPrefabsLoaded;
 		static Prefab* Get(const char* filename);
+		static Prefab* GetAsync(const char* filename); //returns an empty prefab that will be filled in the following frames, check isLoaded
 		void registerPrefab(std::string name);
+		void unregisterPrefab(); //removes it from the cache (if it is the one cached with its name)
 	};
 
 };
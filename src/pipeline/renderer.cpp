@@ -7,6 +7,7 @@
 #include "../gfx/shader.h"
 #include "../gfx/mesh.h"
 #include "../gfx/texture.h"
+#include "../gfx/texture_streamer.h"
 #include "../gfx/fbo.h"
 #include "../pipeline/prefab.h"
 #include "../pipeline/material.h"
@@ -14,6 +15,7 @@
 #include "../utils/utils.h"
 #include "../extra/hdre.h"
 #include "../core/ui.h"
+#include "../core/task.h"
 
 #include "scene.h"
 
@@ -23,16 +25,53 @@ using namespace SCN;
 //some globals
 GFX::Mesh sphere;
 
+//global indices of the uniform blocks
+#define CAMERA_BLOCK_INDEX 1
+#define FRAME_BLOCK_INDEX 2
+
+//uniforms set for every draw, their locations are read from an array instead of searching the name
+static const GFX::sUniformID u_model("u_model");
+static const GFX::sUniformID u_color("u_color");
+static const GFX::sUniformID u_texture("u_texture");
+static const GFX::sUniformID u_alpha_cutoff("u_alpha_cutoff");
+static const GFX::sUniformID u_lod_fade("u_lod_fade");
+static const GFX::sUniformID u_viewprojection("u_viewprojection");
+static const GFX::sUniformID u_camera_position("u_camera_position");
+static const GFX::sUniformID u_time("u_time");
+static const GFX::sUniformID u_camera_block("u_camera_block");
+static const GFX::sUniformID u_frame_block("u_frame_block");
+
 Renderer::Renderer(const char* shader_atlas_filename)
 {
 	render_wireframe = false;
 	render_boundaries = false;
+	use_instancing = true;
+	use_occlusion = false; //it only pays off with big occluders in front of many nodes
+	max_occluders = 32;
+	max_occluder_triangles = 5000;
+	min_occluder_size = 0.1f;
+	use_lods = true;
+	lod_threshold = 1.0f;
+	lod_hysteresis = 0.25f;
+	lod_fade_time = 0.3f;
+	memset(lod_counts, 0, sizeof(lod_counts));
+	instances_vbo_id = 0;
+	instances_vbo_size = 0;
 	scene = nullptr;
 	skybox_cubemap = nullptr;
+	camera_block = sCameraBlock(); //has a Matrix44, cannot be memset
+	frame_block = sFrameBlock();
+	memset(&uniform_stats, 0, sizeof(uniform_stats));
+	memset(&gpu_state_stats, 0, sizeof(gpu_state_stats));
+
+	//before compiling, so the blocks are bound when linking
+	GFX::Shader::setBlockBinding(u_camera_block, CAMERA_BLOCK_INDEX);
+	GFX::Shader::setBlockBinding(u_frame_block, FRAME_BLOCK_INDEX);
 
 	if (!GFX::Shader::LoadAtlas(shader_atlas_filename))
 		exit(1);
 	GFX::checkGLErrors();
+	GFX::Shader::PrewarmVariants(); //the variants used in previous runs, compiled in the first frames
 
 	sphere.createSphere(1.0f);
 	sphere.uploadToVRAM();
@@ -51,8 +90,22 @@ void Renderer::renderScene(SCN::Scene* scene, Camera* camera)
 	this->scene = scene;
 	setupScene();
 
-	glDisable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
+	//the calls of the previous frame
+	uniform_stats = GFX::Shader::s_uniform_stats;
+	memset(&GFX::Shader::s_uniform_stats, 0, sizeof(GFX::sUniformStats));
+	gpu_state_stats = GFX::gpu_state_stats;
+	memset(&GFX::gpu_state_stats, 0, sizeof(GFX::sGPUStateStats));
+
+	//variants of the ubershaders requested with getAsync
+	GFX::Shader::UpdateCompilations();
+
+	uploadFrameBlock();
+	uploadCameraBlock(camera);
+
+	//update the global matrices of the nodes that changed since last frame
+	scene->updateTransforms();
+
+	GFX::setGPUState(GFX_STATE_DEFAULT);
 
 	//set the clear color (the background color)
 	glClearColor(scene->background_color.x, scene->background_color.y, scene->background_color.z, 1.0);
@@ -65,33 +118,59 @@ void Renderer::renderScene(SCN::Scene* scene, Camera* camera)
 	if(skybox_cubemap)
 		renderSkybox(skybox_cubemap);
 
-	//render entities
-	for (int i = 0; i < scene->entities.size(); ++i)
+	//cull the bounds of all the nodes at once, the nodes of a prefab are only tested if the prefab is visible
+	culling_bounds.update(scene->hierarchy);
+	main_view.setPlanes(camera);
+	cullBounds(culling_bounds, &main_view, 1);
+
+	//collect the nodes to render
+	collectVisibleNodes(camera, main_view);
+	if (use_occlusion)
+		renderOccluders(camera);
+	render_queue.clear();
+	addVisibleNodesToQueue(camera);
+
+	//sort and render them
+	renderQueue(camera);
+
+	//load the mips requested by the visible textures
+	GFX::TextureStreamer::instance.update();
+
+	//prefabs still loading in the background
+	for (auto ent : scene->entities)
 	{
-		BaseEntity* ent = scene->entities[i];
-		if (!ent->visible )
+		if (!ent->visible || ent->getType() != eEntityType::PREFAB)
 			continue;
-
-		//is a prefab!
-		if (ent->getType() == eEntityType::PREFAB)
-		{
-			PrefabEntity* pent = (SCN::PrefabEntity*)ent;
-			if (pent->prefab)
-				renderNode( &pent->root, camera);
-		}
+		PrefabEntity* pent = (SCN::PrefabEntity*)ent;
+		if (pent->prefab && pent->prefab->loading_state == SCN::LOADING_IN_PROGRESS && pent->prefab->has_bounding)
+			renderLoadingBox(pent->prefab->bounding, pent->root.global_model, camera);
 	}
 }
 
+void Renderer::renderLoadingBox(const BoundingBox& box, const Matrix44& model, Camera* camera)
+{
+	GFX::Shader* shader = GFX::Shader::Get("flat");
+	if (!shader)
+		return;
+
+	Matrix44 m;
+	m.translate(box.center.x, box.center.y, box.center.z);
+	m.scale(box.halfsize.x, box.halfsize.y, box.halfsize.z);
+
+	shader->enable();
+	cameraToShader(camera, shader);
+	shader->setUniform(u_model, m * model);
+	shader->setUniform(u_color, Vector4f(1.0f, 1.0f, 1.0f, 0.5f));
+	GFX::Mesh::getWireBox()->render(GL_LINES);
+	shader->disable();
+}
+
 
 void Renderer::renderSkybox(GFX::Texture* cubemap)
 {
 	Camera* camera = Camera::current;
 
-	glDisable(GL_BLEND);
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
-	if (render_wireframe)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	GFX::setGPUState(GFX_STATE_WRITE_MASK | (render_wireframe ? GFX_STATE_WIREFRAME : 0));
 
 	GFX::Shader* shader = GFX::Shader::Get("skybox");
 	if (!shader)
@@ -101,42 +180,405 @@ void Renderer::renderSkybox(GFX::Texture* cubemap)
 	Matrix44 m;
 	m.setTranslation(camera->eye.x, camera->eye.y, camera->eye.z);
 	m.scale(10, 10, 10);
-	shader->setUniform("u_model", m);
+	shader->setUniform(u_model, m);
 	cameraToShader(camera, shader);
-	shader->setUniform("u_texture", cubemap, 0);
+	shader->setUniform(u_texture, cubemap, 0);
 	sphere.render(GL_TRIANGLES);
 	shader->disable();
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glEnable(GL_DEPTH_TEST);
+	GFX::setGPUState(GFX_STATE_DEPTH_TEST_LESS, GFX_STATE_DEPTH_TEST_MASK | GFX_STATE_WIREFRAME);
+}
+
+//finds the visible nodes of the prefabs
+void Renderer::collectVisibleNodes(Camera* camera, const sCullingView& view)
+{
+	NodeHierarchy& hierarchy = scene->hierarchy;
+	int num_nodes = (int)hierarchy.nodes.size();
+	hidden_nodes.resize(num_nodes);
+	visible_nodes.clear();
+
+	//nodes are sorted by depth so the parents are always before their children
+	for (int i = 0; i < num_nodes; ++i)
+	{
+		Node* node = hierarchy.nodes[i];
+		int parent = hierarchy.parents[i];
+		bool hidden = !node->visible;
+		if (parent == -1)
+		{
+			//the roots are the entities, only prefabs are rendered
+			assert(i < (int)scene->entities.size() && &scene->entities[i]->root == node);
+			BaseEntity* ent = scene->entities[i];
+			hidden = hidden || !ent->visible || ent->getType() != eEntityType::PREFAB || !((PrefabEntity*)ent)->prefab;
+		}
+		else
+			hidden = hidden || hidden_nodes[parent];
+		hidden_nodes[i] = hidden;
+
+		//does this node have a mesh? then we must render it
+		if (hidden || !node->mesh || !node->material || !node->mesh->getNumVertices())
+			continue;
+
+		//nothing inside the frustum in this branch
+		int index = culling_bounds.node_indices[i];
+		if (!view.isVisible(index))
+			continue;
+
+		//world space bounding box of the mesh, the culled one was the box of the subtree
+		const BoundingBox& world_bounding = node->aabb;
+		if (node->children.size() && !view.isInside(index) && !camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize))
+			continue;
+
+		visible_nodes.push_back(node);
+	}
+}
+
+void Renderer::renderOccluders(Camera* camera)
+{
+	occlusion.clear(camera);
+	occluder_flags.assign(visible_nodes.size(), 0);
+
+	//opaque meshes with few triangles, biggest on screen first
+	std::vector< std::pair<float, int> > candidates;
+	for (int i = 0; i < (int)visible_nodes.size(); ++i)
+	{
+		Node* node = visible_nodes[i];
+		GFX::Mesh* mesh = node->mesh;
+		if (node->material->alpha_mode != SCN::eAlphaMode::NO_ALPHA || mesh->bones_info.size())
+			continue;
+		unsigned int start, size;
+		mesh->getSubmeshStartAndSize(node->submesh_id, start, size);
+		if (size / 3 > (unsigned int)max_occluder_triangles)
+			continue;
+		float size_on_screen = node->aabb.halfsize.length() / std::max(camera->eye.distance(node->aabb.center), 0.001f);
+		if (size_on_screen >= min_occluder_size)
+			candidates.push_back(std::make_pair(size_on_screen, i));
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; });
+
+	std::vector<sOccluder> occluders;
+	for (size_t i = 0; i < candidates.size() && (int)occluders.size() < max_occluders; ++i)
+	{
+		Node* node = visible_nodes[candidates[i].second];
+		GFX::Mesh* mesh = node->mesh;
+		if (!mesh->vertices.size() && !mesh->interleaved.size())
+		{
+			requestOccluderData(mesh); //never read from disk in the frame
+			continue;
+		}
+		sOccluder occluder;
+		occluder.mesh = mesh;
+		occluder.submesh_id = node->submesh_id;
+		occluder.model = node->global_model;
+		occluder.two_sided = node->material->two_sided;
+		occluders.push_back(occluder);
+		occluder_flags[candidates[i].second] = 1; //never tested against itself
+	}
+	occlusion.rasterize(occluders);
 }
 
-//renders a node of the prefab and its children
-void Renderer::renderNode(SCN::Node* node, Camera* camera)
+void Renderer::requestOccluderData(GFX::Mesh* mesh)
 {
-	if (!node->visible)
+	//only meshes from an MBIN can be read again
+	if (!mesh->mapped_filename.size() || occluder_requests.count(mesh->index))
 		return;
+	occluder_requests.insert(mesh->index);
+
+	std::string filename = mesh->mapped_filename;
+	TaskManager::background.addTask([mesh, filename]() {
+		GFX::Mesh* data = new GFX::Mesh();
+		if (!data->readBin(filename.c_str()) || !data->loadCPUData())
+		{
+			std::cout << "[ERROR] reading occluder: " << filename << std::endl;
+			delete data;
+			return;
+		}
 
-	//compute global matrix
-	Matrix44 node_model = node->getGlobalMatrix(true);
+		//swapped in the main thread, nothing is reading the vectors there
+		TaskManager::foreground.addTask([mesh, data]() {
+			if (!mesh->vertices.size() && !mesh->interleaved.size() && mesh->getNumVertices() == data->getNumVertices())
+			{
+				mesh->vertices.swap(data->vertices);
+				mesh->interleaved.swap(data->interleaved);
+				mesh->m_indices.swap(data->m_indices);
+			}
+			delete data;
+		});
+	});
+}
 
-	//does this node have a mesh? then we must render it
-	if (node->mesh && node->material)
+//size of a pixel in uv space at the closest point of the node, tells the texture streamer which mip is needed
+static float computeUVsPerPixel(Node* node, Camera* camera, float viewport_height)
+{
+	Vector3f scale = node->global_model.getScale();
+	float max_scale = std::max(scale.x, std::max(scale.y, scale.z));
+	float pixels_per_unit;
+	if (camera->type == Camera::ORTHOGRAPHIC)
+		pixels_per_unit = viewport_height / fabs(camera->top - camera->bottom);
+	else
 	{
-		//compute the bounding box of the object in world space (by using the mesh bounding box transformed to world space)
-		BoundingBox world_bounding = transformBoundingBox(node_model,node->mesh->box);
-		
-		//if bounding box is inside the camera frustum then the object is probably visible
-		if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize) )
+		float distance = std::max(camera->eye.distance(node->aabb.center) - node->aabb.halfsize.length(), camera->near_plane);
+		pixels_per_unit = viewport_height / (2.0f * tan(camera->fov * 0.5f * DEG2RAD) * distance);
+	}
+	return node->mesh->getUVDensity() / (max_scale * pixels_per_unit);
+}
+
+//adds the visible nodes of the prefabs to the render queue
+void Renderer::addVisibleNodesToQueue(Camera* camera)
+{
+	memset(lod_counts, 0, sizeof(lod_counts));
+	long now = getTime();
+	GFX::Shader* shader = GFX::Shader::Get("texture");
+	float viewport_height = CORE::getWindowSize().y;
+
+	for (size_t i = 0; i < visible_nodes.size(); ++i)
+	{
+		Node* node = visible_nodes[i];
+		const BoundingBox& world_bounding = node->aabb;
+
+		//behind the occluders
+		if (use_occlusion && !occluder_flags[i] && occlusion.isOccluded(world_bounding))
+			continue;
+
+		if (render_boundaries)
+			node->mesh->renderBounding(node->global_model, true);
+
+		GFX::Texture* texture = node->material->textures[SCN::eTextureChannel::ALBEDO].texture;
+		if (texture && texture->streaming)
+			GFX::TextureStreamer::instance.requestTexture(texture, computeUVsPerPixel(node, camera, viewport_height));
+
+		//global matrix and bounding box were updated in Scene::updateTransforms
+		sDrawCall dc;
+		dc.mesh = node->mesh;
+		dc.submesh_id = node->submesh_id;
+		dc.material = node->material;
+		dc.shader = shader;
+		dc.model = node->global_model;
+		dc.distance = camera->eye.distance(world_bounding.center);
+		dc.lod = selectLOD(node, camera);
+		dc.lod_fade = 0.0f;
+		lod_counts[std::min(dc.lod, 3)]++;
+
+		//after a change both levels are rendered with complementary dithering
+		float fade = lod_fade_time > 0.0f ? (now - node->lod_change_time) * 0.001f / lod_fade_time : 1.0f;
+		if (fade < 1.0f && node->previous_lod != dc.lod && node->previous_lod < dc.mesh->getNumLODs())
+		{
+			sDrawCall previous = dc;
+			previous.lod = node->previous_lod;
+			previous.lod_fade = -fade;
+			previous.sort_key = computeSortKey(shader, dc.material, dc.mesh, dc.distance, camera->far_plane, previous.lod);
+			render_queue.push_back(previous);
+			dc.lod_fade = std::max(fade, 0.001f);
+		}
+
+		dc.sort_key = computeSortKey(dc.shader, dc.material, dc.mesh, dc.distance, camera->far_plane, dc.lod);
+		render_queue.push_back(dc);
+	}
+}
+
+//coarsest level whose error on screen is below the threshold, a finer level is only left when the coarser one is clearly below it
+int Renderer::selectLOD(SCN::Node* node, Camera* camera)
+{
+	GFX::Mesh* mesh = node->mesh;
+	int num_lods = mesh->getNumLODs();
+	int current = std::min(node->lod, num_lods - 1);
+	int lod = 0;
+	if (use_lods && num_lods > 1)
+	{
+		Vector3f scale = node->global_model.getScale();
+		float radius = mesh->radius * std::max(scale.x, std::max(scale.y, scale.z));
+		float screen_size = camera->getProjectedScale(node->aabb.center, radius);
+		for (int i = num_lods - 1; i > 0; --i)
 		{
-			if(render_boundaries)
-				node->mesh->renderBounding(node_model, true);
-			renderMeshWithMaterial(node_model, node->mesh, node->material);
+			float threshold = i > current ? lod_threshold * (1.0f - lod_hysteresis) : lod_threshold;
+			if (mesh->lods[i - 1].error * screen_size <= threshold)
+			{
+				lod = i;
+				break;
+			}
 		}
 	}
 
-	//iterate recursively with children
-	for (int i = 0; i < node->children.size(); ++i)
-		renderNode( node->children[i], camera);
+	if (lod != node->lod)
+	{
+		node->previous_lod = node->lod;
+		node->lod = lod;
+		node->lod_change_time = getTime();
+	}
+	return lod;
+}
+
+//key layout (from most to least significant bit):
+// opaque:  [63] 0 | [62..56] shader | [55..40] material | [39..24] mesh | [23..22] lod | [21..0] depth (front to back)
+// blended: [63] 1 | [62..39] inverted depth (back to front) | [38..32] shader | [31..16] material | [15..0] mesh
+//so opaque calls are grouped by state and blended calls are rendered after them in the right order
+uint64 Renderer::computeSortKey(GFX::Shader* shader, SCN::Material* material, GFX::Mesh* mesh, float distance, float far_plane, int lod)
+{
+	uint64 shader_bits = (shader ? shader->program : 0) & 0x7F;
+	uint64 material_bits = material->index & 0xFFFF;
+	uint64 mesh_bits = mesh->index & 0xFFFF;
+	uint64 depth_bits = (uint64)(clamp(distance / far_plane, 0.0f, 1.0f) * 0xFFFFFF);
+
+	if (material->alpha_mode == SCN::eAlphaMode::BLEND)
+		return (1ULL << 63) | ((0xFFFFFF - depth_bits) << 39) | (shader_bits << 32) | (material_bits << 16) | mesh_bits;
+	uint64 lod_bits = std::min(lod, 3);
+	return (shader_bits << 56) | (material_bits << 40) | (mesh_bits << 24) | (lod_bits << 22) | (depth_bits >> 2);
+}
+
+void Renderer::buildRenderGroups(std::vector<sRenderGroup>& groups)
+{
+	instance_models.clear();
+	int num_calls = (int)render_queue.size();
+	for (int i = 0; i < num_calls; )
+	{
+		sDrawCall& dc = render_queue[i];
+		sRenderGroup group;
+		group.first_call = i;
+		group.num_calls = 1;
+		group.first_instance = -1;
+
+		//blended calls must keep their order, so they are never instanced, neither the ones fading (they need their own uniform)
+		if (use_instancing && dc.material->alpha_mode != SCN::eAlphaMode::BLEND && dc.lod_fade == 0.0f)
+		{
+			while (i + group.num_calls < num_calls)
+			{
+				sDrawCall& next = render_queue[i + group.num_calls];
+				if (next.mesh != dc.mesh || next.submesh_id != dc.submesh_id || next.material != dc.material || next.shader != dc.shader || next.lod != dc.lod || next.lod_fade != 0.0f)
+					break;
+				group.num_calls++;
+			}
+		}
+
+		if (group.num_calls > 1)
+		{
+			group.first_instance = (int)instance_models.size();
+			for (int j = 0; j < group.num_calls; ++j)
+				instance_models.push_back(render_queue[i + j].model);
+		}
+
+		groups.push_back(group);
+		i += group.num_calls;
+	}
+
+	if (instance_models.empty())
+		return;
+
+	//upload all the models of the frame at once
+	if (instances_vbo_id == 0)
+		glGenBuffers(1, &instances_vbo_id);
+	GFX::bindBuffer(GL_ARRAY_BUFFER, instances_vbo_id);
+	if (instances_vbo_size < instance_models.size())
+	{
+		instances_vbo_size = std::max((unsigned int)instance_models.size(), instances_vbo_size * 2);
+		glBufferData(GL_ARRAY_BUFFER, instances_vbo_size * sizeof(Matrix44), nullptr, GL_STREAM_DRAW);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instance_models.size() * sizeof(Matrix44), &instance_models[0]);
+	GFX::bindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Renderer::renderQueue(Camera* camera)
+{
+	if (render_queue.empty())
+		return;
+
+	std::sort(render_queue.begin(), render_queue.end(), [](const sDrawCall& a, const sDrawCall& b) { return a.sort_key < b.sort_key; });
+
+	std::vector<sRenderGroup> groups;
+	buildRenderGroups(groups);
+
+	GFX::Shader* instanced_shader = GFX::Shader::Get("texture_instanced");
+
+	//keep track of the current state to skip redundant changes
+	GFX::Shader* current_shader = NULL;
+	SCN::Material* current_material = NULL;
+	GFX::Mesh* current_mesh = NULL;
+
+	for (size_t i = 0; i < groups.size(); ++i)
+	{
+		sRenderGroup& group = groups[i];
+		sDrawCall& dc = render_queue[group.first_call];
+		bool instanced = group.first_instance != -1 && instanced_shader;
+		GFX::Shader* shader = instanced ? instanced_shader : dc.shader;
+		if (!shader)
+			continue;
+
+		//shader change, all uniforms must be sent again
+		if (shader != current_shader)
+		{
+			if (current_mesh)
+				current_mesh->disableBuffers(current_shader);
+			current_mesh = NULL;
+			current_material = NULL;
+			current_shader = shader;
+			current_shader->enable();
+			cameraToShader(camera, current_shader);
+		}
+		if (dc.material != current_material)
+		{
+			SCN::Material* material = dc.material;
+			current_material = material;
+
+			//blending and culling, only the parts that change are sent
+			GFX::setGPUState(getMaterialState(material));
+
+			GFX::Texture* texture = material->textures[SCN::eTextureChannel::ALBEDO].texture;
+			if (texture == NULL)
+				texture = GFX::Texture::getWhiteTexture(); //a 1x1 white texture
+
+			current_shader->setUniform(u_color, material->color);
+			current_shader->setUniform(u_texture, texture, 0);
+			current_shader->setUniform(u_alpha_cutoff, material->alpha_mode == SCN::eAlphaMode::MASK ? material->alpha_cutoff : 0.001f);
+		}
+
+		//one draw for all the calls of the group, models are read from the instance buffer
+		if (instanced)
+		{
+			if (current_mesh)
+				current_mesh->disableBuffers(current_shader);
+			current_mesh = NULL;
+			dc.mesh->renderInstanced(GL_TRIANGLES, instances_vbo_id, group.first_instance, group.num_calls, dc.submesh_id, dc.lod);
+			continue;
+		}
+
+		//only bind the buffers when the mesh changes
+		if (dc.mesh != current_mesh)
+		{
+			if (current_mesh)
+				current_mesh->disableBuffers(current_shader);
+			current_mesh = dc.mesh;
+			current_mesh->enableBuffers(current_shader);
+		}
+
+		for (int j = 0; j < group.num_calls; ++j)
+		{
+			sDrawCall& call = render_queue[group.first_call + j];
+			current_shader->setUniform(u_model, call.model);
+			if (call.lod_fade != 0.0f)
+				current_shader->setUniform(u_lod_fade, call.lod_fade);
+			current_mesh->drawCall(GL_TRIANGLES, dc.submesh_id, 0, call.lod);
+			if (call.lod_fade != 0.0f)
+				current_shader->setUniform(u_lod_fade, 0.0f);
+		}
+	}
+
+	if (current_mesh)
+		current_mesh->disableBuffers(current_shader);
+	if (current_shader)
+		current_shader->disable();
+
+	//set the render state as it was before to avoid problems with future renders
+	GFX::setGPUState(GFX_STATE_NONE, GFX_STATE_BLEND_MASK | GFX_STATE_WIREFRAME);
+}
+
+//render state of a material: depth test, alpha blending and culling of the back faces if it is not two sided
+uint64_t Renderer::getMaterialState(SCN::Material* material)
+{
+	uint64_t state = GFX_STATE_WRITE_MASK | GFX_STATE_DEPTH_TEST_LESS;
+	if (material->alpha_mode == SCN::eAlphaMode::BLEND)
+		state |= GFX_STATE_BLEND_ALPHA;
+	if (!material->two_sided)
+		state |= GFX_STATE_CULL_BACK;
+	if (render_wireframe)
+		state |= GFX_STATE_WIREFRAME;
+	return state;
 }
 
 //renders a mesh given its transform and material
@@ -160,24 +602,10 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, GFX::Mesh* mesh, SCN
 	if (texture == NULL)
 		texture = GFX::Texture::getWhiteTexture(); //a 1x1 white texture
 
-	//select the blending
-	if (material->alpha_mode == SCN::eAlphaMode::BLEND)
-	{
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	}
-	else
-		glDisable(GL_BLEND);
-
-	//select if render both sides of the triangles
-	if(material->two_sided)
-		glDisable(GL_CULL_FACE);
-	else
-		glEnable(GL_CULL_FACE);
+	//select the blending, if render both sides of the triangles and the wireframe
+	GFX::setGPUState(getMaterialState(material));
     assert(glGetError() == GL_NO_ERROR);
 
-	glEnable(GL_DEPTH_TEST);
-
 	//chose a shader
 	shader = GFX::Shader::Get("texture");
 
@@ -189,20 +617,15 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, GFX::Mesh* mesh, SCN
 	shader->enable();
 
 	//upload uniforms
-	shader->setUniform("u_model", model);
+	shader->setUniform(u_model, model);
 	cameraToShader(camera, shader);
-	float t = getTime();
-	shader->setUniform("u_time", t );
 
-	shader->setUniform("u_color", material->color);
+	shader->setUniform(u_color, material->color);
 	if(texture)
-		shader->setUniform("u_texture", texture, 0);
+		shader->setUniform(u_texture, texture, 0);
 
 	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
-	shader->setUniform("u_alpha_cutoff", material->alpha_mode == SCN::eAlphaMode::MASK ? material->alpha_cutoff : 0.001f);
-
-	if (render_wireframe)
-		glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+	shader->setUniform(u_alpha_cutoff, material->alpha_mode == SCN::eAlphaMode::MASK ? material->alpha_cutoff : 0.001f);
 
 	//do the draw call that renders the mesh into the screen
 	mesh->render(GL_TRIANGLES);
@@ -211,14 +634,34 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, GFX::Mesh* mesh, SCN
 	shader->disable();
 
 	//set the render state as it was before to avoid problems with future renders
-	glDisable(GL_BLEND);
-	glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+	GFX::setGPUState(GFX_STATE_NONE, GFX_STATE_BLEND_MASK | GFX_STATE_WIREFRAME);
+}
+
+void SCN::Renderer::uploadCameraBlock(Camera* camera)
+{
+	camera_block.viewprojection = camera->viewprojection_matrix;
+	camera_block.camera_position = camera->eye;
+	camera_buffer.update(camera_block);
+	camera_buffer.bind(NULL, CAMERA_BLOCK_INDEX);
+}
+
+void SCN::Renderer::uploadFrameBlock()
+{
+	frame_block.time = (float)getTime();
+	frame_buffer.update(frame_block);
+	frame_buffer.bind(NULL, FRAME_BLOCK_INDEX);
 }
 
+//the shaders with the blocks read them from the buffers, the ones without (like in the GLSL 1.10 atlas) need the uniforms
 void SCN::Renderer::cameraToShader(Camera* camera, GFX::Shader* shader)
 {
-	shader->setUniform("u_viewprojection", camera->viewprojection_matrix );
-	shader->setUniform("u_camera_position", camera->eye);
+	if (shader->getBlockIndex(u_camera_block) == -1)
+	{
+		shader->setUniform(u_viewprojection, camera->viewprojection_matrix);
+		shader->setUniform(u_camera_position, camera->eye);
+	}
+	if (shader->getBlockIndex(u_frame_block) == -1)
+		shader->setUniform(u_time, frame_block.time);
 }
 
 #ifndef SKIP_IMGUI
@@ -228,6 +671,46 @@ void Renderer::showUI()
 		
 	ImGui::Checkbox("Wireframe", &render_wireframe);
 	ImGui::Checkbox("Boundaries", &render_boundaries);
+	ImGui::Checkbox("Instancing", &use_instancing);
+	ImGui::Text("Uniforms per frame: %d by name, %d by id, %d buffers", uniform_stats.by_name, uniform_stats.by_id, uniform_stats.buffer_updates);
+	ImGui::Text("GL state calls: %d (%d avoided), bindings: %d (%d avoided)", gpu_state_stats.state_calls, gpu_state_stats.redundant_states, gpu_state_stats.bindings, gpu_state_stats.redundant_bindings);
+	ImGui::Checkbox("Shader binary cache", &GFX::Shader::use_binary_cache);
+	ImGui::SameLine();
+	ImGui::Text("%d compiled, %d loaded", GFX::Shader::s_num_programs_compiled, GFX::Shader::s_num_binaries_loaded);
+	ImGui::Text("Shader variants compiling: %d%s", GFX::Shader::s_num_pending_variants, GFX::Shader::s_parallel_compile ? " (parallel)" : "");
+	if (!GFX::Shader::s_parallel_compile)
+		ImGui::SliderInt("Compiles per frame", &GFX::Shader::max_compiles_per_frame, 1, 8);
+	ImGui::Checkbox("Occlusion culling", &use_occlusion);
+	if (use_occlusion)
+	{
+		const sOcclusionStats& stats = occlusion.stats;
+		ImGui::Text("Occluders: %d (%d triangles) %.2fms", stats.num_occluders, stats.num_triangles, stats.raster_time);
+		ImGui::Text("Occluded: %d / %d tested", stats.num_culled, stats.num_tested);
+	}
+	ImGui::Checkbox("Levels of detail", &use_lods);
+	if (use_lods)
+	{
+		ImGui::SliderFloat("LOD threshold", &lod_threshold, 0.1f, 10.0f);
+		ImGui::SliderFloat("LOD hysteresis", &lod_hysteresis, 0.0f, 0.9f);
+		ImGui::SliderFloat("LOD fade time", &lod_fade_time, 0.0f, 2.0f);
+		ImGui::Text("Calls per LOD: %d %d %d %d", lod_counts[0], lod_counts[1], lod_counts[2], lod_counts[3]);
+	}
+
+	GFX::TextureStreamer& streamer = GFX::TextureStreamer::instance;
+	ImGui::Checkbox("Texture streaming", &streamer.enabled); //only for the textures loaded after changing it
+	int budget_mb = (int)(streamer.budget / (1024 * 1024));
+	if (ImGui::SliderInt("Texture budget (MB)", &budget_mb, 16, 2048))
+		streamer.budget = (size_t)budget_mb * 1024 * 1024;
+	ImGui::SliderFloat("Texture mip bias", &streamer.mip_bias, -1.0f, 3.0f);
+	const GFX::sTextureStreamingStats& tstats = streamer.stats;
+	ImGui::Text("Streamed textures: %d, %.1f MB (%.1f MB required)", tstats.num_textures, tstats.resident_bytes / (1024.0f * 1024.0f), tstats.required_bytes / (1024.0f * 1024.0f));
+	ImGui::Text("Loading: %d Evicted: %d Uploaded: %d", tstats.num_loading, tstats.num_evicted, tstats.num_uploaded);
+
+	if (scene)
+	{
+		ImGui::Text("Nodes updated: %d / %d", scene->hierarchy.num_updated, (int)scene->hierarchy.nodes.size());
+		ImGui::Text("Boxes visible: %d / %d", main_view.countVisible(), (int)scene->hierarchy.nodes.size());
+	}
 
 	//add here your stuff
 	//...
@@ -1,8 +1,12 @@
 #pragma once
+#include <set>
 #include "scene.h"
 #include "prefab.h"
 
 #include "light.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "../gfx/shader.h"
 
 //forward declarations
 class Camera;
@@ -18,6 +22,38 @@ namespace SCN {
 	class Prefab;
 	class Material;
 
+	//info required to render one mesh, stored in the render queue so it can be sorted before submitting
+	struct sDrawCall {
+		uint64 sort_key;		//used to sort the calls, see Renderer::computeSortKey
+		GFX::Mesh* mesh;
+		int submesh_id;			//-1 means the whole mesh
+		SCN::Material* material;
+		GFX::Shader* shader;
+		Matrix44 model;
+		float distance;			//distance to camera
+		int lod;				//level of detail of the mesh
+		float lod_fade;			//0 if not fading, positive draws that fraction of the pixels, negative the rest of them
+	};
+
+	//uniform blocks shared by all the shaders, same layout (std140) as u_camera_block and u_frame_block in the shader atlas
+	struct sCameraBlock {
+		Matrix44 viewprojection;
+		Vector3f camera_position;
+		float padding;
+	};
+
+	struct sFrameBlock {
+		float time;
+		float padding[3];
+	};
+
+	//consecutive calls of the queue that can be rendered in one draw
+	struct sRenderGroup {
+		int first_call;			//index in the render queue
+		int num_calls;
+		int first_instance;		//index in the instance buffer, -1 if not instanced
+	};
+
 	// This class is in charge of rendering anything in our system.
 	// Separating the render from anything else makes the code cleaner
 	class Renderer
@@ -25,11 +61,50 @@ namespace SCN {
 	public:
 		bool render_wireframe;
 		bool render_boundaries;
+		bool use_instancing; //render calls sharing mesh and material in a single instanced draw
 
 		GFX::Texture* skybox_cubemap;
 
 		SCN::Scene* scene;
 
+		//all the draw calls of the frame, filled in renderScene and sorted before rendering
+		std::vector<sDrawCall> render_queue;
+
+		//models of all the instanced calls of the frame, uploaded once to instances_vbo_id
+		std::vector<Matrix44> instance_models;
+		unsigned int instances_vbo_id;
+		unsigned int instances_vbo_size; //in matrices
+
+		//world bounds of all the nodes of the scene (prefabs first, then their nodes) and the result of culling them
+		SCN::CullingBounds culling_bounds;
+		SCN::sCullingView main_view;
+		std::vector<uint8> hidden_nodes; //node or any of its parents not visible, filled in collectVisibleNodes
+		std::vector<SCN::Node*> visible_nodes; //nodes with mesh inside the frustum
+
+		//software occlusion culling, the biggest opaque meshes on screen hide the nodes behind them
+		bool use_occlusion;
+		int max_occluders;
+		int max_occluder_triangles;
+		float min_occluder_size; //radius of the box divided by the distance to the camera
+		SCN::OcclusionBuffer occlusion;
+		std::vector<uint8> occluder_flags; //per visible node, rasterized in the occlusion buffer
+		std::set<uint32> occluder_requests; //Mesh::index of the occluders whose positions were requested to a worker
+
+		//levels of detail of the meshes, selected by the error projected on screen
+		bool use_lods;
+		float lod_threshold;	//max error on screen (in the units of Camera::getProjectedScale, around pixels)
+		float lod_hysteresis;	//a coarser level needs an error this fraction below the threshold, avoids switching back and forth
+		float lod_fade_time;	//seconds to cross-fade when the level changes, 0 to switch at once
+		int lod_counts[4];		//calls of every level in the last frame (the last one includes the coarser ones)
+
+		//camera and time uploaded once instead of setting them in every shader
+		sCameraBlock camera_block;
+		sFrameBlock frame_block;
+		GFX::BufferObject camera_buffer;
+		GFX::BufferObject frame_buffer;
+		GFX::sUniformStats uniform_stats; //of the last frame
+		GFX::sGPUStateStats gpu_state_stats; //of the last frame
+
 		//updated every frame
 		Renderer(const char* shaders_atlas_filename );
 
@@ -45,15 +120,43 @@ namespace SCN {
 		//render the skybox
 		void renderSkybox(GFX::Texture* cubemap);
 	
-		//to render one node from the prefab and its children
-		void renderNode(SCN::Node* node, Camera* camera);
+		//fills visible_nodes with the nodes with mesh inside the view, the view must be culled with culling_bounds
+		void collectVisibleNodes(Camera* camera, const SCN::sCullingView& view);
+
+		//rasterizes the biggest visible nodes in the occlusion buffer
+		void renderOccluders(Camera* camera);
+		//reads the positions of a mesh without CPU data in a worker, they are set in the mesh in the following frames
+		void requestOccluderData(GFX::Mesh* mesh);
+
+		//adds the visible nodes that are not occluded to the render queue
+		void addVisibleNodesToQueue(Camera* camera);
+
+		//updates the level of detail of the node for this camera, returns it
+		int selectLOD(SCN::Node* node, Camera* camera);
+
+		//computes the 64 bits key used to sort the render queue
+		uint64 computeSortKey(GFX::Shader* shader, SCN::Material* material, GFX::Mesh* mesh, float distance, float far_plane, int lod = 0);
+
+		//sorts and renders all the calls in the render queue, avoiding redundant state changes
+		void renderQueue(Camera* camera);
+
+		//groups the sorted queue by mesh and material and uploads the models of the instanced ones
+		void buildRenderGroups(std::vector<sRenderGroup>& groups);
+
+		//wire box used as placeholder of the prefabs still loading
+		void renderLoadingBox(const BoundingBox& box, const Matrix44& model, Camera* camera);
 
 		//to render one mesh given its material and transformation matrix
 		void renderMeshWithMaterial(const Matrix44 model, GFX::Mesh* mesh, SCN::Material* material);
+		uint64_t getMaterialState(SCN::Material* material); //for GFX::setGPUState
 
 		void showUI();
 
-		void cameraToShader(Camera* camera, GFX::Shader* shader); //sends camera uniforms to shader
+		//uploads the blocks, the camera one every time the camera changes and the frame one once per frame
+		void uploadCameraBlock(Camera* camera);
+		void uploadFrameBlock();
+
+		void cameraToShader(Camera* camera, GFX::Shader* shader); //sends camera uniforms to the shaders without the blocks
 	};
 
 };
\ No newline at end of file
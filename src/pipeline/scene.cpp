@@ -36,6 +36,7 @@ void SCN::Scene::clear()
 		delete ent;
 	}
 	entities.resize(0);
+	SCN::Node::s_structure_version++;
 	BaseEntity::s_selected = nullptr;
 	SCN::Node::s_selected = nullptr;
 }
@@ -226,6 +227,7 @@ void SCN::Scene::addEntity(BaseEntity* entity)
 {
 	entities.push_back(entity); 
 	entity->scene = this;
+	SCN::Node::s_structure_version++;
 }
 
 void SCN::Scene::removeEntity(BaseEntity* entity)
@@ -235,6 +237,33 @@ void SCN::Scene::removeEntity(BaseEntity* entity)
 	//std::remove(entities.begin(), entities.end(), entity);
 	entities.erase(it);
 	//entities.resize(entities.size() - 1);
+	SCN::Node::s_structure_version++;
+}
+
+void SCN::Scene::updateTransforms()
+{
+	//prefabs that finished loading since last frame
+	for (auto& ent : entities)
+	{
+		if (ent->getType() != eEntityType::PREFAB)
+			continue;
+		PrefabEntity* pent = (PrefabEntity*)ent;
+		if (!pent->instantiated && pent->prefab && pent->prefab->isLoaded())
+			pent->instantiatePrefab();
+	}
+
+	if (hierarchy.needsRebuild())
+	{
+		std::vector<SCN::Node*> roots;
+		for (auto& ent : entities)
+			roots.push_back(&ent->root);
+		hierarchy.build(roots);
+		hierarchy.update();
+		bvh.build(entities);
+		return;
+	}
+	if (hierarchy.update())
+		bvh.refit();
 }
 
 SCN::BaseEntity* SCN::Scene::getEntity(std::string name)
@@ -267,6 +296,7 @@ SCN::BaseEntity* SCN::BaseEntity::createEntity(const char* type)
 SCN::PrefabEntity::PrefabEntity()
 {
 	prefab = NULL;
+	instantiated = false;
 }
 
 void SCN::PrefabEntity::configure(cJSON* json)
@@ -287,19 +317,25 @@ void SCN::PrefabEntity::loadPrefab(const char* filename)
 {
 	assert(scene && "Cannot assign filename without scene (to extract base folder)");
 	std::string fullpath = scene->base_folder + "/" + filename;
-	prefab = SCN::Prefab::Get(fullpath.c_str());
-	if (!prefab)
-		return;
-	
+	prefab = SCN::Prefab::GetAsync(fullpath.c_str());
+	root.clear();
+	instantiated = false;
+	if (prefab->isLoaded())
+		instantiatePrefab();
+}
+
+void SCN::PrefabEntity::instantiatePrefab()
+{
+	assert(prefab && prefab->isLoaded());
 	SCN::Node* child = new SCN::Node();
 	*child = prefab->root;
 	root.clear();
 	root.addChild(child);
+	instantiated = true;
 }
 
 bool SCN::PrefabEntity::testRay(const Ray& ray, Vector3f& coll, float max_dist)
 {
-	root.model = root.model;
 	return root.testRay(ray, coll, 0xFF, max_dist);
 }
 
@@ -347,18 +383,18 @@ SCN::RayTestResult SCN::Scene::testRay(Ray& ray, uint8 layers)
 	result.entity = nullptr;
 	Vector3f collision;
 
-	//TODO: optimal way:
-	//- prebuild BVH (check https://github.com/xelatihy/yocto-gl/blob/main/libs/yocto/yocto_bvh.h )
-	//- get all nodes which bounding intersects ray
-	//- sort by distance to ray origin
-	//- test ray with closer one, if no collision, continue
-	//- if collision check if collision point inside any other node bounding, and test only in those
+	//nodes could have been removed since last update
+	if (hierarchy.needsRebuild())
+		updateTransforms();
 
+	//meshes of the prefabs are tested using the BVH, closest first
+	bvh.testRay(ray, layers, result);
 
+	//other entities are tested one by one
 	float max_dist = result.t;
 	for (auto& ent : entities)
 	{
-		if (!(ent->layers & layers))
+		if (!(ent->layers & layers) || ent->getType() == eEntityType::PREFAB)
 			continue;
 
 		if (!ent->testRay(ray, collision, max_dist))
@@ -368,6 +404,7 @@ SCN::RayTestResult SCN::Scene::testRay(Ray& ray, uint8 layers)
 		if (t > result.t)
 			continue;
 		result.t = t;
+		max_dist = t;
 		result.collision = collision;
 		result.entity = ent;
 		result.collided = true;
@@ -6,6 +6,7 @@
 #include "camera.h"
 #include "animation.h"
 #include "prefab.h"
+#include "bvh.h"
 
 
 //forward declaration
@@ -96,6 +97,7 @@ namespace SCN {
 	public:
 		std::string filename;
 		Prefab* prefab;
+		bool instantiated; //the nodes of the prefab have been copied to root (false while the prefab is loading)
 		
 		PrefabEntity();
 
@@ -103,7 +105,8 @@ namespace SCN {
 
 		virtual void configure(cJSON* json);
 		virtual void serialize(cJSON* json);
-		void loadPrefab(const char* filename);
+		void loadPrefab(const char* filename); //async, the nodes are created once the prefab is loaded
+		void instantiatePrefab();
 
 		bool testRay(const Ray& ray, Vector3f& coll, float max_dist = 100000.0f);
 	};
@@ -140,6 +143,12 @@ namespace SCN {
 		std::string base_folder;
 		std::vector<BaseEntity*> entities;
 
+		//all the nodes of the entities, used to update their transforms every frame
+		NodeHierarchy hierarchy;
+
+		//acceleration structure for testRay, updated in updateTransforms
+		SceneBVH bvh;
+
 		void clear();
 		void addEntity(BaseEntity* entity);
 		void removeEntity(BaseEntity* entity);
@@ -151,6 +160,9 @@ namespace SCN {
 
 		BaseEntity* getEntity(std::string name);
 
+		//updates global matrices and bounding boxes of the nodes that changed (call it once per frame)
+		void updateTransforms();
+
 		RayTestResult testRay( Ray& ray, uint8 layers = 0xFF );
 	};
 
@@ -10,8 +10,11 @@
 #include "../pipeline/material.h"
 #include "../pipeline/prefab.h"
 #include "../utils/utils.h"
+#include "../core/task.h"
+#include "../gfx/mesh_optimizer.h"
 
 #include <iostream>
+#include <map>
 
 //** PARSING GLTF IS UGLY
 std::string base_folder;
@@ -258,94 +261,180 @@ void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor
 	}
 }
 
-std::vector<GFX::Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename)
+//only CPU work, safe to call from any thread
+GFX::Mesh* decodeGLTFPrimitive(cgltf_primitive* primitive)
 {
-	std::vector<GFX::Mesh*> result;
+	GFX::Mesh* mesh = new GFX::Mesh();
 
-	//if (meshdata->name)
-	//	stdlog( std::string("\t<- MESH: ") + meshdata->name);
-
-    //submeshes
-	for (size_t i = 0; i < meshdata->primitives_count; ++i)
+	//streams
+	for (size_t j = 0; j < primitive->attributes_count; ++j)
 	{
-		cgltf_primitive* primitive = &meshdata->primitives[i];
-		GFX::Mesh* mesh = NULL;
+		cgltf_attribute* attr = &primitive->attributes[j];
 
-		std::string submesh_name;
-		if (meshdata->name)
+		//std::string attrname = attr->name;
+		if (attr->type == cgltf_attribute_type_position)
 		{
-			submesh_name = std::string(basename) + std::string("::") + std::string(meshdata->name) + std::string("::") + std::to_string(i);
-			mesh = GFX::Mesh::Get(submesh_name.c_str(), true);
-			if (mesh)
+			parseGLTFBufferVector3(mesh->vertices, attr->data);
+			if (attr->data->has_min && attr->data->has_max)
 			{
-				result.push_back(mesh);
-				continue;
+				mesh->aabb_min = attr->data->min;
+				mesh->aabb_max = attr->data->max;
+				mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
+				mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
 			}
+			else
+				mesh->updateBoundingBox();
+		}
+		else
+		if (attr->type == cgltf_attribute_type_normal)
+			parseGLTFBufferVector3(mesh->normals, attr->data);
+		else
+		if (attr->type == cgltf_attribute_type_texcoord)
+		{
+			if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
+				parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
+			else
+				parseGLTFBufferVector2(mesh->uvs, attr->data);
+		}
+		else
+		if (attr->type == cgltf_attribute_type_color)
+		{
+			parseGLTFBufferVector4(mesh->colors, attr->data);
 		}
+		else
+		if (attr->type == cgltf_attribute_type_weights)
+		{
+			parseGLTFBufferVector4(mesh->weights, attr->data);
+		}
+		else
+		if (attr->type == cgltf_attribute_type_joints)
+		{
+			//parseGLTFBufferVector4(mesh->bones, attr->data);
+		}
+	}
 
-		mesh = new GFX::Mesh();
+	if (primitive->indices && primitive->indices->count)
+		parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
 
-        //streams
-		for (size_t j = 0; j < primitive->attributes_count; ++j)
-		{
-			cgltf_attribute* attr = &primitive->attributes[j];
+	return mesh;
+}
 
-            //std::string attrname = attr->name;
-			if (attr->type == cgltf_attribute_type_position)
-			{
-				parseGLTFBufferVector3(mesh->vertices, attr->data);
-				if (attr->data->has_min && attr->data->has_max)
-				{
-					mesh->aabb_min = attr->data->min;
-					mesh->aabb_max = attr->data->max;
-					mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
-					mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
-				}
-				else
-					mesh->updateBoundingBox();
-			}
-			else
-			if (attr->type == cgltf_attribute_type_normal)
-				parseGLTFBufferVector3(mesh->normals, attr->data);
-			else
-			if (attr->type == cgltf_attribute_type_texcoord)
-			{
-				if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
-					parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
-				else
-					parseGLTFBufferVector2(mesh->uvs, attr->data);
-			}
-			else
-			if (attr->type == cgltf_attribute_type_color)
-			{
-				parseGLTFBufferVector4(mesh->colors, attr->data);
-			}
-			else
-			if (attr->type == cgltf_attribute_type_weights)
-			{
-				parseGLTFBufferVector4(mesh->weights, attr->data);
-			}
-			else
-			if (attr->type == cgltf_attribute_type_joints)
-			{
-				//parseGLTFBufferVector4(mesh->bones, attr->data);
-			}
+//appends the stream of a primitive, filling with the default value if only some primitives have it
+template<typename T>
+void appendGLTFStream(std::vector<T>& container, const std::vector<T>& stream, size_t base, size_t num_vertices, const T& default_value)
+{
+	if (container.empty() && stream.empty())
+		return;
+	container.resize(base, default_value);
+	if (stream.size() == num_vertices)
+		container.insert(container.end(), stream.begin(), stream.end());
+	else
+		container.resize(base + num_vertices, default_value);
+}
+
+//all the primitives of a mesh go to the same buffers, every primitive is a submesh
+//only CPU work, safe to call from any thread
+GFX::Mesh* decodeGLTFMesh(cgltf_mesh* meshdata)
+{
+	GFX::Mesh* mesh = new GFX::Mesh();
 
-			if (primitive->indices && primitive->indices->count)
-				parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+	for (size_t i = 0; i < meshdata->primitives_count; ++i)
+	{
+		cgltf_primitive* primitive = &meshdata->primitives[i];
+		GFX::Mesh* prim = decodeGLTFPrimitive(primitive);
+		size_t base = mesh->vertices.size();
+		size_t num_vertices = prim->vertices.size();
+
+		//non indexed primitives get sequential indices so all submeshes are drawn the same way
+		if (prim->m_indices.empty())
+		{
+			prim->m_indices.resize(num_vertices);
+			for (size_t j = 0; j < num_vertices; ++j)
+				prim->m_indices[j] = (unsigned int)j;
 		}
-		mesh->uploadToVRAM();
+
+		GFX::sSubmeshInfo submesh;
+		memset(&submesh, 0, sizeof(submesh));
 		if (meshdata->name)
-			mesh->registerMesh(submesh_name);
-		result.push_back(mesh);
+			snprintf(submesh.name, sizeof(submesh.name), "%s_%d", meshdata->name, (int)i);
+		if (primitive->material && primitive->material->name)
+			strncpy(submesh.material, primitive->material->name, sizeof(submesh.material) - 1);
+		submesh.start = (int)mesh->m_indices.size();
+		submesh.length = (int)prim->m_indices.size();
+		mesh->submeshes.push_back(submesh);
+
+		for (size_t j = 0; j < prim->m_indices.size(); ++j)
+			mesh->m_indices.push_back(prim->m_indices[j] + (unsigned int)base);
+
+		mesh->vertices.insert(mesh->vertices.end(), prim->vertices.begin(), prim->vertices.end());
+		appendGLTFStream(mesh->normals, prim->normals, base, num_vertices, Vector3f(0, 1, 0));
+		appendGLTFStream(mesh->uvs, prim->uvs, base, num_vertices, Vector2f());
+		appendGLTFStream(mesh->m_uvs1, prim->m_uvs1, base, num_vertices, Vector2f());
+		appendGLTFStream(mesh->colors, prim->colors, base, num_vertices, Vector4f(1, 1, 1, 1));
+		appendGLTFStream(mesh->weights, prim->weights, base, num_vertices, Vector4f());
+
+		if (i == 0)
+		{
+			mesh->aabb_min = prim->aabb_min;
+			mesh->aabb_max = prim->aabb_max;
+		}
+		else
+		{
+			mesh->aabb_min.setMin(prim->aabb_min);
+			mesh->aabb_max.setMax(prim->aabb_max);
+		}
+		delete prim;
 	}
 
-	return result;
+	mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
+	mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
+	mesh->radius = (float)fmax(mesh->aabb_max.length(), mesh->aabb_min.length());
+
+	//every primitive is a submesh so they are reordered separately
+	if (GFX::Mesh::optimize_flags)
+		GFX::optimizeMesh(mesh, GFX::Mesh::optimize_flags);
+	return mesh;
+}
+
+std::string getGLTFMeshName(cgltf_mesh* meshdata, const char* basename)
+{
+	if (!meshdata->name)
+		return "";
+	return std::string(basename) + std::string("::") + std::string(meshdata->name);
+}
+
+//decoded_meshes are the meshes already decoded and uploaded (when loading async)
+GFX::Mesh* parseGLTFMesh(cgltf_mesh* meshdata, const char* basename, std::map<cgltf_mesh*, GFX::Mesh*>* decoded_meshes = NULL)
+{
+	if (decoded_meshes)
+	{
+		auto it = decoded_meshes->find(meshdata);
+		assert(it != decoded_meshes->end() && "mesh not decoded");
+		return it->second;
+	}
+
+	//if (meshdata->name)
+	//	stdlog( std::string("\t<- MESH: ") + meshdata->name);
+
+	std::string mesh_name = getGLTFMeshName(meshdata, basename);
+	if (mesh_name.size())
+	{
+		GFX::Mesh* mesh = GFX::Mesh::Get(mesh_name.c_str(), true);
+		if (mesh)
+			return mesh;
+	}
+
+	GFX::Mesh* mesh = decodeGLTFMesh(meshdata);
+	mesh->uploadToVRAM();
+	if (mesh_name.size())
+		mesh->registerMesh(mesh_name);
+	return mesh;
 }
 
 int GLTF_TEXTURE_LAST_ID = 1;
 
-GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
+//the semantic chooses how the texture is compressed
+GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename, GFX::eTextureSemantic semantic = GFX::TEXTURE_COLOR)
 {
 	if (!load_textures || !image )
 		return NULL;
@@ -353,7 +442,7 @@ GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 	std::string fullpath = filename ? filename : "";
 
 	if (image->uri)
-		return GFX::Texture::GetAsync((std::string(base_folder) + "/" + image->uri).c_str());
+		return GFX::Texture::GetAsync((std::string(base_folder) + "/" + image->uri).c_str(), true, true, semantic);
 	else
 	if (filename)
 	{
@@ -371,32 +460,19 @@ GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 
 	if (image->buffer_view)
 	{
-		Image img;
-		std::vector<unsigned char> buffer;
-		buffer.resize(image->buffer_view->size);
-		memcpy(&buffer[0], (char*)image->buffer_view->buffer->data + image->buffer_view->offset, image->buffer_view->size);
-
-		if (!strcmp(image->mime_type, "image/png"))
-			img.loadPNG(buffer);
-		else if (!strcmp(image->mime_type, "image/jpeg"))
-			img.loadJPG(buffer);
-		else
+		if (strcmp(image->mime_type, "image/png") && strcmp(image->mime_type, "image/jpeg"))
 		{
 			stdlog(std::string("image format not supported: ") + image->mime_type);
 			return NULL;
 		}
-		if (!img.width)
-		{
-			stdlog(std::string("image encoding has error: ") + image->mime_type);
-			return NULL;
-		}
-		GFX::Texture* tex = new GFX::Texture();
-		tex->loadFromImage(&img);
+		std::vector<unsigned char> buffer;
+		buffer.resize(image->buffer_view->size);
+		memcpy(&buffer[0], (char*)image->buffer_view->buffer->data + image->buffer_view->offset, image->buffer_view->size);
+
+		//decoded in the workers like the external images
+		GFX::Texture* tex = GFX::Texture::DecodeAsync(fullpath.c_str(), buffer, true, true, semantic);
 		if (filename)
-		{
-			tex->setName(fullpath.c_str());
 			stdlog(std::string("\t<- TEXTURE: ") + fullpath);
-		}
 		else
 			stdlog(std::string(" TEXTURE: UNNAMED ") + image->mime_type );
 
@@ -431,7 +507,7 @@ SCN::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 	//normalmap
 	if (matdata->normal_texture.texture)
 	{
-		material->textures[SCN::eTextureChannel::NORMALMAP].texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name);
+		material->textures[SCN::eTextureChannel::NORMALMAP].texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name, GFX::TEXTURE_NORMALMAP);
 		material->textures[SCN::eTextureChannel::NORMALMAP].uv_channel = matdata->normal_texture.texcoord;
 	}
 
@@ -465,7 +541,7 @@ SCN::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 			}
 			if (matdata->pbr_metallic_roughness.metallic_roughness_texture.texture)
 			{
-				material->textures[SCN::eTextureChannel::METALLIC_ROUGHNESS].texture = parseGLTFTexture(matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->image, matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->name);
+				material->textures[SCN::eTextureChannel::METALLIC_ROUGHNESS].texture = parseGLTFTexture(matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->image, matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->name, GFX::TEXTURE_DATA);
 				material->textures[SCN::eTextureChannel::METALLIC_ROUGHNESS].uv_channel = matdata->pbr_metallic_roughness.metallic_roughness_texture.texcoord;
 			}
 		}
@@ -473,7 +549,7 @@ SCN::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 
 	if (matdata->occlusion_texture.texture)
 	{
-		material->textures[SCN::eTextureChannel::OCCLUSION].texture = parseGLTFTexture(matdata->occlusion_texture.texture->image, matdata->occlusion_texture.texture->name);
+		material->textures[SCN::eTextureChannel::OCCLUSION].texture = parseGLTFTexture(matdata->occlusion_texture.texture->image, matdata->occlusion_texture.texture->name, GFX::TEXTURE_DATA);
 		material->textures[SCN::eTextureChannel::OCCLUSION].uv_channel = matdata->occlusion_texture.texcoord;
 	}
 
@@ -501,7 +577,7 @@ void parseGLTFTransform(cgltf_node* node, Matrix44 &model)
 }
 
 //GLTF PARSING: you can pass the node or it will create it
-SCN::Node* parseGLTFNode(cgltf_node* node, SCN::Node* scenenode = NULL, const char* basename = NULL)
+SCN::Node* parseGLTFNode(cgltf_node* node, SCN::Node* scenenode = NULL, const char* basename = NULL, std::map<cgltf_mesh*, GFX::Mesh*>* decoded_meshes = NULL)
 {
 	if (scenenode == NULL)
 		scenenode = new SCN::Node();
@@ -516,16 +592,16 @@ SCN::Node* parseGLTFNode(cgltf_node* node, SCN::Node* scenenode = NULL, const ch
 
     if (node->mesh)
 	{
-        //split in subnodes
+		GFX::Mesh* mesh = parseGLTFMesh(node->mesh, basename, decoded_meshes);
+
+        //split in subnodes, all sharing the mesh but rendering only their submesh
 		if (node->mesh->primitives_count > 1)
 		{
-			std::vector<GFX::Mesh*> meshes;
-			meshes = parseGLTFMesh(node->mesh, basename);
-
 			for (size_t i = 0; i < node->mesh->primitives_count; ++i)
 			{
 				SCN::Node* subnode = new SCN::Node();
-				subnode->mesh = meshes[i];
+				subnode->mesh = mesh;
+				subnode->submesh_id = (int)i;
 				if (node->mesh->primitives[i].material)
 					subnode->material = parseGLTFMaterial(node->mesh->primitives[i].material, basename );
 				scenenode->addChild(subnode);
@@ -533,26 +609,14 @@ SCN::Node* parseGLTFNode(cgltf_node* node, SCN::Node* scenenode = NULL, const ch
 		}
 		else //single primitive
 		{
-			if (node->mesh->name)
-				scenenode->mesh = GFX::Mesh::Get(node->mesh->name, true);
-
-			if (!scenenode->mesh)
-			{
-				std::vector<GFX::Mesh*> meshes;
-				meshes = parseGLTFMesh(node->mesh, basename);
-				//printf("Parsed GLTF mesh %s (success)\n", node->name);
-				//return nullptr;
-				if(meshes.size())
-					scenenode->mesh = meshes[0];
-			}
-
+			scenenode->mesh = mesh;
 			if (node->mesh->primitives->material)
 				scenenode->material = parseGLTFMaterial(node->mesh->primitives->material, basename );
 		}
 	}
 
 	for (size_t i = 0; i < node->children_count; ++i)
-		scenenode->addChild(parseGLTFNode(node->children[i],NULL, basename));
+		scenenode->addChild(parseGLTFNode(node->children[i],NULL, basename, decoded_meshes));
 
 	return scenenode;
 }
@@ -585,50 +649,31 @@ cgltf_result internalOpenMemory(const struct cgltf_memory_options* memory_option
 	return cgltf_result_success;
 }
 
-SCN::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
+//creates the nodes of the prefab from the parsed data, must be called from the main thread
+void buildGLTFPrefab(SCN::Prefab* prefab, const char* filename, cgltf_data* data, std::map<cgltf_mesh*, GFX::Mesh*>* decoded_meshes = NULL)
 {
-	cgltf_result result;
-
-	if (data->scenes_count > 1)
-		std::cout << "[WARN] more than one scene, skipping the rest" << std::endl;
-
 	//get nodes
 	cgltf_scene* scene = &data->scenes[0];
 
 	char folder[1024];
-	char basename[1024];
 	strcpy(folder, filename);
 	char* name_start = strrchr(folder, '/');
-	*name_start = '\0';
+	if (name_start)
+		*name_start = '\0';
 	base_folder = folder; //global
-	const char* basename_start = strrchr(filename, '/');
-	strcpy(basename, basename_start+1);
-
-	{
-		result = cgltf_load_buffers(&options, data, filename);
-		if (result != cgltf_result_success) {
-			stdlog(std::string("[BIN NOT FOUND]:") + filename);
-			return NULL;
-		}
-	}
-
-	SCN::Prefab* prefab = new SCN::Prefab();
 
 	{
 		if (scene->nodes_count > 1)
 		{
-			cgltf_node *root = nullptr;
-			float fiTotal = 1.0f / (float) scene->nodes_count;
 			for (size_t i = 0; i < scene->nodes_count; ++i)
 			{
-				float fProgress = ((float) i * fiTotal) * 100.0f;
-				SCN::Node *node = parseGLTFNode(scene->nodes[i], NULL, filename);
+				SCN::Node *node = parseGLTFNode(scene->nodes[i], NULL, filename, decoded_meshes);
 				prefab->root.addChild(node);
 			}
 		}
 		else
 		{
-			parseGLTFNode(scene->nodes[0], &prefab->root, filename);
+			parseGLTFNode(scene->nodes[0], &prefab->root, filename, decoded_meshes);
 		}
 	}
 
@@ -651,6 +696,26 @@ SCN::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 
 	prefab->updateNodesByName();
 	prefab->updateBounding();
+}
+
+SCN::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
+{
+	cgltf_result result;
+
+	if (data->scenes_count > 1)
+		std::cout << "[WARN] more than one scene, skipping the rest" << std::endl;
+
+	{
+		result = cgltf_load_buffers(&options, data, filename);
+		if (result != cgltf_result_success) {
+			stdlog(std::string("[BIN NOT FOUND]:") + filename);
+			cgltf_free(data);
+			return NULL;
+		}
+	}
+
+	SCN::Prefab* prefab = new SCN::Prefab();
+	buildGLTFPrefab(prefab, filename, data);
 
 	//frees all data, including bin
 	cgltf_free(data);
@@ -697,3 +762,172 @@ SCN::Prefab* loadGLTF(const char* filename)
 	return loadGLTF(filename, data, options);
 }
 
+
+
+//*********************************************
+
+//bounding box of a node and its children in parent space, from the accessors min/max (without decoding the meshes)
+bool computeGLTFNodeBounding(cgltf_node* node, BoundingBox& box)
+{
+	Matrix44 model;
+	parseGLTFTransform(node, model);
+
+	bool has_bounds = false;
+	BoundingBox local;
+	if (node->mesh)
+		for (size_t i = 0; i < node->mesh->primitives_count; ++i)
+			for (size_t j = 0; j < node->mesh->primitives[i].attributes_count; ++j)
+			{
+				cgltf_attribute* attr = &node->mesh->primitives[i].attributes[j];
+				if (attr->type != cgltf_attribute_type_position || !attr->data->has_min || !attr->data->has_max)
+					continue;
+				Vector3f min(attr->data->min[0], attr->data->min[1], attr->data->min[2]);
+				Vector3f max(attr->data->max[0], attr->data->max[1], attr->data->max[2]);
+				BoundingBox prim_box;
+				prim_box.center = (min + max) * 0.5f;
+				prim_box.halfsize = max - prim_box.center;
+				local = has_bounds ? mergeBoundingBoxes(local, prim_box) : prim_box;
+				has_bounds = true;
+			}
+
+	for (size_t i = 0; i < node->children_count; ++i)
+	{
+		BoundingBox child_box;
+		if (!computeGLTFNodeBounding(node->children[i], child_box))
+			continue;
+		local = has_bounds ? mergeBoundingBoxes(local, child_box) : child_box;
+		has_bounds = true;
+	}
+
+	if (has_bounds)
+		box = transformBoundingBox(model, local);
+	return has_bounds;
+}
+
+//shared by the tasks of one async load, deleted by the last one
+struct sGLTFAsyncLoad {
+	SCN::Prefab* prefab;
+	std::string filename;
+	cgltf_data* data;
+	std::vector<std::string> names; //registry name of every mesh, empty if unnamed
+	std::vector<GFX::Mesh*> meshes; //decoded mesh of every gltf mesh
+	std::map<cgltf_mesh*, GFX::Mesh*> meshes_by_gltf_mesh;
+	TaskCounter uploads;
+	int num_uploaded;
+};
+
+//runs in a worker: reads the file, loads the buffers and decodes all the meshes in parallel
+class LoadGLTFTask : public Task {
+public:
+	sGLTFAsyncLoad* load;
+	LoadGLTFTask(sGLTFAsyncLoad* load) { this->load = load; }
+	void onExecute();
+};
+
+static void failGLTFAsync(sGLTFAsyncLoad* load)
+{
+	TaskManager::foreground.addTask([load]() {
+		std::cout << "[ERROR]: Prefab not found: " << load->filename << std::endl;
+		load->prefab->loading_state = SCN::LOADING_FAILED;
+		load->prefab->unregisterPrefab(); //so the file can be requested again
+		delete load;
+	});
+}
+
+void LoadGLTFTask::onExecute()
+{
+	sGLTFAsyncLoad* load = this->load;
+	double time = getTime();
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	options.file.read = internalOpenFile;
+	cgltf_data* data = NULL;
+	if (cgltf_parse_file(&options, load->filename.c_str(), &data) != cgltf_result_success)
+	{
+		failGLTFAsync(load);
+		return;
+	}
+	if (cgltf_load_buffers(&options, data, load->filename.c_str()) != cgltf_result_success || !data->scenes_count)
+	{
+		cgltf_free(data);
+		failGLTFAsync(load);
+		return;
+	}
+	load->data = data;
+
+	//placeholder bounding so the entity can show something meanwhile
+	BoundingBox bounding;
+	cgltf_scene* scene = &data->scenes[0];
+	bool has_bounding = false;
+	for (size_t i = 0; i < scene->nodes_count; ++i)
+	{
+		BoundingBox node_box;
+		if (!computeGLTFNodeBounding(scene->nodes[i], node_box))
+			continue;
+		bounding = has_bounding ? mergeBoundingBoxes(bounding, node_box) : node_box;
+		has_bounding = true;
+	}
+	if (has_bounding)
+	{
+		SCN::Prefab* prefab = load->prefab;
+		TaskManager::foreground.addTask([prefab, bounding]() {
+			prefab->bounding = bounding;
+			prefab->has_bounding = true;
+		});
+	}
+
+	//decode every mesh in parallel
+	for (size_t i = 0; i < data->meshes_count; ++i)
+		load->names.push_back(getGLTFMeshName(&data->meshes[i], load->filename.c_str()));
+	load->meshes.resize(data->meshes_count);
+	TaskManager::background.parallelFor(0, (int)data->meshes_count, [load](int start, int end) {
+		for (int i = start; i < end; ++i)
+			load->meshes[i] = decodeGLTFMesh(&load->data->meshes[i]);
+	});
+
+	//the GPU work is done in the main thread, one mesh per task so it can be spread among frames
+	for (size_t i = 0; i < load->meshes.size(); ++i)
+	{
+		TaskManager::foreground.addTask([load, i]() {
+			GFX::Mesh* mesh = load->meshes[i];
+			GFX::Mesh* registered = load->names[i].size() ? GFX::Mesh::Get(load->names[i].c_str(), true) : NULL;
+			if (registered) //already loaded by another prefab
+			{
+				delete mesh;
+				load->meshes[i] = registered;
+			}
+			else
+			{
+				mesh->uploadToVRAM();
+				if (load->names[i].size())
+					mesh->registerMesh(load->names[i]);
+			}
+			load->num_uploaded++;
+			load->prefab->loading_progress = load->num_uploaded / (float)(load->meshes.size() + 1);
+		}, &load->uploads);
+	}
+
+	//once all meshes are in the GPU the nodes are created
+	TaskManager::foreground.addTask([load, time]() {
+		for (size_t i = 0; i < load->data->meshes_count; ++i)
+			load->meshes_by_gltf_mesh[&load->data->meshes[i]] = load->meshes[i];
+		buildGLTFPrefab(load->prefab, load->filename.c_str(), load->data, &load->meshes_by_gltf_mesh);
+		cgltf_free(load->data);
+		load->prefab->loading_state = SCN::LOADING_DONE;
+		load->prefab->loading_progress = 1.0f;
+		stdlog(std::string(" - Loaded async ") + load->filename + " Time: " + std::to_string((getTime() - time) * 0.001) + "sec");
+		delete load;
+	}, NULL, &load->uploads);
+}
+
+void loadGLTFAsync(SCN::Prefab* prefab, const char* filename)
+{
+	sGLTFAsyncLoad* load = new sGLTFAsyncLoad();
+	load->prefab = prefab;
+	load->filename = filename;
+	load->data = NULL;
+	load->num_uploaded = 0;
+	prefab->loading_state = SCN::LOADING_IN_PROGRESS;
+	prefab->loading_progress = 0.0f;
+	TaskManager::background.addTask(new LoadGLTFTask(load));
+}
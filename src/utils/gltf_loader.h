@@ -5,3 +5,7 @@
 SCN::Prefab* loadGLTF(const char* filename);
 //GTR::Prefab* loadGLTF(const char* filename, cgltf_data* data, cgltf_options& options);
 SCN::Prefab* loadGLTF(const std::vector<unsigned char>& data, const std::string& path);
+
+//parsing and decoding happens in the worker threads, GPU uploads and node creation in the foreground tasks (one mesh per task)
+//the prefab loading_state will change to LOADING_DONE or LOADING_FAILED when finished
+void loadGLTFAsync(SCN::Prefab* prefab, const char* filename);
@@ -19,6 +19,24 @@ bool readFile(const std::string& filename, std::string& content);
 bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer);
 bool writeFile(const std::string& filename, std::string& content);
 
+//read-only memory mapping of a whole file, pages are loaded by the OS when accessed
+class MappedFile {
+public:
+	const char* data;
+	size_t size;
+
+	MappedFile();
+	~MappedFile();
+	bool open(const char* filename);
+	void close();
+
+private:
+#ifdef WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+};
+
 //work with file paths
 std::string getFolderName(std::string path);
 std::string getExtension(std::string path);